@@ -18,8 +18,28 @@
 
 #define KNET_RING_DEFPORT 50000
 
+/*
+ * number of tap queues, each one is mapped
+ * to its own knet channel
+ */
+#define KNET_RING_TAPQUEUES 4
+
+/*
+ * offloads enabled on tap devices when requested (-o).
+ * GSO packets, capped by libnozzle to NOZZLE_VNET_MAX_PACKET_SIZE,
+ * are sent as one knet packet and fragmented by knet.
+ * Packets carry the vnet header on the wire, all nodes
+ * must use the same setting.
+ */
+#define KNET_RING_TAPOFFLOADS (NOZZLE_OFFLOAD_CSUM | NOZZLE_OFFLOAD_TSO4 | NOZZLE_OFFLOAD_TSO6)
+
+#if NOZZLE_VNET_MAX_PACKET_SIZE > KNET_MAX_PACKET_SIZE
+#error "tap vnet packets do not fit knet packets"
+#endif
+
 struct knet_cfg_eth {
 	nozzle_t nozzle;
+	int vnet_hdr;
 	int auto_mtu;
 	knet_node_id_t node_id;
 };
@@ -44,6 +64,7 @@ struct knet_cfg_top {
 	char *vty_ipv4;
 	char *vty_ipv6;
 	char *vty_port;
+	int tap_offloads;
 	struct knet_cfg *knet_cfg;
 };
 
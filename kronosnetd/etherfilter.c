@@ -13,6 +13,7 @@
 #include <net/ethernet.h>
 #include <string.h>
 
+#include "cfg.h"
 #include "etherfilter.h"
 
 /*
@@ -44,10 +45,23 @@ int ether_host_filter_fn (void *private_data,
 			  knet_node_id_t *dst_host_ids,
 			  size_t *dst_host_ids_entries)
 {
-	struct ether_header *eth_h = (struct ether_header *)outdata;
-	uint8_t *dst_mac = (uint8_t *)eth_h->ether_dhost;
+	struct knet_cfg_eth *cfg_eth = (struct knet_cfg_eth *)private_data;
+	struct ether_header *eth_h;
+	uint8_t *dst_mac;
 	uint16_t dst_host_id;
 
+	/*
+	 * skip the vnet header if the tap device has offloads enabled
+	 */
+	if ((cfg_eth) && (cfg_eth->vnet_hdr)) {
+		if (outdata_len < (ssize_t)(sizeof(struct nozzle_vnet_hdr) + sizeof(struct ether_header)))
+			return -1;
+		outdata += sizeof(struct nozzle_vnet_hdr);
+	}
+
+	eth_h = (struct ether_header *)outdata;
+	dst_mac = (uint8_t *)eth_h->ether_dhost;
+
 	if (is_zero_ether_addr(dst_mac))
 		return -1;
 
@@ -25,7 +25,7 @@
 
 #define LOCKFILE_NAME RUNDIR PACKAGE "d.pid"
 
-#define OPTION_STRING "hdfVc:l:a:b:p:"
+#define OPTION_STRING "hdfoVc:l:a:b:p:"
 
 static int debug = 0;
 static int daemonize = 1;
@@ -45,6 +45,7 @@ static void print_usage(void)
 	printf("  -l <file>      Use log file (default "DEFAULT_LOG_FILE")\n");
 	printf("  -f             Do not fork in background\n");
 	printf("  -d             Enable debugging output\n");
+	printf("  -o             Enable tap device offloads (must be set on all nodes)\n");
 	printf("  -h             This help\n");
 	printf("  -V             Print program version information\n");
 	return;
@@ -104,6 +105,10 @@ static int read_arguments(int argc, char **argv)
 			daemonize = 0;
 			break;
 
+		case 'o':
+			knet_cfg_head.tap_offloads = 1;
+			break;
+
 		case 'h':
 			print_usage();
 			exit(EXIT_SUCCESS);
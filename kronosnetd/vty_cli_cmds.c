@@ -1587,14 +1587,16 @@ static void sock_notify_fn(void *private_data, int datafd, int8_t chan, uint8_t
 
 static int knet_cmd_interface(struct knet_vty *vty)
 {
-	int err = 0, paramlen = 0, paramoffset = 0, found = 0, requested_id, tapfd;
+	int err = 0, paramlen = 0, paramoffset = 0, found = 0, requested_id;
+	int tapfds[NOZZLE_MAX_QUEUES];
+	size_t tapfds_entries = 0, i;
 	uint16_t baseport;
 	uint8_t *bport = (uint8_t *)&baseport;
 	char *param = NULL;
 	char device[IFNAMSIZ];
 	char mac[30];
 	struct knet_cfg *knet_iface = NULL;
-	int8_t channel = 0;
+	int8_t channel;
 
 	get_param(vty, 1, &param, &paramlen, &paramoffset);
 	param_to_str(device, IFNAMSIZ, param, paramlen);
@@ -1617,8 +1619,31 @@ static int knet_cmd_interface(struct knet_vty *vty)
 		goto tap_found;
 	}
 
-	if (!knet_iface->cfg_eth.nozzle)
-		knet_iface->cfg_eth.nozzle = nozzle_open(device, IFNAMSIZ, DEFAULT_CONFIG_DIR);
+	/*
+	 * offloads change the packet format on the wire, never
+	 * fallback to a plain tap device when they are requested
+	 */
+	if (knet_cfg_head.tap_offloads) {
+		knet_iface->cfg_eth.nozzle = nozzle_open_vnet(device, IFNAMSIZ, DEFAULT_CONFIG_DIR,
+							     KNET_RING_TAPQUEUES, KNET_RING_TAPOFFLOADS);
+		if (knet_iface->cfg_eth.nozzle)
+			knet_iface->cfg_eth.vnet_hdr = 1;
+		if ((!knet_iface->cfg_eth.nozzle) && (errno == EOPNOTSUPP)) {
+			knet_vty_write(vty, "Error: tap offloads are not supported on this system%s",
+					telnet_newline);
+			err = -1;
+			goto out_clean;
+		}
+	} else {
+		knet_iface->cfg_eth.nozzle = nozzle_open_mq(device, IFNAMSIZ, DEFAULT_CONFIG_DIR,
+							   KNET_RING_TAPQUEUES);
+		/*
+		 * fallback to a single queue device
+		 * on systems without multi queue tap support
+		 */
+		if ((!knet_iface->cfg_eth.nozzle) && (errno == EOPNOTSUPP))
+			knet_iface->cfg_eth.nozzle = nozzle_open(device, IFNAMSIZ, DEFAULT_CONFIG_DIR);
+	}
 
 	if ((!knet_iface->cfg_eth.nozzle) && (errno == EBUSY)) {
 		knet_vty_write(vty, "Error: interface %s seems to exist in the system%s",
@@ -1640,7 +1665,12 @@ tap_found:
 
 	knet_iface->cfg_ring.base_port = baseport;
 
-	tapfd = nozzle_get_fd(knet_iface->cfg_eth.nozzle);
+	if (nozzle_get_queue_fds(knet_iface->cfg_eth.nozzle, tapfds, &tapfds_entries) < 0) {
+		knet_vty_write(vty, "Error: Unable to get tap queues for device %s%s",
+				device, telnet_newline);
+		err = -1;
+		goto out_clean;
+	}
 
 	knet_iface->cfg_ring.knet_h = knet_handle_new(requested_id, vty->logfd, vty->loglevel);
 	if (!knet_iface->cfg_ring.knet_h) {
@@ -1657,14 +1687,22 @@ tap_found:
 		goto out_clean;
 	}
 
-	if (knet_handle_add_datafd(knet_iface->cfg_ring.knet_h, &tapfd, &channel) < 0) {
-		knet_vty_write(vty, "Error: Unable to add tapfd to knet_handle %s%s",
-				strerror(errno), telnet_newline);
-		err = -1;
-		goto out_clean;
+	/*
+	 * map each tap queue to the same channel on all nodes
+	 * so that flows spread by the kernel across queues
+	 * are delivered to the matching queue on the other end
+	 */
+	for (i = 0; i < tapfds_entries; i++) {
+		channel = i;
+		if (knet_handle_add_datafd(knet_iface->cfg_ring.knet_h, &tapfds[i], &channel) < 0) {
+			knet_vty_write(vty, "Error: Unable to add tapfd to knet_handle %s%s",
+					strerror(errno), telnet_newline);
+			err = -1;
+			goto out_clean;
+		}
 	}
 
-	knet_handle_enable_filter(knet_iface->cfg_ring.knet_h, NULL, ether_host_filter_fn);
+	knet_handle_enable_filter(knet_iface->cfg_ring.knet_h, &knet_iface->cfg_eth, ether_host_filter_fn);
 
 	if (knet_handle_enable_pmtud_notify(knet_iface->cfg_ring.knet_h,
 					    knet_iface,
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <time.h>
+#include <arpa/inet.h>
 
 #include "internals.h"
 #include "compress.h"
@@ -119,6 +120,159 @@ static int compress_check_lib_is_init(knet_handle_t knet_h, int cmp_model)
 	return 0;
 }
 
+/*
+ * per thread contexts. Each slot is only accessed by the thread owning it,
+ * or in global write lock context.
+ */
+static int compress_get_ctx(knet_handle_t knet_h, int ctx_id, int cmp_model, void **ctx)
+{
+	*ctx = knet_h->compress_ctx[ctx_id][cmp_model];
+
+	if ((*ctx) || (!compress_modules_cmds[cmp_model].ops->ctx_alloc)) {
+		return 0;
+	}
+
+	*ctx = compress_modules_cmds[cmp_model].ops->ctx_alloc(knet_h, cmp_model);
+	if (!*ctx) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to allocate %s context: %s",
+			compress_modules_cmds[cmp_model].model_name, strerror(errno));
+		return -1;
+	}
+
+	knet_h->compress_ctx[ctx_id][cmp_model] = *ctx;
+	return 0;
+}
+
+static void compress_free_ctx(knet_handle_t knet_h, int ctx_id, int cmp_model)
+{
+	if (!knet_h->compress_ctx[ctx_id][cmp_model]) {
+		return;
+	}
+
+	if (compress_modules_cmds[cmp_model].ops->ctx_free) {
+		compress_modules_cmds[cmp_model].ops->ctx_free(knet_h, knet_h->compress_ctx[ctx_id][cmp_model]);
+	}
+	knet_h->compress_ctx[ctx_id][cmp_model] = NULL;
+}
+
+void compress_ctx_fini(
+	knet_handle_t knet_h,
+	int ctx_id)
+{
+	int idx;
+
+	for (idx = 1; idx <= max_model; idx++) {
+		compress_free_ctx(knet_h, ctx_id, idx);
+	}
+}
+
+/*
+ * streaming compression
+ *
+ * each stream owns a module context, allocated when the stream
+ * (re)starts. TX streams are accessed by the TX path, serialized by
+ * tx_mutex, RX streams by the RX thread, or under global write lock.
+ */
+static void compress_stream_free(knet_handle_t knet_h, struct knet_compress_stream *stream)
+{
+	if ((stream->ctx) &&
+	    (compress_modules_cmds[stream->model].ops->ctx_free)) {
+		compress_modules_cmds[stream->model].ops->ctx_free(knet_h, stream->ctx);
+	}
+	stream->ctx = NULL;
+	stream->in_sync = 0;
+}
+
+static int compress_stream_alloc(knet_handle_t knet_h, struct knet_compress_stream *stream, int cmp_model)
+{
+	if ((stream->ctx) && (stream->model == cmp_model)) {
+		return 0;
+	}
+
+	compress_stream_free(knet_h, stream);
+
+	stream->ctx = compress_modules_cmds[cmp_model].ops->ctx_alloc(knet_h, cmp_model);
+	if (!stream->ctx) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to allocate %s stream context: %s",
+			compress_modules_cmds[cmp_model].model_name, strerror(errno));
+		return -1;
+	}
+	stream->model = cmp_model;
+
+	return 0;
+}
+
+void compress_stream_host_fini(
+	knet_handle_t knet_h,
+	struct knet_host *host)
+{
+	int8_t channel;
+
+	for (channel = 0; channel <= KNET_DATAFD_MAX; channel++) {
+		compress_stream_free(knet_h, &host->compress_rx_stream[channel]);
+	}
+}
+
+/*
+ * a packet of the stream has been lost and the receiver dropped
+ * out of sync. Ask the sender to restart the stream, only once
+ * until the restart is received, so that a single lost packet
+ * does not cost the whole resync interval.
+ */
+int compress_stream_rx_need_resync(
+	struct knet_host *src_host,
+	int8_t channel)
+{
+	struct knet_compress_stream *stream;
+
+	if ((channel < 0) || (channel > KNET_DATAFD_MAX)) {
+		return 0;
+	}
+
+	stream = &src_host->compress_rx_stream[channel];
+
+	if (stream->resync) {
+		return 0;
+	}
+
+	stream->resync = 1;
+	return 1;
+}
+
+/*
+ * invoked by the RX thread on a restart request, the TX path
+ * picks it up on the next packet sent on the channel
+ */
+void compress_stream_tx_resync(
+	knet_handle_t knet_h,
+	int8_t channel)
+{
+	if ((channel < 0) || (channel > KNET_DATAFD_MAX)) {
+		return;
+	}
+
+	__atomic_store_n(&knet_h->compress_tx_stream[channel].resync, 1, __ATOMIC_RELEASE);
+}
+
+static int compress_stream_supported(int cmp_model)
+{
+	return ((compress_modules_cmds[cmp_model].ops->compress_stream) &&
+		(compress_modules_cmds[cmp_model].ops->decompress_stream) &&
+		(compress_modules_cmds[cmp_model].ops->ctx_alloc));
+}
+
+/*
+ * compress_set_dict_lib should _always_ be invoked in write lock context
+ */
+static int compress_set_dict_lib(knet_handle_t knet_h, int cmp_model)
+{
+	if (compress_modules_cmds[cmp_model].ops->set_dict == NULL) {
+		return 0;
+	}
+
+	return compress_modules_cmds[cmp_model].ops->set_dict(knet_h, cmp_model);
+}
+
 /*
  * compress_load_lib should _always_ be invoked in write lock context
  */
@@ -134,6 +288,7 @@ static int compress_load_lib(knet_handle_t knet_h, int cmp_model, int rate_limit
 	 * another thread might have init the library in the meantime
 	 */
 	if (compress_check_lib_is_init(knet_h, cmp_model)) {
+		knet_h->decompress_ops[cmp_model] = compress_modules_cmds[cmp_model].ops;
 		return 0;
 	}
 
@@ -185,9 +340,59 @@ static int compress_load_lib(knet_handle_t knet_h, int cmp_model, int rate_limit
 		knet_h->compress_int_data[cmp_model] = (void *)&"1";
 	}
 
+	if (compress_set_dict_lib(knet_h, cmp_model) < 0) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to set compression dictionary for %s",
+			compress_modules_cmds[cmp_model].model_name);
+		return -1;
+	}
+
+	/*
+	 * the model is now ready to decompress packets for this handle
+	 */
+	knet_h->decompress_ops[cmp_model] = compress_modules_cmds[cmp_model].ops;
+
+	return 0;
+}
+
+/*
+ * apply the current dictionary to all the models in use by this handle
+ */
+static int compress_set_dict_all(knet_handle_t knet_h)
+{
+	int idx;
+
+	for (idx = 1; idx <= max_model; idx++) {
+		if (!compress_check_lib_is_init(knet_h, idx)) {
+			continue;
+		}
+		if (compress_set_dict_lib(knet_h, idx) < 0) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to set compression dictionary for %s",
+				compress_modules_cmds[idx].model_name);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
+/*
+ * hash of the dictionary sent onwire in front of each packet
+ * compressed with it, to detect nodes configured with different
+ * dictionaries before handing the data to the compression library
+ */
+static uint32_t compress_dict_id(const unsigned char *dict, size_t dict_len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < dict_len; i++) {
+		hash ^= dict[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 static int compress_lib_test(knet_handle_t knet_h)
 {
 	int savederrno = 0;
@@ -196,16 +401,26 @@ static int compress_lib_test(knet_handle_t knet_h)
 	ssize_t dst_comp_len = KNET_DATABUFSIZE_COMPRESS, dst_decomp_len = KNET_DATABUFSIZE;
 	unsigned int i;
 	int request_level;
+	void *tx_ctx, *rx_ctx;
 
 	memset(src, 0, KNET_DATABUFSIZE);
 	memset(dst, 0, KNET_DATABUFSIZE_COMPRESS);
 
+	/*
+	 * we run in global write lock context, TX and RX threads
+	 * cannot use their contexts at the same time
+	 */
+	if ((compress_get_ctx(knet_h, KNET_COMPRESS_CTX_TX, knet_h->compress_model, &tx_ctx) < 0) ||
+	    (compress_get_ctx(knet_h, KNET_COMPRESS_CTX_RX, knet_h->compress_model, &rx_ctx) < 0)) {
+		return -1;
+	}
+
 	/*
 	 * NOTE: we cannot use compress and decompress API calls due to locking
 	 * so we need to call directly into the modules
 	 */
 
-	if (compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
+	if (compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, tx_ctx, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to compress test buffer. Please check your compression settings: %s", strerror(savederrno));
 		errno = savederrno;
@@ -229,7 +444,7 @@ static int compress_lib_test(knet_handle_t knet_h)
 			memset(src, 0, KNET_DATABUFSIZE);
 			memset(dst, 0, KNET_DATABUFSIZE_COMPRESS);
 			dst_comp_len = KNET_DATABUFSIZE_COMPRESS;
-			if (compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
+			if (compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, tx_ctx, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
 				savederrno = errno;
 				log_err(knet_h, KNET_SUB_COMPRESS, "Unable to compress with default compression level: %s", strerror(savederrno));
 				errno = savederrno;
@@ -240,7 +455,7 @@ static int compress_lib_test(knet_handle_t knet_h)
 		}
 	}
 
-	if (compress_modules_cmds[knet_h->compress_model].ops->decompress(knet_h, dst, dst_comp_len, src, &dst_decomp_len) < 0) {
+	if (compress_modules_cmds[knet_h->compress_model].ops->decompress(knet_h, rx_ctx, dst, dst_comp_len, src, &dst_decomp_len) < 0) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to decompress test buffer. Please check your compression settings: %s", strerror(savederrno));
 		errno = savederrno;
@@ -255,6 +470,42 @@ static int compress_lib_test(knet_handle_t knet_h)
 		}
 	}
 
+	if ((!knet_h->compress_dict) ||
+	    (!compress_modules_cmds[knet_h->compress_model].ops->compress_dict)) {
+		return 0;
+	}
+
+	dst_comp_len = KNET_DATABUFSIZE_COMPRESS;
+	dst_decomp_len = KNET_DATABUFSIZE;
+
+	if (compress_modules_cmds[knet_h->compress_model].ops->compress_dict(knet_h, tx_ctx, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to compress test buffer with dictionary: %s", strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (compress_modules_cmds[knet_h->compress_model].ops->decompress_dict(knet_h, rx_ctx, dst, dst_comp_len, src, &dst_decomp_len) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to decompress test buffer with dictionary: %s", strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (dst_decomp_len != KNET_DATABUFSIZE) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Decompressed buffer with dictionary has incorrect size");
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < KNET_DATABUFSIZE; i++) {
+		if (src[i] != 0) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "Decompressed buffer with dictionary contains incorrect data");
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -353,6 +604,19 @@ int compress_cfg(
 
 		knet_h->compress_model = cmp_model;
 		knet_h->compress_level = knet_handle_compress_cfg->compress_level;
+		memset(knet_h->compress_adaptive, 0, sizeof(knet_h->compress_adaptive));
+
+		/*
+		 * dictionaries can depend on compress_level,
+		 * prepare them again
+		 */
+		if (compress_set_dict_lib(knet_h, cmp_model) < 0) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to set compression dictionary: %s",
+				strerror(savederrno));
+			err = -1;
+			goto out_unlock;
+		}
 
 		if (compress_lib_test(knet_h) < 0) {
 			savederrno = errno;
@@ -379,6 +643,8 @@ void compress_fini(
 {
 	int savederrno = 0;
 	int idx = 0;
+	int ctx_id;
+	int8_t channel;
 
 	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
 	if (savederrno) {
@@ -387,6 +653,14 @@ void compress_fini(
 		return;
 	}
 
+	/*
+	 * TX streams always use the current model and level,
+	 * they restart with the new configuration
+	 */
+	for (channel = 0; channel <= KNET_DATAFD_MAX; channel++) {
+		compress_stream_free(knet_h, &knet_h->compress_tx_stream[channel]);
+	}
+
 	while (idx < KNET_MAX_COMPRESS_METHODS) {
 		if ((compress_modules_cmds[idx].model_name != NULL) &&
 		    (compress_modules_cmds[idx].built_in == 1) &&
@@ -394,6 +668,10 @@ void compress_fini(
 		    (compress_modules_cmds[idx].model_id > 0) &&
 		    (knet_h->compress_int_data[idx] != NULL)) {
 			if ((all) || (compress_modules_cmds[idx].model_id == knet_h->compress_model)) {
+				knet_h->decompress_ops[idx] = NULL;
+				for (ctx_id = 0; ctx_id < KNET_COMPRESS_CTX_MAX; ctx_id++) {
+					compress_free_ctx(knet_h, ctx_id, idx);
+				}
 				if (compress_modules_cmds[idx].ops->fini != NULL) {
 					compress_modules_cmds[idx].ops->fini(knet_h, idx);
 				} else {
@@ -404,31 +682,328 @@ void compress_fini(
 		idx++;
 	}
 
+	if (all) {
+		free(knet_h->compress_dict);
+		knet_h->compress_dict = NULL;
+		knet_h->compress_dict_len = 0;
+	}
+
 	pthread_rwlock_unlock(&shlib_rwlock);
 	return;
 }
 
+int compress_set_dict(
+	knet_handle_t knet_h,
+	const unsigned char *dict,
+	size_t dict_len)
+{
+	int savederrno = 0, err = 0;
+	unsigned char *new_dict = NULL;
+	unsigned char *old_dict;
+	size_t old_dict_len;
+	uint32_t old_dict_id;
+
+	if (dict) {
+		new_dict = malloc(dict_len);
+		if (!new_dict) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to allocate memory for compression dictionary");
+			errno = ENOMEM;
+			return -1;
+		}
+		memmove(new_dict, dict, dict_len);
+	}
+
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
+			strerror(savederrno));
+		free(new_dict);
+		errno = savederrno;
+		return -1;
+	}
+
+	old_dict = knet_h->compress_dict;
+	old_dict_len = knet_h->compress_dict_len;
+	old_dict_id = knet_h->compress_dict_id;
+
+	knet_h->compress_dict = new_dict;
+	knet_h->compress_dict_len = dict_len;
+	knet_h->compress_dict_id = compress_dict_id(new_dict, dict_len);
+
+	err = compress_set_dict_all(knet_h);
+	if ((!err) && (knet_h->compress_model > 0)) {
+		err = compress_lib_test(knet_h);
+	}
+
+	if (err) {
+		savederrno = errno;
+		knet_h->compress_dict = old_dict;
+		knet_h->compress_dict_len = old_dict_len;
+		knet_h->compress_dict_id = old_dict_id;
+		compress_set_dict_all(knet_h);
+		free(new_dict);
+		goto out_unlock;
+	}
+
+	free(old_dict);
+
+	if (new_dict) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Compression dictionary set (size: %zu id: %u)",
+			  knet_h->compress_dict_len, knet_h->compress_dict_id);
+	} else {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Compression dictionary removed");
+	}
+
+out_unlock:
+	pthread_rwlock_unlock(&shlib_rwlock);
+	errno = err ? savederrno : 0;
+	return err;
+}
+
 /*
- * compress does not require compress_check_lib_is_init
- * because it's protected by compress_cfg
+ * adaptive compression
+ *
+ * for every channel and packet size class we keep a running average
+ * of the compression ratio and of the CPU time spent per byte.
+ * Compression stops for a class when the time saved on the wire is lower
+ * than the time spent compressing, or when the data do not compress.
+ * Classes that are not compressed are probed again every
+ * KNET_COMPRESS_ADAPTIVE_PROBE packets.
+ *
+ * All the adaptive state is accessed only by the TX path,
+ * serialized by tx_mutex, or under global write lock.
  */
-int compress(
+
+#define KNET_COMPRESS_ADAPTIVE_PROBE     64
+#define KNET_COMPRESS_ADAPTIVE_MIN_RATIO 1000 /* ~2% saving, in 1/1024 units */
+
+void compress_set_adaptive(
+	knet_handle_t knet_h,
+	uint32_t link_mbps)
+{
+	knet_h->compress_adaptive_mbps = link_mbps;
+	memset(knet_h->compress_adaptive, 0, sizeof(knet_h->compress_adaptive));
+
+	if (link_mbps) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Adaptive compression enabled (link speed: %u Mbit/s)", link_mbps);
+	} else {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Adaptive compression disabled");
+	}
+}
+
+static struct knet_compress_adaptive *compress_adaptive_get(
+	knet_handle_t knet_h,
+	int8_t channel,
+	size_t inlen)
+{
+	int bucket = 0;
+
+	if ((!knet_h->compress_adaptive_mbps) ||
+	    (channel < 0) || (channel > KNET_DATAFD_MAX)) {
+		return NULL;
+	}
+
+	inlen >>= 8;
+	while ((inlen) && (bucket < KNET_COMPRESS_ADAPTIVE_BUCKETS - 1)) {
+		inlen >>= 1;
+		bucket++;
+	}
+
+	return &knet_h->compress_adaptive[channel][bucket];
+}
+
+int compress_adaptive_skip(
+	knet_handle_t knet_h,
+	int8_t channel,
+	size_t inlen)
+{
+	struct knet_compress_adaptive *adaptive = compress_adaptive_get(knet_h, channel, inlen);
+
+	if ((!adaptive) || (!adaptive->skip)) {
+		return 0;
+	}
+
+	adaptive->skip--;
+	return 1;
+}
+
+void compress_adaptive_update(
 	knet_handle_t knet_h,
+	int8_t channel,
+	size_t inlen,
+	size_t outlen,
+	uint64_t compress_time)
+{
+	struct knet_compress_adaptive *adaptive = compress_adaptive_get(knet_h, channel, inlen);
+	uint64_t ratio, cost, wire, gain;
+
+	if ((!adaptive) || (!inlen)) {
+		return;
+	}
+
+	if (outlen >= inlen) {
+		ratio = 1024;
+	} else {
+		ratio = (outlen * 1024) / inlen;
+	}
+
+	cost = (compress_time * 1024) / inlen;
+	if (cost > UINT32_MAX) {
+		cost = UINT32_MAX;
+	}
+
+	if (!adaptive->samples) {
+		adaptive->ratio = ratio;
+		adaptive->cost = cost;
+		adaptive->samples = 1;
+	} else {
+		adaptive->ratio = (adaptive->ratio * 3 + ratio) / 4;
+		adaptive->cost = (((uint64_t)adaptive->cost * 3) + cost) / 4;
+	}
+
+	/*
+	 * time to send one byte on the wire and time saved per original
+	 * byte, both in 1/1024 ns
+	 */
+	wire = (8000llu * 1024) / knet_h->compress_adaptive_mbps;
+	gain = ((1024 - adaptive->ratio) * wire) / 1024;
+
+	if ((adaptive->ratio >= KNET_COMPRESS_ADAPTIVE_MIN_RATIO) ||
+	    (gain <= adaptive->cost)) {
+		adaptive->skip = KNET_COMPRESS_ADAPTIVE_PROBE;
+	}
+}
+
+void compress_set_stream(
+	knet_handle_t knet_h,
+	int8_t channel,
+	uint8_t resync_interval)
+{
+	compress_stream_free(knet_h, &knet_h->compress_tx_stream[channel]);
+	knet_h->compress_tx_stream[channel].interval = resync_interval;
+
+	if (resync_interval) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Stream compression enabled on channel %d (resync interval: %u)",
+			  channel, resync_interval);
+	} else {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Stream compression disabled on channel %d", channel);
+	}
+}
+
+static int compress_stream(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	uint32_t dst_key,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t *compress_flags,
+	uint8_t *compress_pad)
 {
-	return compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
+	int reset = 0;
+
+	if (compress_stream_alloc(knet_h, stream, knet_h->compress_model) < 0) {
+		return -1;
+	}
+
+	/*
+	 * restart the stream when the receivers might have lost track of it,
+	 * or one of them asked for it
+	 */
+	if ((__atomic_exchange_n(&stream->resync, 0, __ATOMIC_ACQ_REL)) ||
+	    (!stream->in_sync) ||
+	    (stream->dst_key != dst_key) ||
+	    (stream->next >= stream->interval)) {
+		reset = 1;
+		stream->next = 0;
+		stream->dst_key = dst_key;
+	}
+
+	if (compress_modules_cmds[knet_h->compress_model].ops->compress_stream(knet_h, stream->ctx, reset,
+									       buf_in, buf_in_len,
+									       buf_out, buf_out_len) < 0) {
+		stream->in_sync = 0;
+		return -1;
+	}
+
+	/*
+	 * the TX path sends the packet uncompressed when compression
+	 * does not reduce its size. Receivers will not see this data
+	 * in the stream, so we need to restart it.
+	 */
+	if (*buf_out_len >= buf_in_len) {
+		stream->in_sync = 0;
+		return 0;
+	}
+
+	*compress_flags = KNET_COMPRESS_STREAM;
+	*compress_pad = stream->next;
+	stream->next++;
+	stream->in_sync = 1;
+
+	return 0;
 }
 
-int decompress(
+/*
+ * compress does not require compress_check_lib_is_init
+ * because it's protected by compress_cfg.
+ * compress is invoked only by the TX path and uses the TX context.
+ */
+int compress(
 	knet_handle_t knet_h,
-	int compress_model,
+	int8_t channel,
+	uint32_t dst_key,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t *compress_flags,
+	uint8_t *compress_pad)
+{
+	void *ctx;
+
+	*compress_flags = 0;
+	*compress_pad = 0;
+
+	if ((channel >= 0) && (channel <= KNET_DATAFD_MAX) &&
+	    (knet_h->compress_tx_stream[channel].interval) &&
+	    (compress_stream_supported(knet_h->compress_model))) {
+		return compress_stream(knet_h, &knet_h->compress_tx_stream[channel], dst_key,
+				       buf_in, buf_in_len, buf_out, buf_out_len,
+				       compress_flags, compress_pad);
+	}
+
+	if (compress_get_ctx(knet_h, KNET_COMPRESS_CTX_TX, knet_h->compress_model, &ctx) < 0) {
+		return -1;
+	}
+
+	if ((knet_h->compress_dict) &&
+	    (compress_modules_cmds[knet_h->compress_model].ops->compress_dict)) {
+		uint32_t dict_id = htonl(knet_h->compress_dict_id);
+		ssize_t dict_out_len = *buf_out_len - KNET_COMPRESS_DICT_ID_SIZE;
+
+		*compress_flags = KNET_COMPRESS_DICT;
+		memmove(buf_out, &dict_id, KNET_COMPRESS_DICT_ID_SIZE);
+		if (compress_modules_cmds[knet_h->compress_model].ops->compress_dict(knet_h, ctx, buf_in, buf_in_len,
+										     buf_out + KNET_COMPRESS_DICT_ID_SIZE, &dict_out_len) < 0) {
+			return -1;
+		}
+		*buf_out_len = dict_out_len + KNET_COMPRESS_DICT_ID_SIZE;
+		return 0;
+	}
+
+	return compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, ctx, buf_in, buf_in_len, buf_out, buf_out_len);
+}
+
+/*
+ * slow path of decompress, invoked the first time a packet
+ * compressed with a given model is received.
+ * It validates the model and loads/init the module for this handle.
+ */
+static int decompress_load(
+	knet_handle_t knet_h,
+	int compress_model)
 {
 	int savederrno = 0, err = 0;
 
@@ -444,45 +1019,163 @@ int decompress(
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&shlib_rwlock);
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get read lock: %s",
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
 
-	if (!compress_check_lib_is_init(knet_h, compress_model)) {
+	if (compress_load_lib(knet_h, compress_model, 1) < 0) {
+		savederrno = errno;
+		err = -1;
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load library: %s",
+			strerror(savederrno));
+	}
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+
+	errno = err ? savederrno : 0;
+	return err;
+}
+
+/*
+ * decompress does not take shlib_rwlock once the model is ready.
+ * knet_h->decompress_ops entries are only set by the RX thread
+ * (via decompress_load) or under get_global_wrlock (compress_cfg),
+ * and cleared under get_global_wrlock (compress_fini), while the RX
+ * thread is in its epoch read section (epoch_read_lock).
+ * get_global_wrlock waits for readers to leave their read section
+ * (epoch_stop_readers) and keeps them out until the lock is released.
+ * Entries must not be cleared under get_global_cfg_wrlock, readers
+ * keep running there and only epoch_synchronize() waits for them.
+ * Modules are never unloaded, so the ops pointers remain valid.
+ * decompress is invoked only by the RX thread and uses the RX context,
+ * or the stream context of src_host for stream packets.
+ */
+static int decompress_stream(
+	knet_handle_t knet_h,
+	struct knet_host *src_host,
+	int8_t channel,
+	int compress_model,
+	uint8_t stream_pos,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct knet_compress_stream *stream;
+
+	if ((!src_host) ||
+	    (channel < 0) || (channel > KNET_DATAFD_MAX) ||
+	    (!compress_stream_supported(compress_model))) {
+		log_err_ratelimited(knet_h, KNET_SUB_COMPRESS, "Received stream packet compressed with %s but streaming is not supported",
+				    compress_modules_cmds[compress_model].model_name);
+		errno = EINVAL;
+		return -1;
+	}
+
+	stream = &src_host->compress_rx_stream[channel];
+
+	if (stream_pos) {
 		/*
-		 * need to switch to write lock, load the lib, and return with a write lock
-		 * this is not racy because compress_load_lib is written idempotent.
+		 * a packet of the stream has been lost or reordered,
+		 * wait for the sender to restart the stream
 		 */
-		pthread_rwlock_unlock(&shlib_rwlock);
-		savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
-		if (savederrno) {
-			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
-				strerror(savederrno));
-			errno = savederrno;
+		if ((!stream->in_sync) ||
+		    (stream->model != compress_model) ||
+		    (stream->next != stream_pos)) {
+			stream->in_sync = 0;
+			errno = EAGAIN;
 			return -1;
 		}
+	} else {
+		if (compress_stream_alloc(knet_h, stream, compress_model) < 0) {
+			stream->in_sync = 0;
+			return -1;
+		}
+		stream->resync = 0;
+	}
 
-		if (compress_load_lib(knet_h, compress_model, 1) < 0) {
-			savederrno = errno;
-			err = -1;
-			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load library: %s",
-				strerror(savederrno));
-			goto out_unlock;
+	if (compress_modules_cmds[compress_model].ops->decompress_stream(knet_h, stream->ctx, (stream_pos == 0),
+									 buf_in, buf_in_len,
+									 buf_out, buf_out_len) < 0) {
+		stream->in_sync = 0;
+		return -1;
+	}
+
+	stream->next = stream_pos + 1;
+	stream->in_sync = 1;
+
+	return 0;
+}
+
+int decompress(
+	knet_handle_t knet_h,
+	struct knet_host *src_host,
+	int8_t channel,
+	int compress_model,
+	uint8_t compress_pad,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct knet_compress_ops *ops;
+	void *ctx;
+	int use_dict = compress_model & KNET_COMPRESS_DICT;
+	int use_stream = compress_model & KNET_COMPRESS_STREAM;
+
+	compress_model &= ~KNET_COMPRESS_FLAGS;
+
+	ops = knet_h->decompress_ops[compress_model];
+	if (!ops) {
+		if (decompress_load(knet_h, compress_model) < 0) {
+			return -1;
 		}
+		ops = knet_h->decompress_ops[compress_model];
 	}
 
-	err = compress_modules_cmds[compress_model].ops->decompress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
-	savederrno = errno;
+	if (use_stream) {
+		return decompress_stream(knet_h, src_host, channel, compress_model, compress_pad,
+					 buf_in, buf_in_len, buf_out, buf_out_len);
+	}
 
-out_unlock:
-	pthread_rwlock_unlock(&shlib_rwlock);
+	if (compress_get_ctx(knet_h, KNET_COMPRESS_CTX_RX, compress_model, &ctx) < 0) {
+		return -1;
+	}
 
-	errno = savederrno;
-	return err;
+	if (use_dict) {
+		uint32_t dict_id;
+
+		if (buf_in_len < (ssize_t)KNET_COMPRESS_DICT_ID_SIZE) {
+			log_err_ratelimited(knet_h, KNET_SUB_COMPRESS, "Received packet compressed with a dictionary is too short");
+			errno = EINVAL;
+			return -1;
+		}
+		memmove(&dict_id, buf_in, KNET_COMPRESS_DICT_ID_SIZE);
+		/*
+		 * the remote node decides, report ENOENT so that
+		 * RX can count mismatches (rx_dict_mismatch_packets)
+		 */
+		if (ntohl(dict_id) != knet_h->compress_dict_id) {
+			log_err_ratelimited(knet_h, KNET_SUB_COMPRESS, "Received packet compressed with a dictionary that does not match the local one");
+			errno = ENOENT;
+			return -1;
+		}
+		if ((!knet_h->compress_dict) || (!ops->decompress_dict)) {
+			log_err_ratelimited(knet_h, KNET_SUB_COMPRESS, "Received packet compressed with %s and a dictionary, but no dictionary is available",
+					    compress_modules_cmds[compress_model].model_name);
+			errno = ENOENT;
+			return -1;
+		}
+		return ops->decompress_dict(knet_h, ctx,
+					    buf_in + KNET_COMPRESS_DICT_ID_SIZE, buf_in_len - KNET_COMPRESS_DICT_ID_SIZE,
+					    buf_out, buf_out_len);
+	}
+
+	return ops->decompress(knet_h, ctx, buf_in, buf_in_len, buf_out, buf_out_len);
 }
 
 int knet_get_compress_list(struct knet_compress_info *compress_list, size_t *compress_list_entries)
@@ -22,16 +22,65 @@ void compress_fini(
 	knet_handle_t knet_h,
 	int all);
 
+void compress_ctx_fini(
+	knet_handle_t knet_h,
+	int ctx_id);
+
+int compress_set_dict(
+	knet_handle_t knet_h,
+	const unsigned char *dict,
+	size_t dict_len);
+
+void compress_set_adaptive(
+	knet_handle_t knet_h,
+	uint32_t link_mbps);
+
+int compress_adaptive_skip(
+	knet_handle_t knet_h,
+	int8_t channel,
+	size_t inlen);
+
+void compress_adaptive_update(
+	knet_handle_t knet_h,
+	int8_t channel,
+	size_t inlen,
+	size_t outlen,
+	uint64_t compress_time);
+
+void compress_set_stream(
+	knet_handle_t knet_h,
+	int8_t channel,
+	uint8_t resync_interval);
+
+void compress_stream_host_fini(
+	knet_handle_t knet_h,
+	struct knet_host *host);
+
+int compress_stream_rx_need_resync(
+	struct knet_host *src_host,
+	int8_t channel);
+
+void compress_stream_tx_resync(
+	knet_handle_t knet_h,
+	int8_t channel);
+
 int compress(
 	knet_handle_t knet_h,
+	int8_t channel,
+	uint32_t dst_key,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len);
+	ssize_t *buf_out_len,
+	uint8_t *compress_flags,
+	uint8_t *compress_pad);
 
 int decompress(
 	knet_handle_t knet_h,
+	struct knet_host *src_host,
+	int8_t channel,
 	int compress_model,
+	uint8_t compress_pad,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -23,6 +23,7 @@
 
 static int bzip2_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -64,6 +65,7 @@ static int bzip2_compress(
 
 static int bzip2_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -122,5 +124,12 @@ compress_ops_t compress_model = {
 	NULL,
 	bzip2_compress,
 	bzip2_decompress,
-	bzip2_get_default_level
+	bzip2_get_default_level,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
 };
@@ -11,6 +11,8 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <lz4.h>
 
 #include "logging.h"
@@ -22,8 +24,96 @@
 #define KNET_COMPRESS_DEFAULT KNET_COMPRESS_UNKNOWN_DEFAULT
 #endif
 
+/*
+ * lz4 only uses the last 64KB of a dictionary
+ */
+#define LZ4_DICT_MAX_SIZE 65536
+
+/*
+ * dict_stream has the dictionary loaded and is never used
+ * to compress directly. It is copied into the per thread
+ * work_stream for every packet, that is a lot cheaper than
+ * loading the dictionary again.
+ */
+struct lz4_ctx {
+	LZ4_stream_t dict_stream;
+	const char *dict;
+	int dict_len;
+};
+
+struct lz4_thread_ctx {
+	int method_idx;
+	LZ4_stream_t work_stream;
+};
+
+static int lz4_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int lz4_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct lz4_ctx *lz4_ctx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		lz4_ctx = malloc(sizeof(struct lz4_ctx));
+		if (!lz4_ctx) {
+			log_err(knet_h, KNET_SUB_LZ4COMP, "lz4 unable to allocate context");
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(lz4_ctx, 0, sizeof(struct lz4_ctx));
+		knet_h->compress_int_data[method_idx] = lz4_ctx;
+	}
+
+	return 0;
+}
+
+static void lz4_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
+static void *lz4_ctx_alloc(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct lz4_thread_ctx *thread_ctx;
+
+	thread_ctx = malloc(sizeof(struct lz4_thread_ctx));
+	if (!thread_ctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(thread_ctx, 0, sizeof(struct lz4_thread_ctx));
+	thread_ctx->method_idx = method_idx;
+
+	return thread_ctx;
+}
+
+static void lz4_ctx_free(
+	knet_handle_t knet_h,
+	void *ctx)
+{
+	free(ctx);
+}
+
 static int lz4_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -63,6 +153,7 @@ static int lz4_compress(
 
 static int lz4_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -92,13 +183,114 @@ static int lz4_get_default_level()
 	return KNET_COMPRESS_DEFAULT;
 }
 
+static int lz4_set_dict(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct lz4_ctx *lz4_ctx = knet_h->compress_int_data[method_idx];
+
+	lz4_ctx->dict = NULL;
+	lz4_ctx->dict_len = 0;
+
+	if (!knet_h->compress_dict) {
+		return 0;
+	}
+
+	if (knet_h->compress_dict_len > LZ4_DICT_MAX_SIZE) {
+		lz4_ctx->dict = (const char *)knet_h->compress_dict + knet_h->compress_dict_len - LZ4_DICT_MAX_SIZE;
+		lz4_ctx->dict_len = LZ4_DICT_MAX_SIZE;
+	} else {
+		lz4_ctx->dict = (const char *)knet_h->compress_dict;
+		lz4_ctx->dict_len = knet_h->compress_dict_len;
+	}
+
+	memset(&lz4_ctx->dict_stream, 0, sizeof(LZ4_stream_t));
+	LZ4_loadDict(&lz4_ctx->dict_stream, lz4_ctx->dict, lz4_ctx->dict_len);
+
+	return 0;
+}
+
+static int lz4_compress_dict(
+	knet_handle_t knet_h,
+	void *ctx,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct lz4_thread_ctx *thread_ctx = ctx;
+	struct lz4_ctx *lz4_ctx = knet_h->compress_int_data[thread_ctx->method_idx];
+	int lzerr = 0, err = 0;
+	int savederrno = 0;
+
+	memmove(&thread_ctx->work_stream, &lz4_ctx->dict_stream, sizeof(LZ4_stream_t));
+
+	lzerr = LZ4_compress_fast_continue(&thread_ctx->work_stream,
+					   (const char *)buf_in, (char *)buf_out,
+					   buf_in_len, KNET_DATABUFSIZE_COMPRESS, knet_h->compress_level);
+
+	if (lzerr > 0) {
+		*buf_out_len = lzerr;
+	}
+
+	if (lzerr == 0) {
+		*buf_out_len = buf_in_len;
+	}
+
+	if (lzerr < 0) {
+		log_err(knet_h, KNET_SUB_LZ4COMP, "lz4 compression with dictionary error: %d", lzerr);
+		savederrno = EINVAL;
+		err = -1;
+	}
+
+	errno = savederrno;
+	return err;
+}
+
+static int lz4_decompress_dict(
+	knet_handle_t knet_h,
+	void *ctx,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct lz4_thread_ctx *thread_ctx = ctx;
+	struct lz4_ctx *lz4_ctx = knet_h->compress_int_data[thread_ctx->method_idx];
+	int lzerr = 0, err = 0;
+	int savederrno = 0;
+
+	lzerr = LZ4_decompress_safe_usingDict((const char *)buf_in, (char *)buf_out, buf_in_len, KNET_DATABUFSIZE,
+					      lz4_ctx->dict, lz4_ctx->dict_len);
+
+	if (lzerr < 0) {
+		log_err_ratelimited(knet_h, KNET_SUB_LZ4COMP, "lz4 decompression with dictionary error: %d", lzerr);
+		savederrno = EINVAL;
+		err = -1;
+	}
+
+	if (lzerr > 0) {
+		*buf_out_len = lzerr;
+	}
+
+	errno = savederrno;
+	return err;
+}
+
 compress_ops_t compress_model = {
 	KNET_COMPRESS_MODEL_ABI,
-	NULL,
-	NULL,
-	NULL,
+	lz4_is_init,
+	lz4_init,
+	lz4_fini,
 	NULL,
 	lz4_compress,
 	lz4_decompress,
-	lz4_get_default_level
+	lz4_get_default_level,
+	lz4_set_dict,
+	lz4_compress_dict,
+	lz4_decompress_dict,
+	lz4_ctx_alloc,
+	lz4_ctx_free,
+	NULL,
+	NULL
 };
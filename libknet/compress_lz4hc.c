@@ -39,6 +39,7 @@
 
 static int lz4hc_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -72,6 +73,7 @@ static int lz4hc_compress(
 /* This is a straight copy from compress_lz4.c */
 static int lz4_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -109,5 +111,12 @@ compress_ops_t compress_model = {
 	NULL,
 	lz4hc_compress,
 	lz4_decompress,
-	lz4hc_get_default_level
+	lz4hc_get_default_level,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
 };
@@ -23,6 +23,7 @@
 
 static int lzma_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -69,6 +70,7 @@ static int lzma_compress(
 
 static int lzma_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -133,5 +135,12 @@ compress_ops_t compress_model = {
 	NULL,
 	lzma_compress,
 	lzma_decompress,
-	lzma_get_default_level
+	lzma_get_default_level,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
 };
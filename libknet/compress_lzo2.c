@@ -24,45 +24,39 @@
 #define KNET_COMPRESS_DEFAULT KNET_COMPRESS_UNKNOWN_DEFAULT
 #endif
 
-static int lzo2_is_init(
-	knet_handle_t knet_h,
-	int method_idx)
-{
-	if (knet_h->compress_int_data[method_idx]) {
-		return 1;
-	}
-	return 0;
-}
+/*
+ * the work memory is only needed to compress and is allocated
+ * the first time the thread compresses data.
+ * LZO1X_999_MEM_COMPRESS is the highest amount of memory lzo2 can use
+ */
+struct lzo2_thread_ctx {
+	void *wrkmem;
+};
 
-static int lzo2_init(
+static void *lzo2_ctx_alloc(
 	knet_handle_t knet_h,
 	int method_idx)
 {
-	/*
-	 * LZO1X_999_MEM_COMPRESS is the highest amount of memory lzo2 can use
-	 */
-	if (!knet_h->compress_int_data[method_idx]) {
-		knet_h->compress_int_data[method_idx] = malloc(LZO1X_999_MEM_COMPRESS);
-		if (!knet_h->compress_int_data[method_idx]) {
-			log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to allocate work memory");
-			errno = ENOMEM;
-			return -1;
-		}
-		memset(knet_h->compress_int_data[method_idx], 0, LZO1X_999_MEM_COMPRESS);
+	struct lzo2_thread_ctx *thread_ctx;
+
+	thread_ctx = malloc(sizeof(struct lzo2_thread_ctx));
+	if (!thread_ctx) {
+		errno = ENOMEM;
+		return NULL;
 	}
+	memset(thread_ctx, 0, sizeof(struct lzo2_thread_ctx));
 
-	return 0;
+	return thread_ctx;
 }
 
-static void lzo2_fini(
+static void lzo2_ctx_free(
 	knet_handle_t knet_h,
-	int method_idx)
+	void *ctx)
 {
-	if (knet_h->compress_int_data[method_idx]) {
-		free(knet_h->compress_int_data[method_idx]);
-		knet_h->compress_int_data[method_idx] = NULL;
-	}
-	return;
+	struct lzo2_thread_ctx *thread_ctx = ctx;
+
+	free(thread_ctx->wrkmem);
+	free(thread_ctx);
 }
 
 static int lzo2_val_level(
@@ -95,32 +89,44 @@ static int lzo2_val_level(
 
 static int lzo2_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
+	struct lzo2_thread_ctx *thread_ctx = ctx;
 	int savederrno = 0, lzerr = 0, err = 0;
 	lzo_uint cmp_len;
 
+	if (!thread_ctx->wrkmem) {
+		thread_ctx->wrkmem = malloc(LZO1X_999_MEM_COMPRESS);
+		if (!thread_ctx->wrkmem) {
+			log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to allocate work memory");
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(thread_ctx->wrkmem, 0, LZO1X_999_MEM_COMPRESS);
+	}
+
 	switch(knet_h->compress_level) {
 		case 1:
-			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 		case 11:
-			lzerr = lzo1x_1_11_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_11_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 		case 12:
-			lzerr = lzo1x_1_12_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_12_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 		case 15:
-			lzerr = lzo1x_1_15_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_15_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 		case 999:
-			lzerr = lzo1x_999_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_999_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 		default:
-			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, thread_ctx->wrkmem);
 			break;
 	}
 
@@ -138,6 +144,7 @@ static int lzo2_compress(
 
 static int lzo2_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -168,11 +175,18 @@ static int lzo2_get_default_level()
 
 compress_ops_t compress_model = {
 	KNET_COMPRESS_MODEL_ABI,
-	lzo2_is_init,
-	lzo2_init,
-	lzo2_fini,
+	NULL,
+	NULL,
+	NULL,
 	lzo2_val_level,
 	lzo2_compress,
 	lzo2_decompress,
-	lzo2_get_default_level
+	lzo2_get_default_level,
+	NULL,
+	NULL,
+	NULL,
+	lzo2_ctx_alloc,
+	lzo2_ctx_free,
+	NULL,
+	NULL
 };
@@ -11,10 +11,10 @@
 
 #include "internals.h"
 
-#define KNET_COMPRESS_MODEL_ABI            2
+#define KNET_COMPRESS_MODEL_ABI            5
 #define KNET_COMPRESS_UNKNOWN_DEFAULT    (-2)
 
-typedef struct {
+typedef struct knet_compress_ops {
 	uint8_t abi_ver;
 
 	/*
@@ -60,13 +60,19 @@ typedef struct {
 	 * required functions
 	 *
 	 * hopefully those 2 don't require any explanation....
+	 *
+	 * ctx is the context of the calling thread allocated by ctx_alloc
+	 * (NULL if the module does not provide ctx_alloc). Different threads
+	 * can invoke compress/decompress at the same time with different contexts.
 	 */
 	int (*compress)	(knet_handle_t knet_h,
+			 void *ctx,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
 			 ssize_t *buf_out_len);
 	int (*decompress)(knet_handle_t knet_h,
+			 void *ctx,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
@@ -76,6 +82,81 @@ typedef struct {
 	 * Get default compression level
 	 */
 	int (*get_default_level) (void);
+
+	/*
+	 * optional dictionary support
+	 *
+	 * set_dict is invoked in shlib_rwlock write context after init,
+	 * after compress configuration changes and every time
+	 * knet_h->compress_dict changes (it is NULL when the dictionary
+	 * has been removed). The module should prepare any
+	 * dictionary state and release the old one.
+	 * knet_h->compress_dict is guaranteed to stay valid until the
+	 * next set_dict call.
+	 *
+	 * compress_dict/decompress_dict work as compress/decompress
+	 * using the dictionary. Modules that support dictionaries
+	 * must provide all 3 functions.
+	 */
+	int (*set_dict)	(knet_handle_t knet_h,
+			 int method_idx);
+	int (*compress_dict)(knet_handle_t knet_h,
+			 void *ctx,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len);
+	int (*decompress_dict)(knet_handle_t knet_h,
+			 void *ctx,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len);
+
+	/*
+	 * optional per thread contexts
+	 *
+	 * modules that need mutable state to compress/decompress
+	 * (compression contexts, work buffers...) must keep it in a per thread
+	 * context and not in knet_h->compress_int_data, that is shared between
+	 * threads and should only contain read only data (such as dictionaries).
+	 *
+	 * ctx_alloc is invoked by a thread the first time it needs the model,
+	 * after init, and returns NULL on error with errno set.
+	 * ctx_free is invoked when the thread exits and, in global write lock
+	 * context, before fini or when the compress configuration changes,
+	 * so that contexts are always created for the current compress_level.
+	 */
+	void *(*ctx_alloc)(knet_handle_t knet_h,
+			 int method_idx);
+	void (*ctx_free)(knet_handle_t knet_h,
+			 void *ctx);
+
+	/*
+	 * optional streaming support
+	 *
+	 * compress_stream/decompress_stream work as compress/decompress
+	 * but packets are part of a stream and can reference data from
+	 * the previous packets of the same stream.
+	 * ctx is allocated by ctx_alloc and dedicated to one stream.
+	 * When reset is set, the stream history is discarded before
+	 * processing the packet. After an error the caller will always
+	 * reset the stream before using it again.
+	 */
+	int (*compress_stream)(knet_handle_t knet_h,
+			 void *ctx,
+			 int reset,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len);
+	int (*decompress_stream)(knet_handle_t knet_h,
+			 void *ctx,
+			 int reset,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len);
 } compress_ops_t;
 
 typedef struct {
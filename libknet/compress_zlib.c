@@ -23,6 +23,7 @@
 
 static int zlib_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -69,6 +70,7 @@ static int zlib_compress(
 
 static int zlib_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -125,5 +127,12 @@ compress_ops_t compress_model = {
 	NULL,
 	zlib_compress,
 	zlib_decompress,
-	zlib_get_default_level
+	zlib_get_default_level,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
 };
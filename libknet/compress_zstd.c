@@ -23,7 +23,26 @@
 #define KNET_COMPRESS_DEFAULT KNET_COMPRESS_UNKNOWN_DEFAULT
 #endif
 
+/*
+ * window used by streams. It bounds the memory used by each
+ * stream on both sides and how far back packets can reference data
+ */
+#define KNET_ZSTD_STREAM_WINDOWLOG 17
+
+/*
+ * dictionaries are read only once created and shared by all threads
+ */
 struct zstd_ctx {
+	ZSTD_CDict* cdict;
+	ZSTD_DDict* ddict;
+};
+
+/*
+ * per thread contexts, compression and decompression
+ * contexts are allocated the first time they are needed
+ */
+struct zstd_thread_ctx {
+	int method_idx;
 	ZSTD_CCtx* cctx;
 	ZSTD_DCtx* dctx;
 };
@@ -42,14 +61,14 @@ static void zstd_fini(
 	knet_handle_t knet_h,
 	int method_idx)
 {
-	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[knet_h->compress_model];
+	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[method_idx];
 
 	if (zstd_ctx) {
-		if (zstd_ctx->cctx) {
-			ZSTD_freeCCtx(zstd_ctx->cctx);
+		if (zstd_ctx->cdict) {
+			ZSTD_freeCDict(zstd_ctx->cdict);
 		}
-		if (zstd_ctx->dctx) {
-			ZSTD_freeDCtx(zstd_ctx->dctx);
+		if (zstd_ctx->ddict) {
+			ZSTD_freeDDict(zstd_ctx->ddict);
 		}
 		free(knet_h->compress_int_data[method_idx]);
 		knet_h->compress_int_data[method_idx] = NULL;
@@ -62,7 +81,6 @@ static int zstd_init(
 	int method_idx)
 {
 	struct zstd_ctx *zstd_ctx;
-	int err = 0;
 
 	if (!knet_h->compress_int_data[method_idx]) {
 		zstd_ctx = malloc(sizeof(struct zstd_ctx));
@@ -73,40 +91,87 @@ static int zstd_init(
 		memset(zstd_ctx, 0, sizeof(struct zstd_ctx));
 
 		knet_h->compress_int_data[method_idx] = zstd_ctx;
+	}
+
+	return 0;
+}
+
+static void *zstd_ctx_alloc(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct zstd_thread_ctx *thread_ctx;
 
-		zstd_ctx->cctx = ZSTD_createCCtx();
-		if (!zstd_ctx->cctx) {
+	thread_ctx = malloc(sizeof(struct zstd_thread_ctx));
+	if (!thread_ctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(thread_ctx, 0, sizeof(struct zstd_thread_ctx));
+	thread_ctx->method_idx = method_idx;
+
+	return thread_ctx;
+}
+
+static void zstd_ctx_free(
+	knet_handle_t knet_h,
+	void *ctx)
+{
+	struct zstd_thread_ctx *thread_ctx = ctx;
+
+	if (thread_ctx->cctx) {
+		ZSTD_freeCCtx(thread_ctx->cctx);
+	}
+	if (thread_ctx->dctx) {
+		ZSTD_freeDCtx(thread_ctx->dctx);
+	}
+	free(thread_ctx);
+}
+
+static ZSTD_CCtx *zstd_get_cctx(
+	knet_handle_t knet_h,
+	struct zstd_thread_ctx *thread_ctx)
+{
+	if (!thread_ctx->cctx) {
+		thread_ctx->cctx = ZSTD_createCCtx();
+		if (!thread_ctx->cctx) {
 			log_err(knet_h, KNET_SUB_ZSTDCOMP, "Unable to create compression context");
-			err = -1;
-			goto out_err;
+			errno = ENOMEM;
 		}
+	}
+	return thread_ctx->cctx;
+}
 
-		zstd_ctx->dctx = ZSTD_createDCtx();
-		if (!zstd_ctx->dctx) {
+static ZSTD_DCtx *zstd_get_dctx(
+	knet_handle_t knet_h,
+	struct zstd_thread_ctx *thread_ctx)
+{
+	if (!thread_ctx->dctx) {
+		thread_ctx->dctx = ZSTD_createDCtx();
+		if (!thread_ctx->dctx) {
 			log_err(knet_h, KNET_SUB_ZSTDCOMP, "Unable to create decompression context");
-			err = -1;
-			goto out_err;
+			errno = ENOMEM;
 		}
 	}
-
-out_err:
-	if (err) {
-		zstd_fini(knet_h, method_idx);
-	}
-	return err;
+	return thread_ctx->dctx;
 }
 
 static int zstd_compress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[knet_h->compress_model];
+	ZSTD_CCtx *cctx = zstd_get_cctx(knet_h, ctx);
 	size_t compress_size;
 
-	compress_size = ZSTD_compressCCtx(zstd_ctx->cctx,
+	if (!cctx) {
+		return -1;
+	}
+
+	compress_size = ZSTD_compressCCtx(cctx,
 					  buf_out, *buf_out_len,
 					  buf_in, buf_in_len,
 					  knet_h->compress_level);
@@ -128,15 +193,20 @@ static int zstd_compress(
 
 static int zstd_decompress(
 	knet_handle_t knet_h,
+	void *ctx,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[knet_h->compress_model];
+	ZSTD_DCtx *dctx = zstd_get_dctx(knet_h, ctx);
 	size_t decompress_size;
 
-	decompress_size = ZSTD_decompressDCtx(zstd_ctx->dctx,
+	if (!dctx) {
+		return -1;
+	}
+
+	decompress_size = ZSTD_decompressDCtx(dctx,
 					      buf_out, *buf_out_len,
 					      buf_in, buf_in_len);
 
@@ -160,6 +230,230 @@ static int zstd_get_default_level()
 	return KNET_COMPRESS_DEFAULT;
 }
 
+static int zstd_set_dict(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[method_idx];
+
+	if (zstd_ctx->cdict) {
+		ZSTD_freeCDict(zstd_ctx->cdict);
+		zstd_ctx->cdict = NULL;
+	}
+	if (zstd_ctx->ddict) {
+		ZSTD_freeDDict(zstd_ctx->ddict);
+		zstd_ctx->ddict = NULL;
+	}
+
+	if (!knet_h->compress_dict) {
+		return 0;
+	}
+
+	/*
+	 * the compression dictionary embeds the compression level,
+	 * it is only needed when zstd is used to send data
+	 */
+	if (method_idx == knet_h->compress_model) {
+		zstd_ctx->cdict = ZSTD_createCDict(knet_h->compress_dict, knet_h->compress_dict_len,
+						   knet_h->compress_level);
+		if (!zstd_ctx->cdict) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "Unable to create compression dictionary");
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	zstd_ctx->ddict = ZSTD_createDDict(knet_h->compress_dict, knet_h->compress_dict_len);
+	if (!zstd_ctx->ddict) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "Unable to create decompression dictionary");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zstd_compress_dict(
+	knet_handle_t knet_h,
+	void *ctx,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct zstd_thread_ctx *thread_ctx = ctx;
+	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[thread_ctx->method_idx];
+	ZSTD_CCtx *cctx;
+	size_t compress_size;
+
+	if (!zstd_ctx->cdict) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "compression dictionary is not available");
+		errno = EINVAL;
+		return -1;
+	}
+
+	cctx = zstd_get_cctx(knet_h, thread_ctx);
+	if (!cctx) {
+		return -1;
+	}
+
+	compress_size = ZSTD_compress_usingCDict(cctx,
+						 buf_out, *buf_out_len,
+						 buf_in, buf_in_len,
+						 zstd_ctx->cdict);
+
+	if (ZSTD_isError(compress_size)) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "error compressing packet with dictionary: %s", ZSTD_getErrorName(compress_size));
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = compress_size;
+
+	return 0;
+}
+
+static int zstd_decompress_dict(
+	knet_handle_t knet_h,
+	void *ctx,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct zstd_thread_ctx *thread_ctx = ctx;
+	struct zstd_ctx *zstd_ctx = knet_h->compress_int_data[thread_ctx->method_idx];
+	ZSTD_DCtx *dctx;
+	size_t decompress_size;
+
+	if (!zstd_ctx->ddict) {
+		log_err_ratelimited(knet_h, KNET_SUB_ZSTDCOMP, "decompression dictionary is not available");
+		errno = EINVAL;
+		return -1;
+	}
+
+	dctx = zstd_get_dctx(knet_h, thread_ctx);
+	if (!dctx) {
+		return -1;
+	}
+
+	decompress_size = ZSTD_decompress_usingDDict(dctx,
+						     buf_out, *buf_out_len,
+						     buf_in, buf_in_len,
+						     zstd_ctx->ddict);
+
+	if (ZSTD_isError(decompress_size)) {
+		log_err_ratelimited(knet_h, KNET_SUB_ZSTDCOMP, "error decompressing packet with dictionary: %s", ZSTD_getErrorName(decompress_size));
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = decompress_size;
+
+	return 0;
+}
+
+static int zstd_compress_stream(
+	knet_handle_t knet_h,
+	void *ctx,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	ZSTD_CCtx *cctx = zstd_get_cctx(knet_h, ctx);
+	ZSTD_inBuffer in = { buf_in, buf_in_len, 0 };
+	ZSTD_outBuffer out = { buf_out, *buf_out_len, 0 };
+	size_t ret;
+
+	if (!cctx) {
+		return -1;
+	}
+
+	if (reset) {
+		ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+		ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, knet_h->compress_level);
+		if (!ZSTD_isError(ret)) {
+			ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, KNET_ZSTD_STREAM_WINDOWLOG);
+		}
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "error setting stream parameters: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	/*
+	 * flush makes all the data of this packet decodable on the
+	 * other side, while keeping the frame (and its history) open
+	 */
+	ret = ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_flush);
+
+	if (ZSTD_isError(ret)) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "error compressing stream packet: %s", ZSTD_getErrorName(ret));
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (ret) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "output buffer too small to compress stream packet");
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	*buf_out_len = out.pos;
+
+	return 0;
+}
+
+static int zstd_decompress_stream(
+	knet_handle_t knet_h,
+	void *ctx,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	ZSTD_DCtx *dctx = zstd_get_dctx(knet_h, ctx);
+	ZSTD_inBuffer in = { buf_in, buf_in_len, 0 };
+	ZSTD_outBuffer out = { buf_out, *buf_out_len, 0 };
+	size_t ret;
+
+	if (!dctx) {
+		return -1;
+	}
+
+	if (reset) {
+		ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+		ret = ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, KNET_ZSTD_STREAM_WINDOWLOG);
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "error setting stream parameters: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	ret = ZSTD_decompressStream(dctx, &out, &in);
+
+	if (ZSTD_isError(ret)) {
+		log_err_ratelimited(knet_h, KNET_SUB_ZSTDCOMP, "error decompressing stream packet: %s", ZSTD_getErrorName(ret));
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (in.pos != in.size) {
+		log_err_ratelimited(knet_h, KNET_SUB_ZSTDCOMP, "output buffer too small to decompress stream packet");
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	*buf_out_len = out.pos;
+
+	return 0;
+}
+
 compress_ops_t compress_model = {
 	KNET_COMPRESS_MODEL_ABI,
 	zstd_is_init,
@@ -168,5 +462,12 @@ compress_ops_t compress_model = {
 	NULL,
 	zstd_compress,
 	zstd_decompress,
-	zstd_get_default_level
+	zstd_get_default_level,
+	zstd_set_dict,
+	zstd_compress_dict,
+	zstd_decompress_dict,
+	zstd_ctx_alloc,
+	zstd_ctx_free,
+	zstd_compress_stream,
+	zstd_decompress_stream
 };
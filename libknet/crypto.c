@@ -19,6 +19,7 @@
 #include "internals.h"
 #include "logging.h"
 #include "common.h"
+#include "epoch.h"
 
 /*
  * internal module switch data
@@ -46,6 +47,93 @@ static int crypto_get_model(const char *model)
  * exported API
  */
 
+/*
+ * the crypto instance can be replaced at any time by
+ * knet_handle_crypto (see epoch.c), load it only once per packet
+ */
+
+static size_t crypto_preheader_len(
+	struct crypto_instance *crypto_instance)
+{
+	return __atomic_load_n(&crypto_instance->sec_preheader_size, __ATOMIC_RELAXED);
+}
+
+/*
+ * copy the first KNET_CRYPTO_PREHEADER_SIZE bytes of the knet header
+ * and mark it as pre-header
+ */
+static int crypto_set_preheader(
+	unsigned char *buf_out,
+	const struct iovec *iov_in,
+	int iovcnt_in)
+{
+	size_t copied = 0, len;
+	int i;
+
+	for (i = 0; (i < iovcnt_in) && (copied < KNET_CRYPTO_PREHEADER_SIZE); i++) {
+		len = iov_in[i].iov_len;
+		if (len > KNET_CRYPTO_PREHEADER_SIZE - copied) {
+			len = KNET_CRYPTO_PREHEADER_SIZE - copied;
+		}
+		memmove(buf_out + copied, iov_in[i].iov_base, len);
+		copied = copied + len;
+	}
+
+	if (copied < KNET_CRYPTO_PREHEADER_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	((struct knet_header *)buf_out)->kh_pad1 |= KNET_HEADER_FLAG_PREHEADER;
+
+	return 0;
+}
+
+/*
+ * RX does not depend on the local pre-header setting, nodes
+ * can enable it one at a time. Packets with a pre-header are
+ * recognized by the mark, knet headers have both pads cleared.
+ *
+ * The mark is not authenticated and packets without pre-header
+ * start with a random salt, that matches it once in 2^24 packets.
+ * A match is only a hint, see crypto_authenticate_and_decrypt_inplace.
+ */
+int crypto_has_preheader(
+	const unsigned char *buf,
+	const ssize_t buf_len)
+{
+	const struct knet_header *preheader = (const struct knet_header *)buf;
+
+	if (buf_len <= (ssize_t)KNET_CRYPTO_PREHEADER_SIZE) {
+		return 0;
+	}
+
+	return ((preheader->kh_version == KNET_HEADER_VERSION) &&
+		(preheader->kh_pad1 == KNET_HEADER_FLAG_PREHEADER) &&
+		(preheader->kh_pad2 == 0));
+}
+
+/*
+ * the pre-header is not authenticated by itself,
+ * it has to match the decrypted header
+ */
+static int crypto_check_preheader(
+	const unsigned char *buf_in,
+	const unsigned char *buf_out,
+	ssize_t buf_out_len)
+{
+	struct knet_header preheader;
+
+	if (buf_out_len < (ssize_t)KNET_CRYPTO_PREHEADER_SIZE) {
+		return -1;
+	}
+
+	memmove(&preheader, buf_out, KNET_CRYPTO_PREHEADER_SIZE);
+	preheader.kh_pad1 |= KNET_HEADER_FLAG_PREHEADER;
+
+	return memcmp(buf_in, &preheader, KNET_CRYPTO_PREHEADER_SIZE) ? -1 : 0;
+}
+
 int crypto_encrypt_and_sign (
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
@@ -53,7 +141,30 @@ int crypto_encrypt_and_sign (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->crypt(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
+	struct crypto_instance *crypto_instance = __atomic_load_n(&knet_h->crypto_instance, __ATOMIC_ACQUIRE);
+	struct iovec iov_in;
+	size_t preheader_len;
+
+	if (!crypto_instance) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	preheader_len = crypto_preheader_len(crypto_instance);
+	if (preheader_len) {
+		iov_in.iov_base = (void *)buf_in;
+		iov_in.iov_len = buf_in_len;
+		if (crypto_set_preheader(buf_out, &iov_in, 1) < 0) {
+			return -1;
+		}
+	}
+
+	if (crypto_modules_cmds[crypto_instance->model].ops->crypt(knet_h, crypto_instance, buf_in, buf_in_len, buf_out + preheader_len, buf_out_len) < 0) {
+		return -1;
+	}
+
+	*buf_out_len = *buf_out_len + preheader_len;
+	return 0;
 }
 
 int crypto_encrypt_and_signv (
@@ -63,7 +174,165 @@ int crypto_encrypt_and_signv (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->cryptv(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len);
+	struct crypto_instance *crypto_instance = __atomic_load_n(&knet_h->crypto_instance, __ATOMIC_ACQUIRE);
+	size_t preheader_len;
+
+	if (!crypto_instance) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	preheader_len = crypto_preheader_len(crypto_instance);
+	if ((preheader_len) && (crypto_set_preheader(buf_out, iov_in, iovcnt_in) < 0)) {
+		return -1;
+	}
+
+	if (crypto_modules_cmds[crypto_instance->model].ops->cryptv(knet_h, crypto_instance, iov_in, iovcnt_in, buf_out + preheader_len, buf_out_len) < 0) {
+		return -1;
+	}
+
+	*buf_out_len = *buf_out_len + preheader_len;
+	return 0;
+}
+
+int crypto_encrypt_and_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	struct crypto_instance *crypto_instance = __atomic_load_n(&knet_h->crypto_instance, __ATOMIC_ACQUIRE);
+	size_t preheader_len;
+	int i, err;
+
+	if (!crypto_instance) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < entries_cnt; i++) {
+		entries[i].mac_only = crypto_instance->mac_only;
+	}
+
+	if (crypto_instance->mac_only) {
+		return crypto_modules_cmds[crypto_instance->model].ops->signv_batch(knet_h, crypto_instance, entries, entries_cnt);
+	}
+
+	preheader_len = crypto_preheader_len(crypto_instance);
+	if (preheader_len) {
+		for (i = 0; i < entries_cnt; i++) {
+			if (crypto_set_preheader(entries[i].buf_out, entries[i].iov_in, entries[i].iovcnt_in) < 0) {
+				return -1;
+			}
+			entries[i].buf_out += preheader_len;
+		}
+	}
+
+	err = crypto_modules_cmds[crypto_instance->model].ops->cryptv_batch(knet_h, crypto_instance, entries, entries_cnt);
+
+	if (preheader_len) {
+		for (i = 0; i < entries_cnt; i++) {
+			entries[i].buf_out -= preheader_len;
+			entries[i].buf_out_len += preheader_len;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * packets can be encrypted with any of the configured instances
+ * (ex: while nodes are switching to a new key). Start with the one
+ * that decrypted the last packet, that is the right one most of
+ * the time.
+ *
+ * MAC only instances verify the packet in place and return buf_in
+ * as payload, others decrypt into buf_out.
+ *
+ * Failures are expected while looking for the right instance and
+ * only the last attempt is logged by the crypto module, unless
+ * quiet is set. A pre-header mismatch after a successful
+ * decryption is always logged.
+ */
+static int crypto_decrypt_instances(
+	knet_handle_t knet_h,
+	unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	size_t preheader_len,
+	int skip_mac_only,
+	uint8_t quiet,
+	unsigned char *buf_out,
+	unsigned char **payload,
+	ssize_t *payload_len)
+{
+	struct crypto_instance *crypto_instance[KNET_MAX_CRYPTO_INSTANCES];
+	uint8_t rx_hint = __atomic_load_n(&knet_h->crypto_rx_hint, __ATOMIC_RELAXED);
+	uint8_t config_num[KNET_MAX_CRYPTO_INSTANCES];
+	uint8_t quiet_attempt;
+	int i, instances = 0, err;
+
+	for (i = 0; i < KNET_MAX_CRYPTO_INSTANCES; i++) {
+		config_num[instances] = ((rx_hint + i) % KNET_MAX_CRYPTO_INSTANCES) + 1;
+		crypto_instance[instances] = __atomic_load_n(&knet_h->crypto_config[config_num[instances]], __ATOMIC_ACQUIRE);
+		if ((crypto_instance[instances]) &&
+		    ((!skip_mac_only) || (!crypto_instance[instances]->mac_only))) {
+			instances++;
+		}
+	}
+
+	for (i = 0; i < instances; i++) {
+		quiet_attempt = ((quiet) || (i < instances - 1));
+		if (crypto_instance[i]->mac_only) {
+			err = crypto_modules_cmds[crypto_instance[i]->model].ops->authenticate(knet_h, crypto_instance[i], buf_in, buf_in_len, payload_len, quiet_attempt);
+			*payload = buf_in;
+		} else {
+			err = crypto_modules_cmds[crypto_instance[i]->model].ops->decrypt(knet_h, crypto_instance[i], buf_in + preheader_len, buf_in_len - preheader_len, buf_out, payload_len, quiet_attempt);
+			*payload = buf_out;
+			if ((!err) && (preheader_len) &&
+			    (crypto_check_preheader(buf_in, buf_out, *payload_len) < 0)) {
+				log_debug(knet_h, KNET_SUB_CRYPTO, "Packet pre-header does not match packet header");
+				err = -1;
+			}
+		}
+		if (!err) {
+			if (config_num[i] != rx_hint + 1) {
+				__atomic_store_n(&knet_h->crypto_rx_hint, config_num[i] - 1, __ATOMIC_RELAXED);
+			}
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * a packet that looks like it has a pre-header can still be
+ * a packet without pre-header (see crypto_has_preheader), that
+ * is decrypted as a whole when the pre-header attempt fails.
+ * MAC only packets never have a pre-header, they are verified
+ * with the whole packet only.
+ */
+int crypto_authenticate_and_decrypt_inplace (
+	knet_handle_t knet_h,
+	unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	unsigned char **payload,
+	ssize_t *payload_len)
+{
+	if (crypto_has_preheader(buf_in, buf_in_len)) {
+		if (!crypto_decrypt_instances(knet_h, buf_in, buf_in_len, KNET_CRYPTO_PREHEADER_SIZE, 1, 1,
+					      buf_out, payload, payload_len)) {
+			return 0;
+		}
+	}
+
+	if (!crypto_decrypt_instances(knet_h, buf_in, buf_in_len, 0, 0, 0,
+				      buf_out, payload, payload_len)) {
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
 }
 
 int crypto_authenticate_and_decrypt (
@@ -73,18 +342,94 @@ int crypto_authenticate_and_decrypt (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->decrypt(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
+	unsigned char *payload;
+
+	if (crypto_authenticate_and_decrypt_inplace(knet_h, (unsigned char *)buf_in, buf_in_len, buf_out, &payload, buf_out_len) < 0) {
+		return -1;
+	}
+
+	if (payload != buf_out) {
+		memmove(buf_out, payload, *buf_out_len);
+	}
+
+	return 0;
+}
+
+/*
+ * data path readers can use the old instance until
+ * they leave their read section
+ */
+static void crypto_instance_release(
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance)
+{
+	int savederrno = 0;
+
+	epoch_synchronize(knet_h);
+
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to get write lock: %s",
+			strerror(savederrno));
+		return;
+	}
+
+	if (crypto_modules_cmds[crypto_instance->model].ops->fini != NULL) {
+		crypto_modules_cmds[crypto_instance->model].ops->fini(knet_h, crypto_instance);
+	}
+	free(crypto_instance);
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+}
+
+static void crypto_set_tx_instance(
+	knet_handle_t knet_h,
+	uint8_t config_num)
+{
+	struct crypto_instance *crypto_instance = NULL;
+
+	struct knet_crypto_overhead overhead;
+	size_t preheader_len = 0;
+
+	if (config_num) {
+		crypto_instance = knet_h->crypto_config[config_num];
+	}
+
+	/*
+	 * readers get all the overhead sizes from the instance
+	 * they loaded (see calc_crypto_overhead), set the pre-header
+	 * size before publishing it
+	 */
+	if (crypto_instance) {
+		if ((!crypto_instance->mac_only) && (knet_h->crypto_preheader)) {
+			preheader_len = KNET_CRYPTO_PREHEADER_SIZE;
+		}
+		__atomic_store_n(&crypto_instance->sec_preheader_size, preheader_len, __ATOMIC_RELAXED);
+		__atomic_store_n(&knet_h->crypto_rx_hint, config_num - 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&knet_h->crypto_instance, crypto_instance, __ATOMIC_RELEASE);
+	knet_h->crypto_in_use_config = config_num;
+
+	calc_crypto_overhead(knet_h, &overhead);
+
+	log_debug(knet_h, KNET_SUB_CRYPTO, "TX crypto config: %u hash size: %zu salt size: %zu block size: %zu",
+		  config_num,
+		  overhead.sec_hash_size,
+		  overhead.sec_salt_size,
+		  overhead.sec_block_size);
 }
 
 int crypto_init(
 	knet_handle_t knet_h,
-	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg)
+	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg,
+	uint8_t config_num)
 {
 	int err = 0, savederrno = 0;
 	int model = 0;
 	struct crypto_instance *current = NULL, *new = NULL;
 
-	current = knet_h->crypto_instance;
+	current = knet_h->crypto_config[config_num];
 
 	model = crypto_get_model(knet_handle_crypto_cfg->crypto_model);
 	if (model < 0) {
@@ -130,7 +475,7 @@ int crypto_init(
 		  knet_handle_crypto_cfg->crypto_cipher_type,
 		  knet_handle_crypto_cfg->crypto_hash_type);
 
-	new = malloc(sizeof(struct crypto_instance));
+	new = calloc(1, sizeof(struct crypto_instance));
 
 	if (!new) {
 		savederrno = ENOMEM;
@@ -153,21 +498,15 @@ int crypto_init(
 
 out:
 	if (!err) {
-		knet_h->crypto_instance = new;
-		knet_h->sec_block_size = new->sec_block_size;
-		knet_h->sec_hash_size = new->sec_hash_size;
-		knet_h->sec_salt_size = new->sec_salt_size;
-
-		log_debug(knet_h, KNET_SUB_CRYPTO, "Hash size: %zu salt size: %zu block size: %zu",
-			  knet_h->sec_hash_size,
-			  knet_h->sec_salt_size,
-			  knet_h->sec_block_size);
-
-		if (current) {
-			if (crypto_modules_cmds[current->model].ops->fini != NULL) {
-				crypto_modules_cmds[current->model].ops->fini(knet_h, current);
-			}
-			free(current);
+		__atomic_store_n(&knet_h->crypto_config[config_num], new, __ATOMIC_RELEASE);
+		/*
+		 * count the config only once it is visible to RX
+		 */
+		if (!current) {
+			__atomic_add_fetch(&knet_h->crypto_rx_configs, 1, __ATOMIC_RELEASE);
+		}
+		if (knet_h->crypto_in_use_config == config_num) {
+			crypto_set_tx_instance(knet_h, config_num);
 		}
 	} else {
 		if (new) {
@@ -175,35 +514,64 @@ out:
 		}
 	}
 
+	/*
+	 * the RX thread can load compress modules in its read section,
+	 * drop shlib_rwlock before waiting for readers
+	 */
 	pthread_rwlock_unlock(&shlib_rwlock);
+
+	if ((!err) && (current)) {
+		crypto_instance_release(knet_h, current);
+	}
+
 	errno = err ? savederrno : 0;
 	return err;
 }
 
+int crypto_use_config(
+	knet_handle_t knet_h,
+	uint8_t config_num)
+{
+	if ((config_num) && (!knet_h->crypto_config[config_num])) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	crypto_set_tx_instance(knet_h, config_num);
+
+	errno = 0;
+	return 0;
+}
+
+void crypto_use_preheader(
+	knet_handle_t knet_h,
+	uint8_t enabled)
+{
+	__atomic_store_n(&knet_h->crypto_preheader, enabled, __ATOMIC_RELAXED);
+	crypto_set_tx_instance(knet_h, knet_h->crypto_in_use_config);
+}
+
 void crypto_fini(
-	knet_handle_t knet_h)
+	knet_handle_t knet_h,
+	uint8_t config_num)
 {
-	int savederrno = 0;
+	struct crypto_instance *current = knet_h->crypto_config[config_num];
 
-	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
-	if (savederrno) {
-		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to get write lock: %s",
-			strerror(savederrno));
+	if (!current) {
 		return;
 	}
 
-	if (knet_h->crypto_instance) {
-		if (crypto_modules_cmds[knet_h->crypto_instance->model].ops->fini != NULL) {
-			crypto_modules_cmds[knet_h->crypto_instance->model].ops->fini(knet_h, knet_h->crypto_instance);
-		}
-		free(knet_h->crypto_instance);
-		knet_h->sec_block_size = 0;
-		knet_h->sec_hash_size = 0;
-		knet_h->sec_salt_size = 0;
-		knet_h->crypto_instance = NULL;
+	if (knet_h->crypto_in_use_config == config_num) {
+		crypto_set_tx_instance(knet_h, 0);
 	}
 
-	pthread_rwlock_unlock(&shlib_rwlock);
+	/*
+	 * stop counting the config before RX can see it gone
+	 */
+	__atomic_sub_fetch(&knet_h->crypto_rx_configs, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&knet_h->crypto_config[config_num], NULL, __ATOMIC_RELEASE);
+
+	crypto_instance_release(knet_h, current);
 	return;
 }
 
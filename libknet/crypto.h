@@ -10,6 +10,11 @@
 #define __KNET_CRYPTO_H__
 
 #include "internals.h"
+#include "crypto_model.h"
+
+int crypto_has_preheader(
+	const unsigned char *buf,
+	const ssize_t buf_len);
 
 int crypto_authenticate_and_decrypt (
 	knet_handle_t knet_h,
@@ -18,6 +23,14 @@ int crypto_authenticate_and_decrypt (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len);
 
+int crypto_authenticate_and_decrypt_inplace (
+	knet_handle_t knet_h,
+	unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	unsigned char **payload,
+	ssize_t *payload_len);
+
 int crypto_encrypt_and_sign (
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
@@ -32,11 +45,26 @@ int crypto_encrypt_and_signv (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len);
 
+int crypto_encrypt_and_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_batch_entry *entries,
+	int entries_cnt);
+
 int crypto_init(
 	knet_handle_t knet_h,
-	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg);
+	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg,
+	uint8_t config_num);
+
+int crypto_use_config(
+	knet_handle_t knet_h,
+	uint8_t config_num);
+
+void crypto_use_preheader(
+	knet_handle_t knet_h,
+	uint8_t enabled);
 
 void crypto_fini(
-	knet_handle_t knet_h);
+	knet_handle_t knet_h,
+	uint8_t config_num);
 
 #endif
@@ -17,12 +17,45 @@ struct crypto_instance {
 	size_t	sec_block_size;
 	size_t	sec_hash_size;
 	size_t	sec_salt_size;
+	uint8_t	mac_only;	/* set by the module when cipher is "none" */
+	size_t	sec_preheader_size; /* set by crypto.c when used for TX, see KNET_CRYPTO_PREHEADER_SIZE */
 };
 
-#define KNET_CRYPTO_MODEL_ABI 3
+/*
+ * one packet of a cryptv_batch/signv_batch call. buf_out_len
+ * is set by the module. mac_only is set by crypto.c when buf_out
+ * only contains the MAC, that must be sent after iov_in.
+ */
+struct crypto_batch_entry {
+	const struct iovec	*iov_in;
+	int			iovcnt_in;
+	unsigned char		*buf_out;
+	ssize_t			buf_out_len;
+	uint8_t			mac_only;
+};
+
+#define KNET_CRYPTO_MODEL_ABI 7
 
 /*
  * see compress_model.h for explanation of the various lib related functions
+ *
+ * crypt/cryptv/decrypt must only use the crypto_instance they are
+ * invoked with, knet_h->crypto_instance can be replaced concurrently.
+ *
+ * cryptv_batch encrypts entries_cnt packets (ex: all fragments of
+ * a message) in one call, so that modules can set up contexts and
+ * keys once per batch. It fails if any of the packets fails.
+ *
+ * signv_batch and authenticate are only used for mac_only
+ * instances: signv_batch writes only the MAC of iov_in to buf_out,
+ * authenticate verifies the MAC at the end of buf_in and returns
+ * the payload length, without copying the payload around.
+ * The on wire format is the same as crypt/decrypt.
+ *
+ * decrypt and authenticate are also used to find out which of
+ * the configured instances a packet belongs to. When quiet is set,
+ * there are more instances to try and packets that fail to
+ * authenticate or decrypt must not be logged.
  */
 typedef struct {
 	uint8_t abi_ver;
@@ -32,20 +65,38 @@ typedef struct {
 	void (*fini)	(knet_handle_t knet_h,
 			 struct crypto_instance *crypto_instance);
 	int (*crypt)	(knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
 			 ssize_t *buf_out_len);
 	int (*cryptv)	(knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
 			 const struct iovec *iov_in,
 			 int iovcnt_in,
 			 unsigned char *buf_out,
 			 ssize_t *buf_out_len);
 	int (*decrypt)	(knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
-			 ssize_t *buf_out_len);
+			 ssize_t *buf_out_len,
+			 uint8_t quiet);
+	int (*cryptv_batch) (knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
+			 struct crypto_batch_entry *entries,
+			 int entries_cnt);
+	int (*signv_batch) (knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
+			 struct crypto_batch_entry *entries,
+			 int entries_cnt);
+	int (*authenticate) (knet_handle_t knet_h,
+			 struct crypto_instance *crypto_instance,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 ssize_t *payload_len,
+			 uint8_t quiet);
 } crypto_ops_t;
 
 typedef struct {
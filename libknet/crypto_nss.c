@@ -11,6 +11,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <nss.h>
 #include <nspr.h>
 #include <pk11pub.h>
@@ -45,6 +46,40 @@ static void nss_atexit_handler(void)
 
 #define SALT_SIZE 16
 
+/*
+ * salts are taken from a per thread pool of random data, refilled
+ * from the library RNG once exhausted, so that the RNG (and its
+ * global locking) is hit once every SALT_POOL_SIZE / SALT_SIZE packets.
+ * The pool is discarded in the child after a fork, to never reuse
+ * salts across processes.
+ */
+#define SALT_POOL_SIZE 4096
+
+static __thread unsigned char salt_pool[SALT_POOL_SIZE];
+static __thread size_t salt_pool_pos = SALT_POOL_SIZE;
+
+static void nss_salt_pool_reset(void)
+{
+	salt_pool_pos = SALT_POOL_SIZE;
+}
+
+static int nss_get_salt(knet_handle_t knet_h, unsigned char *salt)
+{
+	if (salt_pool_pos + SALT_SIZE > SALT_POOL_SIZE) {
+		if (PK11_GenerateRandom(salt_pool, SALT_POOL_SIZE) != SECSuccess) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Failure to generate a random number (err %d): %s",
+				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			return -1;
+		}
+		salt_pool_pos = 0;
+	}
+
+	memcpy(salt, salt_pool + salt_pool_pos, SALT_SIZE);
+	salt_pool_pos += SALT_SIZE;
+
+	return 0;
+}
+
 /*
  * This are defined in new NSS. For older one, we will define our own
  */
@@ -67,11 +102,16 @@ enum nsscrypto_crypt_t {
 	CRYPTO_CIPHER_TYPE_AES128 = 3
 };
 
+/*
+ * on the wire format is CBC with PKCS#7 padding (CKM_AES_CBC_PAD),
+ * padding is added/removed by encrypt_nss/decrypt_nss so that
+ * contexts can be reused across packets (see nss_ctx_slot below)
+ */
 CK_MECHANISM_TYPE cipher_to_nss[] = {
 	0,				/* CRYPTO_CIPHER_TYPE_NONE */
-	CKM_AES_CBC_PAD,		/* CRYPTO_CIPHER_TYPE_AES256 */
-	CKM_AES_CBC_PAD,		/* CRYPTO_CIPHER_TYPE_AES192 */
-	CKM_AES_CBC_PAD			/* CRYPTO_CIPHER_TYPE_AES128 */
+	CKM_AES_CBC,			/* CRYPTO_CIPHER_TYPE_AES256 */
+	CKM_AES_CBC,			/* CRYPTO_CIPHER_TYPE_AES192 */
+	CKM_AES_CBC			/* CRYPTO_CIPHER_TYPE_AES128 */
 };
 
 size_t nsscipher_key_len[] = {
@@ -124,10 +164,39 @@ enum sym_key_type {
 	SYM_KEY_TYPE_HASH
 };
 
+/*
+ * Creating a PK11Context for every packet is expensive (allocations,
+ * slot locks, PKCS#11 init calls). Each instance keeps a small pool
+ * of contexts that threads take for the duration of a crypt/decrypt
+ * call, preferring the same slot every time. When all slots are busy
+ * a temporary set of contexts is created and destroyed as before.
+ *
+ * NSS has no public API to change the IV of a context, but a CBC
+ * context that is never finalized keeps chaining from the last
+ * ciphertext block it has seen. XORing the first plaintext block
+ * (or the first decrypted block) with that block and with the new
+ * IV gives the same result as a fresh context using the new IV.
+ */
+#define NSS_CTX_SLOTS 8
+
+struct nss_ctx_slot {
+	int busy;
+	PK11Context *crypt_context;
+	unsigned char crypt_chain[AES_BLOCK_SIZE];
+	PK11Context *decrypt_context;
+	unsigned char decrypt_chain[AES_BLOCK_SIZE];
+	PK11Context *hash_context;
+};
+
+static __thread unsigned int ctx_slot_hint;
+static unsigned int ctx_slot_seq;
+
 struct nsscrypto_instance {
 	PK11SymKey   *nss_sym_key;
 	PK11SymKey   *nss_sym_key_sign;
 
+	struct nss_ctx_slot ctx_slots[NSS_CTX_SLOTS];
+
 	unsigned char *private_key;
 
 	unsigned int private_key_len;
@@ -137,6 +206,54 @@ struct nsscrypto_instance {
 	int crypto_hash_type;
 };
 
+static void nss_ctx_slot_clear(struct nss_ctx_slot *slot)
+{
+	if (slot->crypt_context) {
+		PK11_DestroyContext(slot->crypt_context, PR_TRUE);
+		slot->crypt_context = NULL;
+	}
+	if (slot->decrypt_context) {
+		PK11_DestroyContext(slot->decrypt_context, PR_TRUE);
+		slot->decrypt_context = NULL;
+	}
+	if (slot->hash_context) {
+		PK11_DestroyContext(slot->hash_context, PR_TRUE);
+		slot->hash_context = NULL;
+	}
+}
+
+static struct nss_ctx_slot *nss_ctx_slot_get(struct nsscrypto_instance *instance, struct nss_ctx_slot *tmp_slot)
+{
+	int i, busy;
+	struct nss_ctx_slot *slot;
+
+	if (!ctx_slot_hint) {
+		ctx_slot_hint = __atomic_add_fetch(&ctx_slot_seq, 1, __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < NSS_CTX_SLOTS; i++) {
+		slot = &instance->ctx_slots[(ctx_slot_hint + i) % NSS_CTX_SLOTS];
+		busy = 0;
+		if (__atomic_compare_exchange_n(&slot->busy, &busy, 1, 0,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return slot;
+		}
+	}
+
+	memset(tmp_slot, 0, sizeof(struct nss_ctx_slot));
+	return tmp_slot;
+}
+
+static void nss_ctx_slot_put(struct nss_ctx_slot *slot, struct nss_ctx_slot *tmp_slot)
+{
+	if (slot == tmp_slot) {
+		nss_ctx_slot_clear(tmp_slot);
+		return;
+	}
+
+	__atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+}
+
 /*
  * crypt/decrypt functions
  */
@@ -342,153 +459,170 @@ static int init_nss_crypto(knet_handle_t knet_h, struct crypto_instance *crypto_
 	return 0;
 }
 
+static PK11Context *nss_create_cipher_context(
+	knet_handle_t knet_h,
+	struct nsscrypto_instance *instance,
+	CK_ATTRIBUTE_TYPE operation,
+	unsigned char *chain)
+{
+	PK11Context *context;
+	SECItem param;
+
+	memset(chain, 0, AES_BLOCK_SIZE);
+
+	param.type = siBuffer;
+	param.data = chain;
+	param.len = AES_BLOCK_SIZE;
+
+	context = PK11_CreateContextBySymKey(cipher_to_nss[instance->crypto_cipher_type],
+					     operation,
+					     instance->nss_sym_key,
+					     &param);
+	if (!context) {
+		log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed (%s) crypt_type=%d (err %d): %s",
+				    operation == CKA_ENCRYPT ? "encrypt" : "decrypt",
+				    (int)cipher_to_nss[instance->crypto_cipher_type],
+				    PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+	}
+
+	return context;
+}
+
 static int encrypt_nss(
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct nss_ctx_slot *slot,
 	const struct iovec *iov,
 	int iovcnt,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	PK11Context*	crypt_context = NULL;
-	SECItem		crypt_param;
-	SECItem		*nss_sec_param = NULL;
-	int		tmp_outlen = 0, tmp1_outlen = 0;
-	unsigned int	tmp2_outlen = 0;
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	int		tmp_outlen = 0;
+	size_t		datalen = 0, padlen;
 	unsigned char	*salt = buf_out;
 	unsigned char	*data = buf_out + SALT_SIZE;
-	int		err = -1;
 	int		i;
 
-	if (PK11_GenerateRandom(salt, SALT_SIZE) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Failure to generate a random number (err %d): %s",
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	if (nss_get_salt(knet_h, salt) < 0) {
+		return -1;
 	}
 
-	crypt_param.type = siBuffer;
-	crypt_param.data = salt;
-	crypt_param.len = SALT_SIZE;
-
-	nss_sec_param = PK11_ParamFromIV(cipher_to_nss[instance->crypto_cipher_type],
-					 &crypt_param);
-	if (nss_sec_param == NULL) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Failure to set up PKCS11 param (err %d): %s",
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	if (!slot->crypt_context) {
+		slot->crypt_context = nss_create_cipher_context(knet_h, instance, CKA_ENCRYPT, slot->crypt_chain);
+		if (!slot->crypt_context) {
+			return -1;
+		}
 	}
 
-	/*
-	 * Create cipher context for encryption
-	 */
-	crypt_context = PK11_CreateContextBySymKey(cipher_to_nss[instance->crypto_cipher_type],
-						   CKA_ENCRYPT,
-						   instance->nss_sym_key,
-						   nss_sec_param);
-	if (!crypt_context) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed (encrypt) crypt_type=%d (err %d): %s",
-			   (int)cipher_to_nss[instance->crypto_cipher_type],
-			   PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	for (i = 0; i < iovcnt; i++) {
+		if (datalen + iov[i].iov_len + AES_BLOCK_SIZE > KNET_DATABUFSIZE_CRYPT - SALT_SIZE) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too big to encrypt");
+			return -1;
+		}
+		memmove(data + datalen, iov[i].iov_base, iov[i].iov_len);
+		datalen = datalen + iov[i].iov_len;
 	}
 
-	for (i=0; i<iovcnt; i++) {
-		if (PK11_CipherOp(crypt_context, data,
-				  &tmp_outlen,
-				  KNET_DATABUFSIZE_CRYPT,
-				  (unsigned char *)iov[i].iov_base,
-				  iov[i].iov_len) != SECSuccess) {
-			log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CipherOp failed (encrypt) crypt_type=%d (err %d): %s",
-				(int)cipher_to_nss[instance->crypto_cipher_type],
-				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-			goto out;
-		}
-		tmp1_outlen = tmp1_outlen + tmp_outlen;
+	padlen = AES_BLOCK_SIZE - (datalen % AES_BLOCK_SIZE);
+	memset(data + datalen, padlen, padlen);
+	datalen = datalen + padlen;
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++) {
+		data[i] ^= salt[i] ^ slot->crypt_chain[i];
 	}
 
-	if (PK11_DigestFinal(crypt_context, data + tmp1_outlen,
-				     &tmp2_outlen, KNET_DATABUFSIZE_CRYPT - tmp1_outlen) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestFinal failed (encrypt) crypt_type=%d (err %d): %s",
+	if (PK11_CipherOp(slot->crypt_context, data,
+			  &tmp_outlen,
+			  KNET_DATABUFSIZE_CRYPT - SALT_SIZE,
+			  data, datalen) != SECSuccess) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CipherOp failed (encrypt) crypt_type=%d (err %d): %s",
 			(int)cipher_to_nss[instance->crypto_cipher_type],
 			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
-
+		/*
+		 * the chaining state is unknown, start over
+		 */
+		PK11_DestroyContext(slot->crypt_context, PR_TRUE);
+		slot->crypt_context = NULL;
+		return -1;
 	}
 
-	*buf_out_len = tmp1_outlen + tmp2_outlen + SALT_SIZE;
+	memmove(slot->crypt_chain, data + datalen - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
 
-	err = 0;
+	*buf_out_len = tmp_outlen + SALT_SIZE;
 
-out:
-	if (crypt_context) {
-		PK11_DestroyContext(crypt_context, PR_TRUE);
-	}
-	if (nss_sec_param) {
-		SECITEM_FreeItem(nss_sec_param, PR_TRUE);
-	}
-	return err;
+	return 0;
 }
 
 static int decrypt_nss (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct nss_ctx_slot *slot,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t quiet)
 {
-	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	PK11Context*	decrypt_context = NULL;
-	SECItem		decrypt_param;
-	int		tmp1_outlen = 0;
-	unsigned int	tmp2_outlen = 0;
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	int		tmp_outlen = 0;
 	unsigned char	*salt = (unsigned char *)buf_in;
 	unsigned char	*data = salt + SALT_SIZE;
 	int		datalen = buf_in_len - SALT_SIZE;
-	int		err = -1;
+	unsigned char	last_block[AES_BLOCK_SIZE];
+	unsigned char	padlen;
+	int		i;
 
-	if (datalen <= 0) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too short");
-		goto out;
+	if ((datalen <= 0) || (datalen % AES_BLOCK_SIZE)) {
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too short");
+		}
+		return -1;
 	}
 
-	/* Create cipher context for decryption */
-	decrypt_param.type = siBuffer;
-	decrypt_param.data = salt;
-	decrypt_param.len = SALT_SIZE;
-
-	decrypt_context = PK11_CreateContextBySymKey(cipher_to_nss[instance->crypto_cipher_type],
-						     CKA_DECRYPT,
-						     instance->nss_sym_key, &decrypt_param);
-	if (!decrypt_context) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext (decrypt) failed (err %d): %s",
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	if (!slot->decrypt_context) {
+		slot->decrypt_context = nss_create_cipher_context(knet_h, instance, CKA_DECRYPT, slot->decrypt_chain);
+		if (!slot->decrypt_context) {
+			return -1;
+		}
 	}
 
-	if (PK11_CipherOp(decrypt_context, buf_out, &tmp1_outlen,
+	memmove(last_block, data + datalen - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+	if (PK11_CipherOp(slot->decrypt_context, buf_out, &tmp_outlen,
 			  KNET_DATABUFSIZE_CRYPT, data, datalen) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CipherOp (decrypt) failed (err %d): %s",
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+		log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CipherOp (decrypt) failed (err %d): %s",
+				    PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+		PK11_DestroyContext(slot->decrypt_context, PR_TRUE);
+		slot->decrypt_context = NULL;
+		return -1;
 	}
 
-	if (PK11_DigestFinal(decrypt_context, buf_out + tmp1_outlen, &tmp2_outlen,
-			     KNET_DATABUFSIZE_CRYPT - tmp1_outlen) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestFinal (decrypt) failed (err %d): %s",
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	for (i = 0; i < AES_BLOCK_SIZE; i++) {
+		buf_out[i] ^= salt[i] ^ slot->decrypt_chain[i];
 	}
 
-	*buf_out_len = tmp1_outlen + tmp2_outlen;
+	memmove(slot->decrypt_chain, last_block, AES_BLOCK_SIZE);
 
-	err = 0;
-
-out:
-	if (decrypt_context) {
-		PK11_DestroyContext(decrypt_context, PR_TRUE);
+	padlen = buf_out[tmp_outlen - 1];
+	if ((padlen == 0) || (padlen > AES_BLOCK_SIZE) || (padlen > tmp_outlen)) {
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "Invalid padding (decrypt)");
+		}
+		return -1;
+	}
+	for (i = tmp_outlen - padlen; i < tmp_outlen; i++) {
+		if (buf_out[i] != padlen) {
+			if (!quiet) {
+				log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "Invalid padding (decrypt)");
+			}
+			return -1;
+		}
 	}
 
-	return err;
+	*buf_out_len = tmp_outlen - padlen;
+
+	return 0;
 }
 
 /*
@@ -531,65 +665,85 @@ static int init_nss_hash(knet_handle_t knet_h, struct crypto_instance *crypto_in
 	return 0;
 }
 
-static int calculate_nss_hash(
+static int calculate_nss_hashv(
 	knet_handle_t knet_h,
-	const unsigned char *buf,
-	const size_t buf_len,
+	struct crypto_instance *crypto_instance,
+	struct nss_ctx_slot *slot,
+	const struct iovec *iov,
+	int iovcnt,
 	unsigned char *hash)
 {
-	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	PK11Context*	hash_context = NULL;
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
 	SECItem		hash_param;
 	unsigned int	hash_tmp_outlen = 0;
-	int		err = -1;
-
-	/* Now do the digest */
-	hash_param.type = siBuffer;
-	hash_param.data = 0;
-	hash_param.len = 0;
-
-	hash_context = PK11_CreateContextBySymKey(hash_to_nss[instance->crypto_hash_type],
-						  CKA_SIGN,
-						  instance->nss_sym_key_sign,
-						  &hash_param);
+	int		i;
 
-	if (!hash_context) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed (hash) hash_type=%d (err %d): %s",
-			(int)hash_to_nss[instance->crypto_hash_type],
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	if (!slot->hash_context) {
+		hash_param.type = siBuffer;
+		hash_param.data = 0;
+		hash_param.len = 0;
+
+		slot->hash_context = PK11_CreateContextBySymKey(hash_to_nss[instance->crypto_hash_type],
+								CKA_SIGN,
+								instance->nss_sym_key_sign,
+								&hash_param);
+		if (!slot->hash_context) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed (hash) hash_type=%d (err %d): %s",
+				(int)hash_to_nss[instance->crypto_hash_type],
+				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			return -1;
+		}
 	}
 
-	if (PK11_DigestBegin(hash_context) != SECSuccess) {
+	/*
+	 * PK11_DigestBegin resets the context for the next packet
+	 */
+	if (PK11_DigestBegin(slot->hash_context) != SECSuccess) {
 		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestBegin failed (hash) hash_type=%d (err %d): %s",
 			(int)hash_to_nss[instance->crypto_hash_type],
 			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+		goto out_err;
 	}
 
-	if (PK11_DigestOp(hash_context, buf, buf_len) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestOp failed (hash) hash_type=%d (err %d): %s",
-			(int)hash_to_nss[instance->crypto_hash_type],
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	for (i = 0; i < iovcnt; i++) {
+		if (PK11_DigestOp(slot->hash_context, iov[i].iov_base, iov[i].iov_len) != SECSuccess) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestOp failed (hash) hash_type=%d (err %d): %s",
+				(int)hash_to_nss[instance->crypto_hash_type],
+				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			goto out_err;
+		}
 	}
 
-	if (PK11_DigestFinal(hash_context, hash,
+	if (PK11_DigestFinal(slot->hash_context, hash,
 			     &hash_tmp_outlen, nsshash_len[instance->crypto_hash_type]) != SECSuccess) {
 		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestFinale failed (hash) hash_type=%d (err %d): %s",
 			(int)hash_to_nss[instance->crypto_hash_type],
 			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+		goto out_err;
 	}
 
-	err = 0;
+	return 0;
 
-out:
-	if (hash_context) {
-		PK11_DestroyContext(hash_context, PR_TRUE);
-	}
+out_err:
+	PK11_DestroyContext(slot->hash_context, PR_TRUE);
+	slot->hash_context = NULL;
+	return -1;
+}
 
-	return err;
+static int calculate_nss_hash(
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct nss_ctx_slot *slot,
+	const unsigned char *buf,
+	const size_t buf_len,
+	unsigned char *hash)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = buf_len;
+
+	return calculate_nss_hashv(knet_h, crypto_instance, slot, &iov, 1, hash);
 }
 
 /*
@@ -599,7 +753,13 @@ out:
 static int init_nss(knet_handle_t knet_h, struct crypto_instance *crypto_instance)
 {
 	static int at_exit_registered = 0;
+	static int at_fork_registered = 0;
 
+	/*
+	 * track both registrations separately, so that a failure
+	 * in the second one does not register the first one twice
+	 * on the next attempt
+	 */
 	if (!at_exit_registered) {
 		if (atexit(nss_atexit_handler)) {
 			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Unable to register NSS atexit handler");
@@ -609,6 +769,15 @@ static int init_nss(knet_handle_t knet_h, struct crypto_instance *crypto_instanc
 		at_exit_registered = 1;
 	}
 
+	if (!at_fork_registered) {
+		if (pthread_atfork(NULL, NULL, nss_salt_pool_reset)) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Unable to register salt pool fork handler");
+			errno = EAGAIN;
+			return -1;
+		}
+		at_fork_registered = 1;
+	}
+
 	if (!nss_db_is_init) {
 		if (NSS_NoDB_Init(NULL) != SECSuccess) {
 			log_err(knet_h, KNET_SUB_NSSCRYPTO, "NSS DB initialization failed (err %d): %s",
@@ -634,18 +803,20 @@ static int init_nss(knet_handle_t knet_h, struct crypto_instance *crypto_instanc
  * exported API
  */
 
-static int nsscrypto_encrypt_and_signv (
+static int nss_encrypt_and_signv_slot (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct nss_ctx_slot *slot,
 	const struct iovec *iov_in,
 	int iovcnt_in,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
 	int i;
 
 	if (cipher_to_nss[instance->crypto_cipher_type]) {
-		if (encrypt_nss(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
+		if (encrypt_nss(knet_h, crypto_instance, slot, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
 	} else {
@@ -657,7 +828,7 @@ static int nsscrypto_encrypt_and_signv (
 	}
 
 	if (hash_to_nss[instance->crypto_hash_type]) {
-		if (calculate_nss_hash(knet_h, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
+		if (calculate_nss_hash(knet_h, crypto_instance, slot, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
 			return -1;
 		}
 		*buf_out_len = *buf_out_len + nsshash_len[instance->crypto_hash_type];
@@ -666,8 +837,58 @@ static int nsscrypto_encrypt_and_signv (
 	return 0;
 }
 
+static int nsscrypto_encrypt_and_signv (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	const struct iovec *iov_in,
+	int iovcnt_in,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	struct nss_ctx_slot tmp_slot, *slot;
+	int err;
+
+	slot = nss_ctx_slot_get(instance, &tmp_slot);
+	err = nss_encrypt_and_signv_slot(knet_h, crypto_instance, slot, iov_in, iovcnt_in, buf_out, buf_out_len);
+	nss_ctx_slot_put(slot, &tmp_slot);
+
+	return err;
+}
+
+/*
+ * the whole batch runs on one context slot, contexts are
+ * created (at most) once and the slot is taken only once
+ */
+static int nsscrypto_encrypt_and_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	struct nss_ctx_slot tmp_slot, *slot;
+	int i, err = 0;
+
+	slot = nss_ctx_slot_get(instance, &tmp_slot);
+
+	for (i = 0; i < entries_cnt; i++) {
+		if (nss_encrypt_and_signv_slot(knet_h, crypto_instance, slot,
+					       entries[i].iov_in, entries[i].iovcnt_in,
+					       entries[i].buf_out, &entries[i].buf_out_len) < 0) {
+			err = -1;
+			break;
+		}
+	}
+
+	nss_ctx_slot_put(slot, &tmp_slot);
+
+	return err;
+}
+
 static int nsscrypto_encrypt_and_sign (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -679,35 +900,45 @@ static int nsscrypto_encrypt_and_sign (
 	iov_in.iov_base = (unsigned char *)buf_in;
 	iov_in.iov_len = buf_in_len;
 
-	return nsscrypto_encrypt_and_signv(knet_h, &iov_in, 1, buf_out, buf_out_len);
+	return nsscrypto_encrypt_and_signv(knet_h, crypto_instance, &iov_in, 1, buf_out, buf_out_len);
 }
 
 static int nsscrypto_authenticate_and_decrypt (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t quiet)
 {
-	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	struct nss_ctx_slot tmp_slot, *slot;
 	ssize_t temp_len = buf_in_len;
+	int err = -1;
+
+	slot = nss_ctx_slot_get(instance, &tmp_slot);
 
 	if (hash_to_nss[instance->crypto_hash_type]) {
 		unsigned char tmp_hash[nsshash_len[instance->crypto_hash_type]];
 		ssize_t temp_buf_len = buf_in_len - nsshash_len[instance->crypto_hash_type];
 
 		if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
-			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
-			return -1;
+			if (!quiet) {
+				log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
+			}
+			goto out;
 		}
 
-		if (calculate_nss_hash(knet_h, buf_in, temp_buf_len, tmp_hash) < 0) {
-			return -1;
+		if (calculate_nss_hash(knet_h, crypto_instance, slot, buf_in, temp_buf_len, tmp_hash) < 0) {
+			goto out;
 		}
 
 		if (memcmp(tmp_hash, buf_in + temp_buf_len, nsshash_len[instance->crypto_hash_type]) != 0) {
-			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Digest does not match");
-			return -1;
+			if (!quiet) {
+				log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "Digest does not match");
+			}
+			goto out;
 		}
 
 		temp_len = temp_len - nsshash_len[instance->crypto_hash_type];
@@ -715,15 +946,92 @@ static int nsscrypto_authenticate_and_decrypt (
 	}
 
 	if (cipher_to_nss[instance->crypto_cipher_type]) {
-		if (decrypt_nss(knet_h, buf_in, temp_len, buf_out, buf_out_len) < 0) {
-			return -1;
+		if (decrypt_nss(knet_h, crypto_instance, slot, buf_in, temp_len, buf_out, buf_out_len, quiet) < 0) {
+			goto out;
 		}
 	} else {
 		memmove(buf_out, buf_in, temp_len);
 		*buf_out_len = temp_len;
 	}
 
-	return 0;
+	err = 0;
+
+out:
+	nss_ctx_slot_put(slot, &tmp_slot);
+	return err;
+}
+
+/*
+ * MAC only (cipher "none"): the MAC is calculated over the
+ * iovecs and verified in place, payload is never copied
+ */
+static int nsscrypto_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	struct nss_ctx_slot tmp_slot, *slot;
+	int i, err = 0;
+
+	slot = nss_ctx_slot_get(instance, &tmp_slot);
+
+	for (i = 0; i < entries_cnt; i++) {
+		if (calculate_nss_hashv(knet_h, crypto_instance, slot,
+					entries[i].iov_in, entries[i].iovcnt_in,
+					entries[i].buf_out) < 0) {
+			err = -1;
+			break;
+		}
+		entries[i].buf_out_len = nsshash_len[instance->crypto_hash_type];
+	}
+
+	nss_ctx_slot_put(slot, &tmp_slot);
+
+	return err;
+}
+
+static int nsscrypto_authenticate (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *payload_len,
+	uint8_t quiet)
+{
+	struct nsscrypto_instance *instance = crypto_instance->model_instance;
+	struct nss_ctx_slot tmp_slot, *slot;
+	unsigned char tmp_hash[nsshash_len[instance->crypto_hash_type]];
+	ssize_t temp_buf_len = buf_in_len - nsshash_len[instance->crypto_hash_type];
+	int err = -1;
+
+	if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
+		if (!quiet) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
+		}
+		return -1;
+	}
+
+	slot = nss_ctx_slot_get(instance, &tmp_slot);
+
+	if (calculate_nss_hash(knet_h, crypto_instance, slot, buf_in, temp_buf_len, tmp_hash) < 0) {
+		goto out;
+	}
+
+	if (memcmp(tmp_hash, buf_in + temp_buf_len, nsshash_len[instance->crypto_hash_type]) != 0) {
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_NSSCRYPTO, "Digest does not match");
+		}
+		goto out;
+	}
+
+	*payload_len = temp_buf_len;
+	err = 0;
+
+out:
+	nss_ctx_slot_put(slot, &tmp_slot);
+	return err;
 }
 
 static void nsscrypto_fini(
@@ -731,8 +1039,12 @@ static void nsscrypto_fini(
 	struct crypto_instance *crypto_instance)
 {
 	struct nsscrypto_instance *nsscrypto_instance = crypto_instance->model_instance;
+	int i;
 
 	if (nsscrypto_instance) {
+		for (i = 0; i < NSS_CTX_SLOTS; i++) {
+			nss_ctx_slot_clear(&nsscrypto_instance->ctx_slots[i]);
+		}
 		if (nsscrypto_instance->nss_sym_key) {
 			PK11_FreeSymKey(nsscrypto_instance->nss_sym_key);
 			nsscrypto_instance->nss_sym_key = NULL;
@@ -803,6 +1115,9 @@ static int nsscrypto_init(
 
 	if (nsscrypto_instance->crypto_hash_type > 0) {
 		crypto_instance->sec_hash_size = nsshash_len[nsscrypto_instance->crypto_hash_type];
+		if (nsscrypto_instance->crypto_cipher_type == 0) {
+			crypto_instance->mac_only = 1;
+		}
 	}
 
 	if (nsscrypto_instance->crypto_cipher_type > 0) {
@@ -836,5 +1151,8 @@ crypto_ops_t crypto_model = {
 	nsscrypto_fini,
 	nsscrypto_encrypt_and_sign,
 	nsscrypto_encrypt_and_signv,
-	nsscrypto_authenticate_and_decrypt
+	nsscrypto_authenticate_and_decrypt,
+	nsscrypto_encrypt_and_signv_batch,
+	nsscrypto_signv_batch,
+	nsscrypto_authenticate
 };
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
@@ -46,6 +47,24 @@
 
 #define SALT_SIZE 16
 
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+/*
+ * HMAC contexts are allocated once and reused across packets.
+ * Each thread starts looking for a free one from its own hint,
+ * so that RX, TX and API threads don't fight for the same context.
+ * If all of them are busy, a temporary one is used.
+ */
+#define OPENSSL_HMAC_SLOTS 8
+
+struct openssl_hmac_slot {
+	int busy;
+	HMAC_CTX *ctx;
+};
+
+static __thread unsigned int hmac_slot_hint;
+static unsigned int hmac_slot_seq;
+#endif
+
 struct opensslcrypto_instance {
 	void *private_key;
 
@@ -54,10 +73,51 @@ struct opensslcrypto_instance {
 	const EVP_CIPHER *crypto_cipher_type;
 
 	const EVP_MD *crypto_hash_type;
+
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+	HMAC_CTX *hmac_template;	/* keyed once, copied for every packet */
+	struct openssl_hmac_slot hmac_slots[OPENSSL_HMAC_SLOTS];
+#endif
 };
 
 static int openssl_is_init = 0;
 
+/*
+ * salts are taken from a per thread pool of random data, refilled
+ * from the library RNG once exhausted, so that the RNG (and its
+ * global locking) is hit once every SALT_POOL_SIZE / SALT_SIZE packets.
+ * The pool is discarded in the child after a fork, to never reuse
+ * salts across processes.
+ */
+#define SALT_POOL_SIZE 4096
+
+static __thread unsigned char salt_pool[SALT_POOL_SIZE];
+static __thread size_t salt_pool_pos = SALT_POOL_SIZE;
+
+static void openssl_salt_pool_reset(void)
+{
+	salt_pool_pos = SALT_POOL_SIZE;
+}
+
+static int openssl_get_salt(knet_handle_t knet_h, unsigned char *salt)
+{
+	if (salt_pool_pos + SALT_SIZE > SALT_POOL_SIZE) {
+		if (!RAND_bytes(salt_pool, SALT_POOL_SIZE)) {
+			char sslerr[SSLERR_BUF_SIZE];
+
+			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random salt data: %s", sslerr);
+			return -1;
+		}
+		salt_pool_pos = 0;
+	}
+
+	memcpy(salt, salt_pool + salt_pool_pos, SALT_SIZE);
+	salt_pool_pos += SALT_SIZE;
+
+	return 0;
+}
+
 /*
  * crypt/decrypt functions openssl1.0
  */
@@ -65,12 +125,13 @@ static int openssl_is_init = 0;
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L)
 static int encrypt_openssl(
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const struct iovec *iov,
 	int iovcnt,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	EVP_CIPHER_CTX	ctx;
 	int		tmplen = 0, offset = 0;
 	unsigned char	*salt = buf_out;
@@ -81,9 +142,7 @@ static int encrypt_openssl(
 
 	EVP_CIPHER_CTX_init(&ctx);
 
-	if (!RAND_bytes(salt, SALT_SIZE)) {
-		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random salt data: %s", sslerr);
+	if (openssl_get_salt(knet_h, salt) < 0) {
 		err = -1;
 		goto out;
 	}
@@ -121,12 +180,14 @@ out:
 
 static int decrypt_openssl (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t quiet)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	EVP_CIPHER_CTX	ctx;
 	int		tmplen1 = 0, tmplen2 = 0;
 	unsigned char	*salt = (unsigned char *)buf_in;
@@ -144,14 +205,16 @@ static int decrypt_openssl (
 
 	if (!EVP_DecryptUpdate(&ctx, buf_out, &tmplen1, data, datalen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
+		log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
 		err = -1;
 		goto out;
 	}
 
 	if (!EVP_DecryptFinal_ex(&ctx, buf_out + tmplen1, &tmplen2)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
+		}
 		err = -1;
 		goto out;
 	}
@@ -163,44 +226,41 @@ out:
 	return err;
 }
 #else /* (OPENSSL_VERSION_NUMBER < 0x10100000L) */
-static int encrypt_openssl(
+/*
+ * ctx must be already initialized with cipher and key,
+ * only the IV (salt) is set per packet
+ */
+static int encrypt_openssl_ctx(
 	knet_handle_t knet_h,
+	EVP_CIPHER_CTX *ctx,
 	const struct iovec *iov,
 	int iovcnt,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	EVP_CIPHER_CTX	*ctx;
 	int		tmplen = 0, offset = 0;
 	unsigned char	*salt = buf_out;
 	unsigned char	*data = buf_out + SALT_SIZE;
-	int		err = 0;
 	int		i;
 	char		sslerr[SSLERR_BUF_SIZE];
 
-	ctx = EVP_CIPHER_CTX_new();
+	if (openssl_get_salt(knet_h, salt) < 0) {
+		return -1;
+	}
 
-	if (!RAND_bytes(salt, SALT_SIZE)) {
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, salt)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random salt data: %s", sslerr);
-		err = -1;
-		goto out;
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set salt: %s", sslerr);
+		return -1;
 	}
 
-	/*
-	 * add warning re keylength
-	 */
-	EVP_EncryptInit_ex(ctx, instance->crypto_cipher_type, NULL, instance->private_key, salt);
-
 	for (i=0; i<iovcnt; i++) {
 		if (!EVP_EncryptUpdate(ctx,
 				       data + offset, &tmplen,
 				       (unsigned char *)iov[i].iov_base, iov[i].iov_len)) {
 			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to encrypt: %s", sslerr);
-			err = -1;
-			goto out;
+			return -1;
 		}
 		offset = offset + tmplen;
 	}
@@ -208,25 +268,73 @@ static int encrypt_openssl(
 	if (!EVP_EncryptFinal_ex(ctx, data + offset, &tmplen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize encrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
 	*buf_out_len = offset + tmplen + SALT_SIZE;
 
-out:
+	return 0;
+}
+
+static EVP_CIPHER_CTX *encrypt_openssl_ctx_new(
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance)
+{
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
+	EVP_CIPHER_CTX	*ctx;
+	char		sslerr[SSLERR_BUF_SIZE];
+
+	ctx = EVP_CIPHER_CTX_new();
+	if (!ctx) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to allocate cipher context");
+		return NULL;
+	}
+
+	/*
+	 * add warning re keylength
+	 */
+	if (!EVP_EncryptInit_ex(ctx, instance->crypto_cipher_type, NULL, instance->private_key, NULL)) {
+		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to init encrypt: %s", sslerr);
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static int encrypt_openssl(
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	const struct iovec *iov,
+	int iovcnt,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	EVP_CIPHER_CTX	*ctx;
+	int		err;
+
+	ctx = encrypt_openssl_ctx_new(knet_h, crypto_instance);
+	if (!ctx) {
+		return -1;
+	}
+
+	err = encrypt_openssl_ctx(knet_h, ctx, iov, iovcnt, buf_out, buf_out_len);
+
 	EVP_CIPHER_CTX_free(ctx);
 	return err;
 }
 
 static int decrypt_openssl (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t quiet)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	EVP_CIPHER_CTX	*ctx = NULL;
 	int		tmplen1 = 0, tmplen2 = 0;
 	unsigned char	*salt = (unsigned char *)buf_in;
@@ -236,7 +344,9 @@ static int decrypt_openssl (
 	char		sslerr[SSLERR_BUF_SIZE];
 
 	if (datalen <= 0) {
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Packet is too short");
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Packet is too short");
+		}
 		err = -1;
 		goto out;
 	}
@@ -250,14 +360,16 @@ static int decrypt_openssl (
 
 	if (!EVP_DecryptUpdate(ctx, buf_out, &tmplen1, data, datalen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
+		log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
 		err = -1;
 		goto out;
 	}
 
 	if (!EVP_DecryptFinal_ex(ctx, buf_out + tmplen1, &tmplen2)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
+		}
 		err = -1;
 		goto out;
 	}
@@ -276,29 +388,122 @@ out:
  * hash/hmac/digest functions
  */
 
-static int calculate_openssl_hash(
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+static struct openssl_hmac_slot *openssl_hmac_slot_get(struct opensslcrypto_instance *instance, struct openssl_hmac_slot *tmp_slot)
+{
+	int i, busy;
+	struct openssl_hmac_slot *slot;
+
+	if (!hmac_slot_hint) {
+		hmac_slot_hint = __atomic_add_fetch(&hmac_slot_seq, 1, __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < OPENSSL_HMAC_SLOTS; i++) {
+		slot = &instance->hmac_slots[(hmac_slot_hint + i) % OPENSSL_HMAC_SLOTS];
+		busy = 0;
+		if (__atomic_compare_exchange_n(&slot->busy, &busy, 1, 0,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	if (i == OPENSSL_HMAC_SLOTS) {
+		memset(tmp_slot, 0, sizeof(struct openssl_hmac_slot));
+		slot = tmp_slot;
+	}
+
+	if (!slot->ctx) {
+		slot->ctx = HMAC_CTX_new();
+	}
+
+	return slot;
+}
+
+static void openssl_hmac_slot_put(struct openssl_hmac_slot *slot, struct openssl_hmac_slot *tmp_slot)
+{
+	if (slot == tmp_slot) {
+		if (tmp_slot->ctx) {
+			HMAC_CTX_free(tmp_slot->ctx);
+		}
+		return;
+	}
+
+	__atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+static int calculate_openssl_hashv(
 	knet_handle_t knet_h,
-	const unsigned char *buf,
-	const size_t buf_len,
+	struct crypto_instance *crypto_instance,
+	const struct iovec *iov,
+	int iovcnt,
 	unsigned char *hash)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	unsigned int hash_len = 0;
-	unsigned char *hash_out = NULL;
+	int i, err = -1;
 	char sslerr[SSLERR_BUF_SIZE];
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+	HMAC_CTX ctx_buf, *ctx = &ctx_buf;
 
-	hash_out = HMAC(instance->crypto_hash_type,
-			instance->private_key, instance->private_key_len,
-			buf, buf_len,
-			hash, &hash_len);
+	HMAC_CTX_init(ctx);
 
-	if ((!hash_out) || (hash_len != knet_h->sec_hash_size)) {
+	if (!HMAC_Init_ex(ctx, instance->private_key, instance->private_key_len, instance->crypto_hash_type, NULL)) {
+		goto out;
+	}
+#else
+	struct openssl_hmac_slot tmp_slot, *slot;
+	HMAC_CTX *ctx;
+
+	/*
+	 * copying the keyed template saves hashing the key for every packet
+	 */
+	slot = openssl_hmac_slot_get(instance, &tmp_slot);
+	ctx = slot->ctx;
+	if ((!ctx) || (!HMAC_CTX_copy(ctx, instance->hmac_template))) {
+		goto out;
+	}
+#endif
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!HMAC_Update(ctx, iov[i].iov_base, iov[i].iov_len)) {
+			goto out;
+		}
+	}
+
+	if ((!HMAC_Final(ctx, hash, &hash_len)) ||
+	    (hash_len != crypto_instance->sec_hash_size)) {
+		goto out;
+	}
+
+	err = 0;
+
+out:
+	if (err) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to calculate hash: %s", sslerr);
-		return -1;
 	}
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+	HMAC_CTX_cleanup(ctx);
+#else
+	openssl_hmac_slot_put(slot, &tmp_slot);
+#endif
+	return err;
+}
 
-	return 0;
+static int calculate_openssl_hash(
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	const unsigned char *buf,
+	const size_t buf_len,
+	unsigned char *hash)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = buf_len;
+
+	return calculate_openssl_hashv(knet_h, crypto_instance, &iov, 1, hash);
 }
 
 /*
@@ -307,16 +512,17 @@ static int calculate_openssl_hash(
 
 static int opensslcrypto_encrypt_and_signv (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const struct iovec *iov_in,
 	int iovcnt_in,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	int i;
 
 	if (instance->crypto_cipher_type) {
-		if (encrypt_openssl(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
+		if (encrypt_openssl(knet_h, crypto_instance, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
 	} else {
@@ -328,17 +534,117 @@ static int opensslcrypto_encrypt_and_signv (
 	}
 
 	if (instance->crypto_hash_type) {
-		if (calculate_openssl_hash(knet_h, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
+		if (calculate_openssl_hash(knet_h, crypto_instance, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
+			return -1;
+		}
+		*buf_out_len = *buf_out_len + crypto_instance->sec_hash_size;
+	}
+
+	return 0;
+}
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+static int opensslcrypto_encrypt_and_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	int i;
+
+	for (i = 0; i < entries_cnt; i++) {
+		if (opensslcrypto_encrypt_and_signv(knet_h, crypto_instance,
+						    entries[i].iov_in, entries[i].iovcnt_in,
+						    entries[i].buf_out, &entries[i].buf_out_len) < 0) {
 			return -1;
 		}
-		*buf_out_len = *buf_out_len + knet_h->sec_hash_size;
 	}
 
 	return 0;
 }
+#else /* (OPENSSL_VERSION_NUMBER < 0x10100000L) */
+/*
+ * cipher key schedule and HMAC key setup are done once per batch,
+ * every packet only re-initializes the contexts with its salt
+ */
+static int opensslcrypto_encrypt_and_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
+	EVP_CIPHER_CTX	*ctx = NULL;
+	HMAC_CTX	*hmac_ctx = NULL;
+	unsigned char	*buf_out;
+	ssize_t		*buf_out_len;
+	unsigned int	hash_len;
+	int		i, j, err = -1;
+	char		sslerr[SSLERR_BUF_SIZE];
+
+	if (instance->crypto_cipher_type) {
+		ctx = encrypt_openssl_ctx_new(knet_h, crypto_instance);
+		if (!ctx) {
+			goto out;
+		}
+	}
+
+	if (instance->crypto_hash_type) {
+		hmac_ctx = HMAC_CTX_new();
+		if ((!hmac_ctx) ||
+		    (!HMAC_Init_ex(hmac_ctx, instance->private_key, instance->private_key_len, instance->crypto_hash_type, NULL))) {
+			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to init hash: %s", sslerr);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < entries_cnt; i++) {
+		buf_out = entries[i].buf_out;
+		buf_out_len = &entries[i].buf_out_len;
+
+		if (ctx) {
+			if (encrypt_openssl_ctx(knet_h, ctx, entries[i].iov_in, entries[i].iovcnt_in, buf_out, buf_out_len) < 0) {
+				goto out;
+			}
+		} else {
+			*buf_out_len = 0;
+			for (j=0; j<entries[i].iovcnt_in; j++) {
+				memmove(buf_out + *buf_out_len, entries[i].iov_in[j].iov_base, entries[i].iov_in[j].iov_len);
+				*buf_out_len = *buf_out_len + entries[i].iov_in[j].iov_len;
+			}
+		}
+
+		if (hmac_ctx) {
+			hash_len = 0;
+			if ((!HMAC_Init_ex(hmac_ctx, NULL, 0, NULL, NULL)) ||
+			    (!HMAC_Update(hmac_ctx, buf_out, *buf_out_len)) ||
+			    (!HMAC_Final(hmac_ctx, buf_out + *buf_out_len, &hash_len)) ||
+			    (hash_len != crypto_instance->sec_hash_size)) {
+				ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+				log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to calculate hash: %s", sslerr);
+				goto out;
+			}
+			*buf_out_len = *buf_out_len + crypto_instance->sec_hash_size;
+		}
+	}
+
+	err = 0;
+
+out:
+	if (hmac_ctx) {
+		HMAC_CTX_free(hmac_ctx);
+	}
+	if (ctx) {
+		EVP_CIPHER_CTX_free(ctx);
+	}
+	return err;
+}
+#endif
 
 static int opensslcrypto_encrypt_and_sign (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -350,42 +656,48 @@ static int opensslcrypto_encrypt_and_sign (
 	iov_in.iov_base = (unsigned char *)buf_in;
 	iov_in.iov_len = buf_in_len;
 
-	return opensslcrypto_encrypt_and_signv(knet_h, &iov_in, 1, buf_out, buf_out_len);
+	return opensslcrypto_encrypt_and_signv(knet_h, crypto_instance, &iov_in, 1, buf_out, buf_out_len);
 }
 
 static int opensslcrypto_authenticate_and_decrypt (
 	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	uint8_t quiet)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_instance *instance = crypto_instance->model_instance;
 	ssize_t temp_len = buf_in_len;
 
 	if (instance->crypto_hash_type) {
-		unsigned char tmp_hash[knet_h->sec_hash_size];
-		ssize_t temp_buf_len = buf_in_len - knet_h->sec_hash_size;
+		unsigned char tmp_hash[crypto_instance->sec_hash_size];
+		ssize_t temp_buf_len = buf_in_len - crypto_instance->sec_hash_size;
 
 		if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
-			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
+			if (!quiet) {
+				log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
+			}
 			return -1;
 		}
 
-		if (calculate_openssl_hash(knet_h, buf_in, temp_buf_len, tmp_hash) < 0) {
+		if (calculate_openssl_hash(knet_h, crypto_instance, buf_in, temp_buf_len, tmp_hash) < 0) {
 			return -1;
 		}
 
-		if (memcmp(tmp_hash, buf_in + temp_buf_len, knet_h->sec_hash_size) != 0) {
-			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Digest does not match");
+		if (memcmp(tmp_hash, buf_in + temp_buf_len, crypto_instance->sec_hash_size) != 0) {
+			if (!quiet) {
+				log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Digest does not match");
+			}
 			return -1;
 		}
 
-		temp_len = temp_len - knet_h->sec_hash_size;
+		temp_len = temp_len - crypto_instance->sec_hash_size;
 		*buf_out_len = temp_len;
 	}
 	if (instance->crypto_cipher_type) {
-		if (decrypt_openssl(knet_h, buf_in, temp_len, buf_out, buf_out_len) < 0) {
+		if (decrypt_openssl(knet_h, crypto_instance, buf_in, temp_len, buf_out, buf_out_len, quiet) < 0) {
 			return -1;
 		}
 	} else {
@@ -396,6 +708,64 @@ static int opensslcrypto_authenticate_and_decrypt (
 	return 0;
 }
 
+/*
+ * MAC only (cipher "none"): the MAC is calculated over the
+ * iovecs and verified in place, payload is never copied
+ */
+static int opensslcrypto_signv_batch (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	struct crypto_batch_entry *entries,
+	int entries_cnt)
+{
+	int i;
+
+	for (i = 0; i < entries_cnt; i++) {
+		if (calculate_openssl_hashv(knet_h, crypto_instance,
+					    entries[i].iov_in, entries[i].iovcnt_in,
+					    entries[i].buf_out) < 0) {
+			return -1;
+		}
+		entries[i].buf_out_len = crypto_instance->sec_hash_size;
+	}
+
+	return 0;
+}
+
+static int opensslcrypto_authenticate (
+	knet_handle_t knet_h,
+	struct crypto_instance *crypto_instance,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *payload_len,
+	uint8_t quiet)
+{
+	unsigned char tmp_hash[crypto_instance->sec_hash_size];
+	ssize_t temp_buf_len = buf_in_len - crypto_instance->sec_hash_size;
+
+	if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
+		if (!quiet) {
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
+		}
+		return -1;
+	}
+
+	if (calculate_openssl_hash(knet_h, crypto_instance, buf_in, temp_buf_len, tmp_hash) < 0) {
+		return -1;
+	}
+
+	if (memcmp(tmp_hash, buf_in + temp_buf_len, crypto_instance->sec_hash_size) != 0) {
+		if (!quiet) {
+			log_err_ratelimited(knet_h, KNET_SUB_OPENSSLCRYPTO, "Digest does not match");
+		}
+		return -1;
+	}
+
+	*payload_len = temp_buf_len;
+
+	return 0;
+}
+
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L)
 static pthread_mutex_t *openssl_internal_lock;
 
@@ -478,6 +848,20 @@ static void opensslcrypto_fini(
 	struct opensslcrypto_instance *opensslcrypto_instance = crypto_instance->model_instance;
 
 	if (opensslcrypto_instance) {
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+		int i;
+
+		for (i = 0; i < OPENSSL_HMAC_SLOTS; i++) {
+			if (opensslcrypto_instance->hmac_slots[i].ctx) {
+				HMAC_CTX_free(opensslcrypto_instance->hmac_slots[i].ctx);
+				opensslcrypto_instance->hmac_slots[i].ctx = NULL;
+			}
+		}
+		if (opensslcrypto_instance->hmac_template) {
+			HMAC_CTX_free(opensslcrypto_instance->hmac_template);
+			opensslcrypto_instance->hmac_template = NULL;
+		}
+#endif
 		if (opensslcrypto_instance->private_key) {
 			free(opensslcrypto_instance->private_key);
 			opensslcrypto_instance->private_key = NULL;
@@ -523,6 +907,11 @@ static int opensslcrypto_init(
 			return -1;
 		}
 #endif
+		if (pthread_atfork(NULL, NULL, openssl_salt_pool_reset)) {
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to register salt pool fork handler");
+			errno = EAGAIN;
+			return -1;
+		}
 		openssl_is_init = 1;
 	}
 
@@ -577,6 +966,20 @@ static int opensslcrypto_init(
 
 	if (opensslcrypto_instance->crypto_hash_type) {
 		crypto_instance->sec_hash_size = EVP_MD_size(opensslcrypto_instance->crypto_hash_type);
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+		opensslcrypto_instance->hmac_template = HMAC_CTX_new();
+		if ((!opensslcrypto_instance->hmac_template) ||
+		    (!HMAC_Init_ex(opensslcrypto_instance->hmac_template,
+				   opensslcrypto_instance->private_key, opensslcrypto_instance->private_key_len,
+				   opensslcrypto_instance->crypto_hash_type, NULL))) {
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to init hash");
+			savederrno = ENOMEM;
+			goto out_err;
+		}
+#endif
+		if (!opensslcrypto_instance->crypto_cipher_type) {
+			crypto_instance->mac_only = 1;
+		}
 	}
 
 	if (opensslcrypto_instance->crypto_cipher_type) {
@@ -603,5 +1006,8 @@ crypto_ops_t crypto_model = {
 	opensslcrypto_fini,
 	opensslcrypto_encrypt_and_sign,
 	opensslcrypto_encrypt_and_signv,
-	opensslcrypto_authenticate_and_decrypt
+	opensslcrypto_authenticate_and_decrypt,
+	opensslcrypto_encrypt_and_signv_batch,
+	opensslcrypto_signv_batch,
+	opensslcrypto_authenticate
 };
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internals.h"
+#include "logging.h"
+#include "epoch.h"
+
+/*
+ * epoch based protection of the data path
+ *
+ * Data path readers announce the epoch they entered with in a
+ * per reader slot, that is only written by the reader itself,
+ * and do not touch global_rwlock in the common case.
+ *
+ * Writers still serialize on global_rwlock and come in two flavours:
+ *
+ * - get_global_wrlock(): the writer changes configuration in place
+ *   (hosts, links, datafds...). It raises the stop flag and waits
+ *   for readers to leave their read section. Readers that see the
+ *   flag fall back to global_rwlock and wait for the writer
+ *   to release it, as they always did.
+ *
+ * - get_global_cfg_wrlock(): the writer publishes a new copy of the
+ *   configuration (ex: crypto instance) and readers are never
+ *   stopped. The old copy is released after epoch_synchronize(),
+ *   once all readers that could still see it have left their
+ *   read section.
+ */
+
+#define KNET_EPOCH_CACHELINE 64
+
+#define KNET_EPOCH_NONE   -1 /* not in a read section */
+#define KNET_EPOCH_RDLOCK -2 /* read section holds global_rwlock */
+
+struct knet_epoch_reader {
+	uint64_t epoch;		/* 0 outside of a read section */
+	uint8_t pad[KNET_EPOCH_CACHELINE - sizeof(uint64_t)];
+};
+
+struct knet_epoch {
+	uint64_t epoch;		/* only written by writers */
+	int stop;		/* a writer is changing configuration in place */
+	uint8_t pad[KNET_EPOCH_CACHELINE - sizeof(uint64_t) - sizeof(int)];
+	struct knet_epoch_reader readers[KNET_EPOCH_READERS];
+};
+
+/*
+ * read sections of the calling thread, one per handle.
+ * A thread can enter a read section of another handle while
+ * in one (ex: from a notify callback), so the state is
+ * looked up by knet_h. Nested read sections on the same
+ * handle are already protected by the outer one and only
+ * counted.
+ *
+ * The table grows by KNET_EPOCH_SECTIONS_CHUNK entries when a
+ * thread uses more handles at the same time, and is released
+ * when the thread exits.
+ */
+#define KNET_EPOCH_SECTIONS_CHUNK 8
+
+struct knet_epoch_section {
+	knet_handle_t knet_h;	/* NULL if the entry is free */
+	int reader;		/* slot in use or KNET_EPOCH_RDLOCK */
+	int request;		/* reader requested by the caller */
+	int depth;		/* nested read sections on the same handle */
+};
+
+static __thread struct knet_epoch_section *sections;
+static __thread unsigned int sections_size;
+static __thread unsigned int api_hint;
+static unsigned int api_hint_seq;
+
+static pthread_key_t sections_key;
+static pthread_once_t sections_key_once = PTHREAD_ONCE_INIT;
+static int sections_key_err;
+
+static void epoch_sections_key_init(void)
+{
+	sections_key_err = pthread_key_create(&sections_key, free);
+}
+
+int epoch_init(knet_handle_t knet_h)
+{
+	struct knet_epoch *ep;
+	int savederrno;
+
+	savederrno = posix_memalign((void **)&ep, KNET_EPOCH_CACHELINE, sizeof(struct knet_epoch));
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for epoch tracker");
+		errno = savederrno;
+		return -1;
+	}
+	memset(ep, 0, sizeof(struct knet_epoch));
+
+	/*
+	 * 0 is reserved for readers outside of a read section
+	 */
+	ep->epoch = 1;
+
+	knet_h->epoch = ep;
+
+	return 0;
+}
+
+void epoch_fini(knet_handle_t knet_h)
+{
+	free(knet_h->epoch);
+	knet_h->epoch = NULL;
+}
+
+static struct knet_epoch_section *epoch_get_section(knet_handle_t knet_h)
+{
+	unsigned int i;
+
+	for (i = 0; i < sections_size; i++) {
+		if (sections[i].knet_h == knet_h) {
+			return &sections[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * only called outside of the read sections of the calling thread
+ * on knet_h, pointers to the old table are never kept around
+ */
+static struct knet_epoch_section *epoch_new_section(void)
+{
+	struct knet_epoch_section *section, *new_sections;
+	unsigned int i, new_size;
+	int savederrno;
+
+	section = epoch_get_section(NULL);
+	if (section) {
+		return section;
+	}
+
+	savederrno = pthread_once(&sections_key_once, epoch_sections_key_init);
+	if (savederrno) {
+		errno = savederrno;
+		return NULL;
+	}
+	if (sections_key_err) {
+		errno = sections_key_err;
+		return NULL;
+	}
+
+	new_size = sections_size + KNET_EPOCH_SECTIONS_CHUNK;
+	new_sections = calloc(new_size, sizeof(struct knet_epoch_section));
+	if (!new_sections) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	savederrno = pthread_setspecific(sections_key, new_sections);
+	if (savederrno) {
+		free(new_sections);
+		errno = savederrno;
+		return NULL;
+	}
+
+	if (sections_size) {
+		memmove(new_sections, sections, sections_size * sizeof(struct knet_epoch_section));
+	}
+	for (i = sections_size; i < new_size; i++) {
+		new_sections[i].reader = KNET_EPOCH_NONE;
+	}
+	free(sections);
+
+	section = &new_sections[sections_size];
+	sections = new_sections;
+	sections_size = new_size;
+
+	return section;
+}
+
+static struct knet_epoch_reader *epoch_get_api_slot(struct knet_epoch *ep, uint64_t epoch, int *reader)
+{
+	uint64_t free_slot;
+	int i;
+
+	if (!api_hint) {
+		api_hint = __atomic_add_fetch(&api_hint_seq, 1, __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < KNET_EPOCH_READERS - KNET_EPOCH_READER_API; i++) {
+		*reader = KNET_EPOCH_READER_API + ((api_hint + i) % (KNET_EPOCH_READERS - KNET_EPOCH_READER_API));
+		free_slot = 0;
+		if (__atomic_compare_exchange_n(&ep->readers[*reader].epoch, &free_slot, epoch, 0,
+						__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return &ep->readers[*reader];
+		}
+	}
+
+	return NULL;
+}
+
+int epoch_read_lock(knet_handle_t knet_h, int reader)
+{
+	struct knet_epoch *ep = knet_h->epoch;
+	struct knet_epoch_section *section;
+	struct knet_epoch_reader *slot;
+	uint64_t epoch;
+	int savederrno;
+
+	section = epoch_get_section(knet_h);
+	if (section) {
+		section->depth++;
+		return 0;
+	}
+
+	section = epoch_new_section();
+	if (!section) {
+		return -1;
+	}
+
+	section->request = reader;
+
+	epoch = __atomic_load_n(&ep->epoch, __ATOMIC_ACQUIRE);
+
+	if (reader < KNET_EPOCH_READER_API) {
+		slot = &ep->readers[reader];
+		__atomic_store_n(&slot->epoch, epoch, __ATOMIC_RELAXED);
+	} else {
+		slot = epoch_get_api_slot(ep, epoch, &reader);
+	}
+
+	if (slot) {
+		/*
+		 * pairs with epoch_advance(): either the writer sees
+		 * this reader in its slot, or the reader sees the
+		 * stop flag and the data published by the writer
+		 */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&ep->stop, __ATOMIC_RELAXED)) {
+			section->knet_h = knet_h;
+			section->reader = reader;
+			return 0;
+		}
+		__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		errno = savederrno;
+		return -1;
+	}
+
+	/*
+	 * no writer can hold the lock now, a stop flag
+	 * is left over from the last one
+	 */
+	__atomic_store_n(&ep->stop, 0, __ATOMIC_RELAXED);
+	section->knet_h = knet_h;
+	section->reader = KNET_EPOCH_RDLOCK;
+
+	return 0;
+}
+
+void epoch_read_unlock(knet_handle_t knet_h)
+{
+	struct knet_epoch_section *section = epoch_get_section(knet_h);
+
+	if (!section) {
+		return;
+	}
+
+	if (section->depth) {
+		section->depth--;
+		return;
+	}
+
+	if (section->reader == KNET_EPOCH_RDLOCK) {
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+	} else {
+		__atomic_store_n(&knet_h->epoch->readers[section->reader].epoch, 0, __ATOMIC_RELEASE);
+	}
+	section->knet_h = NULL;
+	section->reader = KNET_EPOCH_NONE;
+}
+
+int epoch_read_sleep(knet_handle_t knet_h, useconds_t usecs)
+{
+	struct knet_epoch_section *section = epoch_get_section(knet_h);
+	int reader;
+
+	if ((!section) || (section->reader < 0) || (section->depth)) {
+		return 0;
+	}
+
+	reader = section->request;
+
+	epoch_read_unlock(knet_h);
+	usleep(usecs);
+	if (epoch_read_lock(knet_h, reader) < 0) {
+		return -1;
+	}
+
+	return 1;
+}
+
+/*
+ * wait for all readers that entered their read section
+ * before epoch to leave it
+ */
+static void epoch_wait_readers(struct knet_epoch *ep, uint64_t epoch)
+{
+	uint64_t reader_epoch;
+	int i;
+
+	for (i = 0; i < KNET_EPOCH_READERS; i++) {
+		while (1) {
+			reader_epoch = __atomic_load_n(&ep->readers[i].epoch, __ATOMIC_ACQUIRE);
+			if ((!reader_epoch) || (reader_epoch >= epoch)) {
+				break;
+			}
+			sched_yield();
+		}
+	}
+}
+
+static uint64_t epoch_advance(struct knet_epoch *ep)
+{
+	uint64_t epoch;
+
+	epoch = __atomic_add_fetch(&ep->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return epoch;
+}
+
+void epoch_stop_readers(knet_handle_t knet_h)
+{
+	struct knet_epoch *ep = knet_h->epoch;
+
+	if (!ep) {
+		return;
+	}
+
+	__atomic_store_n(&ep->stop, 1, __ATOMIC_RELAXED);
+	epoch_wait_readers(ep, epoch_advance(ep));
+}
+
+void epoch_resume_readers(knet_handle_t knet_h)
+{
+	struct knet_epoch *ep = knet_h->epoch;
+
+	if (!ep) {
+		return;
+	}
+
+	__atomic_store_n(&ep->stop, 0, __ATOMIC_RELAXED);
+}
+
+void epoch_synchronize(knet_handle_t knet_h)
+{
+	struct knet_epoch *ep = knet_h->epoch;
+
+	if (!ep) {
+		return;
+	}
+
+	epoch_wait_readers(ep, epoch_advance(ep));
+}
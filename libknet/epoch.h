@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under LGPL-2.0+
+ */
+
+#ifndef __KNET_EPOCH_H__
+#define __KNET_EPOCH_H__
+
+#include <unistd.h>
+
+#include "internals.h"
+
+/*
+ * data path readers, see epoch.c
+ *
+ * RX and TX threads own their slot, API callers
+ * (knet_send/knet_recv/knet_send_sync) grab any free
+ * slot from KNET_EPOCH_READER_API on, or fall back to
+ * global_rwlock if there is none.
+ */
+#define KNET_EPOCH_READER_RX	0
+#define KNET_EPOCH_READER_TX	1
+#define KNET_EPOCH_READER_API	2
+#define KNET_EPOCH_READERS	16
+
+int epoch_init(knet_handle_t knet_h);
+void epoch_fini(knet_handle_t knet_h);
+
+/*
+ * data path read sections. A thread can be in the read sections
+ * of any number of handles at the same time. Nested read sections
+ * on the same handle are counted and only the outermost one
+ * protects the data path.
+ */
+int epoch_read_lock(knet_handle_t knet_h, int reader);
+void epoch_read_unlock(knet_handle_t knet_h);
+
+/*
+ * drop the read section of the calling thread for usecs
+ * and enter it again. Returns 0 if the calling thread is not
+ * in a lockless read section, 1 on success and -1 on error
+ */
+int epoch_read_sleep(knet_handle_t knet_h, useconds_t usecs);
+
+/*
+ * writers, all of them require global_rwlock to be held in write mode
+ */
+void epoch_stop_readers(knet_handle_t knet_h);
+void epoch_resume_readers(knet_handle_t knet_h);
+void epoch_synchronize(knet_handle_t knet_h);
+
+#endif
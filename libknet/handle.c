@@ -25,6 +25,7 @@
 #include "compress.h"
 #include "compat.h"
 #include "common.h"
+#include "epoch.h"
 #include "threads_common.h"
 #include "threads_heartbeat.h"
 #include "threads_pmtud.h"
@@ -94,6 +95,13 @@ static int _init_locks(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
+	savederrno = pthread_cond_init(&knet_h->threads_status_cond, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize threads status cond: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
 	savederrno = pthread_mutex_init(&knet_h->pmtud_mutex, NULL);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize pmtud mutex: %s",
@@ -143,6 +151,20 @@ static int _init_locks(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
+	savederrno = pthread_mutex_init(&knet_h->dstcache_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize dst cache mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_cond_init(&knet_h->dstcache_cond, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize dst cache conditional mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
 	return 0;
 
 exit_fail:
@@ -160,6 +182,9 @@ static void _destroy_locks(knet_handle_t knet_h)
 	pthread_mutex_destroy(&knet_h->tx_mutex);
 	pthread_mutex_destroy(&knet_h->backoff_mutex);
 	pthread_mutex_destroy(&knet_h->tx_seq_num_mutex);
+	pthread_mutex_destroy(&knet_h->dstcache_mutex);
+	pthread_cond_destroy(&knet_h->dstcache_cond);
+	pthread_cond_destroy(&knet_h->threads_status_cond);
 	pthread_mutex_destroy(&knet_h->threads_status_mutex);
 	pthread_mutex_destroy(&knet_h->handle_stats_mutex);
 }
@@ -175,13 +200,6 @@ static int _init_socks(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	if (_init_socketpair(knet_h, knet_h->dstsockfd)) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize internal dstsockpair: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-
 	return 0;
 
 exit_fail:
@@ -191,7 +209,6 @@ exit_fail:
 
 static void _close_socks(knet_handle_t knet_h)
 {
-	_close_socketpair(knet_h, knet_h->dstsockfd);
 	_close_socketpair(knet_h, knet_h->hostsockfd);
 }
 
@@ -203,124 +220,123 @@ static int _init_buffers(knet_handle_t knet_h)
 
 	for (i = 0; i < PCKT_FRAG_MAX; i++) {
 		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE;
-		knet_h->send_to_links_buf[i] = malloc(bufsize);
+		knet_h->send_to_links_buf[i] = calloc(1, bufsize);
 		if (!knet_h->send_to_links_buf[i]) {
 			savederrno = errno;
 			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory datafd to link buffer: %s",
 				strerror(savederrno));
 			goto exit_fail;
 		}
-		memset(knet_h->send_to_links_buf[i], 0, bufsize);
+	}
+
+	/*
+	 * the rx buffers are 32MB in total and most of them are never
+	 * touched with small packets. Allocate them in one block, that
+	 * is big enough to be mmap'ed by calloc, so that pages are
+	 * only mapped in memory once they are used.
+	 */
+	knet_h->recv_from_links_pool = calloc(PCKT_RX_BUFS, KNET_RX_BUF_STRIDE);
+	if (!knet_h->recv_from_links_pool) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for link to datafd buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
 	}
 
 	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		knet_h->recv_from_links_buf[i] = malloc(KNET_DATABUFSIZE);
-		if (!knet_h->recv_from_links_buf[i]) {
-			savederrno = errno;
-			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for link to datafd buffer: %s",
-				strerror(savederrno));
-			goto exit_fail;
-		}
-		memset(knet_h->recv_from_links_buf[i], 0, KNET_DATABUFSIZE);
+		knet_h->recv_from_links_buf[i] = (struct knet_header *)(knet_h->recv_from_links_pool + (i * KNET_RX_BUF_STRIDE));
 	}
 
-	knet_h->recv_from_sock_buf = malloc(KNET_DATABUFSIZE);
+	knet_h->recv_from_links_buf_gro = calloc(1, KNET_DATABUFSIZE);
+	if (!knet_h->recv_from_links_buf_gro) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for link GRO segment buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	knet_h->recv_from_sock_buf = calloc(1, KNET_DATABUFSIZE);
 	if (!knet_h->recv_from_sock_buf) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for app to datafd buffer: %s",
 				strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->recv_from_sock_buf, 0, KNET_DATABUFSIZE);
 
-	knet_h->pingbuf = malloc(KNET_HEADER_PING_SIZE);
+	knet_h->pingbuf = calloc(1, KNET_HEADER_PING_SIZE);
 	if (!knet_h->pingbuf) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for hearbeat buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->pingbuf, 0, KNET_HEADER_PING_SIZE);
 
-	knet_h->pmtudbuf = malloc(KNET_PMTUD_SIZE_V6 + KNET_HEADER_ALL_SIZE);
+	knet_h->pmtudbuf = calloc(1, KNET_PMTUD_SIZE_V6 + KNET_HEADER_ALL_SIZE);
 	if (!knet_h->pmtudbuf) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for pmtud buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->pmtudbuf, 0, KNET_PMTUD_SIZE_V6 + KNET_HEADER_ALL_SIZE);
 
 	for (i = 0; i < PCKT_FRAG_MAX; i++) {
 		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE + KNET_DATABUFSIZE_CRYPT_PAD;
-		knet_h->send_to_links_buf_crypt[i] = malloc(bufsize);
+		knet_h->send_to_links_buf_crypt[i] = calloc(1, bufsize);
 		if (!knet_h->send_to_links_buf_crypt[i]) {
 			savederrno = errno;
 			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for crypto datafd to link buffer: %s",
 				strerror(savederrno));
 			goto exit_fail;
 		}
-		memset(knet_h->send_to_links_buf_crypt[i], 0, bufsize);
 	}
 
-	knet_h->recv_from_links_buf_decrypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	knet_h->recv_from_links_buf_decrypt = calloc(1, KNET_DATABUFSIZE_CRYPT);
 	if (!knet_h->recv_from_links_buf_decrypt) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->recv_from_links_buf_decrypt, 0, KNET_DATABUFSIZE_CRYPT);
 
-	knet_h->recv_from_links_buf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	knet_h->recv_from_links_buf_crypt = calloc(1, KNET_DATABUFSIZE_CRYPT);
 	if (!knet_h->recv_from_links_buf_crypt) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->recv_from_links_buf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
 
-	knet_h->pingbuf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	knet_h->pingbuf_crypt = calloc(1, KNET_DATABUFSIZE_CRYPT);
 	if (!knet_h->pingbuf_crypt) {
 		savederrno = errno; 
 		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto hearbeat buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->pingbuf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
 
-	knet_h->pmtudbuf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	knet_h->pmtudbuf_crypt = calloc(1, KNET_DATABUFSIZE_CRYPT);
 	if (!knet_h->pmtudbuf_crypt) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for crypto pmtud buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->pmtudbuf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
 
-	knet_h->recv_from_links_buf_decompress = malloc(KNET_DATABUFSIZE_COMPRESS);
+	knet_h->recv_from_links_buf_decompress = calloc(1, KNET_DATABUFSIZE_COMPRESS);
 	if (!knet_h->recv_from_links_buf_decompress) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for decompress buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->recv_from_links_buf_decompress, 0, KNET_DATABUFSIZE_COMPRESS);
 
-	knet_h->send_to_links_buf_compress = malloc(KNET_DATABUFSIZE_COMPRESS);
+	knet_h->send_to_links_buf_compress = calloc(1, KNET_DATABUFSIZE_COMPRESS);
 	if (!knet_h->send_to_links_buf_compress) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for compress buffer: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
-	memset(knet_h->send_to_links_buf_compress, 0, KNET_DATABUFSIZE_COMPRESS);
-
-	memset(knet_h->knet_transport_fd_tracker, 0, sizeof(knet_h->knet_transport_fd_tracker));
-	for (i = 0; i < KNET_MAX_FDS; i++) {
-		knet_h->knet_transport_fd_tracker[i].transport = KNET_MAX_TRANSPORTS;
-	}
 
 	return 0;
 
@@ -338,9 +354,11 @@ static void _destroy_buffers(knet_handle_t knet_h)
 		free(knet_h->send_to_links_buf_crypt[i]);
 	}
 
+	free(knet_h->recv_from_links_pool);
 	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		free(knet_h->recv_from_links_buf[i]);
+		knet_h->recv_from_links_buf[i] = NULL;
 	}
+	free(knet_h->recv_from_links_buf_gro);
 
 	free(knet_h->recv_from_links_buf_decompress);
 	free(knet_h->send_to_links_buf_compress);
@@ -351,6 +369,11 @@ static void _destroy_buffers(knet_handle_t knet_h)
 	free(knet_h->pingbuf_crypt);
 	free(knet_h->pmtudbuf);
 	free(knet_h->pmtudbuf_crypt);
+
+	_free_fd_trackers(knet_h);
+
+	free(knet_h->reachable_hosts);
+	free(knet_h->host_name_index);
 }
 
 static int _init_epolls(knet_handle_t knet_h)
@@ -378,14 +401,6 @@ static int _init_epolls(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	knet_h->dst_link_handler_epollfd = epoll_create(KNET_EPOLL_MAX_EVENTS);
-	if (knet_h->dst_link_handler_epollfd < 0) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to create epoll dst cache fd: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-
 	if (_fdset_cloexec(knet_h->send_to_links_epollfd)) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to set CLOEXEC on datafd to link epoll fd: %s",
@@ -400,16 +415,9 @@ static int _init_epolls(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	if (_fdset_cloexec(knet_h->dst_link_handler_epollfd)) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to set CLOEXEC on dst cache epoll fd: %s",
-			strerror(savederrno)); 
-		goto exit_fail;
-	}
-
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
-	ev.data.fd = knet_h->hostsockfd[0];
+	ev.data.ptr = &knet_h->sockfd[KNET_INTERNAL_DATA_CHANNEL];
 
 	if (epoll_ctl(knet_h->send_to_links_epollfd,
 		      EPOLL_CTL_ADD, knet_h->hostsockfd[0], &ev)) {
@@ -419,18 +427,6 @@ static int _init_epolls(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
-	ev.data.fd = knet_h->dstsockfd[0];
-
-	if (epoll_ctl(knet_h->dst_link_handler_epollfd,
-		      EPOLL_CTL_ADD, knet_h->dstsockfd[0], &ev)) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to add dstsockfd[0] to epoll pool: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-
 	return 0;
 
 exit_fail:
@@ -455,10 +451,8 @@ static void _close_epolls(knet_handle_t knet_h)
 	}
 
 	epoll_ctl(knet_h->send_to_links_epollfd, EPOLL_CTL_DEL, knet_h->hostsockfd[0], &ev);
-	epoll_ctl(knet_h->dst_link_handler_epollfd, EPOLL_CTL_DEL, knet_h->dstsockfd[0], &ev);
 	close(knet_h->send_to_links_epollfd);
 	close(knet_h->recv_from_links_epollfd);
-	close(knet_h->dst_link_handler_epollfd);
 }
 
 static int _start_threads(knet_handle_t knet_h)
@@ -609,12 +603,15 @@ knet_handle_t knet_handle_new(knet_node_id_t host_id,
 	 * allocate handle
 	 */
 
-	knet_h = malloc(sizeof(struct knet_handle));
+	/*
+	 * calloc, rather than malloc + memset, leaves the large
+	 * and mostly unused host tables out of the process RSS
+	 */
+	knet_h = calloc(1, sizeof(struct knet_handle));
 	if (!knet_h) {
 		errno = ENOMEM;
 		return NULL;
 	}
-	memset(knet_h, 0, sizeof(struct knet_handle));
 
 	/*
 	 * setting up some handle data so that we can use logging
@@ -694,6 +691,24 @@ knet_handle_t knet_handle_new(knet_node_id_t host_id,
 		goto exit_fail;
 	}
 
+	/*
+	 * init data path readers tracking
+	 */
+
+	if (epoch_init(knet_h)) {
+		savederrno = errno;
+		goto exit_fail;
+	}
+
+	/*
+	 * start the log thread
+	 */
+
+	if (log_ring_init(knet_h)) {
+		savederrno = errno;
+		goto exit_fail;
+	}
+
 	/*
 	 * init sockets
 	 */
@@ -758,6 +773,7 @@ exit_fail:
 int knet_handle_free(knet_handle_t knet_h)
 {
 	int savederrno = 0;
+	uint8_t i;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -791,8 +807,12 @@ int knet_handle_free(knet_handle_t knet_h)
 	_close_epolls(knet_h);
 	_destroy_buffers(knet_h);
 	_close_socks(knet_h);
-	crypto_fini(knet_h);
+	for (i = 1; i <= KNET_MAX_CRYPTO_INSTANCES; i++) {
+		crypto_fini(knet_h, i);
+	}
 	compress_fini(knet_h, 1);
+	log_ring_fini(knet_h);
+	epoch_fini(knet_h);
 	_destroy_locks(knet_h);
 
 	free(knet_h);
@@ -965,7 +985,7 @@ int knet_handle_add_datafd(knet_handle_t knet_h, int *datafd, int8_t *channel)
 
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
-	ev.data.fd = knet_h->sockfd[*channel].sockfd[knet_h->sockfd[*channel].is_created];
+	ev.data.ptr = &knet_h->sockfd[*channel];
 
 	if (epoll_ctl(knet_h->send_to_links_epollfd,
 		      EPOLL_CTL_ADD, knet_h->sockfd[*channel].sockfd[knet_h->sockfd[*channel].is_created], &ev)) {
@@ -1070,8 +1090,8 @@ int knet_handle_get_datafd(knet_handle_t knet_h, const int8_t channel, int *data
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1087,7 +1107,7 @@ int knet_handle_get_datafd(knet_handle_t knet_h, const int8_t channel, int *data
 	*datafd = knet_h->sockfd[channel].sockfd[0];
 
 out_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1112,8 +1132,8 @@ int knet_handle_get_channel(knet_handle_t knet_h, const int datafd, int8_t *chan
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1137,7 +1157,7 @@ int knet_handle_get_channel(knet_handle_t knet_h, const int datafd, int8_t *chan
 	}
 
 out_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1311,8 +1331,8 @@ int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1321,7 +1341,7 @@ int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
 
 	*interval = knet_h->pmtud_interval;
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 
 	errno = 0;
 	return 0;
@@ -1443,8 +1463,8 @@ int knet_handle_pmtud_get(knet_handle_t knet_h,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1453,7 +1473,56 @@ int knet_handle_pmtud_get(knet_handle_t knet_h,
 
 	*data_mtu = knet_h->data_mtu;
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
+
+	errno = 0;
+	return 0;
+}
+
+static int _crypto_cfg_is_none(struct knet_handle_crypto_cfg *knet_handle_crypto_cfg)
+{
+	if ((!strncmp("none", knet_handle_crypto_cfg->crypto_model, 4)) ||
+	    ((!strncmp("none", knet_handle_crypto_cfg->crypto_cipher_type, 4)) &&
+	     (!strncmp("none", knet_handle_crypto_cfg->crypto_hash_type, 4)))) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * must be called with get_global_cfg_wrlock held
+ */
+static int _handle_crypto_set_config(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet_handle_crypto_cfg, uint8_t config_num)
+{
+	if (_crypto_cfg_is_none(knet_handle_crypto_cfg)) {
+		if (knet_h->crypto_in_use_config == config_num) {
+			log_debug(knet_h, KNET_SUB_CRYPTO, "crypto config %u is in use and cannot be cleared", config_num);
+			errno = EBUSY;
+			return -1;
+		}
+		crypto_fini(knet_h, config_num);
+		log_debug(knet_h, KNET_SUB_CRYPTO, "crypto config %u is not enabled", config_num);
+		errno = 0;
+		return 0;
+	}
+
+	if (knet_handle_crypto_cfg->private_key_len < KNET_MIN_KEY_LEN) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too short (min %d): %u",
+			  KNET_MIN_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (knet_handle_crypto_cfg->private_key_len > KNET_MAX_KEY_LEN) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too long (max %d): %u",
+			  KNET_MAX_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (crypto_init(knet_h, knet_handle_crypto_cfg, config_num) < 0) {
+		return -2;
+	}
 
 	errno = 0;
 	return 0;
@@ -1463,6 +1532,7 @@ int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet
 {
 	int savederrno = 0;
 	int err = 0;
+	uint8_t i;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -1474,7 +1544,11 @@ int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	/*
+	 * the crypto instance is replaced as a whole,
+	 * traffic keeps flowing while the new one is set up
+	 */
+	savederrno = get_global_cfg_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
 			strerror(savederrno));
@@ -1482,47 +1556,148 @@ int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet
 		return -1;
 	}
 
-	if ((!strncmp("none", knet_handle_crypto_cfg->crypto_model, 4)) || 
-	    ((!strncmp("none", knet_handle_crypto_cfg->crypto_cipher_type, 4)) &&
-	     (!strncmp("none", knet_handle_crypto_cfg->crypto_hash_type, 4)))) {
-		crypto_fini(knet_h);
+	/*
+	 * legacy single key API: config 1 is the only one in use
+	 */
+	if (_crypto_cfg_is_none(knet_handle_crypto_cfg)) {
+		for (i = 1; i <= KNET_MAX_CRYPTO_INSTANCES; i++) {
+			crypto_fini(knet_h, i);
+		}
 		log_debug(knet_h, KNET_SUB_CRYPTO, "crypto is not enabled");
 		err = 0;
 		goto exit_unlock;
 	}
 
-	if (knet_handle_crypto_cfg->private_key_len < KNET_MIN_KEY_LEN) {
-		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too short (min %d): %u",
-			  KNET_MIN_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
-		savederrno = EINVAL;
-		err = -1;
+	err = _handle_crypto_set_config(knet_h, knet_handle_crypto_cfg, 1);
+	savederrno = errno;
+	if (err) {
 		goto exit_unlock;
 	}
 
-	if (knet_handle_crypto_cfg->private_key_len > KNET_MAX_KEY_LEN) {
-		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too long (max %d): %u",
-			  KNET_MAX_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
-		savederrno = EINVAL;
-		err = -1;
-		goto exit_unlock;
+	crypto_use_config(knet_h, 1);
+	for (i = 2; i <= KNET_MAX_CRYPTO_INSTANCES; i++) {
+		crypto_fini(knet_h, i);
+	}
+
+exit_unlock:
+	if (!err) {
+		force_pmtud_run(knet_h, KNET_SUB_CRYPTO, 1);
 	}
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = err ? savederrno : 0;
+	return err;
+}
 
-	err = crypto_init(knet_h, knet_handle_crypto_cfg);
+int knet_handle_crypto_set_config(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet_handle_crypto_cfg, uint8_t config_num)
+{
+	int savederrno = 0;
+	int err = 0;
 
-	if (err) {
-		err = -2;
-		savederrno = errno;
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
 	}
 
-exit_unlock:
+	if (!knet_handle_crypto_cfg) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((config_num < 1) || (config_num > KNET_MAX_CRYPTO_INSTANCES)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_cfg_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = _handle_crypto_set_config(knet_h, knet_handle_crypto_cfg, config_num);
+	savederrno = errno;
+
+	/*
+	 * crypto overhead used by PMTUd is the one of the TX config,
+	 * but any config can become the TX config later on. Rerun PMTUd
+	 * on every change and reset the MTU only if the TX overhead changed
+	 */
 	if (!err) {
+		force_pmtud_run(knet_h, KNET_SUB_CRYPTO, knet_h->crypto_in_use_config == config_num);
+	}
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = err ? savederrno : 0;
+	return err;
+}
+
+int knet_handle_crypto_use_config(knet_handle_t knet_h, uint8_t config_num)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (config_num > KNET_MAX_CRYPTO_INSTANCES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_cfg_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = crypto_use_config(knet_h, config_num);
+	savederrno = errno;
+	if (err) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "crypto config %u is not configured", config_num);
+	} else {
 		force_pmtud_run(knet_h, KNET_SUB_CRYPTO, 1);
 	}
+
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 	errno = err ? savederrno : 0;
 	return err;
 }
 
+int knet_handle_crypto_set_preheader(knet_handle_t knet_h, uint8_t enabled)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (enabled > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_cfg_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	crypto_use_preheader(knet_h, enabled);
+	force_pmtud_run(knet_h, KNET_SUB_CRYPTO, 1);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = 0;
+	return 0;
+}
+
 int knet_handle_compress(knet_handle_t knet_h, struct knet_handle_compress_cfg *knet_handle_compress_cfg)
 {
 	int savederrno = 0;
@@ -1555,6 +1730,95 @@ int knet_handle_compress(knet_handle_t knet_h, struct knet_handle_compress_cfg *
 	return err;
 }
 
+int knet_handle_compress_set_dict(knet_handle_t knet_h, const unsigned char *dict, size_t dict_len)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!dict) && (dict_len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((dict) && ((!dict_len) || (dict_len > KNET_COMPRESS_DICT_MAX_SIZE))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = compress_set_dict(knet_h, dict, dict_len);
+	savederrno = errno;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = err ? savederrno : 0;
+	return err;
+}
+
+int knet_handle_compress_set_adaptive(knet_handle_t knet_h, uint32_t link_mbps)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	compress_set_adaptive(knet_h, link_mbps);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = 0;
+	return 0;
+}
+
+int knet_handle_compress_set_stream(knet_handle_t knet_h, int8_t channel, uint8_t resync_interval)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((channel < 0) || (channel >= KNET_DATAFD_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	compress_set_stream(knet_h, channel, resync_interval);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = 0;
+	return 0;
+}
+
 ssize_t knet_recv(knet_handle_t knet_h, char *buff, const size_t buff_len, const int8_t channel)
 {
 	int savederrno = 0;
@@ -1591,8 +1855,8 @@ ssize_t knet_recv(knet_handle_t knet_h, char *buff, const size_t buff_len, const
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1613,7 +1877,7 @@ ssize_t knet_recv(knet_handle_t knet_h, char *buff, const size_t buff_len, const
 	savederrno = errno;
 
 out_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1654,8 +1918,8 @@ ssize_t knet_send(knet_handle_t knet_h, const char *buff, const size_t buff_len,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1677,7 +1941,7 @@ ssize_t knet_send(knet_handle_t knet_h, const char *buff, const size_t buff_len,
 	savederrno = errno;
 
 out_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1696,8 +1960,8 @@ int knet_handle_get_stats(knet_handle_t knet_h, struct knet_handle_stats *stats,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1733,7 +1997,7 @@ int knet_handle_get_stats(knet_handle_t knet_h, struct knet_handle_stats *stats,
 
 out_unlock:
 	pthread_mutex_unlock(&knet_h->handle_stats_mutex);
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	return err;
 }
 
@@ -1825,8 +2089,8 @@ int knet_handle_get_threads_timer_res(knet_handle_t knet_h,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1835,6 +2099,6 @@ int knet_handle_get_threads_timer_res(knet_handle_t knet_h,
 
 	*timeres = knet_h->threads_timer_res;
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	return 0;
 }
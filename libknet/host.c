@@ -15,20 +15,175 @@
 #include <pthread.h>
 #include <stdio.h>
 
+#include "compress.h"
+#include "epoch.h"
 #include "host.h"
 #include "internals.h"
 #include "logging.h"
 #include "threads_common.h"
 
-static void _host_list_update(knet_handle_t knet_h)
+/*
+ * must be called with get_global_wrlock held, TX walks
+ * the reachable host list from its read section.
+ * The reachable host list is sized for all hosts, so that
+ * _host_reachable_list_update can't fail.
+ */
+static int _host_list_update(knet_handle_t knet_h)
 {
 	struct knet_host *host;
+	struct knet_reachable_host *reachable_hosts;
+	size_t reachable_hosts_size;
+
 	knet_h->host_ids_entries = 0;
 
 	for (host = knet_h->host_head; host != NULL; host = host->next) {
 		knet_h->host_ids[knet_h->host_ids_entries] = host->host_id;
 		knet_h->host_ids_entries++;
 	}
+
+	if (knet_h->host_ids_entries > knet_h->reachable_hosts_size) {
+		reachable_hosts_size = knet_h->reachable_hosts_size * 2;
+		if (reachable_hosts_size < KNET_REACHABLE_HOSTS_MIN) {
+			reachable_hosts_size = KNET_REACHABLE_HOSTS_MIN;
+		}
+		if (reachable_hosts_size > KNET_MAX_HOST) {
+			reachable_hosts_size = KNET_MAX_HOST;
+		}
+		reachable_hosts = realloc(knet_h->reachable_hosts,
+					  reachable_hosts_size * sizeof(struct knet_reachable_host));
+		if (!reachable_hosts) {
+			return -1;
+		}
+		knet_h->reachable_hosts = reachable_hosts;
+		knet_h->reachable_hosts_size = reachable_hosts_size;
+	}
+
+	_host_reachable_list_update(knet_h);
+
+	return 0;
+}
+
+/*
+ * must be called with global write lock held
+ * every time a host reachable status changes
+ */
+void _host_reachable_list_update(knet_handle_t knet_h)
+{
+	struct knet_host *host;
+	knet_h->reachable_hosts_entries = 0;
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		if (host->status.reachable) {
+			knet_h->reachable_hosts[knet_h->reachable_hosts_entries].host_id = host->host_id;
+			knet_h->reachable_hosts[knet_h->reachable_hosts_entries].host = host;
+			knet_h->reachable_hosts_entries++;
+		}
+	}
+}
+
+/*
+ * host name index, hosts are hashed by name (FNV-1a)
+ * and chained via host->name_next.
+ *
+ * The table is only allocated by knet_host_set_name. Until then
+ * all hosts have their default name (host_id) and are looked up
+ * in host_index instead.
+ *
+ * All functions must be called with global lock held.
+ */
+
+static uint32_t _host_name_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; (i < KNET_MAX_HOST_LEN) && (name[i]); i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
+
+	return hash & (KNET_HOST_NAME_HASH_SIZE - 1);
+}
+
+static struct knet_host *_host_name_index_find(knet_handle_t knet_h, const char *name)
+{
+	struct knet_host *host;
+	unsigned long host_id;
+	char *endptr;
+
+	if (!knet_h->host_name_index) {
+		errno = 0;
+		host_id = strtoul(name, &endptr, 10);
+		if ((errno) || (endptr == name) || (*endptr) || (host_id >= KNET_MAX_HOST)) {
+			return NULL;
+		}
+		host = knet_h->host_index[host_id];
+		if ((host) && (!strncmp(host->name, name, KNET_MAX_HOST_LEN))) {
+			return host;
+		}
+		return NULL;
+	}
+
+	for (host = knet_h->host_name_index[_host_name_hash(name)]; host != NULL; host = host->name_next) {
+		if (!strncmp(host->name, name, KNET_MAX_HOST_LEN)) {
+			return host;
+		}
+	}
+
+	return NULL;
+}
+
+static void _host_name_index_add(knet_handle_t knet_h, struct knet_host *host)
+{
+	uint32_t bucket;
+
+	if (!knet_h->host_name_index) {
+		return;
+	}
+
+	bucket = _host_name_hash(host->name);
+	host->name_next = knet_h->host_name_index[bucket];
+	knet_h->host_name_index[bucket] = host;
+}
+
+static void _host_name_index_del(knet_handle_t knet_h, struct knet_host *host)
+{
+	struct knet_host **prev;
+
+	if (!knet_h->host_name_index) {
+		return;
+	}
+
+	prev = &knet_h->host_name_index[_host_name_hash(host->name)];
+	while (*prev) {
+		if (*prev == host) {
+			*prev = host->name_next;
+			break;
+		}
+		prev = &(*prev)->name_next;
+	}
+
+	host->name_next = NULL;
+}
+
+static int _host_name_index_init(knet_handle_t knet_h)
+{
+	struct knet_host *host;
+
+	if (knet_h->host_name_index) {
+		return 0;
+	}
+
+	knet_h->host_name_index = calloc(KNET_HOST_NAME_HASH_SIZE, sizeof(struct knet_host *));
+	if (!knet_h->host_name_index) {
+		return -1;
+	}
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		_host_name_index_add(knet_h, host);
+	}
+
+	return 0;
 }
 
 int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
@@ -80,17 +235,33 @@ int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
 	snprintf(host->name, KNET_MAX_HOST_LEN, "%u", host_id);
 
 	/*
-	 * initialize links internal data
+	 * initialize links internal data.
+	 * link_stats_mutex lives as long as the host, RX can
+	 * account packets to a link that is being configured
 	 */
 	for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
 		host->link[link_idx].link_id = link_idx;
 		host->link[link_idx].status.stats.latency_min = UINT32_MAX;
+		savederrno = pthread_mutex_init(&host->link[link_idx].link_stats_mutex, NULL);
+		if (savederrno) {
+			err = -1;
+			log_err(knet_h, KNET_SUB_HOST, "Unable to initialize link stats mutex: %s",
+				strerror(savederrno));
+			while (link_idx > 0) {
+				link_idx--;
+				pthread_mutex_destroy(&host->link[link_idx].link_stats_mutex);
+			}
+			goto exit_unlock;
+		}
 	}
 
+	host->active_links = &host->active_links_buf[0];
+
 	/*
 	 * add new host to the index
 	 */
 	knet_h->host_index[host_id] = host;
+	_host_name_index_add(knet_h, host);
 
 	/*
 	 * add new host to host list
@@ -100,7 +271,19 @@ int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
 	}
 	knet_h->host_head = host;
 
-	_host_list_update(knet_h);
+	if (_host_list_update(knet_h) < 0) {
+		err = -1;
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HOST, "Unable to allocate memory for host %u: %s",
+			host_id, strerror(savederrno));
+		knet_h->host_head = host->next;
+		knet_h->host_index[host_id] = NULL;
+		_host_name_index_del(knet_h, host);
+		_host_list_update(knet_h);
+		for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
+			pthread_mutex_destroy(&host->link[link_idx].link_stats_mutex);
+		}
+	}
 
 exit_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
@@ -173,6 +356,12 @@ int knet_host_remove(knet_handle_t knet_h, knet_node_id_t host_id)
 	}
 
 	knet_h->host_index[host_id] = NULL;
+	_host_name_index_del(knet_h, removed);
+	_host_dstcache_queue_del(knet_h, removed);
+	compress_stream_host_fini(knet_h, removed);
+	for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
+		pthread_mutex_destroy(&removed->link[link_idx].link_stats_mutex);
+	}
 	free(removed);
 
 	_host_list_update(knet_h);
@@ -225,17 +414,28 @@ int knet_host_set_name(knet_handle_t knet_h, knet_node_id_t host_id, const char
 		goto exit_unlock;
 	}
 
-	for (host = knet_h->host_head; host != NULL; host = host->next) {
-		if (!strncmp(host->name, name, KNET_MAX_HOST_LEN)) {
-			err = -1;
-			savederrno = EEXIST;
-			log_err(knet_h, KNET_SUB_HOST, "Duplicated name found on host_id %u",
-				host->host_id);
-			goto exit_unlock;
-		}
+	host = _host_name_index_find(knet_h, name);
+	if (host) {
+		err = -1;
+		savederrno = EEXIST;
+		log_err(knet_h, KNET_SUB_HOST, "Duplicated name found on host_id %u",
+			host->host_id);
+		goto exit_unlock;
+	}
+
+	if (_host_name_index_init(knet_h) < 0) {
+		err = -1;
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HOST, "Unable to allocate memory for host name index: %s",
+			strerror(savederrno));
+		goto exit_unlock;
 	}
 
-	snprintf(knet_h->host_index[host_id]->name, KNET_MAX_HOST_LEN, "%s", name);
+	host = knet_h->host_index[host_id];
+
+	_host_name_index_del(knet_h, host);
+	snprintf(host->name, KNET_MAX_HOST_LEN, "%s", name);
+	_host_name_index_add(knet_h, host);
 
 exit_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
@@ -258,8 +458,8 @@ int knet_host_get_name_by_host_id(knet_handle_t knet_h, knet_node_id_t host_id,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HOST, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -276,7 +476,7 @@ int knet_host_get_name_by_host_id(knet_handle_t knet_h, knet_node_id_t host_id,
 	snprintf(name, KNET_MAX_HOST_LEN, "%s", knet_h->host_index[host_id]->name);
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -284,7 +484,7 @@ exit_unlock:
 int knet_host_get_id_by_host_name(knet_handle_t knet_h, const char *name,
 				  knet_node_id_t *host_id)
 {
-	int savederrno = 0, err = 0, found = 0;
+	int savederrno = 0, err = 0;
 	struct knet_host *host;
 
 	if (!knet_h) {
@@ -302,28 +502,23 @@ int knet_host_get_id_by_host_name(knet_handle_t knet_h, const char *name,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HOST, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
 
-	for (host = knet_h->host_head; host != NULL; host = host->next) {
-		if (!strncmp(name, host->name, KNET_MAX_HOST_LEN)) {
-			found = 1;
-			*host_id = host->host_id;
-			break;
-		}
-	}
-
-	if (!found) {
+	host = _host_name_index_find(knet_h, name);
+	if (host) {
+		*host_id = host->host_id;
+	} else {
 		savederrno = ENOENT;
 		err = -1;
 	}
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -343,8 +538,8 @@ int knet_host_get_host_list(knet_handle_t knet_h,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HOST, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -354,7 +549,7 @@ int knet_host_get_host_list(knet_handle_t knet_h,
 	memmove(host_ids, knet_h->host_ids, sizeof(knet_h->host_ids));
 	*host_ids_entries = knet_h->host_ids_entries;
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	return 0;
 }
 
@@ -424,8 +619,8 @@ int knet_host_get_policy(knet_handle_t knet_h, knet_node_id_t host_id,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HOST, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -443,7 +638,7 @@ int knet_host_get_policy(knet_handle_t knet_h, knet_node_id_t host_id,
 	*policy = knet_h->host_index[host_id]->link_handler_policy;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -464,8 +659,8 @@ int knet_host_get_status(knet_handle_t knet_h, knet_node_id_t host_id,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HOST, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -484,7 +679,7 @@ int knet_host_get_status(knet_handle_t knet_h, knet_node_id_t host_id,
 	memmove(status, &host->status, sizeof(struct knet_host_status));
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -591,6 +786,28 @@ static void _reclaim_old_defrag_bufs(struct knet_host *host, seq_num_t seq_num)
 	}
 }
 
+/*
+ * read only version of _seq_num_lookup, safe to use on data that are
+ * not authenticated yet. Returns 1 only if seq_num is known to be
+ * already delivered.
+ */
+int _seq_num_delivered(struct knet_host *host, seq_num_t seq_num)
+{
+	seq_num_t seq_dist;
+
+	if (seq_num < host->rx_seq_num) {
+		seq_dist =  (SEQ_MAX - seq_num) + host->rx_seq_num;
+	} else {
+		seq_dist = host->rx_seq_num - seq_num;
+	}
+
+	if (seq_dist < KNET_CBUFFER_SIZE) {
+		return (host->circular_buffer[seq_num % KNET_CBUFFER_SIZE] != 0) ? 1 : 0;
+	}
+
+	return 0;
+}
+
 /*
  * check if a given packet seq num is in the circular buffers
  * defrag_buf = 0 -> use normal cbuf 1 -> use the defrag buffer lookup
@@ -659,34 +876,112 @@ void _seq_num_set(struct knet_host *host, seq_num_t seq_num, int defrag_buf)
 	return;
 }
 
+/*
+ * dst cache updates
+ *
+ * Threads that change link status (RX, heartbeat, PMTUd and API calls)
+ * queue the host in knet_h->dstcache_queue, a lock-free LIFO list.
+ * A host is queued only once until the dst link handler thread picks
+ * it up, so a burst of link events for the same host is coalesced
+ * in one update.
+ *
+ * The dst link handler thread takes the whole queue at once,
+ * so there is no ABA problem, and removes hosts only with
+ * get_global_cfg_wrlock held. knet_host_remove holds get_global_wrlock,
+ * when nobody can push (all callers hold the global lock or are data
+ * path readers, that are stopped) or pop, and can unlink a host
+ * from the queue.
+ */
+
 int _host_dstcache_update_async(knet_handle_t knet_h, struct knet_host *host)
 {
+	struct knet_host *head;
 	int savederrno = 0;
-	knet_node_id_t host_id = host->host_id;
 
-	if (sendto(knet_h->dstsockfd[1], &host_id, sizeof(host_id), MSG_DONTWAIT | MSG_NOSIGNAL, NULL, 0) != sizeof(host_id)) {
-		savederrno = errno;
-		log_debug(knet_h, KNET_SUB_HOST, "Unable to write to dstpipefd[1]: %s",
+	if (__atomic_exchange_n(&host->dstcache_queued, 1, __ATOMIC_ACQ_REL)) {
+		return 0;
+	}
+
+	head = __atomic_load_n(&knet_h->dstcache_queue, __ATOMIC_RELAXED);
+	do {
+		host->dstcache_next = head;
+	} while (!__atomic_compare_exchange_n(&knet_h->dstcache_queue, &head, host, 0,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/*
+	 * the dst link handler thread only needs a wake up
+	 * when the queue was empty
+	 */
+	if (head) {
+		return 0;
+	}
+
+	savederrno = pthread_mutex_lock(&knet_h->dstcache_mutex);
+	if (savederrno) {
+		log_debug(knet_h, KNET_SUB_HOST, "Unable to get dst cache mutex lock: %s",
 			  strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
+	pthread_cond_signal(&knet_h->dstcache_cond);
+	pthread_mutex_unlock(&knet_h->dstcache_mutex);
 
 	return 0;
 }
 
-int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host)
+struct knet_host *_host_dstcache_queue_get(knet_handle_t knet_h)
 {
+	return __atomic_exchange_n(&knet_h->dstcache_queue, NULL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * must be called with global write lock held
+ */
+void _host_dstcache_queue_del(knet_handle_t knet_h, struct knet_host *host)
+{
+	struct knet_host **prev;
+
+	if (!host->dstcache_queued) {
+		return;
+	}
+
+	for (prev = &knet_h->dstcache_queue; *prev != NULL; prev = &(*prev)->dstcache_next) {
+		if (*prev == host) {
+			*prev = host->dstcache_next;
+			break;
+		}
+	}
+}
+
+/*
+ * fill the active links that are not in use and publish them.
+ * Must be called with get_global_cfg_wrlock or get_global_wrlock held.
+ * Read mode is not enough: a data path reader that fell back to
+ * global_rwlock is not tracked by epoch_synchronize and could still
+ * be using the old active links when they are reused.
+ * Returns 1 if _host_dstcache_update_reachable needs to be called
+ * (the host reachability changes or the host has no active links),
+ * 0 otherwise.
+ */
+int _host_dstcache_update_links(knet_handle_t knet_h, struct knet_host *host)
+{
+	struct knet_host_active_links *active_links;
 	int link_idx;
 	int best_priority = -1;
-	int reachable = 0;
+
+	if (host->active_links == &host->active_links_buf[0]) {
+		active_links = &host->active_links_buf[1];
+	} else {
+		active_links = &host->active_links_buf[0];
+	}
 
 	if (knet_h->host_id == host->host_id && knet_h->has_loop_link) {
-		host->active_link_entries = 1;
-		return 0;
+		active_links->entries = 1;
+		active_links->links[0] = knet_h->loop_link;
+		goto out_publish;
 	}
 
-	host->active_link_entries = 0;
+	active_links->entries = 0;
 	for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
 		if (host->link[link_idx].status.enabled != 1) /* link is not enabled */
 			continue;
@@ -694,32 +989,65 @@ int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host)
 			continue;
 		if (host->link[link_idx].has_valid_mtu != 1) /* link does not have valid MTU */
 			continue;
+		if (__atomic_load_n(&host->link[link_idx].tx_unreachable, __ATOMIC_RELAXED) == KNET_LINK_TX_UNREACHABLE_DOWN) /* link demoted by TX */
+			continue;
 
 		if (host->link_handler_policy == KNET_LINK_POLICY_PASSIVE) {
 			/* for passive we look for the only active link with higher priority */
 			if (host->link[link_idx].priority > best_priority) {
-				host->active_links[0] = link_idx;
+				active_links->links[0] = link_idx;
 				best_priority = host->link[link_idx].priority;
 			}
-			host->active_link_entries = 1;
+			active_links->entries = 1;
 		} else {
 			/* for RR and ACTIVE we need to copy all available links */
-			host->active_links[host->active_link_entries] = link_idx;
-			host->active_link_entries++;
+			active_links->links[active_links->entries] = link_idx;
+			active_links->entries++;
 		}
 	}
 
 	if (host->link_handler_policy == KNET_LINK_POLICY_PASSIVE) {
 		log_info(knet_h, KNET_SUB_HOST, "host: %u (passive) best link: %u (pri: %u)",
-			 host->host_id, host->link[host->active_links[0]].link_id,
-			 host->link[host->active_links[0]].priority);
+			 host->host_id, host->link[active_links->links[0]].link_id,
+			 host->link[active_links->links[0]].priority);
 	} else {
 		log_info(knet_h, KNET_SUB_HOST, "host: %u has %u active links",
-			 host->host_id, host->active_link_entries);
+			 host->host_id, active_links->entries);
+	}
+
+out_publish:
+	__atomic_store_n(&host->active_links, active_links, __ATOMIC_RELEASE);
+
+	/*
+	 * the old active links are reused by the next update,
+	 * wait for TX readers that might still be using them
+	 */
+	epoch_synchronize(knet_h);
+
+	if (knet_h->host_id == host->host_id && knet_h->has_loop_link) {
+		return 0;
+	}
+
+	if (!active_links->entries) {
+		return 1;
+	}
+
+	return !host->status.reachable;
+}
+
+/*
+ * must be called with global write lock held
+ */
+void _host_dstcache_update_reachable(knet_handle_t knet_h, struct knet_host *host)
+{
+	int reachable = 0;
+
+	if (knet_h->host_id == host->host_id && knet_h->has_loop_link) {
+		return;
 	}
 
 	/* no active links, we can clean the circular buffers and indexes */
-	if (!host->active_link_entries) {
+	if (!host->active_links->entries) {
 		log_warn(knet_h, KNET_SUB_HOST, "host: %u has no active links", host->host_id);
 		_clear_cbuffers(host, 0);
 	} else {
@@ -728,6 +1056,7 @@ int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host)
 
 	if (host->status.reachable != reachable) {
 		host->status.reachable = reachable;
+		_host_reachable_list_update(knet_h);
 		if (knet_h->host_status_change_notify_fn) {
 			knet_h->host_status_change_notify_fn(
 						     knet_h->host_status_change_notify_fn_private_data,
@@ -737,6 +1066,4 @@ int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host)
 						     host->status.external);
 		}
 	}
-
-	return 0;
 }
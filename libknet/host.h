@@ -13,10 +13,15 @@
 #include "internals.h"
 
 int _seq_num_lookup(struct knet_host *host, seq_num_t seq_num, int defrag_buf, int clear_buf);
+int _seq_num_delivered(struct knet_host *host, seq_num_t seq_num);
 void _seq_num_set(struct knet_host *host, seq_num_t seq_num, int defrag_buf);
 
 int _send_host_info(knet_handle_t knet_h, const void *data, const size_t datalen);
 int _host_dstcache_update_async(knet_handle_t knet_h, struct knet_host *host);
-int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host);
+struct knet_host *_host_dstcache_queue_get(knet_handle_t knet_h);
+void _host_dstcache_queue_del(knet_handle_t knet_h, struct knet_host *host);
+int _host_dstcache_update_links(knet_handle_t knet_h, struct knet_host *host);
+void _host_dstcache_update_reachable(knet_handle_t knet_h, struct knet_host *host);
+void _host_reachable_list_update(knet_handle_t knet_h);
 
 #endif
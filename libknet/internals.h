@@ -32,9 +32,37 @@
 
 #define KNET_RING_RCVBUFF 8388608
 
+/*
+ * socket buffers autotuning (KNET_LINK_FLAG_SOCKBUF_AUTO):
+ * buffers are sized to KNET_SOCKBUF_AUTO_BDP_MUL times the
+ * bandwidth-delay product of the link, measured at most every
+ * KNET_SOCKBUF_AUTO_INTERVAL usecs, between KNET_RING_RCVBUFF_MIN
+ * and KNET_RING_RCVBUFF.
+ */
+#define KNET_RING_RCVBUFF_MIN 1048576
+#define KNET_SOCKBUF_AUTO_INTERVAL 1000000
+#define KNET_SOCKBUF_AUTO_BDP_MUL 4
+
+/*
+ * SO_BUSY_POLL time for KNET_LINK_FLAG_BUSYPOLL
+ */
+#define KNET_SOCK_BUSY_POLL_USECS 50
+
 #define PCKT_FRAG_MAX UINT8_MAX
 #define PCKT_RX_BUFS  512
 
+/*
+ * per packet ancillary data buffer, room for SO_RXQ_OVFL
+ * and transport specific control messages
+ */
+#define KNET_RX_CMSG_SIZE 64
+
+/*
+ * rx buffers are carved out of a single allocation,
+ * keep each one of them 64 bytes aligned
+ */
+#define KNET_RX_BUF_STRIDE (((KNET_DATABUFSIZE) + 63) & ~((size_t)63))
+
 #define KNET_EPOLL_MAX_EVENTS KNET_DATAFD_MAX + 1
 
 #define KNET_INTERNAL_DATA_CHANNEL KNET_DATAFD_MAX
@@ -50,12 +78,22 @@
 typedef void *knet_transport_link_t; /* per link transport handle */
 typedef void *knet_transport_t;      /* per knet_h transport handle */
 struct  knet_transport_ops;          /* Forward because of circular dependancy */
+struct  knet_compress_ops;           /* Forward because of circular dependancy */
+struct  knet_log_ring;               /* private to logging.c */
+struct  knet_epoch;                  /* private to epoch.c */
 
 struct knet_mmsghdr {
 	struct msghdr msg_hdr;	/* Message header */
 	unsigned int  msg_len;	/* Number of bytes transmitted */
 };
 
+/*
+ * knet_link->tx_unreachable states
+ */
+#define KNET_LINK_TX_REACHABLE		0	/* no error reported */
+#define KNET_LINK_TX_UNREACHABLE_ERRQUEUE	1	/* errqueue reported dst_addr unreachable */
+#define KNET_LINK_TX_UNREACHABLE_DOWN	2	/* demoted by TX, heartbeat brings the link down */
+
 struct knet_link {
 	/* required */
 	struct sockaddr_storage src_addr;
@@ -78,9 +116,10 @@ struct knet_link {
 	uint8_t transport;                      /* #defined constant from API */
 	knet_transport_link_t transport_link;   /* link_info_t from transport */
 	int outsock;
-	unsigned int configured:1;		/* set to 1 if src/dst have been configured transport initialized on this link*/
+	uint8_t configured;			/* set to 1 if src/dst have been configured transport initialized on this link*/
 	unsigned int transport_connected:1;	/* set to 1 if lower level transport is connected */
 	uint8_t received_pong;
+	uint8_t tx_unreachable;			/* see KNET_LINK_TX_ define above */
 	struct timespec ping_last;
 	/* used by PMTUD thread as temp per-link variables and should always contain the onwire_len value! */
 	uint32_t proto_overhead;		/* IP + UDP/SCTP overhead. NOT to be confused
@@ -94,10 +133,16 @@ struct knet_link {
 	uint32_t last_recv_mtu;
 	uint32_t pmtud_crypto_timeout_multiplier;/* used by PMTUd to adjust timeouts on high loads */
 	uint8_t has_valid_mtu;
+	/* used by heartbeat thread for KNET_LINK_FLAG_SOCKBUF_AUTO */
+	int sockbuf_size;
+	uint64_t sockbuf_last_bytes;
+	struct timespec sockbuf_last;
 };
 
 #define KNET_CBUFFER_SIZE 4096
 
+#define KNET_HOST_NAME_HASH_SIZE 4096	/* must be a power of 2 */
+
 struct knet_host_defrag_buf {
 	char buf[KNET_DATABUFSIZE];
 	uint8_t in_use;			/* 0 buffer is free, 1 is in use */
@@ -110,30 +155,78 @@ struct knet_host_defrag_buf {
 	struct timespec last_update;	/* keep time of the last pckt */
 };
 
+/*
+ * streaming compression state, one per channel.
+ * TX streams live in knet_handle, RX streams in the source knet_host.
+ */
+struct knet_compress_stream {
+	void *ctx;		/* module context dedicated to this stream, NULL if not allocated */
+	int model;		/* compress model that allocated ctx */
+	uint8_t interval;	/* TX: packets between stream restarts, 0 = streaming disabled */
+	uint8_t next;		/* next stream position to send (TX) or to expect (RX) */
+	uint8_t in_sync;	/* RX: history matches the sender. TX: 0 forces a restart */
+	uint8_t resync;		/* RX: restart requested to the sender. TX: restart requested by a receiver */
+	uint32_t dst_key;	/* TX: destinations of the current stream */
+};
+
+/*
+ * fields are ordered by access pattern. Keep the data used
+ * on every packet by RX/TX threads at the top of the struct
+ * so that it sits in the first cache lines, and the large
+ * and rarely accessed buffers at the bottom.
+ */
+/*
+ * set of links used to reach a host, see _host_dstcache_update_links
+ */
+struct knet_host_active_links {
+	uint8_t entries;
+	uint8_t links[KNET_MAX_LINK];
+};
+
 struct knet_host {
-	/* required */
+	/* hot data path state */
 	knet_node_id_t host_id;
-	/* configurable */
 	uint8_t link_handler_policy;
-	char name[KNET_MAX_HOST_LEN];
-	/* status */
 	struct knet_host_status status;
-	/* internals */
-	char circular_buffer[KNET_CBUFFER_SIZE];
+	struct knet_host_active_links *active_links; /* points to one of active_links_buf */
+	unsigned int active_links_rr;		/* next link for RR policy, protected by tx_mutex */
 	seq_num_t rx_seq_num;
 	seq_num_t untimed_rx_seq_num;
 	seq_num_t timed_rx_seq_num;
 	uint8_t got_data;
-	/* defrag/reassembly buffers */
-	struct knet_host_defrag_buf defrag_buf[KNET_MAX_LINK];
+	struct knet_host *next;
+	/* cold config and lookup data */
+	struct knet_host *name_next;		/* next host in the same host_name_index bucket */
+	char name[KNET_MAX_HOST_LEN];
+	/* circular buffers */
+	char circular_buffer[KNET_CBUFFER_SIZE];
 	char circular_buffer_defrag[KNET_CBUFFER_SIZE];
 	/* link stuff */
 	struct knet_link link[KNET_MAX_LINK];
-	uint8_t active_link_entries;
-	uint8_t active_links[KNET_MAX_LINK];
-	struct knet_host *next;
+	/* dst cache, the active_links currently published and the next one */
+	struct knet_host_active_links active_links_buf[2];
+	struct knet_host *dstcache_next;	/* next host in knet_h->dstcache_queue */
+	int dstcache_queued;			/* set while the host is in the queue */
+	uint8_t dstcache_reachable;		/* reachability update pending, dst link handler only */
+	/* defrag/reassembly buffers */
+	struct knet_host_defrag_buf defrag_buf[KNET_MAX_LINK];
+	/* compression streams received from this host, used only by RX thread */
+	struct knet_compress_stream compress_rx_stream[KNET_DATAFD_MAX + 1];
+};
+
+/*
+ * entry of the dense reachable host list walked by TX for broadcast.
+ * host_id is kept in the entry so the loop host can be skipped
+ * without touching struct knet_host, the host is only followed
+ * to dispatch the packet to its links
+ */
+struct knet_reachable_host {
+	knet_node_id_t host_id;
+	struct knet_host *host;
 };
 
+#define KNET_REACHABLE_HOSTS_MIN 16 /* first allocation of the reachable host list */
+
 struct knet_sock {
 	int sockfd[2];   /* sockfd[0] will always be application facing
 			  * and sockfd[1] internal if sockpair has been created by knet */
@@ -150,17 +243,68 @@ struct knet_fd_trackers {
 					     * with this fd */
 	void *data;			    /* pointer to the data */
 	void *access_list_match_entry_head; /* pointer to access list match_entry list head */
+	uint32_t rx_kernel_drops_last;	    /* last SO_RXQ_OVFL counter seen on this fd */
+	uint32_t rx_kernel_drops_pending;   /* drops not yet accounted to a link */
 };
 
 #define KNET_MAX_FDS KNET_MAX_HOST * KNET_MAX_LINK * 4
 
+/*
+ * fd trackers are allocated in chunks, only for the fds
+ * actually used by transports, see _set_fd_tracker()
+ */
+#define KNET_FD_TRACKER_CHUNK_BITS 8
+#define KNET_FD_TRACKER_CHUNK_SIZE (1 << KNET_FD_TRACKER_CHUNK_BITS)
+#define KNET_FD_TRACKER_CHUNKS (KNET_MAX_FDS / KNET_FD_TRACKER_CHUNK_SIZE)
+
 #define KNET_MAX_COMPRESS_METHODS UINT8_MAX
 
+/*
+ * threads with their own compression contexts
+ */
+#define KNET_COMPRESS_CTX_TX  0 /* TX thread and knet_send_sync, serialized by tx_mutex */
+#define KNET_COMPRESS_CTX_RX  1 /* RX thread */
+#define KNET_COMPRESS_CTX_MAX 2
+
+/*
+ * adaptive compression keeps statistics per channel
+ * and per packet size class (<256, <512, ... >=16K bytes)
+ */
+#define KNET_COMPRESS_ADAPTIVE_BUCKETS 8
+
+struct knet_compress_adaptive {
+	uint32_t ratio;   /* compressed/original size in 1/1024 units (running average) */
+	uint32_t cost;    /* compression time in 1/1024 ns per original byte (running average) */
+	uint32_t skip;    /* packets to send uncompressed before probing again */
+	uint32_t samples; /* 0 until the first packet has been measured */
+};
+
+/*
+ * per handle state of rate limited log call sites (see logging.h)
+ */
+#define KNET_LOG_RATELIMIT_BURST 10
+#define KNET_LOG_RATELIMIT_RATE  1
+#define KNET_LOG_RATELIMIT_SITES 128
+
+struct knet_log_ratelimit {
+	const void *site;	/* call site owning this entry, NULL if free */
+	uint64_t last;		/* last refill in ms, 0 if never used */
+	uint32_t tokens;
+	uint32_t suppressed;
+};
+
 struct knet_handle_stats_extra {
 	uint64_t tx_crypt_pmtu_packets;
 	uint64_t tx_crypt_pmtu_reply_packets;
 	uint64_t tx_crypt_ping_packets;
 	uint64_t tx_crypt_pong_packets;
+	/*
+	 * debug counters, updated atomically from the data path
+	 * and not reported by knet_handle_get_stats
+	 */
+	uint64_t tx_udp_gso_trains;
+	uint64_t rx_udp_gro_packets;
+	uint64_t data_path_stops;	/* get_global_wrlock calls, they stop RX/TX */
 };
 
 struct knet_handle {
@@ -169,11 +313,13 @@ struct knet_handle {
 	struct knet_sock sockfd[KNET_DATAFD_MAX + 1];
 	int logfd;
 	uint8_t log_levels[KNET_MAX_SUBSYSTEMS];
+	struct knet_log_ring *log_ring;	/* NULL when messages are written directly to logfd */
 	int hostsockfd[2];
-	int dstsockfd[2];
 	int send_to_links_epollfd;
 	int recv_from_links_epollfd;
-	int dst_link_handler_epollfd;
+	struct knet_host *dstcache_queue;	/* hosts waiting for a dst cache update, see host.c */
+	pthread_mutex_t dstcache_mutex;		/* only used to wake up the dst link handler thread */
+	pthread_cond_t dstcache_cond;
 	uint8_t use_access_lists; /* set to 0 for disable, 1 for enable */
 	unsigned int pmtud_interval;
 	unsigned int manual_mtu;
@@ -181,8 +327,12 @@ struct knet_handle {
 				 * without frags */
 	struct knet_host *host_head;
 	struct knet_host *host_index[KNET_MAX_HOST];
+	struct knet_host **host_name_index;	/* name -> host hash table, NULL until a host name is set */
+	struct knet_reachable_host *reachable_hosts; /* dense list of reachable hosts for broadcast */
+	size_t reachable_hosts_entries;
+	size_t reachable_hosts_size;	/* allocated entries, grows with the host list */
 	knet_transport_t transports[KNET_MAX_TRANSPORTS+1];
-	struct knet_fd_trackers knet_transport_fd_tracker[KNET_MAX_FDS]; /* track status for each fd handled by transports */
+	struct knet_fd_trackers *knet_transport_fd_tracker[KNET_FD_TRACKER_CHUNKS]; /* track status for each fd handled by transports */
 	struct knet_handle_stats stats;
 	struct knet_handle_stats_extra stats_extra;
 	pthread_mutex_t handle_stats_mutex;	/* used to protect handle stats */
@@ -192,22 +342,26 @@ struct knet_handle {
 	struct knet_header *recv_from_sock_buf;
 	struct knet_header *send_to_links_buf[PCKT_FRAG_MAX];
 	struct knet_header *recv_from_links_buf[PCKT_RX_BUFS];
+	uint8_t *recv_from_links_pool;		/* backing memory for recv_from_links_buf */
+	struct knet_header *recv_from_links_buf_gro; /* UDP GRO segment being parsed */
 	struct knet_header *pingbuf;
 	struct knet_header *pmtudbuf;
 	uint8_t threads_status[KNET_THREAD_MAX];
 	uint8_t threads_flush_queue[KNET_THREAD_MAX];
 	useconds_t threads_timer_res;
 	pthread_mutex_t threads_status_mutex;
+	pthread_cond_t threads_status_cond;
 	pthread_t send_to_links_thread;
 	pthread_t recv_from_links_thread;
 	pthread_t heartbt_thread;
 	pthread_t dst_link_handler_thread;
 	pthread_t pmtud_link_handler_thread;
 	pthread_rwlock_t global_rwlock;		/* global config lock */
+	struct knet_epoch *epoch;		/* data path readers, see epoch.c */
 	pthread_mutex_t pmtud_mutex;		/* pmtud mutex to handle conditional send/recv + timeout */
 	pthread_cond_t pmtud_cond;		/* conditional for above */
 	pthread_mutex_t tx_mutex;		/* used to protect knet_send_sync and TX thread */
-	pthread_mutex_t hb_mutex;		/* used to protect heartbeat thread and seq_num broadcasting */
+	pthread_mutex_t hb_mutex;		/* used to protect heartbeat thread, seq_num broadcasting and link up/down */
 	pthread_mutex_t backoff_mutex;		/* used to protect dst_link->pong_timeout_adj */
 	pthread_mutex_t kmtu_mutex;		/* used to protect kernel_mtu */
 	uint32_t kernel_mtu;			/* contains the MTU detected by the kernel on a given link */
@@ -215,10 +369,12 @@ struct knet_handle {
 	int pmtud_running;
 	int pmtud_forcerun;
 	int pmtud_abort;
-	struct crypto_instance *crypto_instance;
-	size_t sec_block_size;
-	size_t sec_hash_size;
-	size_t sec_salt_size;
+	struct crypto_instance *crypto_config[KNET_MAX_CRYPTO_INSTANCES + 1]; /* 1 based, published with get_global_cfg_wrlock */
+	struct crypto_instance *crypto_instance; /* config used for TX, NULL when crypto is disabled */
+	uint8_t crypto_in_use_config;
+	uint8_t crypto_rx_configs;		/* number of configs used to decrypt, __atomic, counts only published crypto_config[] */
+	uint8_t crypto_rx_hint;			/* last config (- 1) that decrypted a packet */
+	uint8_t crypto_preheader;		/* see KNET_CRYPTO_PREHEADER_SIZE */
 	unsigned char *send_to_links_buf_crypt[PCKT_FRAG_MAX];
 	unsigned char *recv_from_links_buf_crypt;
 	unsigned char *recv_from_links_buf_decrypt;
@@ -228,6 +384,14 @@ struct knet_handle {
 	int compress_level;
 	size_t compress_threshold;
 	void *compress_int_data[KNET_MAX_COMPRESS_METHODS]; /* for compress method private data */
+	struct knet_compress_ops *decompress_ops[KNET_MAX_COMPRESS_METHODS]; /* models ready to decompress, NULL if not loaded/init */
+	void *compress_ctx[KNET_COMPRESS_CTX_MAX][KNET_MAX_COMPRESS_METHODS]; /* per thread compress method contexts */
+	unsigned char *compress_dict;	/* shared compression dictionary */
+	size_t compress_dict_len;
+	uint32_t compress_dict_id;	/* sent onwire to detect dictionary mismatches between nodes */
+	uint32_t compress_adaptive_mbps;	/* 0 = adaptive compression disabled */
+	struct knet_compress_adaptive compress_adaptive[KNET_DATAFD_MAX + 1][KNET_COMPRESS_ADAPTIVE_BUCKETS];
+	struct knet_compress_stream compress_tx_stream[KNET_DATAFD_MAX + 1];
 	unsigned char *recv_from_links_buf_decompress;
 	unsigned char *send_to_links_buf_compress;
 	seq_num_t tx_seq_num;
@@ -274,6 +438,7 @@ struct knet_handle {
 		int errorno);
 	int fini_in_progress;
 	uint64_t flags;
+	struct knet_log_ratelimit log_ratelimit[KNET_LOG_RATELIMIT_SITES];
 };
 
 extern pthread_rwlock_t shlib_rwlock;       /* global shared lib load lock */
@@ -416,6 +581,15 @@ typedef struct knet_transport_ops {
  * transport the opportunity to take actions.
  */
 	int (*transport_link_is_down)(knet_handle_t knet_h, struct knet_link *link);
+
+/*
+ * optional, send vlen packets (same semantics as _sendmmsg).
+ * Transports can use it to batch packets to the same destination.
+ * NULL uses _sendmmsg.
+ *
+ * transport_tx_sendmmsg is invoked with global_rwlock
+ */
+	int (*transport_tx_sendmmsg)(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msgvec, unsigned int vlen, unsigned int flags);
 } knet_transport_ops_t;
 
 struct pretty_names {
@@ -423,4 +597,24 @@ struct pretty_names {
 	uint8_t val;
 };
 
+/*
+ * returns the tracker for sockfd or NULL if sockfd
+ * has never been used by a transport
+ */
+static inline struct knet_fd_trackers *_get_fd_tracker(knet_handle_t knet_h, int sockfd)
+{
+	struct knet_fd_trackers *chunk;
+
+	if ((sockfd < 0) || (sockfd >= KNET_MAX_FDS)) {
+		return NULL;
+	}
+
+	chunk = __atomic_load_n(&knet_h->knet_transport_fd_tracker[sockfd >> KNET_FD_TRACKER_CHUNK_BITS], __ATOMIC_ACQUIRE);
+	if (!chunk) {
+		return NULL;
+	}
+
+	return &chunk[sockfd & (KNET_FD_TRACKER_CHUNK_SIZE - 1)];
+}
+
 #endif
@@ -78,6 +78,29 @@ typedef uint16_t knet_node_id_t;
 
 #define KNET_LINK_FLAG_TRAFFICHIPRIO (1ULL << 0)
 
+/*
+ * Size the socket send/receive buffers from the measured
+ * link round trip time and throughput, instead of the
+ * fixed 8MB default. Buffers start at 1MB and only grow.
+ */
+
+#define KNET_LINK_FLAG_SOCKBUF_AUTO (1ULL << 1)
+
+/*
+ * Where possible, busy poll the socket for incoming packets.
+ * On Linux this sets SO_BUSY_POLL and SO_PREFER_BUSY_POLL,
+ * see socket(7). It trades CPU time for lower latency and it
+ * requires a privileged handle (see KNET_HANDLE_FLAG_PRIVILEGED).
+ */
+
+#define KNET_LINK_FLAG_BUSYPOLL (1ULL << 2)
+
+/*
+ * NOTE: UDP links with the same source address share the same
+ * socket, socket related flags are applied by the first link
+ * that opens the socket.
+ */
+
 /*
  * Handle flags
  */
@@ -116,8 +139,10 @@ typedef struct knet_handle *knet_handle_t;
  *            Setting to 0 will disable logging from libknet.
  *            It is possible to enable logging at any given time (see logging API).
  *            Make sure to either read from this filedescriptor properly and/or
- *            mark it O_NONBLOCK, otherwise if the fd becomes full, libknet could
- *            block.
+ *            mark it O_NONBLOCK. Messages are written by a dedicated libknet
+ *            thread: if the fd becomes full, libknet data threads do not block
+ *            but messages are dropped (see log_dropped_messages in
+ *            knet_handle_get_stats).
  *            It is strongly encouraged to use pipes (ex: pipe(2) or pipe2(2)) for
  *            logging fds due to the atomic nature of writes between fds.
  *            See also libknet test suite for reference and guidance.
@@ -711,6 +736,8 @@ int knet_handle_pmtud_get(knet_handle_t knet_h,
 #define KNET_MIN_KEY_LEN  128
 #define KNET_MAX_KEY_LEN 4096
 
+#define KNET_MAX_CRYPTO_INSTANCES 2
+
 struct knet_handle_crypto_cfg {
 	char		crypto_model[16];
 	char		crypto_cipher_type[16];
@@ -764,7 +791,10 @@ struct knet_handle_crypto_cfg {
  *   to processed.
  * - enabling crypto might reduce the overall throughtput
  *   due to crypto data overhead.
- * - re-keying is not implemented yet.
+ * - knet_handle_crypto only manages crypto config 1 and
+ *   it will clear any other config. See knet_handle_crypto_set_config
+ *   and knet_handle_crypto_use_config for re-keying a running
+ *   instance without packet loss.
  * - private/public key encryption/hashing is not currently
  *   planned.
  * - crypto key must be the same for all hosts in the same
@@ -787,6 +817,99 @@ struct knet_handle_crypto_cfg {
 int knet_handle_crypto(knet_handle_t knet_h,
 		       struct knet_handle_crypto_cfg *knet_handle_crypto_cfg);
 
+/**
+ * knet_handle_crypto_set_config
+ *
+ * @brief set up one of the crypto configs of a knet handle
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * knet_handle_crypto_cfg -
+ *            pointer to a knet_handle_crypto_cfg structure,
+ *            see knet_handle_crypto for details.
+ *            Setting crypto_model to "none" will clear the config.
+ *
+ * config_num -
+ *            crypto config to set, 1 to KNET_MAX_CRYPTO_INSTANCES.
+ *
+ * Implementation notes:
+ * - all configured crypto configs are used to decrypt incoming
+ *   packets, only the one selected by knet_handle_crypto_use_config
+ *   is used to encrypt outgoing packets.
+ * - a key rotation looks like:
+ *   1) knet_handle_crypto_set_config(new key, 2) on all nodes
+ *   2) knet_handle_crypto_use_config(2) on all nodes
+ *   3) knet_handle_crypto_set_config("none", 1) on all nodes
+ *   Nodes keep receiving packets encrypted with either key
+ *   during the whole sequence.
+ * - the config in use for TX cannot be cleared (errno EBUSY).
+ * - a failure in crypto init will restore the previous crypto
+ *   configuration for config_num.
+ *
+ * @return
+ * knet_handle_crypto_set_config returns:
+ * @retval 0 on success
+ * @retval -1 on error and errno is set.
+ * @retval -2 on crypto subsystem initialization error. No errno is provided at the moment (yet).
+ */
+
+int knet_handle_crypto_set_config(knet_handle_t knet_h,
+				  struct knet_handle_crypto_cfg *knet_handle_crypto_cfg,
+				  uint8_t config_num);
+
+/**
+ * knet_handle_crypto_use_config
+ *
+ * @brief select the crypto config used to encrypt outgoing packets
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * config_num -
+ *            crypto config to use, 1 to KNET_MAX_CRYPTO_INSTANCES,
+ *            or 0 to send packets in clear (incoming packets will
+ *            still be decrypted with any configured config).
+ *            config_num has to be configured via
+ *            knet_handle_crypto_set_config first.
+ *
+ * @return
+ * knet_handle_crypto_use_config returns:
+ * @retval 0 on success
+ * @retval -1 on error and errno is set.
+ */
+
+int knet_handle_crypto_use_config(knet_handle_t knet_h,
+				  uint8_t config_num);
+
+/**
+ * knet_handle_crypto_set_preheader
+ *
+ * @brief prepend a cleartext copy of the packet header to encrypted packets
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - 1 to prepend the first 8 bytes of the
+ *            packet header (version, type, source node id and, for data,
+ *            the sequence number) in clear to every encrypted packet.
+ *            Incoming packets with a pre-header, from unknown or
+ *            unreachable nodes and data packets already delivered,
+ *            are then dropped before decryption.
+ *            The pre-header is verified against the decrypted header.
+ *            0 (default) to disable.
+ *            Incoming packets are decrypted with or without pre-header
+ *            regardless of this setting, so it can be changed on one
+ *            node at a time.
+ *            It has no effect with crypto_cipher_type "none", that
+ *            already sends the header in clear.
+ *
+ * @return
+ * knet_handle_crypto_set_preheader returns:
+ * @retval 0 on success
+ * @retval -1 on error and errno is set.
+ */
+
+int knet_handle_crypto_set_preheader(knet_handle_t knet_h,
+				     uint8_t enabled);
+
 
 
 #define KNET_COMPRESS_THRESHOLD 100
@@ -855,6 +978,131 @@ struct knet_handle_compress_cfg {
 int knet_handle_compress(knet_handle_t knet_h,
 			 struct knet_handle_compress_cfg *knet_handle_compress_cfg);
 
+#define KNET_COMPRESS_DICT_MAX_SIZE 1048576
+
+/**
+ * knet_handle_compress_set_dict
+ *
+ * @brief Set up a shared dictionary for packet compression
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * dict     - pointer to the dictionary. libknet keeps its own copy.
+ *            NULL removes the dictionary.
+ *
+ * dict_len - length of the dictionary, up to KNET_COMPRESS_DICT_MAX_SIZE.
+ *            Must be 0 when dict is NULL.
+ *
+ * Small packets carry too little data to compress well on their own.
+ * A dictionary built from samples of the traffic gives the compressor
+ * a shared history to reference, which allows small and repetitive
+ * messages to be compressed effectively.
+ *
+ * The dictionary can be a zstd dictionary (see zstd --train) or any raw
+ * sample of representative traffic.
+ *
+ * Implementation notes:
+ * - only zstd and lz4 make use of the dictionary. Other models keep
+ *   compressing packets without it.
+ * - all nodes must be configured with the same dictionary. Packets
+ *   compressed with a different dictionary are dropped and accounted
+ *   as rx_failed_to_decompress.
+ * - nodes running a version of libknet without dictionary support
+ *   drop packets compressed with a dictionary.
+ * - the dictionary can be changed at any time, and it is retained
+ *   across knet_handle_compress calls.
+ *
+ * @return
+ * knet_handle_compress_set_dict returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_compress_set_dict(knet_handle_t knet_h,
+				  const unsigned char *dict,
+				  size_t dict_len);
+
+/**
+ * knet_handle_compress_set_adaptive
+ *
+ * @brief Let libknet decide when compression is worth the CPU time
+ *
+ * knet_h    - pointer to knet_handle_t
+ *
+ * link_mbps - expected bandwidth of the links in Mbit/s.
+ *             0 disables adaptive compression (default).
+ *
+ * When adaptive compression is enabled, libknet measures the compression
+ * ratio and the CPU time spent compressing, per channel and per packet
+ * size class. A size class stops being compressed when the time saved
+ * on the wire (given link_mbps) is lower than the time spent compressing,
+ * or when the data does not compress at all (for example when the
+ * application already encrypts or compresses its payload).
+ * Size classes that are not compressed are probed again periodically,
+ * so compression resumes if the traffic changes.
+ *
+ * Implementation notes:
+ * - adaptive compression only applies to packets above compress_threshold
+ *   and only when a compress_model is configured (see knet_handle_compress).
+ * - the configured compress_model and compress_level are always used
+ *   for the packets that are compressed.
+ * - the decision is local to the sending node and requires no changes
+ *   on the receiving nodes.
+ * - statistics are reset every time knet_handle_compress or
+ *   knet_handle_compress_set_adaptive are called.
+ *
+ * @return
+ * knet_handle_compress_set_adaptive returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_compress_set_adaptive(knet_handle_t knet_h,
+				      uint32_t link_mbps);
+
+/**
+ * knet_handle_compress_set_stream
+ *
+ * @brief Compress the data sent on a channel as a stream
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * channel  - data channel to configure, as returned by knet_handle_add_datafd.
+ *
+ * resync_interval - number of packets after which the stream restarts.
+ *            0 disables streaming on this channel (default).
+ *
+ * By default every packet is compressed on its own. When streaming is
+ * enabled, each packet can reference the data sent in the previous packets
+ * of the same channel, which greatly improves the compression of small
+ * and repetitive messages (replication traffic, RPCs...).
+ *
+ * The stream restarts every resync_interval packets, when the destinations
+ * of the packets change and when a packet could not be compressed.
+ * When a packet of a stream is lost or received out of order, the receiving
+ * node drops the following packets of the stream until it restarts.
+ * Use a short resync_interval on links that can lose or reorder packets
+ * (UDP), a long one on reliable links (SCTP).
+ *
+ * Implementation notes:
+ * - only zstd supports streaming. Other models compress every packet
+ *   on its own regardless of this setting. The stream window is bounded
+ *   to 128KB per channel and per node on both sides.
+ * - streaming takes precedence over the shared dictionary.
+ * - nodes running a version of libknet without streaming support
+ *   drop packets compressed as part of a stream.
+ * - the setting is retained across knet_handle_compress calls.
+ *
+ * @return
+ * knet_handle_compress_set_stream returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_compress_set_stream(knet_handle_t knet_h,
+				    int8_t channel,
+				    uint8_t resync_interval);
+
 
 
 struct knet_handle_stats {
@@ -889,6 +1137,40 @@ struct knet_handle_stats {
 	uint64_t rx_crypt_time_ave;
 	uint64_t rx_crypt_time_min;
 	uint64_t rx_crypt_time_max;
+
+	/* Packets compressed with the shared dictionary, also counted above */
+	uint64_t tx_dict_compressed_packets;
+	uint64_t tx_dict_compressed_original_bytes;
+	uint64_t tx_dict_compressed_size_bytes;
+
+	uint64_t rx_dict_compressed_packets;
+	uint64_t rx_dict_compressed_original_bytes;
+	uint64_t rx_dict_compressed_size_bytes;
+
+	/* Packets sent uncompressed by adaptive compression, also counted in tx_uncompressed_packets */
+	uint64_t tx_adaptive_uncompressed_packets;
+
+	/* Packets compressed as part of a stream, also counted above */
+	uint64_t tx_stream_compressed_packets;
+	uint64_t tx_stream_compressed_original_bytes;
+	uint64_t tx_stream_compressed_size_bytes;
+
+	uint64_t rx_stream_compressed_packets;
+	uint64_t rx_stream_compressed_original_bytes;
+	uint64_t rx_stream_compressed_size_bytes;
+
+	/* Stream packets dropped after a loss, waiting for the stream to restart */
+	uint64_t rx_stream_out_of_sync_packets;
+
+	/* Log messages dropped because logfd could not keep up */
+	uint64_t log_dropped_messages;
+
+	/*
+	 * Packets compressed with a dictionary that does not match the
+	 * local one (or with no local dictionary), also counted in
+	 * rx_failed_to_decompress
+	 */
+	uint64_t rx_dict_mismatch_packets;
 };
 
 /**
@@ -2027,6 +2309,14 @@ struct knet_link_stats {
 	time_t   last_down_times[MAX_LINK_EVENTS];
 	int8_t   last_up_time_index;
 	int8_t   last_down_time_index;
+
+	/*
+	 * packets dropped by the kernel because the socket receive
+	 * buffer was full (Linux UDP only, SO_RXQ_OVFL).
+	 * When a socket is shared by several links, drops are
+	 * accounted to the link receiving the next packet.
+	 */
+	uint64_t rx_kernel_drops;
 	/* Always add new stats at the end */
 };
 
@@ -2108,6 +2398,7 @@ int knet_link_get_status(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
  *                        but this is ready for future and can avoid
  *                        an API/ABI breakage later on.
  *            This function MUST NEVER block or add substantial delays.
+ *            The knet_*_get_* functions can be called from this function.
  *
  * @return
  * knet_host_status_change_notify returns
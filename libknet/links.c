@@ -11,17 +11,34 @@
 
 #include <errno.h>
 #include <netdb.h>
+#include <stddef.h>
 #include <string.h>
 #include <pthread.h>
 
+#include "epoch.h"
 #include "internals.h"
 #include "logging.h"
 #include "links.h"
 #include "transports.h"
+#include "transport_common.h"
 #include "host.h"
 #include "threads_common.h"
 #include "links_acl.h"
 
+void _link_down(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_link *dst_link)
+{
+	memset(&dst_link->pmtud_last, 0, sizeof(struct timespec));
+	dst_link->received_pong = 0;
+	__atomic_store_n(&dst_link->tx_unreachable, KNET_LINK_TX_REACHABLE, __ATOMIC_RELAXED);
+	dst_link->status.pong_last.tv_nsec = 0;
+	dst_link->pong_timeout_backoff = KNET_LINK_PONG_TIMEOUT_BACKOFF;
+	if (dst_link->status.connected == 1) {
+		log_info(knet_h, KNET_SUB_LINK, "host: %u link: %u is down",
+			 dst_host->host_id, dst_link->link_id);
+		_link_updown(knet_h, dst_host->host_id, dst_link->link_id, dst_link->status.enabled, 0, 1);
+	}
+}
+
 int _link_updown(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t link_id,
 		 unsigned int enabled, unsigned int connected, unsigned int lock_stats)
 {
@@ -123,6 +140,7 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 	int savederrno = 0, err = 0, i;
 	struct knet_host *host;
 	struct knet_link *link;
+	struct knet_crypto_overhead overhead;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -150,7 +168,20 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	/*
+	 * UDP links are configured without stopping the data path.
+	 * The socket is handed to RX only once it is set up, access
+	 * lists are published with epoch_synchronize() and RX ignores
+	 * the link until it is marked configured.
+	 * Loopback changes the host reachability in place and SCTP
+	 * shares its sockets with the transport threads, both still
+	 * stop the readers.
+	 */
+	if (transport == KNET_TRANSPORT_UDP) {
+		savederrno = get_global_cfg_wrlock(knet_h);
+	} else {
+		savederrno = get_global_wrlock(knet_h);
+	}
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get write lock: %s",
 			strerror(savederrno));
@@ -268,13 +299,13 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 	link->latency_max_samples = KNET_LINK_DEFAULT_PING_PRECISION;
 	link->status.stats.latency_samples = 0;
 	link->flags = flags;
-
-	savederrno = pthread_mutex_init(&link->link_stats_mutex, NULL);
-	if (savederrno) {
-		log_err(knet_h, KNET_SUB_LINK, "Unable to initialize link stats mutex: %s", strerror(savederrno));
-		err = -1;
-		goto exit_unlock;
+	if (flags & KNET_LINK_FLAG_SOCKBUF_AUTO) {
+		link->sockbuf_size = KNET_RING_RCVBUFF_MIN;
+	} else {
+		link->sockbuf_size = KNET_RING_RCVBUFF;
 	}
+	link->sockbuf_last_bytes = 0;
+	memset(&link->sockbuf_last, 0, sizeof(struct timespec));
 
 	if (transport_link_set_config(knet_h, link, transport) < 0) {
 		savederrno = errno;
@@ -301,14 +332,11 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		}
 	}
 
-	link->configured = 1;
-	log_debug(knet_h, KNET_SUB_LINK, "host: %u link: %u is configured",
-		  host_id, link_id);
-
 	if (transport == KNET_TRANSPORT_LOOPBACK) {
 		knet_h->has_loop_link = 1;
 		knet_h->loop_link = link_id;
 		host->status.reachable = 1;
+		_host_reachable_list_update(knet_h);
 		link->status.mtu = KNET_PMTUD_SIZE_V6;
 	} else {
 		/*
@@ -321,12 +349,13 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 			 * with static link we can be more precise than using
 			 * the generic calc_min_mtu()
 			 */
+			calc_crypto_overhead(knet_h, &overhead);
 			switch (link->dst_addr.ss_family) {
 				case AF_INET6:
-					link->status.mtu =  calc_max_data_outlen(knet_h, KNET_PMTUD_MIN_MTU_V6 - (KNET_PMTUD_OVERHEAD_V6 + link->proto_overhead));
+					link->status.mtu =  calc_max_data_outlen(&overhead, KNET_PMTUD_MIN_MTU_V6 - (KNET_PMTUD_OVERHEAD_V6 + link->proto_overhead));
 					break;
 				case AF_INET:
-					link->status.mtu =  calc_max_data_outlen(knet_h, KNET_PMTUD_MIN_MTU_V4 - (KNET_PMTUD_OVERHEAD_V4 + link->proto_overhead));
+					link->status.mtu =  calc_max_data_outlen(&overhead, KNET_PMTUD_MIN_MTU_V4 - (KNET_PMTUD_OVERHEAD_V4 + link->proto_overhead));
 					break;
 			}
 		} else {
@@ -340,6 +369,14 @@ int knet_link_set_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		link->has_valid_mtu = 1;
 	}
 
+	/*
+	 * pairs with the RX check, the link has to be fully
+	 * set up before it is marked configured
+	 */
+	__atomic_store_n(&link->configured, 1, __ATOMIC_RELEASE);
+	log_debug(knet_h, KNET_SUB_LINK, "host: %u link: %u is configured",
+		  host_id, link_id);
+
 exit_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 	errno = err ? savederrno : 0;
@@ -387,8 +424,8 @@ int knet_link_get_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -406,7 +443,7 @@ int knet_link_get_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -433,7 +470,7 @@ int knet_link_get_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 	}
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -529,19 +566,24 @@ int knet_link_clear_config(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 	 * longer in use by the transport.
 	 */
 	if ((transport_get_acl_type(knet_h, link->transport) == USE_GENERIC_ACL) &&
-	    (knet_h->knet_transport_fd_tracker[sock].transport == KNET_MAX_TRANSPORTS)) {
+	    (_is_valid_fd(knet_h, sock) == 0)) {
 		check_rmall(knet_h, sock, transport);
 	}
 
-	pthread_mutex_destroy(&link->link_stats_mutex);
-
-	memset(link, 0, sizeof(struct knet_link));
+	/*
+	 * the stats mutex lives as long as the host (see knet_host_add),
+	 * reset everything else
+	 */
+	memset(link, 0, offsetof(struct knet_link, link_stats_mutex));
+	memset((uint8_t *)link + offsetof(struct knet_link, link_stats_mutex) + sizeof(pthread_mutex_t), 0,
+	       sizeof(struct knet_link) - offsetof(struct knet_link, link_stats_mutex) - sizeof(pthread_mutex_t));
 	link->link_id = link_id;
 
 	if (knet_h->has_loop_link && host_id == knet_h->host_id && link_id == knet_h->loop_link) {
 		knet_h->has_loop_link = 0;
-		if (host->active_link_entries == 0) {
+		if (host->active_links->entries == 0) {
 			host->status.reachable = 0;
+			_host_reachable_list_update(knet_h);
 		}
 	}
 
@@ -576,9 +618,13 @@ int knet_link_set_enable(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	/*
+	 * the data path only looks at the link status, the active
+	 * links are published by the dst link handler thread
+	 */
+	savederrno = get_global_cfg_wrlock(knet_h);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
+		log_err(knet_h, KNET_SUB_LINK, "Unable to get write lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
@@ -608,9 +654,23 @@ int knet_link_set_enable(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		goto exit_unlock;
 	}
 
-	err = _link_updown(knet_h, host_id, link_id, enabled, link->status.connected, 0);
+	/*
+	 * serialize with the RX and heartbeat threads bringing
+	 * the link up or down
+	 */
+	savederrno = pthread_mutex_lock(&knet_h->hb_mutex);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_LINK, "Unable to get hb mutex lock: %s",
+			strerror(savederrno));
+		err = -1;
+		goto exit_unlock;
+	}
+
+	err = _link_updown(knet_h, host_id, link_id, enabled, link->status.connected, 1);
 	savederrno = errno;
 
+	pthread_mutex_unlock(&knet_h->hb_mutex);
+
 	if (enabled) {
 		goto exit_unlock;
 	}
@@ -646,8 +706,8 @@ int knet_link_get_enable(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -665,7 +725,7 @@ int knet_link_get_enable(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -676,7 +736,7 @@ int knet_link_get_enable(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 	*enabled = link->status.enabled;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -703,7 +763,7 @@ int knet_link_set_pong_count(knet_handle_t knet_h, knet_node_id_t host_id, uint8
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	savederrno = get_global_cfg_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get write lock: %s",
 			strerror(savederrno));
@@ -730,7 +790,10 @@ int knet_link_set_pong_count(knet_handle_t knet_h, knet_node_id_t host_id, uint8
 		goto exit_unlock;
 	}
 
-	link->pong_count = pong_count;
+	/*
+	 * read by RX without locks
+	 */
+	__atomic_store_n(&link->pong_count, pong_count, __ATOMIC_RELAXED);
 
 	log_debug(knet_h, KNET_SUB_LINK,
 		  "host: %u link: %u pong count update: %u",
@@ -764,8 +827,8 @@ int knet_link_get_pong_count(knet_handle_t knet_h, knet_node_id_t host_id, uint8
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -783,7 +846,7 @@ int knet_link_get_pong_count(knet_handle_t knet_h, knet_node_id_t host_id, uint8
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -794,7 +857,7 @@ int knet_link_get_pong_count(knet_handle_t knet_h, knet_node_id_t host_id, uint8
 	*pong_count = link->pong_count;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -831,7 +894,7 @@ int knet_link_set_ping_timers(knet_handle_t knet_h, knet_node_id_t host_id, uint
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	savederrno = get_global_cfg_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get write lock: %s",
 			strerror(savederrno));
@@ -858,9 +921,13 @@ int knet_link_set_ping_timers(knet_handle_t knet_h, knet_node_id_t host_id, uint
 		goto exit_unlock;
 	}
 
+	/*
+	 * the heartbeat thread is stopped by the write lock,
+	 * RX reads the pong timeout and precision without locks
+	 */
 	link->ping_interval = interval * 1000; /* microseconds */
-	link->pong_timeout = timeout * 1000; /* microseconds */
-	link->latency_max_samples = precision;
+	__atomic_store_n(&link->pong_timeout, timeout * 1000, __ATOMIC_RELAXED); /* microseconds */
+	__atomic_store_n(&link->latency_max_samples, precision, __ATOMIC_RELAXED);
 
 	log_debug(knet_h, KNET_SUB_LINK,
 		  "host: %u link: %u timeout update - interval: %llu timeout: %llu precision: %u",
@@ -904,8 +971,8 @@ int knet_link_get_ping_timers(knet_handle_t knet_h, knet_node_id_t host_id, uint
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -923,7 +990,7 @@ int knet_link_get_ping_timers(knet_handle_t knet_h, knet_node_id_t host_id, uint
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -936,7 +1003,7 @@ int knet_link_get_ping_timers(knet_handle_t knet_h, knet_node_id_t host_id, uint
 	*precision = link->latency_max_samples;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -947,7 +1014,6 @@ int knet_link_set_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 	int savederrno = 0, err = 0;
 	struct knet_host *host;
 	struct knet_link *link;
-	uint8_t old_priority;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -959,7 +1025,7 @@ int knet_link_set_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	savederrno = get_global_cfg_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get write lock: %s",
 			strerror(savederrno));
@@ -986,23 +1052,20 @@ int knet_link_set_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 		goto exit_unlock;
 	}
 
-	old_priority = link->priority;
-
 	if (link->priority == priority) {
 		err = 0;
 		goto exit_unlock;
 	}
 
-	link->priority = priority;
+	__atomic_store_n(&link->priority, priority, __ATOMIC_RELAXED);
 
-	if (_host_dstcache_update_sync(knet_h, host)) {
-		savederrno = errno;
-		log_debug(knet_h, KNET_SUB_LINK,
-			  "Unable to update link priority (host: %u link: %u priority: %u): %s",
-			  host_id, link_id, link->priority, strerror(savederrno));
-		link->priority = old_priority;
-		err = -1;
-		goto exit_unlock;
+	/*
+	 * publish the new active links right away, reachability
+	 * changes stop the readers and are left to the dst link
+	 * handler thread
+	 */
+	if (_host_dstcache_update_links(knet_h, host)) {
+		_host_dstcache_update_async(knet_h, host);
 	}
 
 	log_debug(knet_h, KNET_SUB_LINK,
@@ -1037,8 +1100,8 @@ int knet_link_get_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1056,7 +1119,7 @@ int knet_link_get_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -1067,7 +1130,7 @@ int knet_link_get_priority(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t
 	*priority = link->priority;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1094,8 +1157,8 @@ int knet_link_get_link_list(knet_handle_t knet_h, knet_node_id_t host_id,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1113,7 +1176,7 @@ int knet_link_get_link_list(knet_handle_t knet_h, knet_node_id_t host_id,
 
 	for (i = 0; i < KNET_MAX_LINK; i++) {
 		link = &host->link[i];
-		if (!link->configured) {
+		if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 			continue;
 		}
 		link_ids[count] = i;
@@ -1123,7 +1186,7 @@ int knet_link_get_link_list(knet_handle_t knet_h, knet_node_id_t host_id,
 	*link_ids_entries = count;
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
@@ -1150,8 +1213,8 @@ int knet_link_get_status(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_LINK, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -1169,7 +1232,7 @@ int knet_link_get_status(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 
 	link = &host->link[link_id];
 
-	if (!link->configured) {
+	if (!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) {
 		err = -1;
 		savederrno = EINVAL;
 		log_err(knet_h, KNET_SUB_LINK, "host %u link %u is not configured: %s",
@@ -1225,7 +1288,7 @@ int knet_link_get_status(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 	status->size = sizeof(struct knet_link_status);
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = err ? savederrno : 0;
 	return err;
 }
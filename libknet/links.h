@@ -43,6 +43,13 @@
 int _link_updown(knet_handle_t knet_h, knet_node_id_t node_id, uint8_t link_id,
 		 unsigned int enabled, unsigned int connected, unsigned int lock_stats);
 
+/*
+ * declare a link down, the link stays down until enough pongs
+ * (pong_count) are received from the other end.
+ * link_stats_mutex must not be held by the caller
+ */
+void _link_down(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_link *dst_link);
+
 void _link_clear_stats(knet_handle_t knet_h);
 
 #endif
@@ -28,15 +28,23 @@ static check_ops_t proto_check_modules_cmds[] = {
 
 /*
  * all those functions will return errno from the
- * protocol specific functions
+ * protocol specific functions.
+ * sock must have been registered by the transport with _set_fd_tracker
  */
 
 int check_add(knet_handle_t knet_h, int sock, uint8_t transport, int index,
 	      struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 	      check_type_t type, check_acceptreject_t acceptreject)
 {
+	struct knet_fd_trackers *tracker = _get_fd_tracker(knet_h, sock);
+
+	if (!tracker) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	return proto_check_modules_cmds[transport_get_proto(knet_h, transport)].protocheck_add(
-			&knet_h->knet_transport_fd_tracker[sock].access_list_match_entry_head, index,
+			knet_h, &tracker->access_list_match_entry_head, index,
 			ss1, ss2, type, acceptreject);
 }
 
@@ -44,15 +52,28 @@ int check_rm(knet_handle_t knet_h, int sock, uint8_t transport,
 	     struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 	     check_type_t type, check_acceptreject_t acceptreject)
 {
+	struct knet_fd_trackers *tracker = _get_fd_tracker(knet_h, sock);
+
+	if (!tracker) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	return proto_check_modules_cmds[transport_get_proto(knet_h, transport)].protocheck_rm(
-			&knet_h->knet_transport_fd_tracker[sock].access_list_match_entry_head,
+			knet_h, &tracker->access_list_match_entry_head,
 			ss1, ss2, type, acceptreject);
 }
 
 void check_rmall(knet_handle_t knet_h, int sock, uint8_t transport)
 {
+	struct knet_fd_trackers *tracker = _get_fd_tracker(knet_h, sock);
+
+	if (!tracker) {
+		return;
+	}
+
 	proto_check_modules_cmds[transport_get_proto(knet_h, transport)].protocheck_rmall(
-		&knet_h->knet_transport_fd_tracker[sock].access_list_match_entry_head);
+		&tracker->access_list_match_entry_head);
 }
 
 /*
@@ -60,6 +81,12 @@ void check_rmall(knet_handle_t knet_h, int sock, uint8_t transport)
  */
 int check_validate(knet_handle_t knet_h, int sock, uint8_t transport, struct sockaddr_storage *checkip)
 {
+	struct knet_fd_trackers *tracker = _get_fd_tracker(knet_h, sock);
+
+	if (!tracker) {
+		return 0;
+	}
+
 	return proto_check_modules_cmds[transport_get_proto(knet_h, transport)].protocheck_validate(
-			&knet_h->knet_transport_fd_tracker[sock].access_list_match_entry_head, checkip);
+			&tracker->access_list_match_entry_head, checkip);
 }
@@ -16,11 +16,11 @@ typedef struct {
 
 	int (*protocheck_validate)	(void *fd_tracker_match_entry_head, struct sockaddr_storage *checkip);
 
-	int (*protocheck_add)		(void *fd_tracker_match_entry_head, int index,
+	int (*protocheck_add)		(knet_handle_t knet_h, void *fd_tracker_match_entry_head, int index,
 					 struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 					 check_type_t type, check_acceptreject_t acceptreject);
 
-	int (*protocheck_rm)		(void *fd_tracker_match_entry_head,
+	int (*protocheck_rm)		(knet_handle_t knet_h, void *fd_tracker_match_entry_head,
 					 struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 					 check_type_t type, check_acceptreject_t acceptreject);
 
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 
 #include "internals.h"
+#include "epoch.h"
 #include "logging.h"
 #include "transports.h"
 #include "links_acl.h"
@@ -29,6 +30,62 @@ struct ip_acl_match_entry {
 	struct ip_acl_match_entry *next;
 };
 
+/*
+ * IP addresses in host byte order, IPv4 addresses are stored in low
+ * so that both families can share the same compiled table code
+ */
+struct ip_acl_key {
+	uint64_t high;
+	uint64_t low;
+};
+
+#define IP_ACL_NONE   0 /* no rule matches, default reject */
+#define IP_ACL_ACCEPT 1
+#define IP_ACL_REJECT 2
+
+/*
+ * Immutable compiled form of the access list for one address family.
+ *
+ * The address space is split into disjoint intervals, each starting at
+ * start[i] and ending before start[i + 1], with the verdict of the first
+ * rule in the list that covers it. start[0] is always the lowest address
+ * so that a binary search always lands on an interval.
+ *
+ * Intervals not covered by any rule are kept apart from explicit rejects
+ * so that a rule appended to the list can be merged into the existing
+ * table without recompiling the whole list.
+ *
+ * Masks that are not a contiguous prefix cannot be expressed as an
+ * interval. When the list contains one, the table holds a private copy
+ * of the rules instead and validation falls back to a linear scan.
+ */
+struct ip_acl_compiled {
+	size_t entries;
+	struct ip_acl_key *start;
+	uint8_t *verdict;
+	size_t rules_entries;
+	struct ip_acl_match_entry *rules;
+};
+
+#define IP_ACL_V4 0
+#define IP_ACL_V6 1
+#define IP_ACL_FAMILIES 2
+
+/*
+ * what fd_tracker access_list_match_entry_head points to.
+ *
+ * The linked list is the configuration as seen by add/rm and is
+ * only accessed with the global write lock held.
+ *
+ * compiled[] is rebuilt after every change and published with a
+ * single atomic pointer store, so ipcheck_validate never looks at
+ * the list and never observes a partially built table.
+ */
+struct ip_acl {
+	struct ip_acl_match_entry *match_entry_head;
+	struct ip_acl_compiled *compiled[IP_ACL_FAMILIES];
+};
+
 /*
  * s6_addr32 is not defined in BSD userland, only kernel.
  * definition is the same as linux and it works fine for
@@ -142,11 +199,481 @@ static int ip_matches_v6(struct sockaddr_storage *checkip, struct ip_acl_match_e
 }
 
 
-int ipcheck_validate(void *fd_tracker_match_entry_head, struct sockaddr_storage *checkip)
+/*
+ * compiled access lists
+ */
+
+static int ip_acl_family(sa_family_t family)
+{
+	if (family == AF_INET) {
+		return IP_ACL_V4;
+	}
+	return IP_ACL_V6;
+}
+
+static void ip_acl_key_from_ss(struct sockaddr_storage *ss, struct ip_acl_key *key)
+{
+	struct sockaddr_in6 *addr6;
+
+	if (ss->ss_family == AF_INET) {
+		key->high = 0;
+		key->low = ntohl(((struct sockaddr_in *)ss)->sin_addr.s_addr);
+		return;
+	}
+
+	addr6 = (struct sockaddr_in6 *)ss;
+	key->high = ((uint64_t)ntohl(addr6->sin6_addr.s6_addr32[0]) << 32) | (uint64_t)ntohl(addr6->sin6_addr.s6_addr32[1]);
+	key->low  = ((uint64_t)ntohl(addr6->sin6_addr.s6_addr32[2]) << 32) | (uint64_t)ntohl(addr6->sin6_addr.s6_addr32[3]);
+}
+
+static int ip_acl_key_cmp(const struct ip_acl_key *a, const struct ip_acl_key *b)
+{
+	if (a->high != b->high) {
+		return (a->high > b->high) ? 1 : -1;
+	}
+	if (a->low != b->low) {
+		return (a->low > b->low) ? 1 : -1;
+	}
+	return 0;
+}
+
+/*
+ * returns 1 if key wrapped around (key was the highest IPv6 address)
+ */
+static int ip_acl_key_inc(struct ip_acl_key *key)
+{
+	key->low++;
+	if (key->low == 0) {
+		key->high++;
+		if (key->high == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * convert a rule into the interval [start, end] of addresses it matches.
+ * returns 0 on success, 1 if the rule cannot match any address and
+ * -1 if the rule is a non contiguous mask that needs a linear scan
+ */
+static int ip_acl_rule_interval(struct ip_acl_match_entry *match_entry,
+				struct ip_acl_key *start, struct ip_acl_key *end)
+{
+	struct ip_acl_key mask, hostmask;
+
+	ip_acl_key_from_ss(&match_entry->addr1, start);
+
+	switch(match_entry->type) {
+	case CHECK_TYPE_ADDRESS:
+		*end = *start;
+		return 0;
+	case CHECK_TYPE_RANGE:
+		ip_acl_key_from_ss(&match_entry->addr2, end);
+		if (ip_acl_key_cmp(start, end) > 0) {
+			return 1;
+		}
+		return 0;
+	case CHECK_TYPE_MASK:
+		ip_acl_key_from_ss(&match_entry->addr2, &mask);
+		hostmask.high = ~mask.high;
+		hostmask.low = ~mask.low;
+		if (match_entry->addr1.ss_family == AF_INET) {
+			hostmask.high = 0;
+			hostmask.low &= 0xffffffff;
+		}
+		/*
+		 * hostmask + 1 must be a power of 2 for the mask to be a prefix
+		 */
+		if (hostmask.low == UINT64_MAX) {
+			if (hostmask.high & (hostmask.high + 1)) {
+				return -1;
+			}
+		} else {
+			if ((hostmask.high) || (hostmask.low & (hostmask.low + 1))) {
+				return -1;
+			}
+		}
+		/*
+		 * (ip & mask) == addr1 can never be true if addr1
+		 * has bits set outside of the mask
+		 */
+		if ((start->high & hostmask.high) || (start->low & hostmask.low)) {
+			return 1;
+		}
+		end->high = start->high | hostmask.high;
+		end->low = start->low | hostmask.low;
+		return 0;
+	}
+	return 1;
+}
+
+struct ip_acl_event {
+	struct ip_acl_key key;
+	size_t rule;
+	int start;
+};
+
+static int ip_acl_event_cmp(const void *a, const void *b)
+{
+	return ip_acl_key_cmp(&((const struct ip_acl_event *)a)->key, &((const struct ip_acl_event *)b)->key);
+}
+
+/*
+ * minimal binary heap of rule positions, the top is the
+ * rule that comes first in the access list
+ */
+static void ip_acl_heap_push(size_t *heap, size_t *heap_entries, size_t rule)
+{
+	size_t i = (*heap_entries)++;
+	size_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap[parent] <= rule) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = rule;
+}
+
+static void ip_acl_heap_pop(size_t *heap, size_t *heap_entries)
+{
+	size_t last = heap[--(*heap_entries)];
+	size_t i = 0, child;
+
+	while ((child = (2 * i) + 1) < *heap_entries) {
+		if ((child + 1 < *heap_entries) && (heap[child + 1] < heap[child])) {
+			child++;
+		}
+		if (last <= heap[child]) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+}
+
+static void ip_acl_compiled_free(struct ip_acl_compiled *compiled)
+{
+	if (!compiled) {
+		return;
+	}
+	free(compiled->start);
+	free(compiled->verdict);
+	free(compiled->rules);
+	free(compiled);
+}
+
+/*
+ * snapshot the rules of a family for the linear scan fallback
+ */
+static int ip_acl_compile_linear(struct ip_acl_match_entry **rules, size_t rules_entries,
+				 struct ip_acl_compiled *compiled)
+{
+	size_t i;
+
+	compiled->rules = malloc(rules_entries * sizeof(struct ip_acl_match_entry));
+	if (!compiled->rules) {
+		return -1;
+	}
+
+	for (i = 0; i < rules_entries; i++) {
+		memmove(&compiled->rules[i], rules[i], sizeof(struct ip_acl_match_entry));
+		compiled->rules[i].next = NULL;
+	}
+	compiled->rules_entries = rules_entries;
+
+	return 0;
+}
+
+/*
+ * sweep all rule boundaries in address order, keeping the active
+ * rules in a heap. The heap top is the first rule in the list that
+ * matches the current interval. Rules are contiguous, so once a rule
+ * ends it never becomes active again and can be dropped lazily.
+ */
+static int ip_acl_compile_intervals(struct ip_acl_match_entry **rules, size_t rules_entries,
+				    struct ip_acl_compiled *compiled)
+{
+	struct ip_acl_event *events = NULL;
+	size_t *heap = NULL;
+	uint8_t *active = NULL;
+	size_t events_entries = 0, heap_entries = 0;
+	size_t i, j;
+	struct ip_acl_key start, end;
+	uint8_t verdict;
+	int err = -1;
+
+	events = malloc(rules_entries * 2 * sizeof(struct ip_acl_event));
+	heap = malloc(rules_entries * sizeof(size_t));
+	active = calloc(rules_entries, sizeof(uint8_t));
+	/*
+	 * there is at most one interval per boundary plus the leading one
+	 */
+	compiled->start = malloc(((rules_entries * 2) + 1) * sizeof(struct ip_acl_key));
+	compiled->verdict = malloc(((rules_entries * 2) + 1) * sizeof(uint8_t));
+	if ((!events) || (!heap) || (!active) || (!compiled->start) || (!compiled->verdict)) {
+		goto out_clean;
+	}
+
+	for (i = 0; i < rules_entries; i++) {
+		if (ip_acl_rule_interval(rules[i], &start, &end) != 0) {
+			continue;
+		}
+		events[events_entries].key = start;
+		events[events_entries].rule = i;
+		events[events_entries].start = 1;
+		events_entries++;
+		if (!ip_acl_key_inc(&end)) {
+			events[events_entries].key = end;
+			events[events_entries].rule = i;
+			events[events_entries].start = 0;
+			events_entries++;
+		}
+	}
+
+	qsort(events, events_entries, sizeof(struct ip_acl_event), ip_acl_event_cmp);
+
+	compiled->start[0].high = 0;
+	compiled->start[0].low = 0;
+	compiled->verdict[0] = IP_ACL_NONE;
+	compiled->entries = 1;
+
+	i = 0;
+	while (i < events_entries) {
+		/*
+		 * apply all the events at this address before
+		 * looking at the result
+		 */
+		for (j = i; (j < events_entries) && (!ip_acl_key_cmp(&events[j].key, &events[i].key)); j++) {
+			if (events[j].start) {
+				active[events[j].rule] = 1;
+				ip_acl_heap_push(heap, &heap_entries, events[j].rule);
+			} else {
+				active[events[j].rule] = 0;
+			}
+		}
+
+		while ((heap_entries) && (!active[heap[0]])) {
+			ip_acl_heap_pop(heap, &heap_entries);
+		}
+
+		verdict = IP_ACL_NONE;
+		if (heap_entries) {
+			verdict = (rules[heap[0]]->acceptreject == CHECK_ACCEPT) ? IP_ACL_ACCEPT : IP_ACL_REJECT;
+		}
+
+		/*
+		 * events at the lowest address replace the leading interval
+		 */
+		if (!ip_acl_key_cmp(&events[i].key, &compiled->start[compiled->entries - 1])) {
+			compiled->verdict[compiled->entries - 1] = verdict;
+		} else if (verdict != compiled->verdict[compiled->entries - 1]) {
+			compiled->start[compiled->entries] = events[i].key;
+			compiled->verdict[compiled->entries] = verdict;
+			compiled->entries++;
+		}
+
+		i = j;
+	}
+
+	err = 0;
+
+out_clean:
+	free(events);
+	free(heap);
+	free(active);
+	return err;
+}
+
+/*
+ * build a new table from old_compiled (NULL if the family had no rules)
+ * plus one rule that is either the first one of the family in the list
+ * (on_top) or the last one. This is a single merge pass over the old
+ * intervals and avoids recompiling the list for every append.
+ */
+static int ip_acl_compile_add(struct ip_acl_compiled *old_compiled, struct ip_acl_match_entry *match_entry,
+			      int on_top, struct ip_acl_compiled **compiled)
+{
+	struct ip_acl_compiled *new_compiled;
+	struct ip_acl_key start, end, key;
+	struct ip_acl_key none_start = { 0, 0 };
+	uint8_t none_verdict = IP_ACL_NONE;
+	struct ip_acl_key *old_start = &none_start;
+	uint8_t *old_verdict = &none_verdict;
+	size_t old_entries = 1;
+	uint8_t verdict, cur_verdict = IP_ACL_NONE;
+	int start_done = 0, end_done, has_end;
+	size_t i = 0;
+
+	if (old_compiled) {
+		old_start = old_compiled->start;
+		old_verdict = old_compiled->verdict;
+		old_entries = old_compiled->entries;
+	}
+
+	if (ip_acl_rule_interval(match_entry, &start, &end) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	has_end = !ip_acl_key_inc(&end);
+	end_done = !has_end;
+
+	new_compiled = calloc(1, sizeof(struct ip_acl_compiled));
+	if (!new_compiled) {
+		goto out_nomem;
+	}
+	new_compiled->start = malloc((old_entries + 2) * sizeof(struct ip_acl_key));
+	new_compiled->verdict = malloc((old_entries + 2) * sizeof(uint8_t));
+	if ((!new_compiled->start) || (!new_compiled->verdict)) {
+		goto out_nomem;
+	}
+
+	while ((i < old_entries) || (!start_done) || (!end_done)) {
+		/*
+		 * next boundary is the lowest of the old interval start,
+		 * the rule start and the address after the rule end
+		 */
+		if (i < old_entries) {
+			key = old_start[i];
+		} else if (!start_done) {
+			key = start;
+		} else {
+			key = end;
+		}
+		if ((!start_done) && (ip_acl_key_cmp(&start, &key) < 0)) {
+			key = start;
+		}
+		if ((!end_done) && (ip_acl_key_cmp(&end, &key) < 0)) {
+			key = end;
+		}
+
+		if ((i < old_entries) && (!ip_acl_key_cmp(&old_start[i], &key))) {
+			cur_verdict = old_verdict[i];
+			i++;
+		}
+		if ((!start_done) && (!ip_acl_key_cmp(&start, &key))) {
+			start_done = 1;
+		}
+		if ((!end_done) && (!ip_acl_key_cmp(&end, &key))) {
+			end_done = 1;
+		}
+
+		verdict = cur_verdict;
+		if ((ip_acl_key_cmp(&key, &start) >= 0) &&
+		    ((!has_end) || (ip_acl_key_cmp(&key, &end) < 0)) &&
+		    ((on_top) || (verdict == IP_ACL_NONE))) {
+			verdict = (match_entry->acceptreject == CHECK_ACCEPT) ? IP_ACL_ACCEPT : IP_ACL_REJECT;
+		}
+
+		if ((new_compiled->entries) && (verdict == new_compiled->verdict[new_compiled->entries - 1])) {
+			continue;
+		}
+		new_compiled->start[new_compiled->entries] = key;
+		new_compiled->verdict[new_compiled->entries] = verdict;
+		new_compiled->entries++;
+	}
+
+	*compiled = new_compiled;
+	return 0;
+
+out_nomem:
+	ip_acl_compiled_free(new_compiled);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*
+ * build the compiled table for one family out of the current list.
+ * *compiled is set to NULL if there are no rules for the family.
+ */
+static int ip_acl_compile(struct ip_acl_match_entry *match_entry_head, int family,
+			  struct ip_acl_compiled **compiled)
+{
+	struct ip_acl_match_entry *match_entry;
+	struct ip_acl_match_entry **rules = NULL;
+	struct ip_acl_compiled *new_compiled = NULL;
+	struct ip_acl_key start, end;
+	size_t rules_entries = 0, i;
+	int linear = 0;
+	int err = -1;
+
+	*compiled = NULL;
+
+	for (match_entry = match_entry_head; match_entry; match_entry = match_entry->next) {
+		if (ip_acl_family(match_entry->addr1.ss_family) == family) {
+			rules_entries++;
+		}
+	}
+
+	if (!rules_entries) {
+		return 0;
+	}
+
+	rules = malloc(rules_entries * sizeof(struct ip_acl_match_entry *));
+	if (!rules) {
+		goto out_clean;
+	}
+
+	i = 0;
+	for (match_entry = match_entry_head; match_entry; match_entry = match_entry->next) {
+		if (ip_acl_family(match_entry->addr1.ss_family) == family) {
+			rules[i++] = match_entry;
+			if (ip_acl_rule_interval(match_entry, &start, &end) < 0) {
+				linear = 1;
+			}
+		}
+	}
+
+	new_compiled = calloc(1, sizeof(struct ip_acl_compiled));
+	if (!new_compiled) {
+		goto out_clean;
+	}
+
+	if (linear) {
+		err = ip_acl_compile_linear(rules, rules_entries, new_compiled);
+	} else {
+		err = ip_acl_compile_intervals(rules, rules_entries, new_compiled);
+	}
+
+out_clean:
+	free(rules);
+	if (err) {
+		ip_acl_compiled_free(new_compiled);
+		errno = ENOMEM;
+	} else {
+		*compiled = new_compiled;
+	}
+	return err;
+}
+
+/*
+ * packets are validated from the RX thread epoch read section
+ * (epoch_read_lock). UDP links are configured with
+ * get_global_cfg_wrlock, that does not stop the readers, so
+ * the old table can only be released once every reader that
+ * could have picked it up has left its read section.
+ */
+static void ip_acl_publish(knet_handle_t knet_h, struct ip_acl *acl, int family, struct ip_acl_compiled *compiled)
+{
+	struct ip_acl_compiled *old_compiled = acl->compiled[family];
+
+	__atomic_store_n(&acl->compiled[family], compiled, __ATOMIC_RELEASE);
+	if (old_compiled) {
+		epoch_synchronize(knet_h);
+	}
+	ip_acl_compiled_free(old_compiled);
+}
+
+static int ip_acl_validate_linear(struct ip_acl_compiled *compiled, struct sockaddr_storage *checkip)
 {
-	struct ip_acl_match_entry **match_entry_head = (struct ip_acl_match_entry **)fd_tracker_match_entry_head;
-	struct ip_acl_match_entry *match_entry = *match_entry_head;
 	int (*match_fn)(struct sockaddr_storage *checkip, struct ip_acl_match_entry *match_entry);
+	size_t i;
 
 	if (checkip->ss_family == AF_INET) {
 		match_fn = ip_matches_v4;
@@ -154,34 +681,86 @@ int ipcheck_validate(void *fd_tracker_match_entry_head, struct sockaddr_storage
 		match_fn = ip_matches_v6;
 	}
 
-	while (match_entry) {
-		if (match_fn(checkip, match_entry)) {
-			if (match_entry->acceptreject == CHECK_ACCEPT)
+	for (i = 0; i < compiled->rules_entries; i++) {
+		if (match_fn(checkip, &compiled->rules[i])) {
+			if (compiled->rules[i].acceptreject == CHECK_ACCEPT)
 				return 1;
 			else
 				return 0;
 		}
-		match_entry = match_entry->next;
 	}
 	return 0; /* Default reject */
 }
 
+int ipcheck_validate(void *fd_tracker_match_entry_head, struct sockaddr_storage *checkip)
+{
+	struct ip_acl *acl = __atomic_load_n((struct ip_acl **)fd_tracker_match_entry_head, __ATOMIC_ACQUIRE);
+	struct ip_acl_compiled *compiled;
+	struct ip_acl_key key;
+	size_t low, high, mid;
+
+	if (!acl) {
+		return 0; /* Default reject */
+	}
+
+	compiled = __atomic_load_n(&acl->compiled[ip_acl_family(checkip->ss_family)], __ATOMIC_ACQUIRE);
+	if (!compiled) {
+		return 0; /* Default reject */
+	}
+
+	if (compiled->rules) {
+		return ip_acl_validate_linear(compiled, checkip);
+	}
+
+	ip_acl_key_from_ss(checkip, &key);
+
+	/*
+	 * find the last interval starting at or below key,
+	 * start[0] is the lowest address so there is always one
+	 */
+	low = 0;
+	high = compiled->entries;
+	while (high - low > 1) {
+		mid = low + ((high - low) / 2);
+		if (ip_acl_key_cmp(&compiled->start[mid], &key) <= 0) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (compiled->verdict[low] == IP_ACL_ACCEPT);
+}
+
 /*
  * Routines to manuipulate access lists
  */
 
 void ipcheck_rmall(void *fd_tracker_match_entry_head)
 {
-	struct ip_acl_match_entry **match_entry_head = (struct ip_acl_match_entry **)fd_tracker_match_entry_head;
+	struct ip_acl **acl_head = (struct ip_acl **)fd_tracker_match_entry_head;
+	struct ip_acl *acl = *acl_head;
 	struct ip_acl_match_entry *next_match_entry;
-	struct ip_acl_match_entry *match_entry = *match_entry_head;
+	struct ip_acl_match_entry *match_entry;
+	int family;
 
+	if (!acl) {
+		return;
+	}
+
+	*acl_head = NULL;
+
+	match_entry = acl->match_entry_head;
 	while (match_entry) {
 		next_match_entry = match_entry->next;
 		free(match_entry);
 		match_entry = next_match_entry;
 	}
-	*match_entry_head = NULL;
+
+	for (family = 0; family < IP_ACL_FAMILIES; family++) {
+		ip_acl_compiled_free(acl->compiled[family]);
+	}
+	free(acl);
 }
 
 static struct ip_acl_match_entry *ipcheck_findmatch(struct ip_acl_match_entry **match_entry_head,
@@ -203,14 +782,24 @@ static struct ip_acl_match_entry *ipcheck_findmatch(struct ip_acl_match_entry **
 	return NULL;
 }
 
-int ipcheck_rmip(void *fd_tracker_match_entry_head,
+int ipcheck_rmip(knet_handle_t knet_h, void *fd_tracker_match_entry_head,
 		 struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		 check_type_t type, check_acceptreject_t acceptreject)
 {
-	struct ip_acl_match_entry **match_entry_head = (struct ip_acl_match_entry **)fd_tracker_match_entry_head;
-	struct ip_acl_match_entry *next_match_entry = NULL;
+	struct ip_acl **acl_head = (struct ip_acl **)fd_tracker_match_entry_head;
+	struct ip_acl *acl = *acl_head;
+	struct ip_acl_match_entry **match_entry_head;
+	struct ip_acl_match_entry **prev_next;
 	struct ip_acl_match_entry *rm_match_entry;
-	struct ip_acl_match_entry *match_entry = *match_entry_head;
+	struct ip_acl_compiled *compiled;
+	int family = ip_acl_family(ss1->ss_family);
+
+	if (!acl) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	match_entry_head = &acl->match_entry_head;
 
 	rm_match_entry = ipcheck_findmatch(match_entry_head, ss1, ss2, type, acceptreject);
 	if (!rm_match_entry) {
@@ -218,38 +807,60 @@ int ipcheck_rmip(void *fd_tracker_match_entry_head,
 		return -1;
 	}
 
-	while (match_entry) {
-		next_match_entry = match_entry->next;
-		/*
-		 * we are removing the list head, be careful
-		 */
-		if (rm_match_entry == match_entry) {
-			*match_entry_head = next_match_entry;
-			free(match_entry);
-			break;
-		}
-		/*
-		 * the next one is the one we need to remove
-		 */
-		if (rm_match_entry == next_match_entry) {
-			match_entry->next = next_match_entry->next;
-			free(next_match_entry);
-			break;
-		}
-		match_entry = next_match_entry;
+	prev_next = match_entry_head;
+	while (*prev_next != rm_match_entry) {
+		prev_next = &(*prev_next)->next;
+	}
+
+	/*
+	 * unlink the entry and build the new table, put the entry
+	 * back if that fails so that list and table stay in sync
+	 */
+	*prev_next = rm_match_entry->next;
+
+	if (ip_acl_compile(*match_entry_head, family, &compiled) < 0) {
+		*prev_next = rm_match_entry;
+		return -1;
+	}
+
+	ip_acl_publish(knet_h, acl, family, compiled);
+	free(rm_match_entry);
+
+	/*
+	 * an empty access list is always represented by a NULL head
+	 */
+	if (!*match_entry_head) {
+		ipcheck_rmall(fd_tracker_match_entry_head);
 	}
 
 	return 0;
 }
 
-int ipcheck_addip(void *fd_tracker_match_entry_head, int index,
+int ipcheck_addip(knet_handle_t knet_h, void *fd_tracker_match_entry_head, int index,
 		  struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		  check_type_t type, check_acceptreject_t acceptreject)
 {
-	struct ip_acl_match_entry **match_entry_head = (struct ip_acl_match_entry **)fd_tracker_match_entry_head;
+	struct ip_acl **acl_head = (struct ip_acl **)fd_tracker_match_entry_head;
+	struct ip_acl *acl = *acl_head;
+	struct ip_acl_match_entry **match_entry_head;
+	struct ip_acl_match_entry **prev_next;
 	struct ip_acl_match_entry *new_match_entry;
-	struct ip_acl_match_entry *match_entry = *match_entry_head;
-	int i = 0;
+	struct ip_acl_match_entry *match_entry;
+	struct ip_acl_compiled *compiled;
+	struct ip_acl_key start, end;
+	int family = ip_acl_family(ss1->ss_family);
+	int on_top = 1, at_bottom = 1;
+	int i = 0, err;
+
+	if (!acl) {
+		acl = calloc(1, sizeof(struct ip_acl));
+		if (!acl) {
+			return -1;
+		}
+		__atomic_store_n(acl_head, acl, __ATOMIC_RELEASE);
+	}
+
+	match_entry_head = &acl->match_entry_head;
 
 	if (ipcheck_findmatch(match_entry_head, ss1, ss2, type, acceptreject) != NULL) {
 		errno = EEXIST;
@@ -265,46 +876,60 @@ int ipcheck_addip(void *fd_tracker_match_entry_head, int index,
 	memmove(&new_match_entry->addr2, ss2, sizeof(struct sockaddr_storage));
 	new_match_entry->type = type;
 	new_match_entry->acceptreject = acceptreject;
-	new_match_entry->next = NULL;
 
-	if (match_entry) {
-		/*
-		 * special case for index 0, since we need to update
-		 * the head of the list
-		 */
-		if (index == 0) {
-			*match_entry_head = new_match_entry;
-			new_match_entry->next = match_entry;
-		} else {
-			/*
-			 * find the end of the list or stop at "index"
-			 */
-
-			while (match_entry->next) {
-				match_entry = match_entry->next;
-				if (i == index) {
-					break;
-				}
-				i++;
+	/*
+	 * index 0 inserts at the head of the list, any other index
+	 * inserts after entry "index" or appends if the list is
+	 * shorter than that (or index is negative)
+	 */
+	prev_next = match_entry_head;
+	if ((index != 0) && (*prev_next)) {
+		prev_next = &(*prev_next)->next;
+		while (*prev_next) {
+			prev_next = &(*prev_next)->next;
+			if (i == index) {
+				break;
 			}
+			i++;
+		}
+	}
 
-			/*
-			 * insert if there are more entries in the list
-			 */
-			if (match_entry->next) {
-				new_match_entry->next = match_entry->next;
-			}
-			/*
-			 * add if we are at the end
-			 */
-			match_entry->next = new_match_entry;
+	new_match_entry->next = *prev_next;
+	*prev_next = new_match_entry;
+
+	/*
+	 * a rule that ends up first or last among the rules of its family
+	 * can be merged into the current table, anything else (or a table
+	 * that needs a linear scan) requires a full rebuild
+	 */
+	for (match_entry = *match_entry_head; match_entry != new_match_entry; match_entry = match_entry->next) {
+		if (ip_acl_family(match_entry->addr1.ss_family) == family) {
+			on_top = 0;
+			break;
+		}
+	}
+	for (match_entry = new_match_entry->next; match_entry; match_entry = match_entry->next) {
+		if (ip_acl_family(match_entry->addr1.ss_family) == family) {
+			at_bottom = 0;
+			break;
 		}
+	}
+
+	if (((on_top) || (at_bottom)) &&
+	    ((!acl->compiled[family]) || (!acl->compiled[family]->rules)) &&
+	    (!ip_acl_rule_interval(new_match_entry, &start, &end))) {
+		err = ip_acl_compile_add(acl->compiled[family], new_match_entry, !at_bottom, &compiled);
 	} else {
-		/*
-		 * first entry in the list
-		 */
-		*match_entry_head = new_match_entry;
+		err = ip_acl_compile(*match_entry_head, family, &compiled);
 	}
 
+	if (err < 0) {
+		*prev_next = new_match_entry->next;
+		free(new_match_entry);
+		return -1;
+	}
+
+	ip_acl_publish(knet_h, acl, family, compiled);
+
 	return 0;
 }
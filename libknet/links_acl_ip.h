@@ -14,11 +14,11 @@
 
 int ipcheck_validate(void *fd_tracker_match_entry_head, struct sockaddr_storage *checkip);
 
-int ipcheck_addip(void *fd_tracker_match_entry_head, int index,
+int ipcheck_addip(knet_handle_t knet_h, void *fd_tracker_match_entry_head, int index,
 		  struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		  check_type_t type, check_acceptreject_t acceptreject);
 
-int ipcheck_rmip(void *fd_tracker_match_entry_head,
+int ipcheck_rmip(knet_handle_t knet_h, void *fd_tracker_match_entry_head,
 		 struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		 check_type_t type, check_acceptreject_t acceptreject);
 
@@ -14,11 +14,11 @@
 
 int loopbackcheck_validate(void *fd_tracker_match_entry_head, struct sockaddr_storage *checkip);
 
-int loopbackcheck_add(void *fd_tracker_match_entry_head, int index,
+int loopbackcheck_add(knet_handle_t knet_h, void *fd_tracker_match_entry_head, int index,
 		      struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		      check_type_t type, check_acceptreject_t acceptreject);
 
-int loopbackcheck_rm(void *fd_tracker_match_entry_head,
+int loopbackcheck_rm(knet_handle_t knet_h, void *fd_tracker_match_entry_head,
 		     struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 		     check_type_t type, check_acceptreject_t acceptreject);
 
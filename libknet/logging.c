@@ -15,8 +15,14 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include "internals.h"
+#include "common.h"
+#include "epoch.h"
 #include "logging.h"
 #include "threads_common.h"
 
@@ -188,9 +194,9 @@ int knet_log_get_loglevel(knet_handle_t knet_h, uint8_t subsystem,
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
-		log_err(knet_h, subsystem, "Unable to get write lock: %s",
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
+		log_err(knet_h, subsystem, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
@@ -198,18 +204,313 @@ int knet_log_get_loglevel(knet_handle_t knet_h, uint8_t subsystem,
 
 	*level = knet_h->log_levels[subsystem];
 
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 	errno = 0;
 	return 0;
 }
 
+/*
+ * log ring
+ *
+ * log messages are formatted by the thread generating them directly
+ * into a slot of a per handle ring, and written to logfd by a dedicated
+ * thread, so that data path threads never block on logfd.
+ * When the ring is full, messages are dropped and accounted in
+ * knet_h->stats.log_dropped_messages.
+ *
+ * The ring is a bounded multi producer queue: each slot has a sequence
+ * number that tells producers when it is free and the log thread when
+ * it has been filled.
+ */
+
+#define KNET_LOG_RING_SIZE 1024 /* must be a power of 2 */
+
+struct knet_log_ring_slot {
+	uint64_t seq;
+	struct knet_log_msg msg;
+};
+
+struct knet_log_ring {
+	uint64_t head;		/* next slot to fill, shared by all producers */
+	uint8_t pad[64 - sizeof(uint64_t)];
+	uint64_t tail;		/* next slot to write, only used by the log thread */
+	uint64_t reported_drops;
+	int sleeping;		/* log thread is waiting on wakefd */
+	int stop;
+	int wakefd[2];
+	pthread_t log_thread;
+	struct knet_log_ring_slot slots[KNET_LOG_RING_SIZE];
+};
+
+static void log_write(knet_handle_t knet_h, struct knet_log_msg *msg)
+{
+	size_t byte_cnt = 0;
+	int len;
+
+	while (byte_cnt < sizeof(struct knet_log_msg)) {
+		len = write(knet_h->logfd, (char *)msg + byte_cnt, sizeof(struct knet_log_msg) - byte_cnt);
+		if (len <= 0) {
+			if ((len < 0) && (errno == EINTR)) {
+				continue;
+			}
+			if (knet_h->log_ring) {
+				__atomic_add_fetch(&knet_h->stats.log_dropped_messages, 1, __ATOMIC_RELAXED);
+			}
+			return;
+		}
+
+		byte_cnt += len;
+	}
+}
+
+static void log_ring_write_drops(knet_handle_t knet_h)
+{
+	struct knet_log_ring *ring = knet_h->log_ring;
+	struct knet_log_msg msg;
+	uint64_t drops;
+
+	drops = __atomic_load_n(&knet_h->stats.log_dropped_messages, __ATOMIC_RELAXED);
+	if (drops == ring->reported_drops) {
+		return;
+	}
+
+	/*
+	 * stats can be cleared in the meantime
+	 */
+	if (drops > ring->reported_drops) {
+		memset(&msg, 0, sizeof(struct knet_log_msg));
+		msg.subsystem = KNET_SUB_HANDLE;
+		msg.msglevel = KNET_LOG_WARN;
+		msg.knet_h = knet_h;
+		snprintf(msg.msg, sizeof(msg.msg), "%" PRIu64 " log messages dropped",
+			 drops - ring->reported_drops);
+		log_write(knet_h, &msg);
+	}
+
+	ring->reported_drops = __atomic_load_n(&knet_h->stats.log_dropped_messages, __ATOMIC_RELAXED);
+}
+
+/*
+ * returns the next filled slot, or NULL if the ring is empty
+ */
+static struct knet_log_ring_slot *log_ring_peek(struct knet_log_ring *ring)
+{
+	struct knet_log_ring_slot *slot = &ring->slots[ring->tail & (KNET_LOG_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail + 1) {
+		return NULL;
+	}
+
+	return slot;
+}
+
+static void log_ring_drain(knet_handle_t knet_h)
+{
+	struct knet_log_ring *ring = knet_h->log_ring;
+	struct knet_log_ring_slot *slot;
+
+	while ((slot = log_ring_peek(ring)) != NULL) {
+		log_write(knet_h, &slot->msg);
+		__atomic_store_n(&slot->seq, ring->tail + KNET_LOG_RING_SIZE, __ATOMIC_RELEASE);
+		ring->tail++;
+	}
+
+	log_ring_write_drops(knet_h);
+}
+
+static void *_handle_log_thread(void *data)
+{
+	knet_handle_t knet_h = (knet_handle_t) data;
+	struct knet_log_ring *ring = knet_h->log_ring;
+	struct pollfd pfd;
+	char buf[64];
+
+	pfd.fd = ring->wakefd[0];
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+		log_ring_drain(knet_h);
+
+		/*
+		 * announce that we are going to sleep and check again,
+		 * producers wake us up only if they see sleeping set
+		 */
+		__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((log_ring_peek(ring)) ||
+		    (__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE))) {
+			__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		if (poll(&pfd, 1, -1) > 0) {
+			while (read(ring->wakefd[0], buf, sizeof(buf)) > 0);
+		}
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	log_ring_drain(knet_h);
+
+	return NULL;
+}
+
+static void log_ring_wakeup(struct knet_log_ring *ring)
+{
+	char c = 0;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)) &&
+	    (__atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST))) {
+		if (write(ring->wakefd[1], &c, 1) < 0) {
+			/*
+			 * the pipe is full, the log thread is being woken up already
+			 */
+		}
+	}
+}
+
+int log_ring_init(knet_handle_t knet_h)
+{
+	struct knet_log_ring *ring;
+	pthread_attr_t attr;
+	uint64_t i;
+	int savederrno = 0;
+
+	if (knet_h->logfd <= 0) {
+		return 0;
+	}
+
+	ring = malloc(sizeof(struct knet_log_ring));
+	if (!ring) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for log ring");
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(ring, 0, sizeof(struct knet_log_ring));
+
+	for (i = 0; i < KNET_LOG_RING_SIZE; i++) {
+		ring->slots[i].seq = i;
+	}
+
+	if (pipe(ring->wakefd) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to create log ring pipe: %s",
+			strerror(savederrno));
+		free(ring);
+		errno = savederrno;
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((_fdset_cloexec(ring->wakefd[i])) ||
+		    (_fdset_nonblock(ring->wakefd[i]))) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_HANDLE, "Unable to set log ring pipe flags: %s",
+				strerror(savederrno));
+			goto exit_fail;
+		}
+	}
+
+	savederrno = pthread_attr_init(&attr);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to init pthread attributes: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	savederrno = pthread_attr_setstacksize(&attr, KNET_THREAD_STACK_SIZE);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to set stack size attribute: %s",
+			strerror(savederrno));
+		pthread_attr_destroy(&attr);
+		goto exit_fail;
+	}
+
+	/*
+	 * from now on, all the messages go through the ring
+	 */
+	knet_h->log_ring = ring;
+
+	savederrno = pthread_create(&ring->log_thread, &attr,
+				    _handle_log_thread, (void *) knet_h);
+	pthread_attr_destroy(&attr);
+	if (savederrno) {
+		knet_h->log_ring = NULL;
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to start log thread: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	return 0;
+
+exit_fail:
+	close(ring->wakefd[0]);
+	close(ring->wakefd[1]);
+	free(ring);
+	errno = savederrno;
+	return -1;
+}
+
+/*
+ * log_ring_fini must be invoked after all the other
+ * threads of the handle have been stopped
+ */
+void log_ring_fini(knet_handle_t knet_h)
+{
+	struct knet_log_ring *ring = knet_h->log_ring;
+	char c = 0;
+
+	if (!ring) {
+		return;
+	}
+
+	__atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+	if (write(ring->wakefd[1], &c, 1) < 0) {
+		/*
+		 * the pipe is full, the log thread is being woken up already
+		 */
+	}
+	pthread_join(ring->log_thread, NULL);
+
+	knet_h->log_ring = NULL;
+
+	close(ring->wakefd[0]);
+	close(ring->wakefd[1]);
+	free(ring);
+}
+
+/*
+ * claims a free slot of the ring, returns NULL if the ring is full
+ */
+static struct knet_log_ring_slot *log_ring_get_slot(struct knet_log_ring *ring, uint64_t *pos)
+{
+	struct knet_log_ring_slot *slot;
+	int64_t diff;
+
+	*pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	while (1) {
+		slot = &ring->slots[*pos & (KNET_LOG_RING_SIZE - 1)];
+		diff = (int64_t)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (int64_t)*pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring->head, pos, *pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				return slot;
+			}
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			*pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
 void log_msg(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel,
 	     const char *fmt, ...)
 {
 	va_list ap;
-	struct knet_log_msg msg;
-	size_t byte_cnt = 0;
-	int len;
+	struct knet_log_msg local_msg;
+	struct knet_log_msg *msg = &local_msg;
+	struct knet_log_ring_slot *slot = NULL;
+	uint64_t pos = 0;
 
 	if ((!knet_h) ||
 	    (subsystem == KNET_MAX_SUBSYSTEMS) ||
@@ -219,29 +520,36 @@ void log_msg(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel,
 	if (knet_h->logfd <= 0)
 		goto out;
 
-	memset(&msg, 0, sizeof(struct knet_log_msg));
-	msg.subsystem = subsystem;
-	msg.msglevel = msglevel;
-	msg.knet_h = knet_h;
+	if (knet_h->log_ring) {
+		slot = log_ring_get_slot(knet_h->log_ring, &pos);
+		if (!slot) {
+			__atomic_add_fetch(&knet_h->stats.log_dropped_messages, 1, __ATOMIC_RELAXED);
+			goto out;
+		}
+		msg = &slot->msg;
+	}
+
+	memset(msg, 0, sizeof(struct knet_log_msg));
+	msg->subsystem = subsystem;
+	msg->msglevel = msglevel;
+	msg->knet_h = knet_h;
 
 	va_start(ap, fmt);
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
 #endif
-	vsnprintf(msg.msg, sizeof(msg.msg), fmt, ap);
+	vsnprintf(msg->msg, sizeof(msg->msg), fmt, ap);
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 	va_end(ap);
 
-	while (byte_cnt < sizeof(struct knet_log_msg)) {
-		len = write(knet_h->logfd, &msg, sizeof(struct knet_log_msg) - byte_cnt);
-		if (len <= 0) {
-			goto out;
-		}
-
-		byte_cnt += len;
+	if (slot) {
+		__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+		log_ring_wakeup(knet_h->log_ring);
+	} else {
+		log_write(knet_h, msg);
 	}
 
 out:
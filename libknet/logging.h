@@ -10,6 +10,8 @@
 #ifndef __KNET_LOGGING_H__
 #define __KNET_LOGGING_H__
 
+#include <time.h>
+
 #include "internals.h"
 
 typedef void log_msg_t(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel,
@@ -23,6 +25,9 @@ typedef void log_msg_t(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel
 
 log_msg_t LOG_MSG;
 
+int log_ring_init(knet_handle_t knet_h);
+void log_ring_fini(knet_handle_t knet_h);
+
 #define log_err(knet_h, subsys, fmt, args...) \
 	LOG_MSG(knet_h, subsys, KNET_LOG_ERR, fmt, ##args)
 
@@ -35,4 +40,136 @@ log_msg_t LOG_MSG;
 #define log_debug(knet_h, subsys, fmt, args...) \
 	LOG_MSG(knet_h, subsys, KNET_LOG_DEBUG, fmt, ##args)
 
+/*
+ * rate limited logging
+ *
+ * for messages that can be triggered by every packet (invalid packets,
+ * decrypt failures...). Every call site can log a burst of
+ * KNET_LOG_RATELIMIT_BURST messages per handle, then
+ * KNET_LOG_RATELIMIT_RATE messages per second. The number of suppressed
+ * messages is logged with the next message that goes through.
+ *
+ * The state lives in the handle (knet_h->log_ratelimit), in a small
+ * table keyed by the address of a static marker of each call site,
+ * so that a storm on one handle does not silence the others.
+ * Entries are claimed atomically on first use and never released.
+ * The counters are shared by all threads of the handle and are
+ * best effort.
+ */
+
+static inline int log_enabled(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel)
+{
+	return ((knet_h) && (knet_h->logfd > 0) &&
+		(subsystem < KNET_MAX_SUBSYSTEMS) &&
+		(msglevel <= knet_h->log_levels[subsystem]));
+}
+
+static inline struct knet_log_ratelimit *log_ratelimit_get(knet_handle_t knet_h, const void *site)
+{
+	struct knet_log_ratelimit *rl;
+	const void *cur;
+	size_t start, i;
+
+	start = ((uintptr_t)site >> 4) % KNET_LOG_RATELIMIT_SITES;
+
+	for (i = 0; i < KNET_LOG_RATELIMIT_SITES; i++) {
+		rl = &knet_h->log_ratelimit[(start + i) % KNET_LOG_RATELIMIT_SITES];
+		cur = __atomic_load_n(&rl->site, __ATOMIC_ACQUIRE);
+		if (!cur) {
+			if (__atomic_compare_exchange_n(&rl->site, &cur, site, 0,
+							__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				return rl;
+			}
+		}
+		if (cur == site) {
+			return rl;
+		}
+	}
+
+	return NULL;
+}
+
+static inline int log_ratelimit(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel,
+				const void *site)
+{
+	struct knet_log_ratelimit *rl;
+	struct timespec ts;
+	uint64_t now, last, refill;
+	uint32_t tokens, suppressed;
+
+	rl = log_ratelimit_get(knet_h, site);
+	if (!rl) {
+		/*
+		 * more call sites than table entries,
+		 * do not lose messages
+		 */
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + 1;
+
+	last = __atomic_load_n(&rl->last, __ATOMIC_RELAXED);
+	tokens = __atomic_load_n(&rl->tokens, __ATOMIC_RELAXED);
+
+	if (!last) {
+		last = now;
+		tokens = KNET_LOG_RATELIMIT_BURST;
+	}
+
+	refill = ((now - last) * KNET_LOG_RATELIMIT_RATE) / 1000;
+	if (refill) {
+		last = now;
+		tokens = (tokens + refill > KNET_LOG_RATELIMIT_BURST) ? KNET_LOG_RATELIMIT_BURST : tokens + refill;
+	}
+
+	if (!tokens) {
+		__atomic_store_n(&rl->last, last, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	__atomic_store_n(&rl->last, last, __ATOMIC_RELAXED);
+	__atomic_store_n(&rl->tokens, tokens - 1, __ATOMIC_RELAXED);
+
+	suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	if (suppressed) {
+		LOG_MSG(knet_h, subsystem, msglevel, "%u similar messages suppressed", suppressed);
+	}
+
+	return 1;
+}
+
+#define log_ratelimited(knet_h, subsys, level, fmt, args...) \
+	do { \
+		static char _knet_rl_site; \
+		if ((log_enabled(knet_h, subsys, level)) && \
+		    (log_ratelimit(knet_h, subsys, level, &_knet_rl_site))) { \
+			LOG_MSG(knet_h, subsys, level, fmt, ##args); \
+		} \
+	} while (0)
+
+#define log_err_ratelimited(knet_h, subsys, fmt, args...) \
+	log_ratelimited(knet_h, subsys, KNET_LOG_ERR, fmt, ##args)
+
+#define log_warn_ratelimited(knet_h, subsys, fmt, args...) \
+	log_ratelimited(knet_h, subsys, KNET_LOG_WARN, fmt, ##args)
+
+/*
+ * debug logs in the per packet code paths. They are rate limited
+ * and can be compiled out with --disable-datapath-debug-logs,
+ * in which case the arguments are not evaluated.
+ */
+#if !defined(WITH_DATAPATH_DEBUG_LOGS) || WITH_DATAPATH_DEBUG_LOGS
+#define log_debug_datapath(knet_h, subsys, fmt, args...) \
+	log_ratelimited(knet_h, subsys, KNET_LOG_DEBUG, fmt, ##args)
+#else
+#define log_debug_datapath(knet_h, subsys, fmt, args...) \
+	do { \
+		if (0) { \
+			LOG_MSG(knet_h, subsys, KNET_LOG_DEBUG, fmt, ##args); \
+		} \
+	} while (0)
+#endif
+
 #endif
@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "crypto.h"
+#include "crypto_model.h"
 #include "internals.h"
 #include "logging.h"
 #include "common.h"
@@ -36,11 +37,30 @@
  *                  | data_len                                                        |
  *                                              | app MTU    |
  *
- * knet_h->sec_block_size is >= 0 if encryption will pad the data
- * knet_h->sec_salt_size is >= 0 if encryption is enabled
- * knet_h->sec_hash_size is >= 0 if signing is enabled
+ * overhead->sec_block_size is >= 0 if encryption will pad the data
+ * overhead->sec_salt_size is >= 0 if encryption is enabled
+ * overhead->sec_hash_size is >= 0 if signing is enabled
  */
 
+void calc_crypto_overhead(knet_handle_t knet_h, struct knet_crypto_overhead *overhead)
+{
+	struct crypto_instance *crypto_instance = __atomic_load_n(&knet_h->crypto_instance, __ATOMIC_ACQUIRE);
+
+	memset(overhead, 0, sizeof(struct knet_crypto_overhead));
+
+	if (!crypto_instance) {
+		return;
+	}
+
+	overhead->sec_block_size = crypto_instance->sec_block_size;
+	overhead->sec_hash_size = crypto_instance->sec_hash_size;
+	/*
+	 * the pre-header is a fixed per packet overhead, as the salt
+	 */
+	overhead->sec_salt_size = crypto_instance->sec_salt_size +
+				  __atomic_load_n(&crypto_instance->sec_preheader_size, __ATOMIC_RELAXED);
+}
+
 /*
  * this function takes in the data that we would like to send
  * and tells us the outgoing onwire data size with crypto and
@@ -48,22 +68,22 @@
  * calling thread needs to account for protocol overhead.
  */
 
-size_t calc_data_outlen(knet_handle_t knet_h, size_t inlen)
+size_t calc_data_outlen(const struct knet_crypto_overhead *overhead, size_t inlen)
 {
 	size_t outlen = inlen, pad_len = 0;
 
-	if (knet_h->sec_block_size) {
+	if (overhead->sec_block_size) {
 		/*
 		 * if the crypto mechanism requires padding, calculate the padding
 		 * and add it back to outlen because that's what the crypto layer
 		 * would do.
 		 */
-		pad_len = knet_h->sec_block_size - (outlen % knet_h->sec_block_size);
+		pad_len = overhead->sec_block_size - (outlen % overhead->sec_block_size);
 
 		outlen = outlen + pad_len;
 	}
 
-	return outlen + knet_h->sec_salt_size + knet_h->sec_hash_size;
+	return outlen + overhead->sec_salt_size + overhead->sec_hash_size;
 }
 
 /*
@@ -73,17 +93,17 @@ size_t calc_data_outlen(knet_handle_t knet_h, size_t inlen)
  * calling thread needs to account for protocol overhead.
  */
 
-size_t calc_max_data_outlen(knet_handle_t knet_h, size_t inlen)
+size_t calc_max_data_outlen(const struct knet_crypto_overhead *overhead, size_t inlen)
 {
 	size_t outlen = inlen, pad_len = 0;
 
-	if (knet_h->sec_block_size) {
+	if (overhead->sec_block_size) {
 		/*
 		 * drop both salt and hash, that leaves only the crypto data and padding
 		 * we need to calculate the padding based on the real encrypted data
 		 * that includes the knet_header.
 		 */
-		outlen = outlen - (knet_h->sec_salt_size + knet_h->sec_hash_size);
+		outlen = outlen - (overhead->sec_salt_size + overhead->sec_hash_size);
 
 		/*
 		 * if the crypto mechanism requires padding, calculate the padding
@@ -94,7 +114,7 @@ size_t calc_max_data_outlen(knet_handle_t knet_h, size_t inlen)
 		 * so we want to make sure that our data won't add an unnecessary
 		 * block_size that we need to remove later.
 		 */
-		pad_len = outlen % knet_h->sec_block_size;
+		pad_len = outlen % overhead->sec_block_size;
 
 		outlen = outlen - (pad_len + 1);
 
@@ -102,14 +122,14 @@ size_t calc_max_data_outlen(knet_handle_t knet_h, size_t inlen)
 		 * add both hash and salt size back, similar to padding above,
 		 * the crypto layer will add them to the outlen
 		 */
-		outlen = outlen + (knet_h->sec_salt_size + knet_h->sec_hash_size);
+		outlen = outlen + (overhead->sec_salt_size + overhead->sec_hash_size);
 	}
 
 	/*
 	 * drop KNET_HEADER_ALL_SIZE to provide a clean application MTU
 	 * and various crypto headers
 	 */
-	outlen = outlen - (KNET_HEADER_ALL_SIZE + knet_h->sec_salt_size + knet_h->sec_hash_size);
+	outlen = outlen - (KNET_HEADER_ALL_SIZE + overhead->sec_salt_size + overhead->sec_hash_size);
 
 	return outlen;
 }
@@ -123,5 +143,9 @@ size_t calc_max_data_outlen(knet_handle_t knet_h, size_t inlen)
 
 size_t calc_min_mtu(knet_handle_t knet_h)
 {
-	return calc_max_data_outlen(knet_h, KNET_PMTUD_MIN_MTU_V4 - (KNET_PMTUD_OVERHEAD_V6 + KNET_PMTUD_SCTP_OVERHEAD));
+	struct knet_crypto_overhead overhead;
+
+	calc_crypto_overhead(knet_h, &overhead);
+
+	return calc_max_data_outlen(&overhead, KNET_PMTUD_MIN_MTU_V4 - (KNET_PMTUD_OVERHEAD_V6 + KNET_PMTUD_SCTP_OVERHEAD));
 }
@@ -98,10 +98,30 @@ struct knet_hostinfo {
 typedef uint16_t seq_num_t;
 #define SEQ_MAX UINT16_MAX
 
+/*
+ * khp_data_compress contains the compress model id used
+ * to compress the user data. The model id is ORed with
+ * KNET_COMPRESS_DICT when the data have been compressed with
+ * the shared dictionary. Nodes that don't know about
+ * dictionaries see an unknown model and drop the packet.
+ * The compressed data are then prefixed by the 32 bit id
+ * (network byte order) of the dictionary.
+ */
+#define KNET_COMPRESS_DICT 0x80
+#define KNET_COMPRESS_DICT_ID_SIZE sizeof(uint32_t)
+
+/*
+ * KNET_COMPRESS_STREAM is ORed with the model id when the data
+ * are part of a compression stream. khp_data_pad1 then contains
+ * the position of the packet in the stream, 0 starts a new stream.
+ */
+#define KNET_COMPRESS_STREAM 0x40
+#define KNET_COMPRESS_FLAGS (KNET_COMPRESS_DICT | KNET_COMPRESS_STREAM)
+
 struct knet_header_payload_data {
 	seq_num_t	khp_data_seq_num;	/* pckt seq number used to deduplicate pkcts */
 	uint8_t		khp_data_compress;	/* identify if user data are compressed */
-	uint8_t		khp_data_pad1;		/* make sure to have space in the header to grow features */
+	uint8_t		khp_data_pad1;		/* stream position, see KNET_COMPRESS_STREAM */
 	uint8_t		khp_data_bcast;		/* data destination bcast/ucast */
 	uint8_t		khp_data_frag_num;	/* number of fragments of this pckt. 1 is not fragmented */
 	uint8_t		khp_data_frag_seq;	/* as above, indicates the frag sequence number */
@@ -135,6 +155,15 @@ struct knet_header_payload_pmtud {
 	uint8_t		khp_pmtud_data[0];	/* pointer to empty/random data/fill buffer */
 } __attribute__((packed));
 
+/*
+ * sent by a receiver that lost track of a compression stream,
+ * asks the sender to restart the stream on khp_stream_channel
+ * instead of waiting for the next periodic restart
+ */
+struct knet_header_payload_stream {
+	int8_t		khp_stream_channel;	/* channel of the compression stream */
+} __attribute__((packed));
+
 /*
  * union to reference possible individual payloads
  */
@@ -143,6 +172,7 @@ union knet_header_payload {
 	struct knet_header_payload_data		khp_data;  /* pure data packet struct */
 	struct knet_header_payload_ping		khp_ping;  /* heartbeat packet struct */
 	struct knet_header_payload_pmtud 	khp_pmtud; /* Path MTU discovery packet struct */
+	struct knet_header_payload_stream	khp_stream; /* compression stream restart request */
 } __attribute__((packed));
 
 /*
@@ -159,6 +189,7 @@ union knet_header_payload {
 #define KNET_HEADER_TYPE_PONG        0x82 /* reply to heartbeat */
 #define KNET_HEADER_TYPE_PMTUD       0x83 /* Used to determine Path MTU */
 #define KNET_HEADER_TYPE_PMTUD_REPLY 0x84 /* reply from remote host */
+#define KNET_HEADER_TYPE_STREAM_RESYNC 0x85 /* compression stream restart request */
 
 struct knet_header {
 	uint8_t				kh_version; /* pckt format/version */
@@ -181,6 +212,7 @@ struct knet_header {
 #define khp_data_bcast    kh_payload.khp_data.khp_data_bcast
 #define khp_data_channel  kh_payload.khp_data.khp_data_channel
 #define khp_data_compress kh_payload.khp_data.khp_data_compress
+#define khp_data_pad1     kh_payload.khp_data.khp_data_pad1
 
 #define khp_ping_link     kh_payload.khp_ping.khp_ping_link
 #define khp_ping_time     kh_payload.khp_ping.khp_ping_time
@@ -191,6 +223,8 @@ struct knet_header {
 #define khp_pmtud_size    kh_payload.khp_pmtud.khp_pmtud_size
 #define khp_pmtud_data    kh_payload.khp_pmtud.khp_pmtud_data
 
+#define khp_stream_channel kh_payload.khp_stream.khp_stream_channel
+
 /*
  * extra defines to avoid mingling with sizeof() too much
  */
@@ -200,9 +234,47 @@ struct knet_header {
 #define KNET_HEADER_PING_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_ping))
 #define KNET_HEADER_PMTUD_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_pmtud))
 #define KNET_HEADER_DATA_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_data))
+#define KNET_HEADER_STREAM_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_stream))
 
-size_t calc_data_outlen(knet_handle_t knet_h, size_t inlen);
-size_t calc_max_data_outlen(knet_handle_t knet_h, size_t inlen);
+/*
+ * optional cleartext pre-header of encrypted packets
+ * (see knet_handle_crypto_set_preheader).
+ *
+ * It is a copy of the first bytes of the knet header (version, type,
+ * source node and, for data packets, seq_num), so that RX can discard
+ * packets from unknown or unreachable hosts and duplicates before
+ * paying the crypto cost. Once decrypted, the knet header must match
+ * the pre-header or the packet is dropped.
+ *
+ * MAC only packets are sent without pre-header, they already start
+ * with the same cleartext bytes.
+ *
+ * The pre-header has KNET_HEADER_FLAG_PREHEADER set in kh_pad1, that
+ * is never set in the knet header itself. RX uses the mark to tell
+ * packets with and without pre-header apart, so that the pre-header
+ * can be enabled on one node at a time (see crypto_has_preheader).
+ * The mark is not authenticated: a packet without pre-header that
+ * looks marked is decrypted again as a whole, and packets are only
+ * filtered on their pre-header when it is enabled locally.
+ */
+#define KNET_CRYPTO_PREHEADER_SIZE (KNET_HEADER_SIZE + sizeof(seq_num_t))
+#define KNET_HEADER_FLAG_PREHEADER 0x01
+
+/*
+ * crypto overhead of the TX crypto instance, all 0 when TX crypto
+ * is disabled. The crypto instance can be replaced at any time
+ * (see epoch.c), calc_crypto_overhead loads it only once so that
+ * all sizes belong to the same config.
+ */
+struct knet_crypto_overhead {
+	size_t sec_block_size;
+	size_t sec_hash_size;
+	size_t sec_salt_size;	/* includes the pre-header, if any */
+};
+
+void calc_crypto_overhead(knet_handle_t knet_h, struct knet_crypto_overhead *overhead);
+size_t calc_data_outlen(const struct knet_crypto_overhead *overhead, size_t inlen);
+size_t calc_max_data_outlen(const struct knet_crypto_overhead *overhead, size_t inlen);
 size_t calc_min_mtu(knet_handle_t knet_h);
 
 #endif
@@ -10,7 +10,13 @@ api_checks		= \
 			  api_knet_handle_new_test \
 			  api_knet_handle_free_test \
 			  api_knet_handle_compress_test \
+			  api_knet_handle_compress_set_dict_test \
+			  api_knet_handle_compress_set_adaptive_test \
+			  api_knet_handle_compress_set_stream_test \
 			  api_knet_handle_crypto_test \
+			  api_knet_handle_crypto_set_config_test \
+			  api_knet_handle_crypto_use_config_test \
+			  api_knet_handle_crypto_set_preheader_test \
 			  api_knet_handle_setfwd_test \
 			  api_knet_handle_enable_access_lists_test \
 			  api_knet_handle_enable_filter_test \
@@ -90,9 +96,27 @@ api_knet_handle_new_limit_test_SOURCES = api_knet_handle_new_limit.c \
 api_knet_handle_compress_test_SOURCES = api_knet_handle_compress.c \
 					test-common.c
 
+api_knet_handle_compress_set_dict_test_SOURCES = api_knet_handle_compress_set_dict.c \
+						 test-common.c
+
+api_knet_handle_compress_set_adaptive_test_SOURCES = api_knet_handle_compress_set_adaptive.c \
+						     test-common.c
+
+api_knet_handle_compress_set_stream_test_SOURCES = api_knet_handle_compress_set_stream.c \
+						     test-common.c
+
 api_knet_handle_crypto_test_SOURCES = api_knet_handle_crypto.c \
 				      test-common.c
 
+api_knet_handle_crypto_set_config_test_SOURCES = api_knet_handle_crypto_set_config.c \
+						 test-common.c
+
+api_knet_handle_crypto_use_config_test_SOURCES = api_knet_handle_crypto_use_config.c \
+						 test-common.c
+
+api_knet_handle_crypto_set_preheader_test_SOURCES = api_knet_handle_crypto_set_preheader.c \
+						    test-common.c
+
 api_knet_handle_setfwd_test_SOURCES = api_knet_handle_setfwd.c \
 				      test-common.c
 
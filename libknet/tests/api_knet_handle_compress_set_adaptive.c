@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+#if WITH_COMPRESS_ZLIB > 0
+#define TEST_PACKETS 100
+#define TEST_PACKET_SIZE 1024
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static int send_packets(knet_handle_t knet_h, int logfd, int datafd, int8_t channel, const char *send_buff)
+{
+	char recv_buff[TEST_PACKET_SIZE];
+	ssize_t send_len;
+	ssize_t recv_len;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		send_len = knet_send(knet_h, send_buff, TEST_PACKET_SIZE, channel);
+		if (send_len != TEST_PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(knet_h, 10, datafd, logfd, stdout)) {
+			printf("Error waiting for packet: %s\n", strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(knet_h, recv_buff, TEST_PACKET_SIZE, channel);
+		if (recv_len != send_len) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, TEST_PACKET_SIZE)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+#if WITH_COMPRESS_ZLIB > 0
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_stats stats;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	struct sockaddr_storage lo;
+	char send_buff[TEST_PACKET_SIZE];
+	uint64_t skipped;
+	int i;
+#endif
+
+	printf("Test knet_handle_compress_set_adaptive incorrect knet_h\n");
+
+	if ((!knet_handle_compress_set_adaptive(NULL, 1000)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_adaptive accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_adaptive enable\n");
+
+	if (knet_handle_compress_set_adaptive(knet_h, 1000) < 0) {
+		printf("knet_handle_compress_set_adaptive failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_adaptive_mbps != 1000) {
+		printf("knet_handle_compress_set_adaptive did not store link speed\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_adaptive disable\n");
+
+	if (knet_handle_compress_set_adaptive(knet_h, 0) < 0) {
+		printf("knet_handle_compress_set_adaptive failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_adaptive_mbps != 0) {
+		printf("knet_handle_compress_set_adaptive did not disable adaptive compression\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+#if WITH_COMPRESS_ZLIB > 0
+	printf("Test knet_handle_compress_set_adaptive with zlib and incompressible data\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 0;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress did not accept zlib: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * a slow link makes compression pay off whenever the data
+	 * compress at all, the decision is driven by the ratio only
+	 */
+	if (knet_handle_compress_set_adaptive(knet_h, 1) < 0) {
+		printf("knet_handle_compress_set_adaptive failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	srand(getpid());
+	for (i = 0; i < TEST_PACKET_SIZE; i++) {
+		send_buff[i] = rand();
+	}
+
+	if (send_packets(knet_h, logfds[0], datafd, channel, send_buff) < 0) {
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * the first packet is probed and every following packet
+	 * is sent uncompressed, except for one probe every 64
+	 */
+	if (stats.tx_adaptive_uncompressed_packets < TEST_PACKETS / 2) {
+		printf("adaptive compression did not skip incompressible data: %" PRIu64 " skipped, %" PRIu64 " compressed\n",
+		       stats.tx_adaptive_uncompressed_packets, stats.tx_compressed_packets);
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_adaptive with zlib and compressible data\n");
+
+	if (knet_handle_compress_set_adaptive(knet_h, 1) < 0) {
+		printf("knet_handle_compress_set_adaptive failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	skipped = stats.tx_adaptive_uncompressed_packets;
+	memset(send_buff, 0, sizeof(send_buff));
+
+	if (send_packets(knet_h, logfds[0], datafd, channel, send_buff) < 0) {
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (stats.tx_adaptive_uncompressed_packets != skipped) {
+		printf("adaptive compression skipped compressible data: %" PRIu64 " skipped\n",
+		       stats.tx_adaptive_uncompressed_packets - skipped);
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_setfwd(knet_h, 0);
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+#endif
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
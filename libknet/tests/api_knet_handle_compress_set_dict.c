@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static unsigned char dict[4096];
+
+#if (WITH_COMPRESS_ZLIB > 0) || (WITH_COMPRESS_ZSTD > 0) || (WITH_COMPRESS_LZ4 > 0)
+static void test_model(knet_handle_t knet_h, int logfds[2], const char *model, int level)
+{
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+
+	printf("Test knet_handle_compress_set_dict with %s compress\n", model);
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, model, sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = level;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress did not accept %s with dictionary: %s\n", model, strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_compress_set_dict(knet_h, dict, sizeof(dict)) < 0) {
+		printf("knet_handle_compress_set_dict did not accept dictionary with %s: %s\n", model, strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_dict retains dictionary when changing %s level\n", model);
+
+	knet_handle_compress_cfg.compress_level = level + 1;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress did not accept %s level change with dictionary: %s\n", model, strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_h->compress_dict) || (knet_h->compress_dict_len != sizeof(dict))) {
+		printf("knet_handle_compress dropped the dictionary\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+}
+#endif
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	size_t i;
+
+	for (i = 0; i < sizeof(dict); i++) {
+		dict[i] = "knet dictionary "[i % 16];
+	}
+
+	printf("Test knet_handle_compress_set_dict incorrect knet_h\n");
+
+	if ((!knet_handle_compress_set_dict(NULL, dict, sizeof(dict))) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_dict accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_dict with NULL dict and length\n");
+
+	if ((!knet_handle_compress_set_dict(knet_h, NULL, sizeof(dict))) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_dict accepted NULL dict with length or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_dict with 0 length dict\n");
+
+	if ((!knet_handle_compress_set_dict(knet_h, dict, 0)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_dict accepted 0 length dict or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_dict with dict too big\n");
+
+	if ((!knet_handle_compress_set_dict(knet_h, dict, KNET_COMPRESS_DICT_MAX_SIZE + 1)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_dict accepted dict too big or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_dict without compression\n");
+
+	if (knet_handle_compress_set_dict(knet_h, dict, sizeof(dict)) < 0) {
+		printf("knet_handle_compress_set_dict did not accept dict: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_h->compress_dict) || (knet_h->compress_dict_len != sizeof(dict)) ||
+	    (memcmp(knet_h->compress_dict, dict, sizeof(dict)))) {
+		printf("knet_handle_compress_set_dict did not store the dictionary\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+#if WITH_COMPRESS_ZLIB > 0
+	test_model(knet_h, logfds, "zlib", 4);
+#endif
+#if WITH_COMPRESS_ZSTD > 0
+	test_model(knet_h, logfds, "zstd", 4);
+#endif
+#if WITH_COMPRESS_LZ4 > 0
+	test_model(knet_h, logfds, "lz4", 4);
+#endif
+
+	printf("Test knet_handle_compress_set_dict remove dictionary\n");
+
+	if (knet_handle_compress_set_dict(knet_h, NULL, 0) < 0) {
+		printf("knet_handle_compress_set_dict did not remove dict: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->compress_dict) || (knet_h->compress_dict_len)) {
+		printf("knet_handle_compress_set_dict did not remove the dictionary\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
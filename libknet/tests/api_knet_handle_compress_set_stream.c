@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+#if WITH_COMPRESS_ZSTD > 0
+#define TEST_PACKETS 100
+#define TEST_PACKET_SIZE 512
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+/*
+ * every packet carries a sequence number, the same random
+ * block and some padding. Each packet compresses a bit on its own
+ * but most of its content can be found in the previous packet.
+ */
+static int send_packets(knet_handle_t knet_h, int logfd, int datafd, int8_t channel, char *send_buff)
+{
+	char recv_buff[TEST_PACKET_SIZE];
+	ssize_t send_len;
+	ssize_t recv_len;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		snprintf(send_buff, 16, "seq: %08d", i);
+
+		send_len = knet_send(knet_h, send_buff, TEST_PACKET_SIZE, channel);
+		if (send_len != TEST_PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(knet_h, 10, datafd, logfd, stdout)) {
+			printf("Error waiting for packet: %s\n", strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(knet_h, recv_buff, TEST_PACKET_SIZE, channel);
+		if (recv_len != send_len) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, TEST_PACKET_SIZE)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+#if WITH_COMPRESS_ZSTD > 0
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_stats stats;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	struct sockaddr_storage lo;
+	char send_buff[TEST_PACKET_SIZE];
+	int i;
+#endif
+
+	printf("Test knet_handle_compress_set_stream incorrect knet_h\n");
+
+	if ((!knet_handle_compress_set_stream(NULL, 0, 16)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_stream accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_stream incorrect channel\n");
+
+	if ((!knet_handle_compress_set_stream(knet_h, -1, 16)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_stream accepted invalid channel -1 or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_handle_compress_set_stream(knet_h, KNET_DATAFD_MAX, 16)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_set_stream accepted invalid channel KNET_DATAFD_MAX or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_stream enable\n");
+
+	if (knet_handle_compress_set_stream(knet_h, 0, 16) < 0) {
+		printf("knet_handle_compress_set_stream failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_tx_stream[0].interval != 16) {
+		printf("knet_handle_compress_set_stream did not store resync interval\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_stream disable\n");
+
+	if (knet_handle_compress_set_stream(knet_h, 0, 0) < 0) {
+		printf("knet_handle_compress_set_stream failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_tx_stream[0].interval != 0) {
+		printf("knet_handle_compress_set_stream did not disable streaming\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+#if WITH_COMPRESS_ZSTD > 0
+	printf("Test knet_handle_compress_set_stream with zstd\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zstd", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 0;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress did not accept zstd: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_compress_set_stream(knet_h, channel, 16) < 0) {
+		printf("knet_handle_compress_set_stream failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	srand(getpid());
+	memset(send_buff, 0, sizeof(send_buff));
+	for (i = 16; i < TEST_PACKET_SIZE / 2; i++) {
+		send_buff[i] = rand();
+	}
+
+	if (send_packets(knet_h, logfds[0], datafd, channel, send_buff) < 0) {
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("stream packets tx: %" PRIu64 " rx: %" PRIu64 " out of sync: %" PRIu64 " original bytes: %" PRIu64 " compressed bytes: %" PRIu64 "\n",
+	       stats.tx_stream_compressed_packets, stats.rx_stream_compressed_packets,
+	       stats.rx_stream_out_of_sync_packets,
+	       stats.tx_stream_compressed_original_bytes, stats.tx_stream_compressed_size_bytes);
+
+	if ((stats.tx_stream_compressed_packets != TEST_PACKETS) ||
+	    (stats.rx_stream_compressed_packets != TEST_PACKETS) ||
+	    (stats.rx_stream_out_of_sync_packets != 0)) {
+		printf("packets were not compressed as part of a stream\n");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * on their own, packets cannot compress below the size
+	 * of the random block
+	 */
+	if (stats.tx_stream_compressed_size_bytes >= (TEST_PACKETS * TEST_PACKET_SIZE) / 4) {
+		printf("stream compression did not reference previous packets\n");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_set_stream restarts the stream after a lost packet\n");
+
+	/*
+	 * simulate a lost packet by dropping the receiver out of sync,
+	 * the next packet is discarded and the receiver asks the
+	 * sender to restart the stream right away
+	 */
+	knet_h->host_index[1]->compress_rx_stream[channel].in_sync = 0;
+
+	if (knet_send(knet_h, send_buff, TEST_PACKET_SIZE, channel) != TEST_PACKET_SIZE) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (!wait_for_packet(knet_h, 1, datafd, logfds[0], stdout)) {
+		printf("packet out of the stream has been delivered\n");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * all the following packets must be delivered,
+	 * without waiting for the periodic restart
+	 */
+	if (send_packets(knet_h, logfds[0], datafd, channel, send_buff) < 0) {
+		printf("stream has not been restarted after a lost packet\n");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (stats.rx_stream_out_of_sync_packets != 1) {
+		printf("unexpected number of out of sync packets: %" PRIu64 "\n", stats.rx_stream_out_of_sync_packets);
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_setfwd(knet_h, 0);
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+#endif
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "crypto_model.h"
+#include "test-common.h"
+
+static void fill_cfg(struct knet_handle_crypto_cfg *knet_handle_crypto_cfg, const char *model, const char *cipher, unsigned int key_len)
+{
+	memset(knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg->crypto_model, model, sizeof(knet_handle_crypto_cfg->crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg->crypto_cipher_type, cipher, sizeof(knet_handle_crypto_cfg->crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg->crypto_hash_type, "sha1", sizeof(knet_handle_crypto_cfg->crypto_hash_type) - 1);
+	knet_handle_crypto_cfg->private_key_len = key_len;
+}
+
+static void test(const char *model)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+	struct crypto_instance *current = NULL;
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+
+	printf("Test knet_handle_crypto_set_config incorrect knet_h\n");
+
+	if ((!knet_handle_crypto_set_config(NULL, &knet_handle_crypto_cfg, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_crypto_set_config accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_crypto_set_config with invalid cfg\n");
+
+	if ((!knet_handle_crypto_set_config(knet_h, NULL, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_crypto_set_config accepted invalid cfg or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_crypto_set_config with invalid config_num\n");
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes128", 2000);
+
+	if ((!knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 0)) || (errno != EINVAL) ||
+	    (!knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, KNET_MAX_CRYPTO_INSTANCES + 1)) || (errno != EINVAL)) {
+		printf("knet_handle_crypto_set_config accepted invalid config_num or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_crypto_set_config with %s/aes128/sha1 and too short key\n", model);
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes128", 10);
+
+	if ((!knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_crypto_set_config accepted too short private key\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_crypto_set_config with %s/aes128/sha1 on config 1\n", model);
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes128", 2000);
+
+	if (knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 1)) {
+		printf("knet_handle_crypto_set_config failed with correct config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((!knet_h->crypto_config[1]) || (knet_h->crypto_instance)) {
+		printf("knet_handle_crypto_set_config did not install config 1 or enabled it for TX\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_crypto_set_config with %s/aes256/sha1 on config 2\n", model);
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes256", 2000);
+
+	if (knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 2)) {
+		printf("knet_handle_crypto_set_config failed with correct config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((!knet_h->crypto_config[1]) || (!knet_h->crypto_config[2]) || (knet_h->crypto_rx_configs != 2)) {
+		printf("knet_handle_crypto_set_config did not keep both configs\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_crypto_set_config reconfig of in use config with %s/aes129/sha1\n", model);
+
+	if (knet_handle_crypto_use_config(knet_h, 1) < 0) {
+		printf("knet_handle_crypto_use_config failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	current = knet_h->crypto_instance;
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes129", 2000);
+
+	if (!knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 1)) {
+		printf("knet_handle_crypto_set_config failed to detect incorrect config\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((current != knet_h->crypto_instance) || (current != knet_h->crypto_config[1])) {
+		printf("knet_handle_crypto_set_config failed to restore correct config\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_crypto_set_config reconfig of in use config with %s/aes128/sha1\n", model);
+
+	fill_cfg(&knet_handle_crypto_cfg, model, "aes128", 2003);
+
+	if (knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 1)) {
+		printf("knet_handle_crypto_set_config failed with correct config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((current == knet_h->crypto_instance) || (knet_h->crypto_instance != knet_h->crypto_config[1])) {
+		printf("knet_handle_crypto_set_config failed to install new config for TX\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_crypto_set_config clear in use config\n");
+
+	fill_cfg(&knet_handle_crypto_cfg, "none", "none", 0);
+
+	if ((!knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 1)) || (errno != EBUSY)) {
+		printf("knet_handle_crypto_set_config cleared in use config or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_crypto_set_config clear spare config\n");
+
+	if ((knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, 2) < 0) ||
+	    (knet_h->crypto_config[2]) || (knet_h->crypto_rx_configs != 1)) {
+		printf("knet_handle_crypto_set_config failed to clear spare config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_crypto_info crypto_list[16];
+	size_t crypto_list_entries;
+	size_t i;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		printf("knet_get_crypto_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	if (crypto_list_entries == 0) {
+		printf("no crypto modules detected. Skipping\n");
+		return SKIP;
+	}
+
+	for (i=0; i < crypto_list_entries; i++) {
+		test(crypto_list[i].name);
+	}
+
+	return PASS;
+}
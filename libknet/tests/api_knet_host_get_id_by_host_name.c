@@ -96,8 +96,97 @@ static void test(void)
 
 	flush_logs(logfds[0], stdout);
 
+	printf("Test knet_host_get_id_by_host_name after rename\n");
+
+	if (knet_host_add(knet_h, 2) < 0) {
+		printf("knet_host_add failed error: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_set_name(knet_h, 1, "test") < 0) {
+		printf("knet_host_set_name failed error: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_host_get_id_by_host_name(knet_h, "test", &host_id) < 0) || (host_id != 1)) {
+		printf("knet_host_get_id_by_host_name could not find renamed host: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_host_get_id_by_host_name(knet_h, "1", &host_id)) || (errno != ENOENT)) {
+		printf("knet_host_get_id_by_host_name found host by old name or returned incorrect error: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_host_get_id_by_host_name reusing an old name\n");
+
+	if (knet_host_set_name(knet_h, 2, "1") < 0) {
+		printf("knet_host_set_name failed to reuse released name: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_host_get_id_by_host_name(knet_h, "1", &host_id) < 0) || (host_id != 2)) {
+		printf("knet_host_get_id_by_host_name returned wrong host for reused name: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_host_get_id_by_host_name after host removal\n");
+
 	knet_host_remove(knet_h, 1);
 
+	if ((!knet_host_get_id_by_host_name(knet_h, "test", &host_id)) || (errno != ENOENT)) {
+		printf("knet_host_get_id_by_host_name found removed host or returned incorrect error: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_host_get_id_by_host_name(knet_h, "1", &host_id) < 0) || (host_id != 2)) {
+		printf("knet_host_get_id_by_host_name lost host after removal of another host: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 2);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_host_remove(knet_h, 2);
+
 	knet_handle_free(knet_h);
 	flush_logs(logfds[0], stdout);
 	close_logpipes(logfds);
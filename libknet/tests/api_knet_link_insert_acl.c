@@ -200,7 +200,7 @@ static void test(void)
 	host = knet_h->host_index[1];
 	link = &host->link[0];
 
-	if (knet_h->knet_transport_fd_tracker[link->outsock].access_list_match_entry_head) {
+	if (_get_fd_tracker(knet_h, link->outsock)->access_list_match_entry_head) {
 		printf("match list not empty!");
 		knet_link_clear_config(knet_h, 1, 0);
 		knet_host_remove(knet_h, 1);
@@ -220,7 +220,7 @@ static void test(void)
 		exit(FAIL);
 	}
 
-	if (!knet_h->knet_transport_fd_tracker[link->outsock].access_list_match_entry_head) {
+	if (!_get_fd_tracker(knet_h, link->outsock)->access_list_match_entry_head) {
 		printf("match list empty!");
 		knet_link_clear_config(knet_h, 1, 0);
 		knet_host_remove(knet_h, 1);
@@ -34,7 +34,7 @@ static void sock_notify(void *pvt_data,
 	return;
 }
 
-static void test(const char *model)
+static void test(const char *model, int use_dict)
 {
 	knet_handle_t knet_h;
 	int logfds[2];
@@ -48,8 +48,10 @@ static void test(const char *model)
 	int savederrno;
 	struct sockaddr_storage lo;
 	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	unsigned char dict[1024];
 
 	memset(send_buff, 0, sizeof(send_buff));
+	memset(dict, 0, sizeof(dict));
 
 	setup_logpipes(logfds);
 
@@ -57,7 +59,7 @@ static void test(const char *model)
 
 	flush_logs(logfds[0], stdout);
 
-	printf("Test knet_send with %s and valid data\n", model);
+	printf("Test knet_send with %s%s and valid data\n", model, use_dict ? " and dictionary" : "");
 
 	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
 	strncpy(knet_handle_compress_cfg.compress_model, model, sizeof(knet_handle_compress_cfg.compress_model) - 1);
@@ -72,6 +74,14 @@ static void test(const char *model)
 		exit(FAIL);
         }
 
+	if ((use_dict) && (knet_handle_compress_set_dict(knet_h, dict, sizeof(dict)) < 0)) {
+		printf("knet_handle_compress_set_dict failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
 	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
 		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
 		knet_handle_free(knet_h);
@@ -256,6 +266,44 @@ static void test(const char *model)
 
 		}
 	}
+
+	/*
+	 * only zstd and lz4 implement dictionary compression,
+	 * all other models must ignore the dictionary
+	 */
+	if ((use_dict) &&
+	    ((strcmp(model, "zstd") == 0) || (strcmp(model, "lz4") == 0))) {
+		if (stats.tx_dict_compressed_packets != 1 ||
+		    stats.rx_dict_compressed_packets != 1 ||
+		    stats.tx_dict_compressed_size_bytes > stats.tx_compressed_size_bytes) {
+			printf("dict stats look wrong: tx_packets: %" PRIu64 " (%" PRIu64 "/%" PRIu64 " comp/uncomp), rx_packets: %" PRIu64 " (%" PRIu64 "/%" PRIu64 " comp/uncomp)\n",
+			       stats.tx_dict_compressed_packets,
+			       stats.tx_dict_compressed_size_bytes,
+			       stats.tx_dict_compressed_original_bytes,
+			       stats.rx_dict_compressed_packets,
+			       stats.rx_dict_compressed_size_bytes,
+			       stats.rx_dict_compressed_original_bytes);
+			knet_link_set_enable(knet_h, 1, 0, 0);
+			knet_link_clear_config(knet_h, 1, 0);
+			knet_host_remove(knet_h, 1);
+			knet_handle_free(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+	} else {
+		if (stats.tx_dict_compressed_packets != 0 ||
+		    stats.rx_dict_compressed_packets != 0) {
+			printf("dict stats look wrong: s/b all 0 for model '%s'\n", model);
+			knet_link_set_enable(knet_h, 1, 0, 0);
+			knet_link_clear_config(knet_h, 1, 0);
+			knet_host_remove(knet_h, 1);
+			knet_handle_free(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+	}
 	flush_logs(logfds[0], stdout);
 
 	knet_link_set_enable(knet_h, 1, 0, 0);
@@ -284,10 +332,11 @@ int main(int argc, char *argv[])
 		return SKIP;
 	}
 
-	test("none");
+	test("none", 0);
 
 	for (i=0; i < compress_list_entries; i++) {
-		test(compress_list[i].name);
+		test(compress_list[i].name, 0);
+		test(compress_list[i].name, 1);
 	}
 
 	return PASS;
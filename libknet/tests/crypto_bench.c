@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * measure crypto operations per second on small packets.
+ *
+ * Each thread gets its own (fake) handle and crypto instance,
+ * so that the only shared state between threads is the one
+ * of the crypto libraries (ex: RNG used for salts).
+ *
+ * The same number of packets is then encrypted in batches of
+ * BATCH_SIZE (as done by the TX thread for fragments). With cipher
+ * "none" batches only calculate the MAC (see signv_batch).
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "crypto.h"
+#include "test-common.h"
+
+#define PACKET_SIZE   64
+#define PACKETS       200000
+#define MAX_THREADS   4
+#define BATCH_SIZE    16
+
+/*
+ * crypto.c is linked in, it needs the shared lib lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int logfds[2];
+
+struct bench_info {
+	knet_handle_t knet_h;
+	uint64_t elapsed;
+	uint64_t elapsed_batch;
+	int err;
+};
+
+static uint64_t now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_info *info = arg;
+	unsigned char plain[PACKET_SIZE];
+	unsigned char crypt[KNET_DATABUFSIZE_CRYPT];
+	unsigned char decrypt[KNET_DATABUFSIZE_CRYPT];
+	static __thread unsigned char crypt_batch[BATCH_SIZE][KNET_DATABUFSIZE_CRYPT];
+	struct crypto_batch_entry batch[BATCH_SIZE];
+	struct iovec iov_in;
+	ssize_t crypt_len, decrypt_len;
+	uint64_t start;
+	int i;
+
+	memset(plain, 0x5a, sizeof(plain));
+
+	iov_in.iov_base = plain;
+	iov_in.iov_len = PACKET_SIZE;
+	for (i = 0; i < BATCH_SIZE; i++) {
+		batch[i].iov_in = &iov_in;
+		batch[i].iovcnt_in = 1;
+		batch[i].buf_out = crypt_batch[i];
+	}
+
+	start = now_usecs();
+	for (i = 0; i < PACKETS; i++) {
+		if (crypto_encrypt_and_sign(info->knet_h, plain, PACKET_SIZE, crypt, &crypt_len) < 0) {
+			printf("Unable to encrypt packet\n");
+			info->err = -1;
+			return NULL;
+		}
+	}
+	info->elapsed = now_usecs() - start;
+
+	if ((crypto_authenticate_and_decrypt(info->knet_h, crypt, crypt_len, decrypt, &decrypt_len) < 0) ||
+	    (decrypt_len != PACKET_SIZE) ||
+	    (memcmp(plain, decrypt, PACKET_SIZE))) {
+		printf("Unable to decrypt packet\n");
+		info->err = -1;
+		return NULL;
+	}
+
+	start = now_usecs();
+	for (i = 0; i < PACKETS / BATCH_SIZE; i++) {
+		if (crypto_encrypt_and_signv_batch(info->knet_h, batch, BATCH_SIZE) < 0) {
+			printf("Unable to encrypt batch\n");
+			info->err = -1;
+			return NULL;
+		}
+	}
+	info->elapsed_batch = now_usecs() - start;
+
+	if (batch[BATCH_SIZE - 1].mac_only) {
+		memmove(crypt_batch[BATCH_SIZE - 1] + PACKET_SIZE, crypt_batch[BATCH_SIZE - 1], batch[BATCH_SIZE - 1].buf_out_len);
+		memmove(crypt_batch[BATCH_SIZE - 1], plain, PACKET_SIZE);
+		batch[BATCH_SIZE - 1].buf_out_len += PACKET_SIZE;
+	}
+
+	if ((crypto_authenticate_and_decrypt(info->knet_h, crypt_batch[BATCH_SIZE - 1], batch[BATCH_SIZE - 1].buf_out_len, decrypt, &decrypt_len) < 0) ||
+	    (decrypt_len != PACKET_SIZE) ||
+	    (memcmp(plain, decrypt, PACKET_SIZE))) {
+		printf("Unable to decrypt batch packet\n");
+		info->err = -1;
+	}
+
+	return NULL;
+}
+
+static knet_handle_t bench_handle_new(const char *model, const char *cipher)
+{
+	knet_handle_t knet_h;
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+
+	knet_h = calloc(1, sizeof(struct knet_handle));
+	if (!knet_h) {
+		printf("Unable to allocate memory for handle\n");
+		return NULL;
+	}
+
+	knet_h->logfd = logfds[1];
+	memset(knet_h->log_levels, KNET_LOG_ERR, KNET_MAX_SUBSYSTEMS);
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg.crypto_model, model, sizeof(knet_handle_crypto_cfg.crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_cipher_type, cipher, sizeof(knet_handle_crypto_cfg.crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_hash_type, "sha256", sizeof(knet_handle_crypto_cfg.crypto_hash_type) - 1);
+	memset(knet_handle_crypto_cfg.private_key, 0x42, KNET_MIN_KEY_LEN);
+	knet_handle_crypto_cfg.private_key_len = KNET_MIN_KEY_LEN;
+
+	if ((crypto_init(knet_h, &knet_handle_crypto_cfg, 1) < 0) ||
+	    (crypto_use_config(knet_h, 1) < 0)) {
+		printf("Unable to initialize %s/%s crypto\n", model, cipher);
+		flush_logs(logfds[0], stdout);
+		free(knet_h);
+		return NULL;
+	}
+
+	return knet_h;
+}
+
+static void bench_handle_free(knet_handle_t knet_h)
+{
+	crypto_fini(knet_h, 1);
+	free(knet_h);
+}
+
+static int bench(const char *model, const char *cipher, int threads)
+{
+	struct bench_info info[MAX_THREADS];
+	pthread_t thread[MAX_THREADS];
+	uint64_t elapsed_max = 0, elapsed_batch_max = 0;
+	int i, err = 0;
+
+	memset(info, 0, sizeof(info));
+
+	for (i = 0; i < threads; i++) {
+		info[i].knet_h = bench_handle_new(model, cipher);
+		if (!info[i].knet_h) {
+			err = -1;
+			threads = i;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&thread[i], NULL, bench_thread, &info[i])) {
+			printf("Unable to start bench thread\n");
+			exit(FAIL);
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(thread[i], NULL);
+		if (info[i].err) {
+			err = -1;
+		}
+		if (info[i].elapsed > elapsed_max) {
+			elapsed_max = info[i].elapsed;
+		}
+		if (info[i].elapsed_batch > elapsed_batch_max) {
+			elapsed_batch_max = info[i].elapsed_batch;
+		}
+	}
+
+	if (!err) {
+		printf("%s %s/sha256 %d bytes, %d thread(s): %" PRIu64 " encrypt ops/sec\n",
+		       model, cipher, PACKET_SIZE, threads,
+		       elapsed_max ? ((uint64_t)PACKETS * threads * 1000000) / elapsed_max : 0);
+		printf("%s %s/sha256 %d bytes, %d thread(s), batch of %d: %" PRIu64 " encrypt ops/sec\n",
+		       model, cipher, PACKET_SIZE, threads, BATCH_SIZE,
+		       elapsed_batch_max ? ((uint64_t)(PACKETS / BATCH_SIZE) * BATCH_SIZE * threads * 1000000) / elapsed_batch_max : 0);
+	}
+
+out:
+	for (i = 0; i < threads; i++) {
+		bench_handle_free(info[i].knet_h);
+	}
+	flush_logs(logfds[0], stdout);
+
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_crypto_info crypto_list[16];
+	size_t crypto_list_entries;
+	size_t i;
+	int err = 0;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		printf("knet_get_crypto_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	if (crypto_list_entries == 0) {
+		printf("no crypto modules detected. Skipping\n");
+		return SKIP;
+	}
+
+	setup_logpipes(logfds);
+
+	for (i = 0; i < crypto_list_entries; i++) {
+		if ((bench(crypto_list[i].name, "aes128", 1) < 0) ||
+		    (bench(crypto_list[i].name, "aes128", MAX_THREADS) < 0) ||
+		    (bench(crypto_list[i].name, "none", 1) < 0) ||
+		    (bench(crypto_list[i].name, "none", MAX_THREADS) < 0)) {
+			err = -1;
+		}
+	}
+
+	close_logpipes(logfds);
+
+	return err ? FAIL : PASS;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * measure the time between a link being declared down
+ * (pong timeout) and traffic moving to the backup link.
+ *
+ * Host 1 has 2 links in passive mode, link 0 with higher priority.
+ * While packets are being sent, link 0 ping interval is raised way
+ * above its pong timeout, so that no more pongs are received.
+ * The heartbeat thread declares the link down after pong_timeout
+ * and the dst link handler thread has to switch traffic to link 1.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define PING_INTERVAL 100    /* msecs */
+#define PONG_TIMEOUT  500    /* msecs */
+#define NO_PING       60000  /* msecs */
+#define MAX_FAILOVER  200000 /* usecs */
+#define TEST_TIMEOUT  10000  /* msecs */
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static uint64_t now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int link_status(knet_handle_t knet_h, uint8_t link_id, struct knet_link_status *status)
+{
+	if (knet_link_get_status(knet_h, 1, link_id, status, sizeof(struct knet_link_status)) < 0) {
+		printf("knet_link_get_status failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int send_recv(knet_handle_t knet_h, int datafd, int8_t channel, int *received)
+{
+	char buff[64];
+	struct pollfd pfd;
+
+	memset(buff, 0, sizeof(buff));
+
+	if (knet_send(knet_h, buff, sizeof(buff), channel) != sizeof(buff)) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	pfd.fd = datafd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 1) > 0) {
+		if (knet_recv(knet_h, buff, sizeof(buff), channel) != sizeof(buff)) {
+			printf("knet_recv failed: %s\n", strerror(errno));
+			return -1;
+		}
+		(*received)++;
+	}
+
+	return 0;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+	struct knet_link_status status0, status1;
+	uint64_t tx_backup, start, link_down = 0, failover = 0;
+	int received = 0, i;
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_INFO);
+
+	flush_logs(logfds[0], stdout);
+
+	channel = -1;
+
+	if ((knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) ||
+	    (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) ||
+	    (knet_host_add(knet_h, 1) < 0) ||
+	    (knet_host_set_policy(knet_h, 1, KNET_LINK_POLICY_PASSIVE) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) ||
+	    (_knet_link_set_config(knet_h, 1, 1, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) ||
+	    (knet_link_set_priority(knet_h, 1, 0, 1) < 0) ||
+	    (knet_link_set_priority(knet_h, 1, 1, 0) < 0) ||
+	    (knet_link_set_ping_timers(knet_h, 1, 0, PING_INTERVAL, PONG_TIMEOUT, 2048) < 0) ||
+	    (knet_link_set_ping_timers(knet_h, 1, 1, PING_INTERVAL, PONG_TIMEOUT, 2048) < 0) ||
+	    (knet_link_set_enable(knet_h, 1, 0, 1) < 0) ||
+	    (knet_link_set_enable(knet_h, 1, 1, 1) < 0) ||
+	    (knet_handle_setfwd(knet_h, 1) < 0)) {
+		printf("Unable to configure links: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * both links need to be up before breaking the primary one
+	 */
+	for (i = 0; i < TEST_TIMEOUT; i++) {
+		if ((link_status(knet_h, 0, &status0) < 0) ||
+		    (link_status(knet_h, 1, &status1) < 0)) {
+			knet_handle_stop(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+		if ((status0.connected) && (status1.connected)) {
+			break;
+		}
+		usleep(1000);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((!status0.connected) || (!status1.connected)) {
+		printf("timeout waiting for links to be up\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Stopping pings on link 0\n");
+
+	tx_backup = status1.stats.tx_data_packets;
+
+	if (knet_link_set_ping_timers(knet_h, 1, 0, NO_PING, PONG_TIMEOUT, 2048) < 0) {
+		printf("knet_link_set_ping_timers failed: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	start = now_usecs();
+	while ((!failover) && (now_usecs() - start < TEST_TIMEOUT * 1000)) {
+		if ((send_recv(knet_h, datafd, channel, &received) < 0) ||
+		    (link_status(knet_h, 0, &status0) < 0) ||
+		    (link_status(knet_h, 1, &status1) < 0)) {
+			knet_handle_stop(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+		if ((!link_down) && (!status0.connected)) {
+			link_down = now_usecs();
+		}
+		if ((link_down) && (status1.stats.tx_data_packets > tx_backup)) {
+			failover = now_usecs();
+		}
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (!failover) {
+		printf("Traffic did not move to link 1 within %d msecs\n", TEST_TIMEOUT);
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("link down after: %" PRIu64 " usecs failover latency: %" PRIu64 " usecs\n",
+	       link_down - start, failover - link_down);
+
+	/*
+	 * make sure packets are delivered again over the backup link
+	 */
+	received = 0;
+	for (i = 0; (i < 1000) && (!received); i++) {
+		if (send_recv(knet_h, datafd, channel, &received) < 0) {
+			knet_handle_stop(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+	}
+
+	if (!received) {
+		printf("No packets received over link 1\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((failover - link_down > MAX_FAILOVER) && (!is_memcheck()) && (!is_helgrind())) {
+		printf("Failover took too long\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
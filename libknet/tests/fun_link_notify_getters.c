@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * check that the read only API can be called from the link
+ * status change notification while configuration writers
+ * are waiting for the data path threads.
+ *
+ * The link is brought up by the RX thread, that runs the
+ * notification from within its read section. A writer thread
+ * keeps changing the configuration and the notification calls
+ * a few getters. If the getters do not nest in the RX read
+ * section, RX and the writer wait for each other forever and
+ * the test is killed by the alarm.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define CYCLES        5
+#define PING_INTERVAL 100    /* msecs */
+#define PONG_TIMEOUT  1000   /* msecs */
+#define TEST_TIMEOUT  10000  /* msecs */
+#define ALARM_TIMEOUT 60     /* secs */
+
+struct notify_info {
+	knet_handle_t knet_h;
+	int up_events;
+	int getter_errors;
+	int stop;
+};
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void link_notify(void *priv_data,
+			knet_node_id_t host_id,
+			uint8_t link_id,
+			uint8_t connected,
+			uint8_t remote,
+			uint8_t external)
+{
+	struct notify_info *info = (struct notify_info *)priv_data;
+	struct knet_link_status link_status;
+	struct knet_host_status host_status;
+	struct knet_handle_stats stats;
+
+	if (!connected) {
+		/*
+		 * link down is notified by the test disabling the link,
+		 * the getters can't take the lock it holds (EDEADLK)
+		 */
+		return;
+	}
+
+	if ((knet_link_get_status(info->knet_h, host_id, link_id, &link_status, sizeof(link_status)) < 0) ||
+	    (knet_host_get_status(info->knet_h, host_id, &host_status) < 0) ||
+	    (knet_handle_get_stats(info->knet_h, &stats, sizeof(stats)) < 0)) {
+		__atomic_add_fetch(&info->getter_errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_add_fetch(&info->up_events, 1, __ATOMIC_RELAXED);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct notify_info *info = (struct notify_info *)arg;
+	uint8_t priority = 0;
+
+	while (!__atomic_load_n(&info->stop, __ATOMIC_RELAXED)) {
+		knet_link_set_priority(info->knet_h, 1, 0, priority++);
+		knet_log_set_loglevel(info->knet_h, KNET_SUB_TX, KNET_LOG_DEBUG);
+	}
+
+	return NULL;
+}
+
+static void fail(knet_handle_t knet_h, int logfds[2], int ret)
+{
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+	exit(ret);
+}
+
+static int wait_for_link(knet_handle_t knet_h, struct notify_info *info, int up_events)
+{
+	int i;
+
+	for (i = 0; i < TEST_TIMEOUT; i++) {
+		if (__atomic_load_n(&info->up_events, __ATOMIC_RELAXED) >= up_events) {
+			return 0;
+		}
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+	struct notify_info info;
+	pthread_t writer;
+	int i;
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	memset(&info, 0, sizeof(info));
+	info.knet_h = knet_h;
+
+	channel = -1;
+
+	if ((knet_handle_enable_sock_notify(knet_h, &info, sock_notify) < 0) ||
+	    (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) ||
+	    (knet_link_enable_status_change_notify(knet_h, &info, link_notify) < 0) ||
+	    (knet_host_add(knet_h, 1) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (pthread_create(&writer, NULL, writer_thread, &info)) {
+		printf("Unable to start writer thread\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	alarm(ALARM_TIMEOUT);
+
+	for (i = 1; i <= CYCLES; i++) {
+		printf("Test link up %d/%d with a looping writer\n", i, CYCLES);
+
+		/*
+		 * a fresh link config starts disconnected,
+		 * RX brings it up once pongs are received
+		 */
+		if ((_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) ||
+		    (knet_link_set_ping_timers(knet_h, 1, 0, PING_INTERVAL, PONG_TIMEOUT, 2048) < 0) ||
+		    (knet_link_set_enable(knet_h, 1, 0, 1) < 0)) {
+			printf("Unable to configure link: %s\n", strerror(errno));
+			break;
+		}
+
+		if (wait_for_link(knet_h, &info, i) < 0) {
+			printf("timeout waiting for link up notification\n");
+			break;
+		}
+
+		if ((knet_link_set_enable(knet_h, 1, 0, 0) < 0) ||
+		    (knet_link_clear_config(knet_h, 1, 0) < 0)) {
+			printf("Unable to clear link: %s\n", strerror(errno));
+			break;
+		}
+
+		flush_logs(logfds[0], stdout);
+	}
+
+	__atomic_store_n(&info.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(writer, NULL);
+
+	alarm(0);
+
+	flush_logs(logfds[0], stdout);
+
+	if (info.getter_errors) {
+		printf("Getters failed %d times from the link notification\n", info.getter_errors);
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (i <= CYCLES) {
+		fail(knet_h, logfds, FAIL);
+	}
+
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
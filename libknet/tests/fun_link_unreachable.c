@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * check that the TX path fails over as soon as the kernel
+ * reports the active link unreachable.
+ *
+ * Host 1 has 3 links in passive mode, link 0 with the highest
+ * priority. Once all links are up, link 0 destination is replaced
+ * with an IPv4 mapped address, that can't be reached from an IPv6
+ * only socket (ENETUNREACH). The pong timeout is way longer than
+ * the test, so the heartbeat thread can't be the one declaring
+ * the link down: the very next packet sent has to be delivered
+ * over link 1 and links 1 and 2 have to stay up.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define LINKS         3
+#define PING_INTERVAL 100    /* msecs */
+#define PONG_TIMEOUT  60000  /* msecs */
+#define TEST_TIMEOUT  10000  /* msecs */
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void fail(knet_handle_t knet_h, int logfds[2], int ret)
+{
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+	exit(ret);
+}
+
+static int links_status(knet_handle_t knet_h, struct knet_link_status *status)
+{
+	uint8_t link_id;
+
+	for (link_id = 0; link_id < LINKS; link_id++) {
+		if (knet_link_get_status(knet_h, 1, link_id, &status[link_id], sizeof(struct knet_link_status)) < 0) {
+			printf("knet_link_get_status failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+	struct sockaddr_in6 *dst_addr;
+	struct knet_link_status before[LINKS], after[LINKS];
+	char send_buff[64], recv_buff[64];
+	uint8_t link_id;
+	int i, up;
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	channel = -1;
+
+	if ((knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) ||
+	    (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) ||
+	    (knet_host_add(knet_h, 1) < 0) ||
+	    (knet_host_set_policy(knet_h, 1, KNET_LINK_POLICY_PASSIVE) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		fail(knet_h, logfds, FAIL);
+	}
+
+	for (link_id = 0; link_id < LINKS; link_id++) {
+		if (_knet_link_set_config(knet_h, 1, link_id, KNET_TRANSPORT_UDP, 0, AF_INET6, 0, &lo) < 0) {
+			if ((errno == EADDRNOTAVAIL) || (errno == EAFNOSUPPORT)) {
+				printf("IPv6 loopback is not available\n");
+				fail(knet_h, logfds, SKIP);
+			}
+			printf("Unable to configure link %u: %s\n", link_id, strerror(errno));
+			fail(knet_h, logfds, FAIL);
+		}
+		if ((knet_link_set_priority(knet_h, 1, link_id, LINKS - link_id) < 0) ||
+		    (knet_link_set_ping_timers(knet_h, 1, link_id, PING_INTERVAL, PONG_TIMEOUT, 2048) < 0) ||
+		    (knet_link_set_enable(knet_h, 1, link_id, 1) < 0)) {
+			printf("Unable to configure link %u: %s\n", link_id, strerror(errno));
+			fail(knet_h, logfds, FAIL);
+		}
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	/*
+	 * all links need to be up before breaking the primary one
+	 */
+	for (i = 0; i < TEST_TIMEOUT; i++) {
+		if (links_status(knet_h, before) < 0) {
+			fail(knet_h, logfds, FAIL);
+		}
+		for (link_id = 0, up = 0; link_id < LINKS; link_id++) {
+			up += before[link_id].connected;
+		}
+		if (up == LINKS) {
+			break;
+		}
+		usleep(1000);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (up != LINKS) {
+		printf("timeout waiting for links to be up\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	printf("Making link 0 unreachable\n");
+
+	dst_addr = (struct sockaddr_in6 *)&knet_h->host_index[1]->link[0].dst_addr;
+	if (inet_pton(AF_INET6, "::ffff:192.0.2.1", &dst_addr->sin6_addr) != 1) {
+		printf("Unable to convert test address\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (links_status(knet_h, before) < 0) {
+		fail(knet_h, logfds, FAIL);
+	}
+
+	memset(send_buff, 0, sizeof(send_buff));
+
+	if (knet_send(knet_h, send_buff, sizeof(send_buff), channel) != sizeof(send_buff)) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (wait_for_packet(knet_h, 10, datafd, logfds[0], stdout) < 0) {
+		printf("Packet has not been delivered over the backup link\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (knet_recv(knet_h, recv_buff, sizeof(recv_buff), channel) != sizeof(recv_buff)) {
+		printf("knet_recv failed: %s\n", strerror(errno));
+		fail(knet_h, logfds, FAIL);
+	}
+
+	/*
+	 * TX only demotes the link, the heartbeat thread declares it
+	 * down well before the pong timeout
+	 */
+	for (i = 0; i < TEST_TIMEOUT; i++) {
+		if (links_status(knet_h, after) < 0) {
+			fail(knet_h, logfds, FAIL);
+		}
+		if (!after[0].connected) {
+			break;
+		}
+		usleep(1000);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (after[0].connected) {
+		printf("Link 0 has not been declared down\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (after[0].stats.tx_data_errors <= before[0].stats.tx_data_errors) {
+		printf("Send errors on link 0 have not been recorded\n");
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if (after[1].stats.tx_data_packets != before[1].stats.tx_data_packets + 1) {
+		printf("Packet has not been resent over link 1 (%" PRIu64 " -> %" PRIu64 ")\n",
+		       before[1].stats.tx_data_packets, after[1].stats.tx_data_packets);
+		fail(knet_h, logfds, FAIL);
+	}
+
+	if ((!after[1].connected) || (!after[2].connected)) {
+		printf("Other links went down: link 1 %u link 2 %u\n",
+		       after[1].connected, after[2].connected);
+		fail(knet_h, logfds, FAIL);
+	}
+
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
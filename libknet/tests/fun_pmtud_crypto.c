@@ -113,6 +113,7 @@ static void test_mtu(const char *model, const char *crypto, const char *hash)
 	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
 	unsigned int data_mtu, expected_mtu;
 	size_t calculated_iface_mtu = 0, detected_iface_mtu = 0;
+	struct knet_crypto_overhead overhead;
 
 	setup_logpipes(logfds);
 
@@ -215,12 +216,13 @@ static void test_mtu(const char *model, const char *crypto, const char *hash)
 		exit_local(FAIL);
 	}
 
-	calculated_iface_mtu = calc_data_outlen(knet_h, data_mtu + KNET_HEADER_ALL_SIZE) + 28;
+	calc_crypto_overhead(knet_h, &overhead);
+	calculated_iface_mtu = calc_data_outlen(&overhead, data_mtu + KNET_HEADER_ALL_SIZE) + 28;
 	detected_iface_mtu = get_iface_mtu();
 	/*
 	 * 28 = 20 IP header + 8 UDP header
 	 */
-	expected_mtu = calc_max_data_outlen(knet_h, detected_iface_mtu - 28);
+	expected_mtu = calc_max_data_outlen(&overhead, detected_iface_mtu - 28);
 
 	if (expected_mtu != data_mtu) {
 		printf("Wrong MTU detected! interface mtu: %zu knet mtu: %u expected mtu: %u\n", detected_iface_mtu, data_mtu, expected_mtu);
@@ -233,7 +235,7 @@ static void test_mtu(const char *model, const char *crypto, const char *hash)
 		exit_local(FAIL);
 	}
 
-	if ((detected_iface_mtu - calculated_iface_mtu) >= knet_h->sec_block_size) {
+	if ((detected_iface_mtu - calculated_iface_mtu) >= overhead.sec_block_size) {
 		printf("Wrong MTU detected! real iface mtu: %zu calculated: %zu\n", detected_iface_mtu, calculated_iface_mtu);
 		knet_link_set_enable(knet_h, 1, 0, 0);
 		knet_link_clear_config(knet_h, 1, 0);
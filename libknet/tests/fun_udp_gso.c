@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * make sure that fragmented messages sent over UDP are delivered
+ * intact. With a small MTU every message is split into a train of
+ * same sized fragments, that the UDP transport sends with GSO
+ * (when available) and the RX thread has to split again when
+ * they are coalesced by GRO.
+ *
+ * Messages are sent in bursts, so that trains are back to back
+ * in the RX buffers, with and without compression (when zlib
+ * is available), that changes the size of the data delivered
+ * after defragmentation.
+ *
+ * If the running kernel supports UDP GSO and GRO, both the GSO
+ * send path and the GRO split path must have been used.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define IFACE_MTU     1500
+#define MSG_SIZE      60000
+#define MESSAGES      200
+#define BURST         8
+#define RECV_TIMEOUT  5000 /* msecs */
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+/*
+ * same checks done by the UDP transport on its sockets
+ */
+static int gso_gro_supported(void)
+{
+#if defined (UDP_SEGMENT) && defined (UDP_GRO)
+	int sock, value = 1, supported = 0;
+	socklen_t value_len = sizeof(value);
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		return 0;
+	}
+
+	if ((getsockopt(sock, SOL_UDP, UDP_SEGMENT, &value, &value_len) == 0) &&
+	    (setsockopt(sock, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0)) {
+		supported = 1;
+	}
+
+	close(sock);
+	return supported;
+#else
+	return 0;
+#endif
+}
+
+static void fill_buff(char *buff, int seq)
+{
+	uint32_t lcg = seq + 1;
+	int i;
+
+	/*
+	 * low entropy data, that compresses but still needs
+	 * to be fragmented once compressed
+	 */
+	for (i = 0; i < MSG_SIZE; i++) {
+		lcg = (lcg * 1103515245) + 12345;
+		buff[i] = (char)((lcg >> 16) & 0x0f);
+	}
+}
+
+static int send_recv(knet_handle_t knet_h, int datafd, int8_t channel, int seq)
+{
+	static char tx_buff[MSG_SIZE];
+	static char rx_buff[KNET_MAX_PACKET_SIZE];
+	struct pollfd pfd;
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < BURST; i++) {
+		fill_buff(tx_buff, seq + i);
+		if (knet_send(knet_h, tx_buff, MSG_SIZE, channel) != MSG_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < BURST; i++) {
+		pfd.fd = datafd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, RECV_TIMEOUT) != 1) {
+			printf("Message %d has not been received\n", seq + i);
+			return -1;
+		}
+
+		len = knet_recv(knet_h, rx_buff, sizeof(rx_buff), channel);
+		if (len != MSG_SIZE) {
+			printf("knet_recv returned %zd bytes for message %d: %s\n", len, seq + i, strerror(errno));
+			return -1;
+		}
+
+		fill_buff(tx_buff, seq + i);
+		if (memcmp(tx_buff, rx_buff, MSG_SIZE)) {
+			printf("Message %d has been corrupted\n", seq + i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void test(const char *compress_model)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+	struct knet_link_status status;
+	unsigned int data_mtu;
+	struct knet_handle_compress_cfg compress_cfg;
+	unsigned int min_frags;
+	int i;
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_INFO);
+
+	flush_logs(logfds[0], stdout);
+
+	channel = -1;
+
+	if ((knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) ||
+	    (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) ||
+	    (knet_handle_pmtud_set(knet_h, IFACE_MTU) < 0) ||
+	    (knet_host_add(knet_h, 1) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	memset(&compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(compress_cfg.compress_model, compress_model, sizeof(compress_cfg.compress_model) - 1);
+	compress_cfg.compress_level = 1;
+	compress_cfg.compress_threshold = 1;
+
+	if (knet_handle_compress(knet_h, &compress_cfg) < 0) {
+		printf("Unable to configure %s compression: %s\n", compress_model, strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) ||
+	    (knet_link_set_enable(knet_h, 1, 0, 1) < 0) ||
+	    (knet_handle_setfwd(knet_h, 1) < 0)) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * wait for PMTUd to apply the manual MTU,
+	 * otherwise messages are not fragmented
+	 */
+	for (i = 0; i < 10000; i++) {
+		if (knet_handle_pmtud_get(knet_h, &data_mtu) < 0) {
+			printf("knet_handle_pmtud_get failed: %s\n", strerror(errno));
+			knet_handle_stop(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+		if ((data_mtu) && (data_mtu < IFACE_MTU)) {
+			break;
+		}
+		usleep(1000);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if ((!data_mtu) || (data_mtu >= IFACE_MTU)) {
+		printf("timeout waiting for data MTU to be set\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Sending %d messages of %d bytes in bursts of %d with data MTU %u and compression %s\n",
+	       MESSAGES, MSG_SIZE, BURST, data_mtu, compress_model);
+
+	for (i = 0; i < MESSAGES; i += BURST) {
+		if (send_recv(knet_h, datafd, channel, i) < 0) {
+			knet_handle_stop(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (knet_link_get_status(knet_h, 1, 0, &status, sizeof(struct knet_link_status)) < 0) {
+		printf("knet_link_get_status failed: %s\n", strerror(errno));
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("tx_data_packets: %" PRIu64 " rx_data_packets: %" PRIu64 " rx_kernel_drops: %" PRIu64 "\n",
+	       status.stats.tx_data_packets, status.stats.rx_data_packets, status.stats.rx_kernel_drops);
+
+	/*
+	 * compressed messages are at least half the size of the original data
+	 */
+	min_frags = MSG_SIZE / data_mtu;
+	if (strcmp(compress_model, "none")) {
+		min_frags = (MSG_SIZE / 2) / data_mtu;
+	}
+
+	if (status.stats.rx_data_packets < (uint64_t)MESSAGES * min_frags) {
+		printf("Messages have not been fragmented\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("tx_udp_gso_trains: %" PRIu64 " rx_udp_gro_packets: %" PRIu64 "\n",
+	       knet_h->stats_extra.tx_udp_gso_trains, knet_h->stats_extra.rx_udp_gro_packets);
+
+	if (!gso_gro_supported()) {
+		printf("UDP GSO/GRO not supported by the running kernel, not checking GSO/GRO paths\n");
+	} else if ((!knet_h->stats_extra.tx_udp_gso_trains) || (!knet_h->stats_extra.rx_udp_gro_packets)) {
+		printf("GSO send path and/or GRO split path have not been used\n");
+		knet_handle_stop(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_stop(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[256];
+	size_t compress_list_entries, i;
+
+	test("none");
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i = 0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			test("zlib");
+			return PASS;
+		}
+	}
+
+	printf("zlib support not builtin the library, not testing with compression\n");
+
+	return PASS;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * measure how long it takes to create and destroy a handle
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "test-common.h"
+
+#define ITERATIONS 100
+
+static uint64_t now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void bench(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	uint64_t start, new_total = 0, new_max = 0, free_total = 0, free_max = 0, elapsed;
+	int i;
+
+	setup_logpipes(logfds);
+
+	printf("Creating and destroying %d handles\n", ITERATIONS);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		start = now_usecs();
+		knet_h = knet_handle_new(1, logfds[1], KNET_LOG_INFO, 0);
+		elapsed = now_usecs() - start;
+		if (!knet_h) {
+			printf("knet_handle_new failed: %s\n", strerror(errno));
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+		new_total += elapsed;
+		if (elapsed > new_max) {
+			new_max = elapsed;
+		}
+
+		start = now_usecs();
+		if (knet_handle_free(knet_h) < 0) {
+			printf("knet_handle_free failed: %s\n", strerror(errno));
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+		elapsed = now_usecs() - start;
+		free_total += elapsed;
+		if (elapsed > free_max) {
+			free_max = elapsed;
+		}
+
+		flush_logs(logfds[0], stdout);
+	}
+
+	printf("knet_handle_new ave: %" PRIu64 " max: %" PRIu64 " usecs\n",
+	       new_total / ITERATIONS, new_max);
+	printf("knet_handle_free ave: %" PRIu64 " max: %" PRIu64 " usecs\n",
+	       free_total / ITERATIONS, free_max);
+
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	bench();
+
+	return PASS;
+}
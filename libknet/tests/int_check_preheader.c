@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * check that pre-headers are recognized by their mark and that
+ * packets are discarded based on their cleartext pre-header only
+ * when they would be dropped after decryption: unknown or
+ * unreachable source host and data packets that have already
+ * been delivered.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "crypto.h"
+#include "host.h"
+#include "onwire.h"
+#include "threads_rx.h"
+#include "test-common.h"
+
+/*
+ * threads_rx.c is linked in, it needs the shared lib lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void check(knet_handle_t knet_h, struct knet_header *preheader, ssize_t len, int expected, const char *msg)
+{
+	int err;
+
+	err = _check_preheader(knet_h, (const unsigned char *)preheader, len);
+	if (err != expected) {
+		printf("%s: expected %d got %d\n", msg, expected, err);
+		exit(FAIL);
+	}
+}
+
+static void set_preheader(struct knet_header *preheader, uint8_t type, knet_node_id_t host_id, seq_num_t seq_num)
+{
+	memset(preheader, 0, sizeof(struct knet_header));
+	preheader->kh_version = KNET_HEADER_VERSION;
+	preheader->kh_type = type;
+	preheader->kh_node = htons(host_id);
+	preheader->kh_pad1 = KNET_HEADER_FLAG_PREHEADER;
+	if (type == KNET_HEADER_TYPE_DATA) {
+		preheader->khp_data_seq_num = htons(seq_num);
+	}
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	struct knet_host *host;
+	struct knet_header preheader;
+	ssize_t len = KNET_CRYPTO_PREHEADER_SIZE;
+
+	knet_h = calloc(1, sizeof(struct knet_handle));
+	host = calloc(1, sizeof(struct knet_host));
+	if ((!knet_h) || (!host)) {
+		printf("Unable to allocate memory\n");
+		exit(FAIL);
+	}
+	host->host_id = 1;
+
+	printf("Test pre-header mark\n");
+	set_preheader(&preheader, KNET_HEADER_TYPE_PING, 1, 0);
+	if (!crypto_has_preheader((const unsigned char *)&preheader, len + 1)) {
+		printf("Marked pre-header has not been recognized\n");
+		exit(FAIL);
+	}
+	if (crypto_has_preheader((const unsigned char *)&preheader, len)) {
+		printf("Packet without payload has been recognized as pre-header\n");
+		exit(FAIL);
+	}
+	preheader.kh_pad1 = 0;
+	if (crypto_has_preheader((const unsigned char *)&preheader, len + 1)) {
+		printf("Unmarked header has been recognized as pre-header\n");
+		exit(FAIL);
+	}
+
+	printf("Test short packet\n");
+	set_preheader(&preheader, KNET_HEADER_TYPE_PING, 1, 0);
+	check(knet_h, &preheader, len - 1, -1, "short packet");
+
+	printf("Test unknown version\n");
+	preheader.kh_version = KNET_HEADER_VERSION + 1;
+	check(knet_h, &preheader, len, -1, "unknown version");
+
+	printf("Test unknown host\n");
+	set_preheader(&preheader, KNET_HEADER_TYPE_PING, 1, 0);
+	check(knet_h, &preheader, len, -1, "unknown host ping");
+	set_preheader(&preheader, KNET_HEADER_TYPE_DATA, 1, 1);
+	check(knet_h, &preheader, len, -1, "unknown host data");
+
+	knet_h->host_index[1] = host;
+
+	printf("Test unreachable host\n");
+	set_preheader(&preheader, KNET_HEADER_TYPE_DATA, 1, 1);
+	check(knet_h, &preheader, len, -1, "unreachable host data");
+	set_preheader(&preheader, KNET_HEADER_TYPE_HOST_INFO, 1, 0);
+	check(knet_h, &preheader, len, -1, "unreachable host info");
+	set_preheader(&preheader, KNET_HEADER_TYPE_PING, 1, 0);
+	check(knet_h, &preheader, len, 0, "unreachable host ping");
+
+	host->status.reachable = 1;
+
+	printf("Test reachable host\n");
+	set_preheader(&preheader, KNET_HEADER_TYPE_HOST_INFO, 1, 0);
+	check(knet_h, &preheader, len, 0, "reachable host info");
+	set_preheader(&preheader, KNET_HEADER_TYPE_DATA, 1, 1);
+	check(knet_h, &preheader, len, 0, "new data");
+
+	printf("Test already delivered data\n");
+	if (!_seq_num_lookup(host, 1, 0, 0)) {
+		printf("Seq num 1 should not have been delivered yet\n");
+		exit(FAIL);
+	}
+	_seq_num_set(host, 1, 0);
+	check(knet_h, &preheader, len, -1, "delivered data");
+
+	set_preheader(&preheader, KNET_HEADER_TYPE_DATA, 1, 2);
+	check(knet_h, &preheader, len, 0, "next data");
+
+	free(host);
+	free(knet_h);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * make sure that all crypto models produce the same on wire format,
+ * by encrypting with one model and decrypting with the others,
+ * for all packet sizes around the cipher block size and for
+ * a number of packets in a row (crypto modules can keep state
+ * between packets). The pre-header can be enabled on either side.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "crypto.h"
+#include "onwire.h"
+#include "test-common.h"
+
+#define MAX_MODELS 16
+#define MAX_SIZE   1100
+
+/*
+ * crypto.c is linked in, it needs the shared lib lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int logfds[2];
+
+static knet_handle_t compat_handle_new(const char *model, const char *cipher, const char *hash)
+{
+	knet_handle_t knet_h;
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+
+	knet_h = calloc(1, sizeof(struct knet_handle));
+	if (!knet_h) {
+		printf("Unable to allocate memory for handle\n");
+		return NULL;
+	}
+
+	knet_h->logfd = logfds[1];
+	memset(knet_h->log_levels, KNET_LOG_ERR, KNET_MAX_SUBSYSTEMS);
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg.crypto_model, model, sizeof(knet_handle_crypto_cfg.crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_cipher_type, cipher, sizeof(knet_handle_crypto_cfg.crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_hash_type, hash, sizeof(knet_handle_crypto_cfg.crypto_hash_type) - 1);
+	memset(knet_handle_crypto_cfg.private_key, 0x42, KNET_MIN_KEY_LEN);
+	knet_handle_crypto_cfg.private_key_len = KNET_MIN_KEY_LEN;
+
+	if ((crypto_init(knet_h, &knet_handle_crypto_cfg, 1) < 0) ||
+	    (crypto_use_config(knet_h, 1) < 0)) {
+		printf("Unable to initialize %s/%s/%s crypto\n", model, cipher, hash);
+		flush_logs(logfds[0], stdout);
+		free(knet_h);
+		return NULL;
+	}
+
+	return knet_h;
+}
+
+/*
+ * packets start with a knet header, RX tells packets with
+ * and without pre-header apart from its first bytes
+ */
+static void set_header(unsigned char *plain)
+{
+	struct knet_header *header = (struct knet_header *)plain;
+
+	header->kh_version = KNET_HEADER_VERSION;
+	header->kh_pad1 = 0;
+	header->kh_pad2 = 0;
+}
+
+static void compat_handle_free(knet_handle_t knet_h)
+{
+	crypto_fini(knet_h, 1);
+	free(knet_h);
+}
+
+/*
+ * encrypt all fragment sizes of a message in one batch,
+ * as done by the TX thread
+ */
+static int check_pair_batch(knet_handle_t src, knet_handle_t dst, int min_size)
+{
+	static unsigned char plain[PCKT_FRAG_MAX];
+	static unsigned char crypt[PCKT_FRAG_MAX][KNET_DATABUFSIZE_CRYPT];
+	unsigned char decrypt[KNET_DATABUFSIZE_CRYPT];
+	struct crypto_batch_entry batch[PCKT_FRAG_MAX];
+	struct iovec iov_in[PCKT_FRAG_MAX][2];
+	ssize_t decrypt_len;
+	int i, first = min_size - 1;
+
+	for (i = 0; i < PCKT_FRAG_MAX; i++) {
+		plain[i] = i;
+	}
+	set_header(plain);
+
+	for (i = first; i < PCKT_FRAG_MAX; i++) {
+		iov_in[i][0].iov_base = plain;
+		iov_in[i][0].iov_len = 1;
+		iov_in[i][1].iov_base = plain + 1;
+		iov_in[i][1].iov_len = i;
+		batch[i].iov_in = iov_in[i];
+		batch[i].iovcnt_in = 2;
+		batch[i].buf_out = crypt[i];
+	}
+
+	if (crypto_encrypt_and_signv_batch(src, batch + first, PCKT_FRAG_MAX - first) < 0) {
+		printf("Unable to encrypt batch\n");
+		return -1;
+	}
+
+	for (i = first; i < PCKT_FRAG_MAX; i++) {
+		/*
+		 * MAC only batches return the MAC, the on wire
+		 * packet is the payload followed by the MAC
+		 */
+		if (batch[i].mac_only) {
+			memmove(crypt[i] + i + 1, crypt[i], batch[i].buf_out_len);
+			memmove(crypt[i], plain, i + 1);
+			batch[i].buf_out_len += i + 1;
+		}
+
+		if (crypto_authenticate_and_decrypt(dst, crypt[i], batch[i].buf_out_len, decrypt, &decrypt_len) < 0) {
+			printf("Unable to decrypt batch entry %d\n", i);
+			return -1;
+		}
+
+		if ((decrypt_len != i + 1) || (memcmp(plain, decrypt, i + 1))) {
+			printf("Decrypted data do not match for batch entry %d\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_pair(knet_handle_t src, knet_handle_t dst)
+{
+	unsigned char plain[MAX_SIZE];
+	unsigned char crypt[KNET_DATABUFSIZE_CRYPT];
+	unsigned char decrypt[KNET_DATABUFSIZE_CRYPT];
+	ssize_t crypt_len, decrypt_len;
+	int i, size, min_size = 1;
+
+	/*
+	 * the pre-header is a copy of the knet header, packets
+	 * are never shorter than that
+	 */
+	if (src->crypto_preheader) {
+		min_size = KNET_CRYPTO_PREHEADER_SIZE;
+	}
+
+	for (size = min_size; size < MAX_SIZE; size++) {
+		for (i = 0; i < size; i++) {
+			plain[i] = size + i;
+		}
+		set_header(plain);
+
+		if (crypto_encrypt_and_sign(src, plain, size, crypt, &crypt_len) < 0) {
+			printf("Unable to encrypt %d bytes\n", size);
+			return -1;
+		}
+
+		if (crypto_authenticate_and_decrypt(dst, crypt, crypt_len, decrypt, &decrypt_len) < 0) {
+			printf("Unable to decrypt %d bytes\n", size);
+			return -1;
+		}
+
+		if ((decrypt_len != size) || (memcmp(plain, decrypt, size))) {
+			printf("Decrypted data do not match for %d bytes\n", size);
+			return -1;
+		}
+
+		if ((src->crypto_preheader) && (!src->crypto_instance->mac_only) &&
+		    (!(((struct knet_header *)crypt)->kh_pad1 & KNET_HEADER_FLAG_PREHEADER))) {
+			printf("Pre-header of %d bytes packet is not marked\n", size);
+			return -1;
+		}
+
+		/*
+		 * tampered packets must be rejected
+		 */
+		crypt[crypt_len / 2] ^= 0x01;
+		if (crypto_authenticate_and_decrypt(dst, crypt, crypt_len, decrypt, &decrypt_len) == 0) {
+			printf("Tampered packet of %d bytes has been accepted\n", size);
+			return -1;
+		}
+		crypt[crypt_len / 2] ^= 0x01;
+
+		/*
+		 * as well as packets with a pre-header that does not
+		 * match the encrypted header
+		 */
+		if ((src->crypto_preheader) && (!src->crypto_instance->mac_only)) {
+			crypt[2] ^= 0x01;
+			if (crypto_authenticate_and_decrypt(dst, crypt, crypt_len, decrypt, &decrypt_len) == 0) {
+				printf("Packet of %d bytes with tampered pre-header has been accepted\n", size);
+				return -1;
+			}
+			crypt[2] ^= 0x01;
+			crypt[0] ^= 0x01;
+			if (crypto_authenticate_and_decrypt(dst, crypt, crypt_len, decrypt, &decrypt_len) == 0) {
+				printf("Packet of %d bytes with unmarked pre-header has been accepted\n", size);
+				return -1;
+			}
+		}
+		flush_logs(logfds[0], stdout);
+	}
+
+	return check_pair_batch(src, dst, min_size);
+}
+
+static void test(void)
+{
+	struct knet_crypto_info crypto_list[MAX_MODELS];
+	size_t crypto_list_entries;
+	knet_handle_t knet_h[MAX_MODELS], knet_h_dst[MAX_MODELS];
+	const char *ciphers[] = { "aes128", "aes256", "none" };
+	size_t i, j, c;
+	uint8_t preheader, dst_preheader;
+	int err = 0;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		printf("knet_get_crypto_list failed: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	if (crypto_list_entries == 0) {
+		printf("no crypto modules detected. Skipping\n");
+		exit(SKIP);
+	}
+
+	setup_logpipes(logfds);
+
+	for (c = 0; c < sizeof(ciphers) / sizeof(ciphers[0]); c++) {
+		for (i = 0; i < crypto_list_entries; i++) {
+			knet_h[i] = compat_handle_new(crypto_list[i].name, ciphers[c], "sha256");
+			knet_h_dst[i] = compat_handle_new(crypto_list[i].name, ciphers[c], "sha256");
+			if ((!knet_h[i]) || (!knet_h_dst[i])) {
+				exit(FAIL);
+			}
+		}
+
+		/*
+		 * nodes can enable the pre-header one at a time,
+		 * check mixed pairs too
+		 */
+		for (preheader = 0; preheader < 2; preheader++) {
+			for (dst_preheader = 0; dst_preheader < 2; dst_preheader++) {
+				for (i = 0; i < crypto_list_entries; i++) {
+					crypto_use_preheader(knet_h[i], preheader);
+					crypto_use_preheader(knet_h_dst[i], dst_preheader);
+				}
+
+				for (i = 0; i < crypto_list_entries; i++) {
+					for (j = 0; j < crypto_list_entries; j++) {
+						printf("Checking %s -> %s with %s/sha256 pre-header: %u -> %u\n",
+						       crypto_list[i].name, crypto_list[j].name, ciphers[c], preheader, dst_preheader);
+						if (check_pair(knet_h[i], knet_h_dst[j]) < 0) {
+							err = -1;
+						}
+					}
+				}
+			}
+		}
+
+		for (i = 0; i < crypto_list_entries; i++) {
+			compat_handle_free(knet_h[i]);
+			compat_handle_free(knet_h_dst[i]);
+		}
+		flush_logs(logfds[0], stdout);
+	}
+
+	close_logpipes(logfds);
+
+	if (err) {
+		exit(FAIL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * check that a thread can be in the data path read sections
+ * of more handles than the initial size of its section table,
+ * from the main thread and from a thread that exits with
+ * sections allocated.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "epoch.h"
+#include "test-common.h"
+
+#define HANDLES 40
+
+static knet_handle_t knet_h[HANDLES];
+
+static knet_handle_t new_handle(void)
+{
+	knet_handle_t new_h;
+
+	new_h = calloc(1, sizeof(struct knet_handle));
+	if (!new_h) {
+		printf("Unable to allocate handle: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	if ((pthread_rwlock_init(&new_h->global_rwlock, NULL) != 0) ||
+	    (epoch_init(new_h) < 0)) {
+		printf("Unable to initialize handle: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	return new_h;
+}
+
+static void free_handle(knet_handle_t old_h)
+{
+	epoch_fini(old_h);
+	pthread_rwlock_destroy(&old_h->global_rwlock);
+	free(old_h);
+}
+
+static void *lock_all(void *data)
+{
+	int i;
+
+	for (i = 0; i < HANDLES; i++) {
+		if (epoch_read_lock(knet_h[i], KNET_EPOCH_READER_API) < 0) {
+			printf("Unable to enter read section of handle %d: %s\n", i, strerror(errno));
+			exit(FAIL);
+		}
+		/*
+		 * nested read section on the same handle
+		 */
+		if (epoch_read_lock(knet_h[i], KNET_EPOCH_READER_API) < 0) {
+			printf("Unable to enter nested read section of handle %d: %s\n", i, strerror(errno));
+			exit(FAIL);
+		}
+	}
+
+	for (i = HANDLES - 1; i >= 0; i--) {
+		epoch_read_unlock(knet_h[i]);
+		epoch_read_unlock(knet_h[i]);
+	}
+
+	/*
+	 * all readers have left, a writer must not wait for them
+	 */
+	for (i = 0; i < HANDLES; i++) {
+		if (pthread_rwlock_wrlock(&knet_h[i]->global_rwlock) != 0) {
+			printf("Unable to get write lock of handle %d\n", i);
+			exit(FAIL);
+		}
+		epoch_stop_readers(knet_h[i]);
+		epoch_resume_readers(knet_h[i]);
+		pthread_rwlock_unlock(&knet_h[i]->global_rwlock);
+	}
+
+	return NULL;
+}
+
+static void test(void)
+{
+	pthread_t thread;
+	int i;
+
+	for (i = 0; i < HANDLES; i++) {
+		knet_h[i] = new_handle();
+	}
+
+	printf("Test read sections of %d handles from the main thread\n", HANDLES);
+	lock_all(NULL);
+
+	printf("Test read sections of %d handles from another thread\n", HANDLES);
+	if (pthread_create(&thread, NULL, lock_all, NULL) != 0) {
+		printf("Unable to create thread\n");
+		exit(FAIL);
+	}
+	pthread_join(thread, NULL);
+
+	for (i = 0; i < HANDLES; i++) {
+		free_handle(knet_h[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
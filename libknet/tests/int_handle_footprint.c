@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * make sure that an idle handle does not pin memory that
+ * is never used (fd trackers, rx buffers...)
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define HANDLES          8
+#define MAX_HANDLE_RSS   (4 * 1024 * 1024) /* bytes */
+
+static int get_rss(size_t *rss)
+{
+	FILE *statm;
+	unsigned long size, resident;
+	int err = 0;
+
+	statm = fopen("/proc/self/statm", "r");
+	if (!statm) {
+		return -1;
+	}
+
+	if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+		err = -1;
+	} else {
+		*rss = resident * sysconf(_SC_PAGESIZE);
+	}
+
+	fclose(statm);
+	return err;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h[HANDLES];
+	int logfds[2];
+	size_t rss_start, rss_end, per_handle;
+	int i;
+
+	if (get_rss(&rss_start) < 0) {
+		printf("Unable to read /proc/self/statm. Skipping\n");
+		exit(SKIP);
+	}
+
+	setup_logpipes(logfds);
+
+	for (i = 0; i < HANDLES; i++) {
+		knet_h[i] = knet_handle_new(i + 1, logfds[1], KNET_LOG_INFO, 0);
+		if (!knet_h[i]) {
+			printf("knet_handle_new failed: %s\n", strerror(errno));
+			flush_logs(logfds[0], stdout);
+			exit(FAIL);
+		}
+		flush_logs(logfds[0], stdout);
+	}
+
+	if (get_rss(&rss_end) < 0) {
+		printf("Unable to read /proc/self/statm\n");
+		exit(FAIL);
+	}
+
+	per_handle = rss_end > rss_start ? (rss_end - rss_start) / HANDLES : 0;
+
+	printf("knet_handle size: %zu bytes rss per handle: %zu bytes\n",
+	       sizeof(struct knet_handle), per_handle);
+
+	for (i = 0; i < HANDLES; i++) {
+		knet_handle_free(knet_h[i]);
+		flush_logs(logfds[0], stdout);
+	}
+
+	close_logpipes(logfds);
+
+	if ((per_handle > MAX_HANDLE_RSS) && (!is_memcheck()) && (!is_helgrind())) {
+		printf("Handle uses more than %d bytes of memory\n", MAX_HANDLE_RSS);
+		exit(FAIL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -16,8 +16,11 @@
 #include <string.h>
 #include <netdb.h>
 #include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
 
 #include "internals.h"
+#include "threads_common.h"
 #include "links_acl.h"
 #include "links_acl_ip.h"
 
@@ -25,6 +28,12 @@
 
 static struct acl_match_entry *match_entry_v4;
 static struct acl_match_entry *match_entry_v6;
+static struct acl_match_entry *match_entry_bench;
+
+/*
+ * without an epoch, publishing a new table does not wait for readers
+ */
+static knet_handle_t knet_h;
 
 /* This is a test program .. remember! */
 #define BUFLEN 1024
@@ -97,11 +106,11 @@ static const char *rules[100] = {
 	"AM3ffe:1::0/ffff:ffff:ffff:ffff::0"
 };
 
-static int _ipcheck_addip(void *fd_tracker_match_entry_head,
+static int _ipcheck_addip(knet_handle_t knet_h, void *fd_tracker_match_entry_head,
 			  struct sockaddr_storage *ss1, struct sockaddr_storage *ss2,
 			  check_type_t type, check_acceptreject_t acceptreject)
 {
-	return ipcheck_addip(fd_tracker_match_entry_head, -1, ss1, ss2, type, acceptreject);
+	return ipcheck_addip(knet_h, fd_tracker_match_entry_head, -1, ss1, ss2, type, acceptreject);
 }
 
 static int default_rules(int load)
@@ -112,7 +121,7 @@ static int default_rules(int load)
 	struct sockaddr_storage addr1;
 	struct sockaddr_storage addr2;
 	int i = 0;
-	int (*loadfn)(void *fd_tracker_match_entry_head, struct sockaddr_storage *ss1, struct sockaddr_storage *ss2, check_type_t type, check_acceptreject_t acceptreject);
+	int (*loadfn)(knet_handle_t knet_h, void *fd_tracker_match_entry_head, struct sockaddr_storage *ss1, struct sockaddr_storage *ss2, check_type_t type, check_acceptreject_t acceptreject);
 
 	if (load) {
 		loadfn = _ipcheck_addip;
@@ -169,12 +178,12 @@ static int default_rules(int load)
 			return -1;
 		} else {
 			if (addr1.ss_family == AF_INET) {
-				if (loadfn(&match_entry_v4, &addr1, &addr2, type, acceptreject) < 0) {
+				if (loadfn(knet_h, &match_entry_v4, &addr1, &addr2, type, acceptreject) < 0) {
 					fprintf(stderr, "Failed to add/rm address on line %d: %s (errno: %s)\n", i, rules[i], strerror(errno));
 					return -1;
 				}
 			} else {
-				if (loadfn(&match_entry_v6, &addr1, &addr2, type, acceptreject) < 0) {
+				if (loadfn(knet_h, &match_entry_v6, &addr1, &addr2, type, acceptreject) < 0) {
 					fprintf(stderr, "Failed to add/rm address on line %d: %s (errno: %s)\n", i, rules[i], strerror(errno));
 					return -1;
 				}
@@ -284,7 +293,7 @@ int test(void)
 		return FAIL;
 	}
 
-	if (ipcheck_addip(&match_entry_v4, 3, &saddr, &saddr, CHECK_TYPE_ADDRESS, CHECK_ACCEPT) < 0) {
+	if (ipcheck_addip(knet_h, &match_entry_v4, 3, &saddr, &saddr, CHECK_TYPE_ADDRESS, CHECK_ACCEPT) < 0) {
 		fprintf(stderr, "Unable to insert address in position 3 192.168.2.1\n");
 		return FAIL;
 	}
@@ -294,7 +303,7 @@ int test(void)
 		return FAIL;
 	}
 
-	if (ipcheck_addip(&match_entry_v6, 3, &saddr, &saddr, CHECK_TYPE_ADDRESS, CHECK_ACCEPT) < 0) {
+	if (ipcheck_addip(knet_h, &match_entry_v6, 3, &saddr, &saddr, CHECK_TYPE_ADDRESS, CHECK_ACCEPT) < 0) {
 		fprintf(stderr, "Unable to insert address in position 3 3ffe:1::1\n");
 		return FAIL;
 	}
@@ -336,6 +345,141 @@ int test(void)
 	return PASS;
 }
 
+/*
+ * benchmark a large access list:
+ * BENCH_ENTRIES address rules for 10.0.0.0 + (i * 2), alternating
+ * accept and reject, followed by an accept range for 10.0.0.0/8
+ */
+#define BENCH_BASE 0x0a000000
+#define BENCH_ENTRIES 10000
+#define BENCH_LOOKUPS 1000000
+#define BENCH_LINEAR_LOOKUPS 10000
+
+static void bench_addr(uint32_t ip, struct sockaddr_storage *addr)
+{
+	struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
+
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	addr_in->sin_family = AF_INET;
+	addr_in->sin_addr.s_addr = htonl(ip);
+}
+
+static int bench_expected(uint32_t offset)
+{
+	if ((offset % 2 == 0) && (offset / 2 < BENCH_ENTRIES)) {
+		return ((offset / 2) % 2 == 0);
+	}
+	return 1;
+}
+
+static int bench_lookups(const char *desc, int lookups)
+{
+	struct sockaddr_storage saddr;
+	struct timespec clock_start, clock_end;
+	unsigned long long time_diff;
+	uint32_t offset;
+	int i;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &clock_start) != 0) {
+		fprintf(stderr, "Unable to get start time!\n");
+		return FAIL;
+	}
+
+	for (i = 0; i < lookups; i++) {
+		offset = ((uint32_t)i * 7919) % (BENCH_ENTRIES * 4);
+		bench_addr(BENCH_BASE + offset, &saddr);
+		if (ipcheck_validate(&match_entry_bench, &saddr) != bench_expected(offset)) {
+			fprintf(stderr, "%s: wrong result for offset %u\n", desc, offset);
+			return FAIL;
+		}
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &clock_end) != 0) {
+		fprintf(stderr, "Unable to get end time!\n");
+		return FAIL;
+	}
+
+	timespec_diff(clock_start, clock_end, &time_diff);
+	printf("%s: %d lookups with %d entries: %llu ns/lookup\n",
+	       desc, lookups, BENCH_ENTRIES + 1, time_diff / lookups);
+
+	return PASS;
+}
+
+static int bench(void)
+{
+	struct sockaddr_storage addr1, addr2;
+	struct timespec clock_start, clock_end;
+	unsigned long long time_diff;
+	int i;
+	int ret = FAIL;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &clock_start) != 0) {
+		fprintf(stderr, "Unable to get start time!\n");
+		return FAIL;
+	}
+
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		bench_addr(BENCH_BASE + ((uint32_t)i * 2), &addr1);
+		if (ipcheck_addip(knet_h, &match_entry_bench, -1, &addr1, &addr1, CHECK_TYPE_ADDRESS,
+				  (i % 2 == 0) ? CHECK_ACCEPT : CHECK_REJECT) < 0) {
+			fprintf(stderr, "Unable to add benchmark entry %d: %s\n", i, strerror(errno));
+			goto out;
+		}
+	}
+
+	bench_addr(BENCH_BASE, &addr1);
+	bench_addr(BENCH_BASE + 0x00ffffff, &addr2);
+	if (ipcheck_addip(knet_h, &match_entry_bench, -1, &addr1, &addr2, CHECK_TYPE_RANGE, CHECK_ACCEPT) < 0) {
+		fprintf(stderr, "Unable to add benchmark range: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &clock_end) != 0) {
+		fprintf(stderr, "Unable to get end time!\n");
+		goto out;
+	}
+
+	timespec_diff(clock_start, clock_end, &time_diff);
+	printf("Loaded %d entries in %llu ms\n", BENCH_ENTRIES + 1, time_diff / 1000000llu);
+
+	if (bench_lookups("compiled", BENCH_LOOKUPS) != PASS) {
+		goto out;
+	}
+
+	/*
+	 * a non contiguous mask forces the linear scan of the rules,
+	 * it does not match anything in 10.0.0.0/8
+	 */
+	bench_addr(0x0b000001, &addr1);
+	bench_addr(0xff0000ff, &addr2);
+	if (ipcheck_addip(knet_h, &match_entry_bench, -1, &addr1, &addr2, CHECK_TYPE_MASK, CHECK_REJECT) < 0) {
+		fprintf(stderr, "Unable to add benchmark mask: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (bench_lookups("linear", BENCH_LINEAR_LOOKUPS) != PASS) {
+		goto out;
+	}
+
+	/*
+	 * removing it must go back to the compiled table
+	 */
+	if (ipcheck_rmip(knet_h, &match_entry_bench, &addr1, &addr2, CHECK_TYPE_MASK, CHECK_REJECT) < 0) {
+		fprintf(stderr, "Unable to remove benchmark mask: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (bench_lookups("compiled", BENCH_LOOKUPS) != PASS) {
+		goto out;
+	}
+
+	ret = PASS;
+out:
+	ipcheck_rmall(&match_entry_bench);
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_storage saddr;
@@ -343,6 +487,12 @@ int main(int argc, char *argv[])
 	int ret = PASS;
 	int i;
 
+	knet_h = calloc(1, sizeof(struct knet_handle));
+	if (!knet_h) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		return FAIL;
+	}
+
 	if (default_rules(1) < 0) {
 		return -1;
 	}
@@ -376,6 +526,9 @@ int main(int argc, char *argv[])
 		 * run automatic tests
 		 */
 		ret = test();
+		if (ret == PASS) {
+			ret = bench();
+		}
 	}
 
 	/*
@@ -394,6 +547,7 @@ int main(int argc, char *argv[])
 out:
 	ipcheck_rmall(&match_entry_v4);
 	ipcheck_rmall(&match_entry_v6);
+	free(knet_h);
 
 	return ret;
 }
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * check the rate limiter of the data path logs: burst size,
+ * refill rate, suppressed messages count and that the state
+ * of a call site is not shared between handles.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "logging.h"
+#include "test-common.h"
+
+static char site;
+
+static knet_handle_t new_handle(int logfd)
+{
+	knet_handle_t knet_h;
+
+	knet_h = calloc(1, sizeof(struct knet_handle));
+	if (!knet_h) {
+		printf("Unable to allocate handle: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+	knet_h->logfd = logfd;
+	knet_h->log_levels[KNET_SUB_RX] = KNET_LOG_DEBUG;
+
+	return knet_h;
+}
+
+static int try_log(knet_handle_t knet_h)
+{
+	return log_ratelimit(knet_h, KNET_SUB_RX, KNET_LOG_DEBUG, &site);
+}
+
+/*
+ * return the number of log messages in the pipe,
+ * looking for a message containing expected (if not NULL)
+ */
+static int read_logs(int logfd, const char *expected, int *found)
+{
+	struct knet_log_msg msg;
+	int msgs = 0;
+
+	if (found) {
+		*found = 0;
+	}
+
+	while (read(logfd, &msg, sizeof(struct knet_log_msg)) == sizeof(struct knet_log_msg)) {
+		msg.msg[sizeof(msg.msg) - 1] = 0;
+		printf("log: %s\n", msg.msg);
+		if ((expected) && (found) && (strstr(msg.msg, expected))) {
+			*found = 1;
+		}
+		msgs++;
+	}
+
+	return msgs;
+}
+
+static void test(void)
+{
+	int logfds[2];
+	knet_handle_t knet_h1, knet_h2;
+	int i, found;
+
+	if (pipe(logfds) < 0) {
+		printf("Unable to create log pipe: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+	if (fcntl(logfds[0], F_SETFL, O_NONBLOCK) < 0) {
+		printf("Unable to set log pipe non blocking: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	knet_h1 = new_handle(logfds[1]);
+	knet_h2 = new_handle(logfds[1]);
+
+	printf("Test burst of %d messages\n", KNET_LOG_RATELIMIT_BURST);
+
+	for (i = 0; i < KNET_LOG_RATELIMIT_BURST; i++) {
+		if (!try_log(knet_h1)) {
+			printf("Message %d of the burst has been suppressed\n", i);
+			exit(FAIL);
+		}
+	}
+
+	for (i = 0; i < 5; i++) {
+		if (try_log(knet_h1)) {
+			printf("Message %d after the burst has not been suppressed\n", i);
+			exit(FAIL);
+		}
+	}
+
+	if (read_logs(logfds[0], NULL, NULL) != 0) {
+		printf("Rate limiter logged before messages went through\n");
+		exit(FAIL);
+	}
+
+	printf("Test call site state is per handle\n");
+
+	if (!try_log(knet_h2)) {
+		printf("Message on a different handle has been suppressed\n");
+		exit(FAIL);
+	}
+
+	printf("Test refill of %d message per second and suppressed count\n", KNET_LOG_RATELIMIT_RATE);
+
+	usleep(1100000);
+
+	if (!try_log(knet_h1)) {
+		printf("Message after refill has been suppressed\n");
+		exit(FAIL);
+	}
+
+	if (read_logs(logfds[0], "5 similar messages suppressed", &found) != 1) {
+		printf("Unexpected number of log messages\n");
+		exit(FAIL);
+	}
+	if (!found) {
+		printf("Suppressed messages count has not been logged\n");
+		exit(FAIL);
+	}
+
+	if (try_log(knet_h1)) {
+		printf("More than %d message went through after refill\n", KNET_LOG_RATELIMIT_RATE);
+		exit(FAIL);
+	}
+
+	free(knet_h1);
+	free(knet_h2);
+	close(logfds[0]);
+	close(logfds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -33,6 +33,7 @@ static int thisnodeid = -1;
 static knet_handle_t knet_h;
 static int datafd = 0;
 static int8_t channel = 0;
+static int compress_stream = 0;
 static int globallistener = 0;
 static int continous = 0;
 static int show_stats = 0;
@@ -89,8 +90,14 @@ static void print_help(void)
 	printf(" -f                                        enable use of access lists (default: off)\n");
 	printf(" -c [implementation]:[crypto]:[hashing]    crypto configuration. (default disabled)\n");
 	printf("                                           Example: -c nss:aes128:sha1\n");
-	printf(" -z [implementation]:[level]:[threshold]   compress configuration. (default disabled)\n");
-	printf("                                           Example: -z zlib:5:100\n");
+	printf(" -z [implementation]:[level]:[threshold][:adaptive][:stream]\n");
+	printf("                                           compress configuration. (default disabled)\n");
+	printf("                                           adaptive is the link speed in Mbit/s and enables\n");
+	printf("                                           adaptive compression (default disabled, 0 to skip)\n");
+	printf("                                           stream is the resync interval and enables\n");
+	printf("                                           stream compression (default disabled)\n");
+	printf("                                           Example: -z zlib:5:100 or -z lz4:1:100:1000\n");
+	printf("                                           or -z zstd:3:100:0:64\n");
 	printf(" -p [active|passive|rr]                    (default: passive)\n");
 	printf(" -P [UDP|SCTP]                             (default: UDP) protocol (transport) to use for all links\n");
 	printf(" -t [nodeid]                               This nodeid (required)\n");
@@ -516,14 +523,25 @@ static void setup_knet(int argc, char *argv[])
 	}
 
 	if (compresscfg) {
+		char *adaptive, *stream;
+
 		memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
 		snprintf(knet_handle_compress_cfg.compress_model, 16, "%s", strtok(compresscfg, ":"));
 		knet_handle_compress_cfg.compress_level = atoi(strtok(NULL, ":"));
 		knet_handle_compress_cfg.compress_threshold = atoi(strtok(NULL, ":"));
+		adaptive = strtok(NULL, ":");
+		stream = strtok(NULL, ":");
+		if (stream) {
+			compress_stream = atoi(stream);
+		}
 		if (knet_handle_compress(knet_h, &knet_handle_compress_cfg)) {
 			printf("Unable to configure compress\n");
 			exit(FAIL);
 		}
+		if ((adaptive) && (knet_handle_compress_set_adaptive(knet_h, atoi(adaptive)))) {
+			printf("Unable to configure adaptive compression\n");
+			exit(FAIL);
+		}
 	}
 
 	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
@@ -541,6 +559,12 @@ static void setup_knet(int argc, char *argv[])
 		exit(FAIL);
 	}
 
+	if ((compress_stream) && (knet_handle_compress_set_stream(knet_h, channel, compress_stream) < 0)) {
+		printf("knet_handle_compress_set_stream failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
 	if (knet_handle_pmtud_setfreq(knet_h, pmtud_interval) < 0) {
 		printf("knet_handle_pmtud_setfreq failed: %s\n", strerror(errno));
 		knet_handle_free(knet_h);
@@ -1054,6 +1078,20 @@ static void display_stats(int level)
 			printf("[stat]:  rx_compress_time_min: %" PRIu64 "\n", handle_stats.rx_compress_time_min);
 			printf("[stat]:  rx_compress_time_max: %" PRIu64 "\n", handle_stats.rx_compress_time_max);
 			printf("[stat]:  rx_failed_to_decompress: %" PRIu64 "\n", handle_stats.rx_failed_to_decompress);
+			printf("[stat]:  tx_dict_compressed_packets: %" PRIu64 "\n", handle_stats.tx_dict_compressed_packets);
+			printf("[stat]:  tx_dict_compressed_original_bytes: %" PRIu64 "\n", handle_stats.tx_dict_compressed_original_bytes);
+			printf("[stat]:  tx_dict_compressed_size_bytes: %" PRIu64 "\n", handle_stats.tx_dict_compressed_size_bytes);
+			printf("[stat]:  rx_dict_compressed_packets: %" PRIu64 "\n", handle_stats.rx_dict_compressed_packets);
+			printf("[stat]:  rx_dict_compressed_original_bytes: %" PRIu64 "\n", handle_stats.rx_dict_compressed_original_bytes);
+			printf("[stat]:  rx_dict_compressed_size_bytes: %" PRIu64 "\n", handle_stats.rx_dict_compressed_size_bytes);
+			printf("[stat]:  tx_adaptive_uncompressed_packets: %" PRIu64 "\n", handle_stats.tx_adaptive_uncompressed_packets);
+			printf("[stat]:  tx_stream_compressed_packets: %" PRIu64 "\n", handle_stats.tx_stream_compressed_packets);
+			printf("[stat]:  tx_stream_compressed_original_bytes: %" PRIu64 "\n", handle_stats.tx_stream_compressed_original_bytes);
+			printf("[stat]:  tx_stream_compressed_size_bytes: %" PRIu64 "\n", handle_stats.tx_stream_compressed_size_bytes);
+			printf("[stat]:  rx_stream_compressed_packets: %" PRIu64 "\n", handle_stats.rx_stream_compressed_packets);
+			printf("[stat]:  rx_stream_compressed_original_bytes: %" PRIu64 "\n", handle_stats.rx_stream_compressed_original_bytes);
+			printf("[stat]:  rx_stream_compressed_size_bytes: %" PRIu64 "\n", handle_stats.rx_stream_compressed_size_bytes);
+			printf("[stat]:  rx_stream_out_of_sync_packets: %" PRIu64 "\n", handle_stats.rx_stream_out_of_sync_packets);
 			printf("\n");
 		}
 		if (cryptocfg) {
@@ -1130,6 +1168,7 @@ static void display_stats(int level)
 
 			total_link_stats.down_count += link_status.stats.down_count;
 			total_link_stats.up_count += link_status.stats.up_count;
+			total_link_stats.rx_kernel_drops += link_status.stats.rx_kernel_drops;
 
 			if (level > 2) {
 				printf("\n");
@@ -1175,6 +1214,7 @@ static void display_stats(int level)
 
 				printf("[stat]:   down_count:       %" PRIu32 "\n", link_status.stats.down_count);
 				printf("[stat]:   up_count:         %" PRIu32 "\n", link_status.stats.up_count);
+				printf("[stat]:   rx_kernel_drops:  %" PRIu64 "\n", link_status.stats.rx_kernel_drops);
 			}
 		}
 	}
@@ -1216,6 +1256,7 @@ static void display_stats(int level)
 
 	printf("[stat]: down_count:       %" PRIu32 "\n", total_link_stats.down_count);
 	printf("[stat]: up_count:         %" PRIu32 "\n", total_link_stats.up_count);
+	printf("[stat]: rx_kernel_drops:  %" PRIu64 "\n", total_link_stats.rx_kernel_drops);
 
 }
 
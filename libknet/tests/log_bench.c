@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * measure the latency of the data path while libknet
+ * logs at high rate to a slow reader.
+ *
+ * logfd is a blocking pipe that is read one message every
+ * SLOW_READER_DELAY usecs. For every data packet, NOISE_PACKETS
+ * packets are rejected by the TX thread, each one generating
+ * a debug message.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define DATA_PACKETS      2000
+#define NOISE_PACKETS     20
+#define PACKET_SIZE       512
+#define SLOW_READER_DELAY 10000   /* usecs */
+#define MAX_LATENCY       100000  /* usecs, anything above is a stall */
+
+static int logfds[2];
+static int reader_mode = 0; /* 0 slow, 1 fast, 2 exit */
+static uint64_t messages_read = 0;
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static int noise_filter(void *pvt_data,
+			const unsigned char *outdata,
+			ssize_t outdata_len,
+			uint8_t tx_rx,
+			knet_node_id_t this_host_id,
+			knet_node_id_t src_host_id,
+			int8_t *dst_channel,
+			knet_node_id_t *dst_host_ids,
+			size_t *dst_host_ids_entries)
+{
+	if ((tx_rx == KNET_NOTIFY_TX) && (outdata[0] == 1)) {
+		return -1;
+	}
+	return 1;
+}
+
+static void *slow_reader_thread(void *arg)
+{
+	struct knet_log_msg msg;
+	int mode;
+
+	while ((mode = __atomic_load_n(&reader_mode, __ATOMIC_ACQUIRE)) != 2) {
+		if (read(logfds[0], &msg, sizeof(msg)) == sizeof(msg)) {
+			if (mode) {
+				continue;
+			}
+			messages_read++;
+		}
+		usleep(mode ? 1000 : SLOW_READER_DELAY);
+	}
+
+	return NULL;
+}
+
+static uint64_t now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int send_data(knet_handle_t knet_h, int datafd, int8_t channel, uint64_t *latency)
+{
+	char send_buff[PACKET_SIZE];
+	char recv_buff[PACKET_SIZE];
+	struct pollfd pfd;
+	uint64_t start;
+	int i;
+
+	memset(send_buff, 0, sizeof(send_buff));
+
+	send_buff[0] = 1;
+	for (i = 0; i < NOISE_PACKETS; i++) {
+		if (knet_send(knet_h, send_buff, PACKET_SIZE, channel) != PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	send_buff[0] = 0;
+	start = now_usecs();
+	if (knet_send(knet_h, send_buff, PACKET_SIZE, channel) != PACKET_SIZE) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	pfd.fd = datafd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 10000) <= 0) {
+		printf("Data path stalled: no packet received in 10 seconds\n");
+		return -1;
+	}
+
+	if (knet_recv(knet_h, recv_buff, PACKET_SIZE, channel) != PACKET_SIZE) {
+		printf("knet_recv failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	*latency = now_usecs() - start;
+
+	return 0;
+}
+
+static void bench(void)
+{
+	knet_handle_t knet_h;
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+	struct knet_handle_stats stats;
+	pthread_t reader;
+	uint64_t latency, latency_max = 0, latency_total = 0;
+	uint64_t start, elapsed;
+	int i, err = 0;
+
+	if (pipe(logfds) < 0) {
+		printf("Unable to setup logging pipe\n");
+		exit(FAIL);
+	}
+
+	/*
+	 * only the read end is non blocking, libknet writes
+	 * to a blocking fd
+	 */
+	if (fcntl(logfds[0], F_SETFL, O_NONBLOCK) < 0) {
+		printf("Unable to set logging pipe flags\n");
+		exit(FAIL);
+	}
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	if ((knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) ||
+	    (knet_handle_enable_filter(knet_h, NULL, noise_filter) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if (_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if ((knet_link_set_enable(knet_h, 1, 0, 1) < 0) ||
+	    (knet_handle_setfwd(knet_h, 1) < 0) ||
+	    (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0)) {
+		printf("Unable to bring up link: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+	knet_handle_clear_stats(knet_h, KNET_CLEARSTATS_HANDLE_ONLY);
+
+	if (pthread_create(&reader, NULL, slow_reader_thread, NULL)) {
+		printf("Unable to start reader thread\n");
+		exit(FAIL);
+	}
+
+	printf("Sending %d packets, %d log messages per packet, reader delay %d usecs\n",
+	       DATA_PACKETS, NOISE_PACKETS, SLOW_READER_DELAY);
+
+	start = now_usecs();
+	for (i = 0; i < DATA_PACKETS; i++) {
+		if (send_data(knet_h, datafd, channel, &latency) < 0) {
+			err = -1;
+			break;
+		}
+		latency_total += latency;
+		if (latency > latency_max) {
+			latency_max = latency;
+		}
+	}
+	elapsed = now_usecs() - start;
+
+	/*
+	 * let the reader catch up, so that libknet
+	 * does not block on a full pipe while shutting down
+	 */
+	__atomic_store_n(&reader_mode, 1, __ATOMIC_RELEASE);
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		err = -1;
+	}
+
+	if (!err) {
+		printf("packets: %d time: %" PRIu64 " usecs latency ave: %" PRIu64 " max: %" PRIu64 " usecs\n",
+		       DATA_PACKETS, elapsed, latency_total / DATA_PACKETS, latency_max);
+		printf("log messages read: %" PRIu64 " dropped: %" PRIu64 "\n",
+		       messages_read, stats.log_dropped_messages);
+		if (latency_max > MAX_LATENCY) {
+			printf("Data path stalled waiting for the log reader\n");
+			err = -1;
+		}
+	}
+
+	knet_handle_setfwd(knet_h, 0);
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+
+	__atomic_store_n(&reader_mode, 2, __ATOMIC_RELEASE);
+	pthread_join(reader, NULL);
+	close_logpipes(logfds);
+
+	if (err) {
+		exit(FAIL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bench();
+
+	return PASS;
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Authors: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+/*
+ * measure the latency of the data path while the
+ * configuration is changed in a loop.
+ *
+ * A traffic thread sends packets over a loopback link and
+ * waits for each one of them, while the main thread rotates
+ * the crypto key and changes the timers, priority, pong count
+ * and enable status of the links.
+ * The new key is installed in the spare crypto config before
+ * TX is switched to it, so no packet should be lost.
+ * None of those changes is allowed to stop the data path
+ * threads (get_global_wrlock).
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define RECONFIGS         500
+#define PACKET_SIZE       512
+#define PACKET_TIMEOUT    100     /* msecs before a packet is considered lost */
+#define MAX_LATENCY       100000  /* usecs, anything above is a stall */
+
+static int logfds[2];
+static int stop = 0;
+static uint64_t packets = 0, lost = 0, latency_max = 0, latency_total = 0;
+static int traffic_err = 0;
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static uint64_t now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+struct traffic_info {
+	knet_handle_t knet_h;
+	int datafd;
+	int8_t channel;
+};
+
+static void *traffic_thread(void *arg)
+{
+	struct traffic_info *info = arg;
+	char send_buff[PACKET_SIZE];
+	char recv_buff[PACKET_SIZE];
+	struct pollfd pfd;
+	uint64_t start, latency;
+
+	memset(send_buff, 0, sizeof(send_buff));
+
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+		start = now_usecs();
+		if (knet_send(info->knet_h, send_buff, PACKET_SIZE, info->channel) != PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			traffic_err = -1;
+			break;
+		}
+
+		pfd.fd = info->datafd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, PACKET_TIMEOUT) <= 0) {
+			lost++;
+			continue;
+		}
+
+		if (knet_recv(info->knet_h, recv_buff, PACKET_SIZE, info->channel) != PACKET_SIZE) {
+			printf("knet_recv failed: %s\n", strerror(errno));
+			traffic_err = -1;
+			break;
+		}
+
+		latency = now_usecs() - start;
+		latency_total += latency;
+		if (latency > latency_max) {
+			latency_max = latency;
+		}
+		packets++;
+	}
+
+	return NULL;
+}
+
+static int set_crypto(knet_handle_t knet_h, const char *model, uint8_t key, uint8_t config_num)
+{
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg.crypto_model, model, sizeof(knet_handle_crypto_cfg.crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_cipher_type, "aes128", sizeof(knet_handle_crypto_cfg.crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_hash_type, "sha1", sizeof(knet_handle_crypto_cfg.crypto_hash_type) - 1);
+	memset(knet_handle_crypto_cfg.private_key, key, KNET_MIN_KEY_LEN);
+	knet_handle_crypto_cfg.private_key_len = KNET_MIN_KEY_LEN;
+
+	if (knet_handle_crypto_set_config(knet_h, &knet_handle_crypto_cfg, config_num) < 0) {
+		return -1;
+	}
+
+	return knet_handle_crypto_use_config(knet_h, config_num);
+}
+
+static uint64_t data_path_stops(knet_handle_t knet_h)
+{
+	return __atomic_load_n(&knet_h->stats_extra.data_path_stops, __ATOMIC_RELAXED);
+}
+
+static int reconfig_link(knet_handle_t knet_h, int i)
+{
+	switch (i % 4) {
+		case 0:
+			return knet_link_set_ping_timers(knet_h, 1, 0, 1000 + i, 5000 + i, 2048);
+		case 1:
+			return knet_link_set_priority(knet_h, 1, 1, i % 256);
+		case 2:
+			return knet_link_set_pong_count(knet_h, 1, 1, ((i / 4) % 5) + 1);
+		default:
+			return knet_link_set_enable(knet_h, 1, 1, (i / 4) % 2);
+	}
+}
+
+static void bench(const char *model)
+{
+	knet_handle_t knet_h;
+	struct traffic_info info;
+	struct sockaddr_storage lo, lo1;
+	pthread_t traffic;
+	uint64_t start, elapsed, reconfig_max = 0, reconfig_start, reconfig, stops;
+	int i, err = 0;
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_INFO);
+
+	memset(&info, 0, sizeof(info));
+	info.knet_h = knet_h;
+	info.channel = -1;
+
+	if ((knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) ||
+	    (knet_handle_add_datafd(knet_h, &info.datafd, &info.channel) < 0) ||
+	    (set_crypto(knet_h, model, 0, 1) < 0)) {
+		printf("Unable to configure handle: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if (_knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if ((knet_link_set_enable(knet_h, 1, 0, 1) < 0) ||
+	    (knet_handle_setfwd(knet_h, 1) < 0) ||
+	    (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0)) {
+		printf("Unable to bring up link: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	stops = data_path_stops(knet_h);
+	if (_knet_link_set_config(knet_h, 1, 1, KNET_TRANSPORT_UDP, 0, AF_INET, 0, &lo1) < 0) {
+		printf("Unable to configure second link: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+	if (data_path_stops(knet_h) != stops) {
+		printf("Link configuration stopped the data path\n");
+		exit(FAIL);
+	}
+
+	if (pthread_create(&traffic, NULL, traffic_thread, &info)) {
+		printf("Unable to start traffic thread\n");
+		exit(FAIL);
+	}
+
+	printf("Reconfiguring %d times with %s crypto key rotation and link changes while sending %d bytes packets\n",
+	       RECONFIGS, model, PACKET_SIZE);
+
+	start = now_usecs();
+	for (i = 0; i < RECONFIGS; i++) {
+		reconfig_start = now_usecs();
+		if (i % 2) {
+			stops = data_path_stops(knet_h);
+			err = reconfig_link(knet_h, i / 2);
+			if ((!err) && (data_path_stops(knet_h) != stops)) {
+				printf("Link reconfiguration stopped the data path\n");
+				err = -1;
+				break;
+			}
+		} else {
+			err = set_crypto(knet_h, model, i, (((i / 2) + 1) % KNET_MAX_CRYPTO_INSTANCES) + 1);
+		}
+		if (err) {
+			printf("Reconfiguration failed: %s\n", strerror(errno));
+			err = -1;
+			break;
+		}
+		reconfig = now_usecs() - reconfig_start;
+		if (reconfig > reconfig_max) {
+			reconfig_max = reconfig;
+		}
+		usleep(1000);
+		flush_logs(logfds[0], stdout);
+	}
+	elapsed = now_usecs() - start;
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	pthread_join(traffic, NULL);
+
+	if (traffic_err) {
+		err = -1;
+	}
+
+	if (!err) {
+		printf("reconfigs: %d time: %" PRIu64 " usecs max reconfig: %" PRIu64 " usecs\n",
+		       RECONFIGS, elapsed, reconfig_max);
+		printf("packets: %" PRIu64 " lost: %" PRIu64 " latency ave: %" PRIu64 " max: %" PRIu64 " usecs\n",
+		       packets, lost, packets ? latency_total / packets : 0, latency_max);
+		if (latency_max > MAX_LATENCY) {
+			printf("Data path stalled during reconfiguration\n");
+			err = -1;
+		}
+		if (lost) {
+			printf("Packets lost during key rotation\n");
+			err = -1;
+		}
+	}
+
+	knet_handle_setfwd(knet_h, 0);
+	knet_link_set_enable(knet_h, 1, 1, 0);
+	knet_link_clear_config(knet_h, 1, 1);
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+
+	if (err) {
+		exit(FAIL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_crypto_info crypto_list[16];
+	size_t crypto_list_entries;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		printf("knet_get_crypto_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	if (crypto_list_entries == 0) {
+		printf("no crypto modules detected. Skipping\n");
+		return SKIP;
+	}
+
+	bench(crypto_list[0].name);
+
+	return PASS;
+}
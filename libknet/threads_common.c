@@ -12,9 +12,11 @@
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include "internals.h"
 #include "logging.h"
+#include "epoch.h"
 #include "threads_common.h"
 
 int shutdown_in_progress(knet_handle_t knet_h)
@@ -56,12 +58,54 @@ static int pmtud_reschedule(knet_handle_t knet_h)
 	return 0;
 }
 
+/*
+ * the configuration is changed in place, data path readers
+ * are stopped until the lock is released
+ */
 int get_global_wrlock(knet_handle_t knet_h)
+{
+	int savederrno;
+
+	if (pmtud_reschedule(knet_h) < 0) {
+		log_info(knet_h, KNET_SUB_PMTUD, "Unable to notify PMTUd to reschedule. Expect delays in executing API calls");
+	}
+	savederrno = pthread_rwlock_wrlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		return savederrno;
+	}
+	epoch_stop_readers(knet_h);
+	__atomic_add_fetch(&knet_h->stats_extra.data_path_stops, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * the configuration is published as a new copy, data path readers
+ * keep running and the writer uses epoch_synchronize() before
+ * releasing the old copy
+ */
+int get_global_cfg_wrlock(knet_handle_t knet_h)
 {
 	if (pmtud_reschedule(knet_h) < 0) {
 		log_info(knet_h, KNET_SUB_PMTUD, "Unable to notify PMTUd to reschedule. Expect delays in executing API calls");
 	}
-	return pthread_rwlock_wrlock(&knet_h->global_rwlock);
+	return get_global_cfg_wrlock_noabort(knet_h);
+}
+
+/*
+ * same as get_global_cfg_wrlock, without aborting a running PMTUd,
+ * for internal publishes that do not affect PMTUd (ex: dst cache).
+ * The caller waits for PMTUd to complete its run instead.
+ */
+int get_global_cfg_wrlock_noabort(knet_handle_t knet_h)
+{
+	int savederrno;
+
+	savederrno = pthread_rwlock_wrlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		return savederrno;
+	}
+	epoch_resume_readers(knet_h);
+	return 0;
 }
 
 static struct pretty_names thread_names[KNET_THREAD_MAX] =
@@ -183,6 +227,7 @@ int set_thread_status(knet_handle_t knet_h, uint8_t thread_id, uint8_t status)
 	log_debug(knet_h, KNET_SUB_HANDLE, "Updated status for thread %s to %s",
 		  get_thread_name(thread_id), get_thread_status_name(status));
 
+	pthread_cond_broadcast(&knet_h->threads_status_cond);
 	pthread_mutex_unlock(&knet_h->threads_status_mutex);
 	return 0;
 }
@@ -190,14 +235,13 @@ int set_thread_status(knet_handle_t knet_h, uint8_t thread_id, uint8_t status)
 int wait_all_threads_status(knet_handle_t knet_h, uint8_t status)
 {
 	uint8_t i = 0, found = 0;
+	struct timespec ts;
 
-	while (!found) {
-		usleep(knet_h->threads_timer_res);
-
-		if (pthread_mutex_lock(&knet_h->threads_status_mutex) != 0) {
-			continue;
-		}
+	if (pthread_mutex_lock(&knet_h->threads_status_mutex) != 0) {
+		return -1;
+	}
 
+	while (!found) {
 		found = 1;
 
 		for (i = 0; i < KNET_THREAD_MAX; i++) {
@@ -213,9 +257,26 @@ int wait_all_threads_status(knet_handle_t knet_h, uint8_t status)
 			}
 		}
 
-		pthread_mutex_unlock(&knet_h->threads_status_mutex);
+		if (found) {
+			break;
+		}
+
+		/*
+		 * set_thread_status() wakes us up, the timeout is only
+		 * a safety net
+		 */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += knet_h->threads_timer_res / 1000000;
+		ts.tv_nsec += (knet_h->threads_timer_res % 1000000) * 1000;
+		while (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&knet_h->threads_status_cond, &knet_h->threads_status_mutex, &ts);
 	}
 
+	pthread_mutex_unlock(&knet_h->threads_status_mutex);
+
 	return 0;
 }
 
@@ -44,6 +44,8 @@ do { \
 
 int shutdown_in_progress(knet_handle_t knet_h);
 int get_global_wrlock(knet_handle_t knet_h);
+int get_global_cfg_wrlock(knet_handle_t knet_h);
+int get_global_cfg_wrlock_noabort(knet_handle_t knet_h);
 int get_thread_flush_queue(knet_handle_t knet_h, uint8_t thread_id);
 int set_thread_flush_queue(knet_handle_t knet_h, uint8_t thread_id, uint8_t status);
 int wait_all_threads_flush_queue(knet_handle_t knet_h);
@@ -11,6 +11,7 @@
 
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "host.h"
 #include "compat.h"
@@ -19,30 +20,56 @@
 #include "threads_dsthandler.h"
 #include "threads_pmtud.h"
 
+/*
+ * active links are published without stopping the data path
+ * (get_global_cfg_wrlock_noabort), readers are stopped only when
+ * a host reachability changes
+ */
 static void _handle_dst_link_updates(knet_handle_t knet_h)
 {
-	knet_node_id_t host_id;
-	struct knet_host *host;
+	struct knet_host *host, *next;
+	int reachable_update = 0;
 
-	if (recv(knet_h->dstsockfd[0], &host_id, sizeof(host_id), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(host_id)) {
-		log_debug(knet_h, KNET_SUB_DSTCACHE, "Short read on dstsockfd");
+	if (!__atomic_load_n(&knet_h->dstcache_queue, __ATOMIC_ACQUIRE)) {
 		return;
 	}
 
-	if (get_global_wrlock(knet_h) != 0) {
-		log_debug(knet_h, KNET_SUB_DSTCACHE, "Unable to get read lock");
+	if (get_global_cfg_wrlock_noabort(knet_h) != 0) {
+		log_debug(knet_h, KNET_SUB_DSTCACHE, "Unable to get write lock");
+		return;
+	}
+
+	for (host = _host_dstcache_queue_get(knet_h); host != NULL; host = next) {
+		next = host->dstcache_next;
+		/*
+		 * clear before the update, link changes from now on
+		 * will queue the host again
+		 */
+		__atomic_store_n(&host->dstcache_queued, 0, __ATOMIC_SEQ_CST);
+		if (_host_dstcache_update_links(knet_h, host)) {
+			host->dstcache_reachable = 1;
+			reachable_update = 1;
+		}
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	if (!reachable_update) {
 		return;
 	}
 
-	host = knet_h->host_index[host_id];
-	if (!host) {
-		log_debug(knet_h, KNET_SUB_DSTCACHE, "Unable to find host: %u", host_id);
-		goto out_unlock;
+	if (get_global_wrlock(knet_h) != 0) {
+		log_debug(knet_h, KNET_SUB_DSTCACHE, "Unable to get write lock");
+		return;
 	}
 
-	_host_dstcache_update_sync(knet_h, host);
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		if (host->dstcache_reachable) {
+			host->dstcache_reachable = 0;
+			_host_dstcache_update_reachable(knet_h, host);
+		}
+	}
 
-out_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
 	return;
@@ -51,13 +78,29 @@ out_unlock:
 void *_handle_dst_link_handler_thread(void *data)
 {
 	knet_handle_t knet_h = (knet_handle_t) data;
-	struct epoll_event events[KNET_EPOLL_MAX_EVENTS];
+	struct timespec ts;
 
 	set_thread_status(knet_h, KNET_THREAD_DST_LINK, KNET_THREAD_STARTED);
 
 	while (!shutdown_in_progress(knet_h)) {
-		if (epoll_wait(knet_h->dst_link_handler_epollfd, events, KNET_EPOLL_MAX_EVENTS, knet_h->threads_timer_res / 1000) >= 1)
-			_handle_dst_link_updates(knet_h);
+		if (pthread_mutex_lock(&knet_h->dstcache_mutex) != 0) {
+			log_debug(knet_h, KNET_SUB_DSTCACHE, "Unable to get dst cache mutex lock");
+			usleep(knet_h->threads_timer_res);
+			continue;
+		}
+		if (!__atomic_load_n(&knet_h->dstcache_queue, __ATOMIC_ACQUIRE)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += knet_h->threads_timer_res / 1000000;
+			ts.tv_nsec += (knet_h->threads_timer_res % 1000000) * 1000;
+			while (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec += 1;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&knet_h->dstcache_cond, &knet_h->dstcache_mutex, &ts);
+		}
+		pthread_mutex_unlock(&knet_h->dstcache_mutex);
+
+		_handle_dst_link_updates(knet_h);
 	}
 
 	set_thread_status(knet_h, KNET_THREAD_DST_LINK, KNET_THREAD_STOPPED);
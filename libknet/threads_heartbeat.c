@@ -14,25 +14,78 @@
 #include <string.h>
 #include <pthread.h>
 #include <time.h>
+#include <inttypes.h>
 
 #include "crypto.h"
 #include "links.h"
 #include "logging.h"
 #include "transports.h"
+#include "transport_common.h"
 #include "threads_common.h"
 #include "threads_heartbeat.h"
 
-static void _link_down(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_link *dst_link)
+/*
+ * grow socket buffers to KNET_SOCKBUF_AUTO_BDP_MUL times the
+ * bandwidth-delay product of the link (see KNET_LINK_FLAG_SOCKBUF_AUTO)
+ */
+static void _autotune_sockbuf(knet_handle_t knet_h, struct knet_link *dst_link, struct timespec clock_now)
 {
-	memset(&dst_link->pmtud_last, 0, sizeof(struct timespec));
-	dst_link->received_pong = 0;
-	dst_link->status.pong_last.tv_nsec = 0;
-	dst_link->pong_timeout_backoff = KNET_LINK_PONG_TIMEOUT_BACKOFF;
-	if (dst_link->status.connected == 1) {
-		log_info(knet_h, KNET_SUB_LINK, "host: %u link: %u is down",
-			 dst_host->host_id, dst_link->link_id);
-		_link_updown(knet_h, dst_host->host_id, dst_link->link_id, dst_link->status.enabled, 0, 1);
+	unsigned long long diff;
+	uint64_t bytes, rate, target;
+	uint32_t rtt;
+
+	if ((!dst_link->sockbuf_last.tv_sec) && (!dst_link->sockbuf_last.tv_nsec)) {
+		dst_link->sockbuf_last = clock_now;
+		return;
+	}
+
+	timespec_diff(dst_link->sockbuf_last, clock_now, &diff);
+	diff = diff / 1000llu; /* usecs */
+	if (diff < KNET_SOCKBUF_AUTO_INTERVAL) {
+		return;
+	}
+
+	if (pthread_mutex_lock(&dst_link->link_stats_mutex)) {
+		log_debug(knet_h, KNET_SUB_HEARTBEAT, "Unable to get stats mutex lock");
+		return;
+	}
+	bytes = dst_link->status.stats.tx_data_bytes + dst_link->status.stats.rx_data_bytes;
+	rtt = dst_link->status.stats.latency_ave;
+	pthread_mutex_unlock(&dst_link->link_stats_mutex);
+
+	/*
+	 * stats have been cleared (knet_handle_clear_stats), start
+	 * a new interval from here
+	 */
+	if (bytes < dst_link->sockbuf_last_bytes) {
+		dst_link->sockbuf_last = clock_now;
+		dst_link->sockbuf_last_bytes = bytes;
+		return;
 	}
+
+	rate =((bytes - dst_link->sockbuf_last_bytes) * 1000000llu) / diff; /* bytes/sec */
+	target = ((rate * rtt) / 1000000llu) * KNET_SOCKBUF_AUTO_BDP_MUL;
+
+	dst_link->sockbuf_last = clock_now;
+	dst_link->sockbuf_last_bytes = bytes;
+
+	if (target > KNET_RING_RCVBUFF) {
+		target = KNET_RING_RCVBUFF;
+	}
+
+	if (target <= (uint64_t)dst_link->sockbuf_size) {
+		return;
+	}
+
+	log_debug(knet_h, KNET_SUB_HEARTBEAT, "link: %u rate: %" PRIu64 " bytes/sec rtt: %u usecs, growing socket buffers to %" PRIu64 " bytes",
+		  dst_link->link_id, rate, rtt, target);
+
+	/*
+	 * on failure do not retry every interval, errors are logged
+	 * by the transport code
+	 */
+	_configure_link_sockbuf(knet_h, dst_link->outsock, (int)target);
+	dst_link->sockbuf_size = (int)target;
 }
 
 static void _handle_check_each(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_link *dst_link, int timed)
@@ -44,7 +97,8 @@ static void _handle_check_each(knet_handle_t knet_h, struct knet_host *dst_host,
 	unsigned long long diff_ping;
 	unsigned char *outbuf = (unsigned char *)knet_h->pingbuf;
 
-	if (dst_link->transport_connected == 0) {
+	if ((dst_link->transport_connected == 0) ||
+	    (__atomic_load_n(&dst_link->tx_unreachable, __ATOMIC_RELAXED) == KNET_LINK_TX_UNREACHABLE_DOWN)) {
 		_link_down(knet_h, dst_host, dst_link);
 		return;
 	}
@@ -57,6 +111,10 @@ static void _handle_check_each(knet_handle_t knet_h, struct knet_host *dst_host,
 		return;
 	}
 
+	if (dst_link->flags & KNET_LINK_FLAG_SOCKBUF_AUTO) {
+		_autotune_sockbuf(knet_h, dst_link, clock_now);
+	}
+
 	timespec_diff(dst_link->ping_last, clock_now, &diff_ping);
 
 	if ((diff_ping >= (dst_link->ping_interval * 1000llu)) || (!timed)) {
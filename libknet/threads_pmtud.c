@@ -25,6 +25,7 @@
 static int _calculate_manual_mtu(knet_handle_t knet_h, struct knet_link *dst_link)
 {
 	size_t ipproto_overhead_len;	/* onwire packet overhead (protocol based) */
+	struct knet_crypto_overhead overhead;
 
 	switch (dst_link->dst_addr.ss_family) {
 		case AF_INET6:
@@ -39,7 +40,8 @@ static int _calculate_manual_mtu(knet_handle_t knet_h, struct knet_link *dst_lin
 			break;
 	}
 
-	dst_link->status.mtu = calc_max_data_outlen(knet_h, knet_h->manual_mtu - ipproto_overhead_len);
+	calc_crypto_overhead(knet_h, &overhead);
+	dst_link->status.mtu = calc_max_data_outlen(&overhead, knet_h->manual_mtu - ipproto_overhead_len);
 
 	return 1;
 }
@@ -57,6 +59,7 @@ static int _handle_check_link_pmtud(knet_handle_t knet_h, struct knet_host *dst_
 					 */
 	size_t app_mtu_len;		/* real data that we can send onwire */
 	ssize_t len;			/* len of what we were able to sendto onwire */
+	struct knet_crypto_overhead overhead;	/* crypto overhead for this packet */
 
 	struct timespec ts, pmtud_crypto_start_ts, pmtud_crypto_stop_ts;
 	unsigned long long pong_timeout_adj_tmp, timediff;
@@ -117,27 +120,29 @@ restart:
 	 * common to all packets
 	 */
 
+	calc_crypto_overhead(knet_h, &overhead);
+
 	/*
 	 * calculate the application MTU based on current onwire_len minus ipproto_overhead_len
 	 */
 
-	app_mtu_len = calc_max_data_outlen(knet_h, onwire_len - ipproto_overhead_len);
+	app_mtu_len = calc_max_data_outlen(&overhead, onwire_len - ipproto_overhead_len);
 
 	/*
 	 * recalculate onwire len back that might be different based
 	 * on data padding from crypto layer.
 	 */
 
-	onwire_len = calc_data_outlen(knet_h, app_mtu_len + KNET_HEADER_ALL_SIZE) + ipproto_overhead_len;
+	onwire_len = calc_data_outlen(&overhead, app_mtu_len + KNET_HEADER_ALL_SIZE) + ipproto_overhead_len;
 
 	/*
 	 * calculate the size of what we need to send to sendto(2).
 	 * see also onwire.c for packet format explanation.
 	 */
-	data_len = app_mtu_len + knet_h->sec_hash_size + knet_h->sec_salt_size + KNET_HEADER_ALL_SIZE;
+	data_len = app_mtu_len + overhead.sec_hash_size + overhead.sec_salt_size + KNET_HEADER_ALL_SIZE;
 
 	if (knet_h->crypto_instance) {
-		if (data_len < (knet_h->sec_hash_size + knet_h->sec_salt_size) + 1) {
+		if (data_len < (overhead.sec_hash_size + overhead.sec_salt_size) + 1) {
 			log_debug(knet_h, KNET_SUB_PMTUD, "Aborting PMTUD process: link mtu smaller than crypto header detected (link might have been disconnected)");
 			return -1;
 		}
@@ -146,7 +151,7 @@ restart:
 
 		if (crypto_encrypt_and_sign(knet_h,
 					    (const unsigned char *)knet_h->pmtudbuf,
-					    data_len - (knet_h->sec_hash_size + knet_h->sec_salt_size),
+					    data_len - (overhead.sec_hash_size + overhead.sec_salt_size),
 					    knet_h->pmtudbuf_crypt,
 					    (ssize_t *)&data_len) < 0) {
 			log_debug(knet_h, KNET_SUB_PMTUD, "Unable to crypto pmtud packet");
@@ -411,9 +416,9 @@ retry:
 		} else {
 			int found_mtu = 0;
 
-			if (knet_h->sec_block_size) {
-				if ((onwire_len + knet_h->sec_block_size >= max_mtu_len) ||
-				   ((dst_link->last_bad_mtu) && (dst_link->last_bad_mtu <= (onwire_len + knet_h->sec_block_size)))) {
+			if (overhead.sec_block_size) {
+				if ((onwire_len + overhead.sec_block_size >= max_mtu_len) ||
+				   ((dst_link->last_bad_mtu) && (dst_link->last_bad_mtu <= (onwire_len + overhead.sec_block_size)))) {
 					found_mtu = 1;
 				}
 			} else {
@@ -428,7 +433,7 @@ retry:
 				/*
 				 * account for IP overhead, knet headers and crypto in PMTU calculation
 				 */
-				dst_link->status.mtu = calc_max_data_outlen(knet_h, onwire_len - ipproto_overhead_len);
+				dst_link->status.mtu = calc_max_data_outlen(&overhead, onwire_len - ipproto_overhead_len);
 				pthread_mutex_unlock(&knet_h->pmtud_mutex);
 				return 0;
 			}
@@ -454,6 +459,7 @@ static int _handle_check_pmtud(knet_handle_t knet_h, struct knet_host *dst_host,
 	unsigned int saved_pmtud;
 	struct timespec clock_now;
 	unsigned long long diff_pmtud, interval;
+	struct knet_crypto_overhead overhead;
 
 	if (clock_gettime(CLOCK_MONOTONIC, &clock_now) != 0) {
 		log_debug(knet_h, KNET_SUB_PMTUD, "Unable to get monotonic clock");
@@ -476,12 +482,13 @@ static int _handle_check_pmtud(knet_handle_t knet_h, struct knet_host *dst_host,
 	 * please note that it is not the same as link->proto_overhead that
 	 * includes only either UDP or SCTP (at the moment) overhead.
 	 */
+	calc_crypto_overhead(knet_h, &overhead);
 	switch (dst_link->dst_addr.ss_family) {
 		case AF_INET6:
-			dst_link->status.proto_overhead = KNET_PMTUD_OVERHEAD_V6 + dst_link->proto_overhead + KNET_HEADER_ALL_SIZE + knet_h->sec_hash_size + knet_h->sec_salt_size;
+			dst_link->status.proto_overhead = KNET_PMTUD_OVERHEAD_V6 + dst_link->proto_overhead + KNET_HEADER_ALL_SIZE + overhead.sec_hash_size + overhead.sec_salt_size;
 			break;
 		case AF_INET:
-			dst_link->status.proto_overhead = KNET_PMTUD_OVERHEAD_V4 + dst_link->proto_overhead + KNET_HEADER_ALL_SIZE + knet_h->sec_hash_size + knet_h->sec_salt_size;
+			dst_link->status.proto_overhead = KNET_PMTUD_OVERHEAD_V4 + dst_link->proto_overhead + KNET_HEADER_ALL_SIZE + overhead.sec_hash_size + overhead.sec_salt_size;
 			break;
 	}
 
@@ -632,6 +639,13 @@ out_unlock:
 			log_debug(knet_h, KNET_SUB_PMTUD, "Unable to get mutex lock");
 		} else {
 			knet_h->pmtud_running = 0;
+			/*
+			 * a forced run that has been rescheduled by a writer
+			 * would otherwise wait for the next pmtud_interval
+			 */
+			if ((knet_h->pmtud_abort) && (force_run)) {
+				knet_h->pmtud_forcerun = 1;
+			}
 			pthread_mutex_unlock(&knet_h->pmtud_mutex);
 		}
 	}
@@ -14,10 +14,12 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <pthread.h>
+#include <netinet/udp.h>
 
 #include "compat.h"
 #include "compress.h"
 #include "crypto.h"
+#include "epoch.h"
 #include "host.h"
 #include "links.h"
 #include "links_acl.h"
@@ -226,6 +228,115 @@ static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t
 	return 1;
 }
 
+/*
+ * discard packets that would be dropped after decryption anyway,
+ * using the cleartext pre-header (see KNET_CRYPTO_PREHEADER_SIZE).
+ * Nothing here can change the host state, the pre-header is not
+ * authenticated yet.
+ */
+int _check_preheader(knet_handle_t knet_h, const unsigned char *buf, ssize_t len)
+{
+	const struct knet_header *preheader = (const struct knet_header *)buf;
+	struct knet_host *src_host;
+
+	if (len < (ssize_t)KNET_CRYPTO_PREHEADER_SIZE) {
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Packet is too short for pre-header: %ld", (long)len);
+		return -1;
+	}
+
+	if (preheader->kh_version != KNET_HEADER_VERSION) {
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Packet pre-header version does not match");
+		return -1;
+	}
+
+	src_host = knet_h->host_index[ntohs(preheader->kh_node)];
+	if (src_host == NULL) {
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Unable to find source host for this packet pre-header");
+		return -1;
+	}
+
+	switch (preheader->kh_type) {
+	case KNET_HEADER_TYPE_HOST_INFO:
+	case KNET_HEADER_TYPE_DATA:
+		if (!src_host->status.reachable) {
+			log_debug_datapath(knet_h, KNET_SUB_RX, "Source host %u not reachable yet. Discarding packet.", src_host->host_id);
+			return -1;
+		}
+		if ((preheader->kh_type == KNET_HEADER_TYPE_DATA) &&
+		    (_seq_num_delivered(src_host, ntohs(preheader->khp_data_seq_num)))) {
+			return -1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * ask src_host to restart the compression stream on channel,
+ * sent back on the link the out of sync packet has been received from
+ */
+static void _send_stream_resync(knet_handle_t knet_h, struct knet_host *src_host, struct knet_link *src_link, int8_t channel)
+{
+	struct knet_header resync;
+	unsigned char *outbuf = (unsigned char *)&resync;
+	ssize_t outlen = KNET_HEADER_STREAM_SIZE;
+	ssize_t len;
+	int err, savederrno;
+
+	if (!src_link->transport_connected) {
+		return;
+	}
+
+	memset(&resync, 0, sizeof(struct knet_header));
+	resync.kh_version = KNET_HEADER_VERSION;
+	resync.kh_type = KNET_HEADER_TYPE_STREAM_RESYNC;
+	resync.kh_node = htons(knet_h->host_id);
+	resync.khp_stream_channel = channel;
+
+	if (knet_h->crypto_instance) {
+		if (crypto_encrypt_and_sign(knet_h,
+					    (const unsigned char *)&resync,
+					    outlen,
+					    knet_h->recv_from_links_buf_crypt,
+					    &outlen) < 0) {
+			log_debug_datapath(knet_h, KNET_SUB_RX, "Unable to encrypt stream resync packet");
+			return;
+		}
+		outbuf = knet_h->recv_from_links_buf_crypt;
+	}
+
+retry:
+	if (transport_get_connection_oriented(knet_h, src_link->transport) == TRANSPORT_PROTO_NOT_CONNECTION_ORIENTED) {
+		len = sendto(src_link->outsock, outbuf, outlen, MSG_DONTWAIT | MSG_NOSIGNAL,
+			     (struct sockaddr *) &src_link->dst_addr, sizeof(struct sockaddr_storage));
+	} else {
+		len = sendto(src_link->outsock, outbuf, outlen, MSG_DONTWAIT | MSG_NOSIGNAL, NULL, 0);
+	}
+	savederrno = errno;
+	if (len != outlen) {
+		err = transport_tx_sock_error(knet_h, src_link->transport, src_link->outsock, len, savederrno);
+		switch(err) {
+			case -1: /* unrecoverable error */
+				log_debug_datapath(knet_h, KNET_SUB_RX,
+						   "Unable to send stream resync request to host %u link %u: %s",
+						   src_host->host_id, src_link->link_id, strerror(savederrno));
+				break;
+			case 0: /* ignore error and continue */
+				break;
+			case 1: /* retry to send those same data */
+				goto retry;
+				break;
+		}
+		return;
+	}
+
+	log_debug_datapath(knet_h, KNET_SUB_COMPRESS, "Requested compression stream restart to host %u channel %d",
+			   src_host->host_id, channel);
+}
+
 static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struct knet_mmsghdr *msg)
 {
 	int err = 0, savederrno = 0, stats_err = 0;
@@ -247,48 +358,79 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 	struct sockaddr_storage pckt_src;
 	seq_num_t recv_seq_num;
 	int wipe_bufs = 0;
+	int link_up = 0;
+	unsigned int latency_max_samples;
+	struct knet_fd_trackers *tracker;
 
-	if (knet_h->crypto_instance) {
+	if (__atomic_load_n(&knet_h->crypto_rx_configs, __ATOMIC_ACQUIRE)) {
 		struct timespec start_time;
 		struct timespec end_time;
+		unsigned char *payload;
 
+		/*
+		 * the pre-header mark is only a hint (see crypto_has_preheader)
+		 * and the filter could drop packets sent without pre-header.
+		 * Packets are filtered only once the pre-header is enabled
+		 * locally, decryption does not depend on it.
+		 */
+		if ((__atomic_load_n(&knet_h->crypto_preheader, __ATOMIC_RELAXED)) &&
+		    (crypto_has_preheader((unsigned char *)inbuf, len)) &&
+		    (_check_preheader(knet_h, (unsigned char *)inbuf, len) < 0)) {
+			return;
+		}
 
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		if (crypto_authenticate_and_decrypt(knet_h,
-						    (unsigned char *)inbuf,
-						    len,
-						    knet_h->recv_from_links_buf_decrypt,
-						    &outlen) < 0) {
-			log_debug(knet_h, KNET_SUB_RX, "Unable to decrypt/auth packet");
+		if (crypto_authenticate_and_decrypt_inplace(knet_h,
+							    (unsigned char *)inbuf,
+							    len,
+							    knet_h->recv_from_links_buf_decrypt,
+							    &payload,
+							    &outlen) < 0) {
+			log_debug_datapath(knet_h, KNET_SUB_RX, "Unable to decrypt/auth packet");
 			return;
 		}
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
 		timespec_diff(start_time, end_time, &decrypt_time);
 
 		len = outlen;
-		inbuf = (struct knet_header *)knet_h->recv_from_links_buf_decrypt;
+		inbuf = (struct knet_header *)payload;
+		/*
+		 * replies are sent in clear from the payload buffer
+		 * when TX crypto is disabled (crypto config 0)
+		 */
+		outbuf = payload;
 	}
 
 	if (len < (ssize_t)(KNET_HEADER_SIZE + 1)) {
-		log_debug(knet_h, KNET_SUB_RX, "Packet is too short: %ld", (long)len);
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Packet is too short: %ld", (long)len);
 		return;
 	}
 
 	if (inbuf->kh_version != KNET_HEADER_VERSION) {
-		log_debug(knet_h, KNET_SUB_RX, "Packet version does not match");
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Packet version does not match");
 		return;
 	}
 
 	inbuf->kh_node = ntohs(inbuf->kh_node);
 	src_host = knet_h->host_index[inbuf->kh_node];
 	if (src_host == NULL) {  /* host not found */
-		log_debug(knet_h, KNET_SUB_RX, "Unable to find source host for this packet");
+		log_debug_datapath(knet_h, KNET_SUB_RX, "Unable to find source host for this packet");
 		return;
 	}
 
 	src_link = src_host->link +
 		(inbuf->khp_ping_link % KNET_MAX_LINK);
 	if ((inbuf->kh_type & KNET_HEADER_TYPE_PMSK) != 0) {
+		/*
+		 * links are configured without stopping RX,
+		 * pairs with knet_link_set_config
+		 */
+		if (!__atomic_load_n(&src_link->configured, __ATOMIC_ACQUIRE)) {
+			log_debug_datapath(knet_h, KNET_SUB_RX, "host: %u link: %u is not configured",
+					   src_host->host_id, src_link->link_id);
+			return;
+		}
+
 		if (src_link->dynamic == KNET_LINK_DYNIP) {
 			/*
 			 * cpyaddrport will only copy address and port of the incoming
@@ -329,12 +471,18 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 		return;
 	}
 
+	tracker = _get_fd_tracker(knet_h, sockfd);
+	if ((tracker) && (tracker->rx_kernel_drops_pending)) {
+		src_link->status.stats.rx_kernel_drops += tracker->rx_kernel_drops_pending;
+		tracker->rx_kernel_drops_pending = 0;
+	}
+
 	switch (inbuf->kh_type) {
 	case KNET_HEADER_TYPE_HOST_INFO:
 	case KNET_HEADER_TYPE_DATA:
 		if (!src_host->status.reachable) {
 			pthread_mutex_unlock(&src_link->link_stats_mutex);
-			log_debug(knet_h, KNET_SUB_RX, "Source host %u not reachable yet. Discarding packet.", src_host->host_id);
+			log_debug_datapath(knet_h, KNET_SUB_RX, "Source host %u not reachable yet. Discarding packet.", src_host->host_id);
 			return;
 		}
 		inbuf->khp_data_seq_num = ntohs(inbuf->khp_data_seq_num);
@@ -347,7 +495,7 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 		if (!_seq_num_lookup(src_host, inbuf->khp_data_seq_num, 0, 0)) {
 			pthread_mutex_unlock(&src_link->link_stats_mutex);
 			if (src_host->link_handler_policy != KNET_LINK_POLICY_ACTIVE) {
-				log_debug(knet_h, KNET_SUB_RX, "Packet has already been delivered");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Packet has already been delivered");
 			}
 			return;
 		}
@@ -372,13 +520,17 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 			struct timespec start_time;
 			struct timespec end_time;
 			uint64_t compress_time;
+			int decmp_errno;
 
 			clock_gettime(CLOCK_MONOTONIC, &start_time);
-			err = decompress(knet_h, inbuf->khp_data_compress,
+			err = decompress(knet_h, src_host, inbuf->khp_data_channel,
+					 inbuf->khp_data_compress,
+					 inbuf->khp_data_pad1,
 					 (const unsigned char *)inbuf->khp_data_userdata,
 					 len - KNET_HEADER_DATA_SIZE,
 					 knet_h->recv_from_links_buf_decompress,
 					 &decmp_outlen);
+			decmp_errno = errno;
 
 			stats_err = pthread_mutex_lock(&knet_h->handle_stats_mutex);
 			if (stats_err < 0) {
@@ -405,22 +557,56 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 				knet_h->stats.rx_compressed_packets++;
 				knet_h->stats.rx_compressed_original_bytes += decmp_outlen;
 				knet_h->stats.rx_compressed_size_bytes += len - KNET_HEADER_SIZE;
+				if (inbuf->khp_data_compress & KNET_COMPRESS_DICT) {
+					knet_h->stats.rx_dict_compressed_packets++;
+					knet_h->stats.rx_dict_compressed_original_bytes += decmp_outlen;
+					knet_h->stats.rx_dict_compressed_size_bytes += len - KNET_HEADER_SIZE;
+				}
+				if (inbuf->khp_data_compress & KNET_COMPRESS_STREAM) {
+					knet_h->stats.rx_stream_compressed_packets++;
+					knet_h->stats.rx_stream_compressed_original_bytes += decmp_outlen;
+					knet_h->stats.rx_stream_compressed_size_bytes += len - KNET_HEADER_SIZE;
+				}
 
 				memmove(inbuf->khp_data_userdata, knet_h->recv_from_links_buf_decompress, decmp_outlen);
 				len = decmp_outlen + KNET_HEADER_DATA_SIZE;
+			} else if (decmp_errno == EAGAIN) {
+				/*
+				 * compression stream out of sync after a lost packet,
+				 * expected on lossy links until the stream restarts
+				 */
+				knet_h->stats.rx_stream_out_of_sync_packets++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+				log_debug_datapath(knet_h, KNET_SUB_COMPRESS, "Dropping packet from host %u channel %d: compression stream out of sync",
+						   src_host->host_id, inbuf->khp_data_channel);
+				if (compress_stream_rx_need_resync(src_host, inbuf->khp_data_channel)) {
+					_send_stream_resync(knet_h, src_host, src_link, inbuf->khp_data_channel);
+				}
+				pthread_mutex_unlock(&src_link->link_stats_mutex);
+				return;
+			} else if (decmp_errno == ENOENT) {
+				/*
+				 * dictionary mismatch, already logged (rate limited)
+				 * by decompress
+				 */
+				knet_h->stats.rx_failed_to_decompress++;
+				knet_h->stats.rx_dict_mismatch_packets++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+				pthread_mutex_unlock(&src_link->link_stats_mutex);
+				return;
 			} else {
 				knet_h->stats.rx_failed_to_decompress++;
 				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 				pthread_mutex_unlock(&src_link->link_stats_mutex);
-				log_warn(knet_h, KNET_SUB_COMPRESS, "Unable to decompress packet (%d): %s",
-					 err, strerror(errno));
+				log_warn_ratelimited(knet_h, KNET_SUB_COMPRESS, "Unable to decompress packet (%d): %s",
+						     err, strerror(decmp_errno));
 				return;
 			}
 			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 		}
 
 		if (inbuf->kh_type == KNET_HEADER_TYPE_DATA) {
-			if (knet_h->crypto_instance) {
+			if (__atomic_load_n(&knet_h->crypto_rx_configs, __ATOMIC_ACQUIRE)) {
 				stats_err = pthread_mutex_lock(&knet_h->handle_stats_mutex);
 				if (stats_err < 0) {
 					pthread_mutex_unlock(&src_link->link_stats_mutex);
@@ -461,13 +647,13 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 						&dst_host_ids_entries);
 				if (bcast < 0) {
 					pthread_mutex_unlock(&src_link->link_stats_mutex);
-					log_debug(knet_h, KNET_SUB_RX, "Error from dst_host_filter_fn: %d", bcast);
+					log_debug_datapath(knet_h, KNET_SUB_RX, "Error from dst_host_filter_fn: %d", bcast);
 					return;
 				}
 
 				if ((!bcast) && (!dst_host_ids_entries)) {
 					pthread_mutex_unlock(&src_link->link_stats_mutex);
-					log_debug(knet_h, KNET_SUB_RX, "Message is unicast but no dst_host_ids_entries");
+					log_debug_datapath(knet_h, KNET_SUB_RX, "Message is unicast but no dst_host_ids_entries");
 					return;
 				}
 
@@ -475,7 +661,7 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 				if (!bcast) {
 					if (dst_host_ids_entries > KNET_MAX_HOST) {
 						pthread_mutex_unlock(&src_link->link_stats_mutex);
-						log_debug(knet_h, KNET_SUB_RX, "dst_host_filter_fn returned too many destinations");
+						log_debug_datapath(knet_h, KNET_SUB_RX, "dst_host_filter_fn returned too many destinations");
 						return;
 					}
 					for (host_idx = 0; host_idx < dst_host_ids_entries; host_idx++) {
@@ -486,7 +672,7 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 					}
 					if (!found) {
 						pthread_mutex_unlock(&src_link->link_stats_mutex);
-						log_debug(knet_h, KNET_SUB_RX, "Packet is not for us");
+						log_debug_datapath(knet_h, KNET_SUB_RX, "Packet is not for us");
 						return;
 					}
 				}
@@ -496,9 +682,9 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 		if (inbuf->kh_type == KNET_HEADER_TYPE_DATA) {
 			if (!knet_h->sockfd[channel].in_use) {
 				pthread_mutex_unlock(&src_link->link_stats_mutex);
-				log_debug(knet_h, KNET_SUB_RX,
-					  "received packet for channel %d but there is no local sock connected",
-					  channel);
+				log_debug_datapath(knet_h, KNET_SUB_RX,
+						   "received packet for channel %d but there is no local sock connected",
+						   channel);
 				return;
 			}
 
@@ -511,9 +697,9 @@ retry:
 
 			outlen = writev(knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], iov_out, 1);
 			if ((outlen > 0) && (outlen < (ssize_t)iov_out[0].iov_len)) {
-				log_debug(knet_h, KNET_SUB_RX,
-					  "Unable to send all data to the application in one go. Expected: %zu Sent: %zd\n",
-					  iov_out[0].iov_len, outlen);
+				log_debug_datapath(knet_h, KNET_SUB_RX,
+						   "Unable to send all data to the application in one go. Expected: %zu Sent: %zd\n",
+						   iov_out[0].iov_len, outlen);
 				goto retry;
 			}
 
@@ -546,7 +732,7 @@ retry:
 				case KNET_HOSTINFO_TYPE_LINK_TABLE:
 					break;
 				default:
-					log_warn(knet_h, KNET_SUB_RX, "Receiving unknown host info message from host %u", src_host->host_id);
+					log_warn_ratelimited(knet_h, KNET_SUB_RX, "Receiving unknown host info message from host %u", src_host->host_id);
 					break;
 			}
 		}
@@ -658,7 +844,7 @@ retry_pong:
 		timespec_diff(recvtime,
 				src_link->status.pong_last, &latency_last);
 
-		if ((latency_last / 1000llu) > src_link->pong_timeout) {
+		if ((latency_last / 1000llu) > __atomic_load_n(&src_link->pong_timeout, __ATOMIC_RELAXED)) {
 			log_debug(knet_h, KNET_SUB_RX,
 				  "Incoming pong packet from host: %u link: %u has higher latency than pong_timeout. Discarding",
 				  src_host->host_id, src_link->link_id);
@@ -673,18 +859,19 @@ retry_pong:
 			/*
 			 * limit to max_samples (precision)
 			 */
-			if (src_link->status.stats.latency_samples >= src_link->latency_max_samples) {
-				src_link->status.stats.latency_samples = src_link->latency_max_samples;
+			latency_max_samples = __atomic_load_n(&src_link->latency_max_samples, __ATOMIC_RELAXED);
+			if (src_link->status.stats.latency_samples >= latency_max_samples) {
+				src_link->status.stats.latency_samples = latency_max_samples;
 			}
 			src_link->status.stats.latency_ave =
 				(((src_link->status.stats.latency_ave * (src_link->status.stats.latency_samples - 1)) + (latency_last / 1000llu)) / src_link->status.stats.latency_samples);
 
 			if (src_link->status.stats.latency_ave < src_link->pong_timeout_adj) {
 				if (!src_link->status.connected) {
-					if (src_link->received_pong >= src_link->pong_count) {
+					if (src_link->received_pong >= __atomic_load_n(&src_link->pong_count, __ATOMIC_RELAXED)) {
 						log_info(knet_h, KNET_SUB_RX, "host: %u link: %u is up",
 							 src_host->host_id, src_link->link_id);
-						_link_updown(knet_h, src_host->host_id, src_link->link_id, src_link->status.enabled, 1, 0);
+						link_up = 1;
 					} else {
 						src_link->received_pong++;
 						log_debug(knet_h, KNET_SUB_RX, "host: %u link: %u received pong: %u",
@@ -776,6 +963,11 @@ retry_pmtud:
 		pthread_mutex_unlock(&knet_h->tx_mutex);
 out_pmtud:
 		return; /* Don't need to unlock link_stats_mutex */
+	case KNET_HEADER_TYPE_STREAM_RESYNC:
+		log_debug_datapath(knet_h, KNET_SUB_COMPRESS, "Host %u requested a compression stream restart on channel %d",
+				   src_host->host_id, inbuf->khp_stream_channel);
+		compress_stream_tx_resync(knet_h, inbuf->khp_stream_channel);
+		break;
 	case KNET_HEADER_TYPE_PMTUD_REPLY:
 		src_link->status.stats.rx_pmtu_packets++;
 		src_link->status.stats.rx_pmtu_bytes += len;
@@ -796,14 +988,119 @@ out_pmtud:
 		return;
 	}
 	pthread_mutex_unlock(&src_link->link_stats_mutex);
+
+	/*
+	 * the link status change notification can call back into
+	 * the API (ex: knet_link_get_status), do not hold link_stats_mutex.
+	 * hb_mutex serializes with knet_link_set_enable and the heartbeat
+	 * thread bringing the link down.
+	 */
+	if (link_up) {
+		if (pthread_mutex_lock(&knet_h->hb_mutex)) {
+			log_debug(knet_h, KNET_SUB_RX, "Unable to get hb mutex lock");
+			return;
+		}
+		_link_updown(knet_h, src_host->host_id, src_link->link_id, src_link->status.enabled, 1, 1);
+		pthread_mutex_unlock(&knet_h->hb_mutex);
+	}
+}
+
+/*
+ * parse the ancillary data of a received packet:
+ *
+ * SO_RXQ_OVFL reports the total number of packets dropped on the socket,
+ * keep track of the new drops until we know which link to account them to.
+ *
+ * UDP_GRO reports the size of the packets coalesced by the kernel,
+ * returned to the caller (0 if the packet has not been coalesced).
+ */
+static size_t _parse_rx_cmsg(knet_handle_t knet_h, int sockfd, struct msghdr *msg)
+{
+	size_t gro_size = 0;
+#if defined (SO_RXQ_OVFL) || defined (UDP_GRO)
+	struct cmsghdr *cmsg;
+#endif
+#ifdef SO_RXQ_OVFL
+	struct knet_fd_trackers *tracker;
+	uint32_t drops;
+#endif
+#ifdef UDP_GRO
+	int gso_size;
+#endif
+
+#if defined (SO_RXQ_OVFL) || defined (UDP_GRO)
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef SO_RXQ_OVFL
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+			tracker = _get_fd_tracker(knet_h, sockfd);
+			if (tracker) {
+				memmove(&drops, CMSG_DATA(cmsg), sizeof(drops));
+				tracker->rx_kernel_drops_pending += drops - tracker->rx_kernel_drops_last;
+				tracker->rx_kernel_drops_last = drops;
+			}
+		}
+#endif
+#ifdef UDP_GRO
+		if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+			memmove(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+			if (gso_size > 0) {
+				gro_size = gso_size;
+			}
+		}
+#endif
+	}
+#endif
+
+	return gro_size;
+}
+
+/*
+ * split packets coalesced by UDP GRO, each segment is a knet packet.
+ *
+ * Segments are copied one by one in recv_from_links_buf_gro before
+ * parsing. defrag and decompress write up to KNET_DATABUFSIZE from
+ * the start of the packet, that would overrun the rx pool slot
+ * (and the following ones) when parsing segments in place.
+ */
+static void _parse_recv_from_links_segments(knet_handle_t knet_h, int sockfd, const struct knet_mmsghdr *msg, size_t gro_size)
+{
+	struct knet_mmsghdr seg_msg;
+	struct iovec seg_iov;
+	unsigned char *buf = msg->msg_hdr.msg_iov->iov_base;
+	unsigned char *seg_buf = (unsigned char *)knet_h->recv_from_links_buf_gro;
+	size_t offset, seg_len;
+
+	if ((!gro_size) || (msg->msg_len <= gro_size)) {
+		_parse_recv_from_links(knet_h, sockfd, msg);
+		return;
+	}
+
+	__atomic_add_fetch(&knet_h->stats_extra.rx_udp_gro_packets, 1, __ATOMIC_RELAXED);
+
+	memmove(&seg_msg, msg, sizeof(struct knet_mmsghdr));
+	seg_msg.msg_hdr.msg_iov = &seg_iov;
+	seg_msg.msg_hdr.msg_iovlen = 1;
+
+	for (offset = 0; offset < msg->msg_len; offset += gro_size) {
+		seg_len = msg->msg_len - offset;
+		if (seg_len > gro_size) {
+			seg_len = gro_size;
+		}
+		memmove(seg_buf, buf + offset, seg_len);
+		seg_iov.iov_base = seg_buf;
+		seg_iov.iov_len = seg_len;
+		seg_msg.msg_len = seg_len;
+		_parse_recv_from_links(knet_h, sockfd, &seg_msg);
+	}
 }
 
 static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msg)
 {
 	int err, savederrno;
 	int i, msg_recv, transport;
+	size_t gro_size;
 
-	if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_RX) < 0) {
 		log_debug(knet_h, KNET_SUB_RX, "Unable to get global read lock");
 		return;
 	}
@@ -816,7 +1113,7 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 		goto exit_unlock;
 	}
 
-	transport = knet_h->knet_transport_fd_tracker[sockfd].transport;
+	transport = _get_fd_tracker(knet_h, sockfd)->transport;
 
 	/*
 	 * reset msg_namelen to buffer size because after recvmmsg
@@ -825,6 +1122,7 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 
 	for (i = 0; i < PCKT_RX_BUFS; i++) {
 		msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		msg[i].msg_hdr.msg_controllen = KNET_RX_CMSG_SIZE;
 	}
 
 	msg_recv = _recvmmsg(sockfd, &msg[0], PCKT_RX_BUFS, MSG_DONTWAIT | MSG_NOSIGNAL);
@@ -860,6 +1158,8 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 	}
 
 	for (i = 0; i < msg_recv; i++) {
+		gro_size = _parse_rx_cmsg(knet_h, sockfd, &msg[i].msg_hdr);
+
 		err = transport_rx_is_data(knet_h, transport, sockfd, &msg[i]);
 
 		/*
@@ -869,14 +1169,14 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 
 		switch(err) {
 			case KNET_TRANSPORT_RX_ERROR: /* on error */
-				log_debug(knet_h, KNET_SUB_RX, "Transport reported error parsing packet");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Transport reported error parsing packet");
 				goto exit_unlock;
 				break;
 			case KNET_TRANSPORT_RX_NOT_DATA_CONTINUE: /* packet is not data and we should continue the packet process loop */
-				log_debug(knet_h, KNET_SUB_RX, "Transport reported no data, continue");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Transport reported no data, continue");
 				break;
 			case KNET_TRANSPORT_RX_NOT_DATA_STOP: /* packet is not data and we should STOP the packet process loop */
-				log_debug(knet_h, KNET_SUB_RX, "Transport reported no data, stop");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Transport reported no data, stop");
 				goto exit_unlock;
 				break;
 			case KNET_TRANSPORT_RX_IS_DATA: /* packet is data and should be parsed as such */
@@ -895,9 +1195,9 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 								   src_ipaddr, KNET_MAX_HOST_LEN,
 								   src_port, KNET_MAX_PORT_LEN) < 0) {
 
-							log_debug(knet_h, KNET_SUB_RX, "Packet rejected: unable to resolve host/port");
+							log_debug_datapath(knet_h, KNET_SUB_RX, "Packet rejected: unable to resolve host/port");
 						} else {
-							log_debug(knet_h, KNET_SUB_RX, "Packet rejected from %s/%s", src_ipaddr, src_port);
+							log_debug_datapath(knet_h, KNET_SUB_RX, "Packet rejected from %s/%s", src_ipaddr, src_port);
 						}
 						/*
 						 * continue processing the other packets
@@ -905,20 +1205,20 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 						continue;
 					}
 				}
-				_parse_recv_from_links(knet_h, sockfd, &msg[i]);
+				_parse_recv_from_links_segments(knet_h, sockfd, &msg[i], gro_size);
 				break;
 			case KNET_TRANSPORT_RX_OOB_DATA_CONTINUE:
-				log_debug(knet_h, KNET_SUB_RX, "Transport is processing sock OOB data, continue");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Transport is processing sock OOB data, continue");
 				break;
 			case KNET_TRANSPORT_RX_OOB_DATA_STOP:
-				log_debug(knet_h, KNET_SUB_RX, "Transport has completed processing sock OOB data, stop");
+				log_debug_datapath(knet_h, KNET_SUB_RX, "Transport has completed processing sock OOB data, stop");
 				goto exit_unlock;
 				break;
 		}
 	}
 
 exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 }
 
 void *_handle_recv_from_links_thread(void *data)
@@ -929,6 +1229,7 @@ void *_handle_recv_from_links_thread(void *data)
 	struct sockaddr_storage address[PCKT_RX_BUFS];
 	struct knet_mmsghdr msg[PCKT_RX_BUFS];
 	struct iovec iov_in[PCKT_RX_BUFS];
+	uint64_t control[PCKT_RX_BUFS][KNET_RX_CMSG_SIZE / sizeof(uint64_t)];
 
 	set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_STARTED);
 
@@ -944,6 +1245,8 @@ void *_handle_recv_from_links_thread(void *data)
 		msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
 		msg[i].msg_hdr.msg_iov = &iov_in[i];
 		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_control = control[i];
+		msg[i].msg_hdr.msg_controllen = KNET_RX_CMSG_SIZE;
 	}
 
 	while (!shutdown_in_progress(knet_h)) {
@@ -970,6 +1273,8 @@ void *_handle_recv_from_links_thread(void *data)
 		}
 	}
 
+	compress_ctx_fini(knet_h, KNET_COMPRESS_CTX_RX);
+
 	set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_STOPPED);
 
 	return NULL;
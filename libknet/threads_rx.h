@@ -12,4 +12,10 @@
 
 void *_handle_recv_from_links_thread(void *data);
 
+/*
+ * returns -1 if the packet can be discarded based on its
+ * cleartext pre-header, 0 if it needs to be decrypted
+ */
+int _check_preheader(knet_handle_t knet_h, const unsigned char *buf, ssize_t len);
+
 #endif
@@ -19,8 +19,8 @@
 #include "compat.h"
 #include "compress.h"
 #include "crypto.h"
+#include "epoch.h"
 #include "host.h"
-#include "link.h"
 #include "logging.h"
 #include "transports.h"
 #include "transport_common.h"
@@ -33,25 +33,79 @@
  * SEND
  */
 
+/*
+ * the kernel has no route to the destination, there is no point
+ * in waiting for the pong timeout to stop using the link.
+ * The error might be left over from a packet sent to another
+ * destination on the same socket, so the link is demoted only
+ * if the errqueue reported its dst_addr unreachable or if the
+ * error repeats on the link.
+ */
+static int _is_link_unreachable(int err)
+{
+	return ((err == EHOSTUNREACH) || (err == ENETUNREACH) || (err == ENETDOWN));
+}
+
+/*
+ * find the best link to resend data after a link has been demoted,
+ * the dst link handler thread has not published the new active
+ * links yet. Same rules as _host_dstcache_update_links.
+ */
+static struct knet_link *_find_failover_link(struct knet_host *dst_host)
+{
+	struct knet_link *link, *best_link = NULL;
+	int link_idx;
+
+	for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
+		link = &dst_host->link[link_idx];
+		if ((link->status.enabled != 1) ||
+		    (link->status.connected != 1) ||
+		    (link->has_valid_mtu != 1) ||
+		    (__atomic_load_n(&link->tx_unreachable, __ATOMIC_RELAXED) == KNET_LINK_TX_UNREACHABLE_DOWN) ||
+		    (link->transport == KNET_TRANSPORT_LOOPBACK)) {
+			continue;
+		}
+		if ((!best_link) || (link->priority > best_link->priority)) {
+			best_link = link;
+		}
+	}
+
+	return best_link;
+}
+
 static int _dispatch_to_links(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_mmsghdr *msg, int msgs_to_send)
 {
-	int link_idx, msg_idx, sent_msgs, prev_sent, progress;
+	int link_idx, msg_idx, sent_msgs, prev_sent, progress, unreachable;
 	int err = 0, savederrno = 0, locked = 0;
-	unsigned int i;
+	unsigned int i, rr_start = 0;
 	struct knet_mmsghdr *cur;
 	struct knet_link *cur_link;
+	struct knet_host_active_links *active_links;
+
+	/*
+	 * active links are replaced by the dst link handler thread,
+	 * load them once and stick with them for this dispatch
+	 */
+	active_links = __atomic_load_n(&dst_host->active_links, __ATOMIC_ACQUIRE);
+
+	if ((dst_host->link_handler_policy == KNET_LINK_POLICY_RR) &&
+	    (active_links->entries > 1)) {
+		rr_start = dst_host->active_links_rr % active_links->entries;
+	}
 
-	for (link_idx = 0; link_idx < dst_host->active_link_entries; link_idx++) {
+	for (link_idx = 0; link_idx < active_links->entries; link_idx++) {
 		prev_sent = 0;
 		progress = 1;
 		locked = 0;
+		unreachable = 0;
 
-		cur_link = &dst_host->link[dst_host->active_links[link_idx]];
+		cur_link = &dst_host->link[active_links->links[(rr_start + link_idx) % active_links->entries]];
 
 		if (cur_link->transport == KNET_TRANSPORT_LOOPBACK) {
 			continue;
 		}
 
+send_to_link:
 		savederrno = pthread_mutex_lock(&cur_link->link_stats_mutex);
 		if (savederrno) {
 			log_err(knet_h, KNET_SUB_TX, "Unable to get stats mutex lock for host %u link %u: %s",
@@ -60,7 +114,7 @@ static int _dispatch_to_links(knet_handle_t knet_h, struct knet_host *dst_host,
 		}
 		locked = 1;
 
-		msg_idx = 0;
+		msg_idx = prev_sent;
 		while (msg_idx < msgs_to_send) {
 			msg[msg_idx].msg_hdr.msg_name = &cur_link->dst_addr;
 
@@ -75,12 +129,46 @@ static int _dispatch_to_links(knet_handle_t knet_h, struct knet_host *dst_host,
 retry:
 		cur = &msg[prev_sent];
 
-		sent_msgs = _sendmmsg(dst_host->link[dst_host->active_links[link_idx]].outsock,
-				      transport_get_connection_oriented(knet_h, dst_host->link[dst_host->active_links[link_idx]].transport),
-				      &cur[0], msgs_to_send - prev_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		sent_msgs = transport_tx_sendmmsg(knet_h, cur_link->transport, cur_link->outsock,
+						  &cur[0], msgs_to_send - prev_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
 		savederrno = errno;
 
-		err = transport_tx_sock_error(knet_h, dst_host->link[dst_host->active_links[link_idx]].transport, dst_host->link[dst_host->active_links[link_idx]].outsock, sent_msgs, savederrno);
+		err = transport_tx_sock_error(knet_h, cur_link->transport, cur_link->outsock, sent_msgs, savederrno);
+		if ((err) && (_is_link_unreachable(savederrno))) {
+			if ((__atomic_load_n(&cur_link->tx_unreachable, __ATOMIC_RELAXED) == KNET_LINK_TX_REACHABLE) &&
+			    (!unreachable)) {
+				unreachable = 1;
+				cur_link->status.stats.tx_data_retries++;
+				goto retry;
+			}
+			cur_link->status.stats.tx_data_errors++;
+			pthread_mutex_unlock(&cur_link->link_stats_mutex);
+			locked = 0;
+			/*
+			 * demote the link now: drop it from the active links
+			 * and let the heartbeat thread bring it down (and back up
+			 * once pongs are received again). TX does not touch the
+			 * link status or run notifications with tx_mutex held.
+			 * Resend what is left on the next best link.
+			 * With active policy, all other links already get the data.
+			 */
+			if (__atomic_exchange_n(&cur_link->tx_unreachable, KNET_LINK_TX_UNREACHABLE_DOWN, __ATOMIC_RELAXED) != KNET_LINK_TX_UNREACHABLE_DOWN) {
+				log_info(knet_h, KNET_SUB_TX, "host: %u link: %u send error: %s, failing over",
+					 dst_host->host_id, cur_link->link_id, strerror(savederrno));
+				_host_dstcache_update_async(knet_h, dst_host);
+			}
+			if (dst_host->link_handler_policy == KNET_LINK_POLICY_ACTIVE) {
+				continue;
+			}
+			cur_link = _find_failover_link(dst_host);
+			if (!cur_link) {
+				goto out_unlock;
+			}
+			progress = 1;
+			unreachable = 0;
+			goto send_to_link;
+		}
+
 		switch(err) {
 			case -1: /* unrecoverable error */
 				cur_link->status.stats.tx_data_errors++;
@@ -104,12 +192,12 @@ retry:
 					progress = 0;
 				}
 #ifdef DEBUG
-				log_debug(knet_h, KNET_SUB_TX, "Unable to send all (%d/%d) data packets to host %s (%u) link %s:%s (%u)",
-					  sent_msgs, msg_idx,
-					  dst_host->name, dst_host->host_id,
-					  dst_host->link[dst_host->active_links[link_idx]].status.dst_ipaddr,
-					  dst_host->link[dst_host->active_links[link_idx]].status.dst_port,
-					  dst_host->link[dst_host->active_links[link_idx]].link_id);
+				log_debug_datapath(knet_h, KNET_SUB_TX, "Unable to send all (%d/%d) data packets to host %s (%u) link %s:%s (%u)",
+						   sent_msgs, msg_idx,
+						   dst_host->name, dst_host->host_id,
+						   cur_link->status.dst_ipaddr,
+						   cur_link->status.dst_port,
+						   cur_link->link_id);
 #endif
 				goto retry;
 			}
@@ -121,12 +209,8 @@ retry:
 		}
 
 		if ((dst_host->link_handler_policy == KNET_LINK_POLICY_RR) &&
-		    (dst_host->active_link_entries > 1)) {
-			uint8_t cur_link_id = dst_host->active_links[0];
-
-			memmove(&dst_host->active_links[0], &dst_host->active_links[1], KNET_MAX_LINK - 1);
-			dst_host->active_links[dst_host->active_link_entries - 1] = cur_link_id;
-
+		    (active_links->entries > 1)) {
+			dst_host->active_links_rr++;
 			break;
 		}
 		pthread_mutex_unlock(&cur_link->link_stats_mutex);
@@ -143,7 +227,7 @@ out_unlock:
 
 static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t channel, int is_sync)
 {
-	size_t outlen, frag_len;
+	size_t frag_len;
 	struct knet_host *dst_host;
 	knet_node_id_t dst_host_ids_temp[KNET_MAX_HOST];
 	size_t dst_host_ids_entries_temp = 0;
@@ -151,7 +235,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	size_t dst_host_ids_entries = 0;
 	int bcast = 1;
 	struct knet_hostinfo *knet_hostinfo;
-	struct iovec iov_out[PCKT_FRAG_MAX][2];
+	struct iovec iov_out[PCKT_FRAG_MAX][3]; /* header, data, MAC */
 	int iovcnt_out = 2;
 	uint8_t frag_idx;
 	unsigned int temp_data_mtu;
@@ -167,6 +251,10 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	int j;
 	int send_local = 0;
 	int data_compressed = 0;
+	uint8_t compress_flags = 0;
+	uint8_t compress_pad = 0;
+	uint32_t dst_key = 0;
+	int adaptive_skipped = 0;
 	size_t uncrypted_frag_size;
 	int stats_locked = 0, stats_err = 0;
 
@@ -174,7 +262,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 
 	if ((knet_h->enabled != 1) &&
 	    (inbuf->kh_type != KNET_HEADER_TYPE_HOST_INFO)) { /* data forward is disabled */
-		log_debug(knet_h, KNET_SUB_TX, "Received data packet but forwarding is disabled");
+		log_debug_datapath(knet_h, KNET_SUB_TX, "Received data packet but forwarding is disabled");
 		savederrno = ECANCELED;
 		err = -1;
 		goto out_unlock;
@@ -198,14 +286,14 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 						dst_host_ids_temp,
 						&dst_host_ids_entries_temp);
 				if (bcast < 0) {
-					log_debug(knet_h, KNET_SUB_TX, "Error from dst_host_filter_fn: %d", bcast);
+					log_debug_datapath(knet_h, KNET_SUB_TX, "Error from dst_host_filter_fn: %d", bcast);
 					savederrno = EFAULT;
 					err = -1;
 					goto out_unlock;
 				}
 
 				if ((!bcast) && (!dst_host_ids_entries_temp)) {
-					log_debug(knet_h, KNET_SUB_TX, "Message is unicast but no dst_host_ids_entries");
+					log_debug_datapath(knet_h, KNET_SUB_TX, "Message is unicast but no dst_host_ids_entries");
 					savederrno = EINVAL;
 					err = -1;
 					goto out_unlock;
@@ -213,7 +301,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 
 				if ((!bcast) &&
 				    (dst_host_ids_entries_temp > KNET_MAX_HOST)) {
-					log_debug(knet_h, KNET_SUB_TX, "dst_host_filter_fn returned too many destinations");
+					log_debug_datapath(knet_h, KNET_SUB_TX, "dst_host_filter_fn returned too many destinations");
 					savederrno = EINVAL;
 					err = -1;
 					goto out_unlock;
@@ -242,11 +330,11 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 				local_retry:
 					err = write(knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], buf, buflen);
 					if (err < 0) {
-						log_err(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local failed. error=%s\n", strerror(errno));
+						log_err_ratelimited(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local failed. error=%s\n", strerror(errno));
 						local_link->status.stats.tx_data_errors++;
 					}
 					if (err > 0 && err < buflen) {
-						log_debug(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local incomplete=%d bytes of %zu\n", err, inlen);
+						log_debug_datapath(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local incomplete=%d bytes of %zu\n", err, inlen);
 						local_link->status.stats.tx_data_retries++;
 						buf += err;
 						buflen -= err;
@@ -269,7 +357,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			}
 			break;
 		default:
-			log_warn(knet_h, KNET_SUB_TX, "Receiving unknown messages from socket");
+			log_warn_ratelimited(knet_h, KNET_SUB_TX, "Receiving unknown messages from socket");
 			savederrno = ENOMSG;
 			err = -1;
 			goto out_unlock;
@@ -279,7 +367,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	if (is_sync) {
 		if ((bcast) ||
 		    ((!bcast) && (dst_host_ids_entries_temp > 1))) {
-			log_debug(knet_h, KNET_SUB_TX, "knet_send_sync is only supported with unicast packets for one destination");
+			log_debug_datapath(knet_h, KNET_SUB_TX, "knet_send_sync is only supported with unicast packets for one destination");
 			savederrno = E2BIG;
 			err = -1;
 			goto out_unlock;
@@ -315,10 +403,9 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		}
 	} else {
 		send_mcast = 0;
-		for (dst_host = knet_h->host_head; dst_host != NULL; dst_host = dst_host->next) {
-			if (!(dst_host->host_id == knet_h->host_id &&
-			      knet_h->has_loop_link) &&
-			    dst_host->status.reachable) {
+		for (host_idx = 0; host_idx < knet_h->reachable_hosts_entries; host_idx++) {
+			if (!(knet_h->reachable_hosts[host_idx].host_id == knet_h->host_id &&
+			      knet_h->has_loop_link)) {
 				send_mcast = 1;
 				break;
 			}
@@ -334,11 +421,11 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		/*
 		 * using MIN_MTU_V4 for data mtu is not completely accurate but safe enough
 		 */
-		log_debug(knet_h, KNET_SUB_TX,
-			  "Received data packet but data MTU is still unknown."
-			  " Packet might not be delivered."
-			  " Assuming minimum IPv4 MTU (%d)",
-			  KNET_PMTUD_MIN_MTU_V4);
+		log_debug_datapath(knet_h, KNET_SUB_TX,
+				   "Received data packet but data MTU is still unknown."
+				   " Packet might not be delivered."
+				   " Assuming minimum IPv4 MTU (%d)",
+				   KNET_PMTUD_MIN_MTU_V4);
 		temp_data_mtu = KNET_PMTUD_MIN_MTU_V4;
 	} else {
 		/*
@@ -352,15 +439,31 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	 * compress data
 	 */
 	if ((knet_h->compress_model > 0) && (inlen > knet_h->compress_threshold)) {
+		adaptive_skipped = compress_adaptive_skip(knet_h, channel, inlen);
+	}
+	if ((knet_h->compress_model > 0) && (inlen > knet_h->compress_threshold) && (!adaptive_skipped)) {
 		size_t cmp_outlen = KNET_DATABUFSIZE_COMPRESS;
 		struct timespec start_time;
 		struct timespec end_time;
 		uint64_t compress_time;
 
+		/*
+		 * identify the destinations for stream compression,
+		 * 0 for broadcast
+		 */
+		if (!bcast) {
+			dst_key = 2166136261U;
+			for (host_idx = 0; host_idx < dst_host_ids_entries; host_idx++) {
+				dst_key ^= dst_host_ids[host_idx];
+				dst_key *= 16777619U;
+			}
+		}
+
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		err = compress(knet_h,
+		err = compress(knet_h, channel, dst_key,
 			       (const unsigned char *)inbuf->khp_data_userdata, inlen,
-			       knet_h->send_to_links_buf_compress, (ssize_t *)&cmp_outlen);
+			       knet_h->send_to_links_buf_compress, (ssize_t *)&cmp_outlen,
+			       &compress_flags, &compress_pad);
 
 		savederrno = errno;
 
@@ -376,6 +479,8 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
 		timespec_diff(start_time, end_time, &compress_time);
 
+		compress_adaptive_update(knet_h, channel, inlen, (err < 0) ? inlen : cmp_outlen, compress_time);
+
 		if (compress_time < knet_h->stats.tx_compress_time_min) {
 			knet_h->stats.tx_compress_time_min = compress_time;
 		}
@@ -387,11 +492,21 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			 compress_time) / (knet_h->stats.tx_compressed_packets+1);
 		if (err < 0) {
 			knet_h->stats.tx_failed_to_compress++;
-			log_warn(knet_h, KNET_SUB_COMPRESS, "Compression failed (%d): %s", err, strerror(savederrno));
+			log_warn_ratelimited(knet_h, KNET_SUB_COMPRESS, "Compression failed (%d): %s", err, strerror(savederrno));
 		} else {
 			knet_h->stats.tx_compressed_packets++;
 			knet_h->stats.tx_compressed_original_bytes += inlen;
 			knet_h->stats.tx_compressed_size_bytes += cmp_outlen;
+			if (compress_flags & KNET_COMPRESS_DICT) {
+				knet_h->stats.tx_dict_compressed_packets++;
+				knet_h->stats.tx_dict_compressed_original_bytes += inlen;
+				knet_h->stats.tx_dict_compressed_size_bytes += cmp_outlen;
+			}
+			if (compress_flags & KNET_COMPRESS_STREAM) {
+				knet_h->stats.tx_stream_compressed_packets++;
+				knet_h->stats.tx_stream_compressed_original_bytes += inlen;
+				knet_h->stats.tx_stream_compressed_size_bytes += cmp_outlen;
+			}
 
 			if (cmp_outlen < inlen) {
 				memmove(inbuf->khp_data_userdata, knet_h->send_to_links_buf_compress, cmp_outlen);
@@ -414,6 +529,9 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	if (knet_h->compress_model > 0 && !data_compressed) {
 		knet_h->stats.tx_uncompressed_packets++;
 	}
+	if (adaptive_skipped) {
+		knet_h->stats.tx_adaptive_uncompressed_packets++;
+	}
 	pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 	stats_locked = 0;
 
@@ -428,9 +546,11 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	inbuf->khp_data_frag_num = ceil((float)inlen / temp_data_mtu);
 	inbuf->khp_data_channel = channel;
 	if (data_compressed) {
-		inbuf->khp_data_compress = knet_h->compress_model;
+		inbuf->khp_data_compress = knet_h->compress_model | compress_flags;
+		inbuf->khp_data_pad1 = compress_pad;
 	} else {
 		inbuf->khp_data_compress = 0;
+		inbuf->khp_data_pad1 = 0;
 	}
 
 	if (pthread_mutex_lock(&knet_h->tx_seq_num_mutex)) {
@@ -495,6 +615,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			knet_h->send_to_links_buf[frag_idx]->khp_data_bcast = inbuf->khp_data_bcast;
 			knet_h->send_to_links_buf[frag_idx]->khp_data_channel = inbuf->khp_data_channel;
 			knet_h->send_to_links_buf[frag_idx]->khp_data_compress = inbuf->khp_data_compress;
+			knet_h->send_to_links_buf[frag_idx]->khp_data_pad1 = inbuf->khp_data_pad1;
 
 			frag_len = frag_len - temp_data_mtu;
 			frag_idx++;
@@ -510,54 +631,74 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		struct timespec start_time;
 		struct timespec end_time;
 		uint64_t crypt_time;
+		struct crypto_batch_entry crypt_batch[PCKT_FRAG_MAX];
 
-		frag_idx = 0;
-		while (frag_idx < inbuf->khp_data_frag_num) {
-			clock_gettime(CLOCK_MONOTONIC, &start_time);
-			if (crypto_encrypt_and_signv(
-					knet_h,
-					iov_out[frag_idx], iovcnt_out,
-					knet_h->send_to_links_buf_crypt[frag_idx],
-					(ssize_t *)&outlen) < 0) {
-				log_debug(knet_h, KNET_SUB_TX, "Unable to encrypt packet");
-				savederrno = ECHILD;
-				err = -1;
-				goto out_unlock;
-			}
-			clock_gettime(CLOCK_MONOTONIC, &end_time);
-			timespec_diff(start_time, end_time, &crypt_time);
+		/*
+		 * all fragments are encrypted in one call, crypt time
+		 * is accounted evenly to each fragment
+		 */
+		for (frag_idx = 0; frag_idx < inbuf->khp_data_frag_num; frag_idx++) {
+			crypt_batch[frag_idx].iov_in = iov_out[frag_idx];
+			crypt_batch[frag_idx].iovcnt_in = iovcnt_out;
+			crypt_batch[frag_idx].buf_out = knet_h->send_to_links_buf_crypt[frag_idx];
+		}
 
-			stats_err = pthread_mutex_lock(&knet_h->handle_stats_mutex);
-			if (stats_err < 0) {
-				log_err(knet_h, KNET_SUB_TX, "Unable to get mutex lock: %s", strerror(stats_err));
-				err = -1;
-				savederrno = stats_err;
-				goto out_unlock;
-			}
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		if (crypto_encrypt_and_signv_batch(knet_h, crypt_batch, inbuf->khp_data_frag_num) < 0) {
+			log_debug_datapath(knet_h, KNET_SUB_TX, "Unable to encrypt packet");
+			savederrno = ECHILD;
+			err = -1;
+			goto out_unlock;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		timespec_diff(start_time, end_time, &crypt_time);
+		crypt_time = crypt_time / inbuf->khp_data_frag_num;
 
-			if (crypt_time < knet_h->stats.tx_crypt_time_min) {
-				knet_h->stats.tx_crypt_time_min = crypt_time;
-			}
-			if (crypt_time > knet_h->stats.tx_crypt_time_max) {
-				knet_h->stats.tx_crypt_time_max = crypt_time;
-			}
-			knet_h->stats.tx_crypt_time_ave =
-				(knet_h->stats.tx_crypt_time_ave * knet_h->stats.tx_crypt_packets +
-				 crypt_time) / (knet_h->stats.tx_crypt_packets+1);
+		stats_err = pthread_mutex_lock(&knet_h->handle_stats_mutex);
+		if (stats_err < 0) {
+			log_err(knet_h, KNET_SUB_TX, "Unable to get mutex lock: %s", strerror(stats_err));
+			err = -1;
+			savederrno = stats_err;
+			goto out_unlock;
+		}
 
+		if (crypt_time < knet_h->stats.tx_crypt_time_min) {
+			knet_h->stats.tx_crypt_time_min = crypt_time;
+		}
+		if (crypt_time > knet_h->stats.tx_crypt_time_max) {
+			knet_h->stats.tx_crypt_time_max = crypt_time;
+		}
+		knet_h->stats.tx_crypt_time_ave =
+			(knet_h->stats.tx_crypt_time_ave * knet_h->stats.tx_crypt_packets +
+			 crypt_time * inbuf->khp_data_frag_num) /
+			(knet_h->stats.tx_crypt_packets + inbuf->khp_data_frag_num);
+
+		for (frag_idx = 0; frag_idx < inbuf->khp_data_frag_num; frag_idx++) {
 			uncrypted_frag_size = 0;
 			for (j=0; j < iovcnt_out; j++) {
 				uncrypted_frag_size += iov_out[frag_idx][j].iov_len;
 			}
-			knet_h->stats.tx_crypt_byte_overhead += (outlen - uncrypted_frag_size);
 			knet_h->stats.tx_crypt_packets++;
-			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 
-			iov_out[frag_idx][0].iov_base = knet_h->send_to_links_buf_crypt[frag_idx];
-			iov_out[frag_idx][0].iov_len = outlen;
-			frag_idx++;
+			/*
+			 * MAC only: the payload is sent as is, followed by the MAC
+			 */
+			if (crypt_batch[frag_idx].mac_only) {
+				knet_h->stats.tx_crypt_byte_overhead += crypt_batch[frag_idx].buf_out_len;
+				iov_out[frag_idx][iovcnt_out].iov_base = knet_h->send_to_links_buf_crypt[frag_idx];
+				iov_out[frag_idx][iovcnt_out].iov_len = crypt_batch[frag_idx].buf_out_len;
+			} else {
+				knet_h->stats.tx_crypt_byte_overhead += (crypt_batch[frag_idx].buf_out_len - uncrypted_frag_size);
+				iov_out[frag_idx][0].iov_base = knet_h->send_to_links_buf_crypt[frag_idx];
+				iov_out[frag_idx][0].iov_len = crypt_batch[frag_idx].buf_out_len;
+			}
+		}
+		pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		if (crypt_batch[0].mac_only) {
+			iovcnt_out++;
+		} else {
+			iovcnt_out = 1;
 		}
-		iovcnt_out = 1;
 	}
 
 	memset(&msg, 0, sizeof(msg));
@@ -584,13 +725,12 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			}
 		}
 	} else {
-		for (dst_host = knet_h->host_head; dst_host != NULL; dst_host = dst_host->next) {
-			if (dst_host->status.reachable) {
-				err = _dispatch_to_links(knet_h, dst_host, &msg[0], msgs_to_send);
-				savederrno = errno;
-				if (err) {
-					goto out_unlock;
-				}
+		for (host_idx = 0; host_idx < knet_h->reachable_hosts_entries; host_idx++) {
+			dst_host = knet_h->reachable_hosts[host_idx].host;
+			err = _dispatch_to_links(knet_h, dst_host, &msg[0], msgs_to_send);
+			savederrno = errno;
+			if (err) {
+				goto out_unlock;
 			}
 		}
 	}
@@ -634,8 +774,8 @@ int knet_send_sync(knet_handle_t knet_h, const char *buff, const size_t buff_len
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
-	if (savederrno) {
+	if (epoch_read_lock(knet_h, KNET_EPOCH_READER_API) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_TX, "Unable to get read lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
@@ -664,7 +804,7 @@ int knet_send_sync(knet_handle_t knet_h, const char *buff, const size_t buff_len
 	pthread_mutex_unlock(&knet_h->tx_mutex);
 
 out:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	epoch_read_unlock(knet_h);
 
 	errno = err ? savederrno : 0;
 	return err;
@@ -682,7 +822,7 @@ static void _handle_send_to_links(knet_handle_t knet_h, struct msghdr *msg, int
 	} else {
 		inlen = recvmsg(sockfd, msg, MSG_DONTWAIT | MSG_NOSIGNAL);
 		if (msg->msg_flags & MSG_TRUNC) {
-			log_warn(knet_h, KNET_SUB_TX, "Received truncated message from sock %d. Discarding", sockfd);
+			log_warn_ratelimited(knet_h, KNET_SUB_TX, "Received truncated message from sock %d. Discarding", sockfd);
 			return;
 		}
 	}
@@ -729,9 +869,10 @@ void *_handle_send_to_links_thread(void *data)
 {
 	knet_handle_t knet_h = (knet_handle_t) data;
 	struct epoll_event events[KNET_EPOLL_MAX_EVENTS];
-	int i, nev, type;
+	int i, nev, type, sockfd;
 	int flush, flush_queue_limit;
 	int8_t channel;
+	struct knet_sock *sock;
 	struct iovec iov_in;
 	struct msghdr msg;
 	struct sockaddr_storage address;
@@ -761,7 +902,7 @@ void *_handle_send_to_links_thread(void *data)
 	flush_queue_limit = 0;
 
 	while (!shutdown_in_progress(knet_h)) {
-		nev = epoll_wait(knet_h->send_to_links_epollfd, events, KNET_EPOLL_MAX_EVENTS + 1, knet_h->threads_timer_res / 1000);
+		nev = epoll_wait(knet_h->send_to_links_epollfd, events, KNET_EPOLL_MAX_EVENTS, knet_h->threads_timer_res / 1000);
 
 		flush = get_thread_flush_queue(knet_h, KNET_THREAD_TX);
 
@@ -801,37 +942,54 @@ void *_handle_send_to_links_thread(void *data)
 			flush_queue_limit = 0;
 		}
 
-		if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
+		if (epoch_read_lock(knet_h, KNET_EPOCH_READER_TX) < 0) {
 			log_debug(knet_h, KNET_SUB_TX, "Unable to get read lock");
 			continue;
 		}
 
+		if (pthread_mutex_lock(&knet_h->tx_mutex) != 0) {
+			log_debug(knet_h, KNET_SUB_TX, "Unable to get mutex lock");
+			epoch_read_unlock(knet_h);
+			continue;
+		}
+
 		for (i = 0; i < nev; i++) {
-			if (events[i].data.fd == knet_h->hostsockfd[0]) {
+			/*
+			 * datafds are registered in epoll with a pointer to
+			 * their knet_sock, hostsockfd[0] uses the internal
+			 * channel slot
+			 */
+			sock = events[i].data.ptr;
+			channel = sock - knet_h->sockfd;
+			if (channel == KNET_INTERNAL_DATA_CHANNEL) {
 				type = KNET_HEADER_TYPE_HOST_INFO;
-				channel = KNET_INTERNAL_DATA_CHANNEL;
+				sockfd = knet_h->hostsockfd[0];
 			} else {
-				type = KNET_HEADER_TYPE_DATA;
-				for (channel = 0; channel < KNET_DATAFD_MAX; channel++) {
-					if ((knet_h->sockfd[channel].in_use) &&
-					    (knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created] == events[i].data.fd)) {
-						break;
-					}
-				}
-				if (channel >= KNET_DATAFD_MAX) {
+				/*
+				 * the datafd might have been removed after
+				 * epoll_wait returned
+				 */
+				if (!sock->in_use) {
 					log_debug(knet_h, KNET_SUB_TX, "No available channels");
-					continue; /* channel not found */
+					continue;
 				}
+				type = KNET_HEADER_TYPE_DATA;
+				sockfd = sock->sockfd[sock->is_created];
 			}
-			if (pthread_mutex_lock(&knet_h->tx_mutex) != 0) {
-				log_debug(knet_h, KNET_SUB_TX, "Unable to get mutex lock");
-				continue;
-			}
-			_handle_send_to_links(knet_h, &msg, events[i].data.fd, channel, type);
-			pthread_mutex_unlock(&knet_h->tx_mutex);
+			_handle_send_to_links(knet_h, &msg, sockfd, channel, type);
 		}
 
-		pthread_rwlock_unlock(&knet_h->global_rwlock);
+		pthread_mutex_unlock(&knet_h->tx_mutex);
+		epoch_read_unlock(knet_h);
+	}
+
+	/*
+	 * release the compression contexts owned by this thread,
+	 * knet_send_sync shares them and requires tx_mutex
+	 */
+	if (pthread_mutex_lock(&knet_h->tx_mutex) == 0) {
+		compress_ctx_fini(knet_h, KNET_COMPRESS_CTX_TX);
+		pthread_mutex_unlock(&knet_h->tx_mutex);
 	}
 
 	set_thread_status(knet_h, KNET_THREAD_TX, KNET_THREAD_STOPPED);
@@ -8,6 +8,7 @@
 
 #include "config.h"
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -162,10 +163,120 @@ static int _configure_sockbuf(knet_handle_t knet_h, int sock, int option, int fo
 	return 0;
 }
 
+/*
+ * only grow socket buffers, UDP sockets can be shared
+ * between links with different needs
+ */
+static int _grow_sockbuf(knet_handle_t knet_h, int sock, int option, int force, int target)
+{
+	int savederrno = 0;
+	int value;
+	socklen_t value_len = sizeof value;
+
+	if (getsockopt(sock, SOL_SOCKET, option, &value, &value_len) != 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TRANSPORT,
+			"Error getting socket buffer via option %d: %s\n",
+			option, strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (target <= value) {
+		return 0;
+	}
+
+	return _configure_sockbuf(knet_h, sock, option, force, target);
+}
+
+int _configure_link_sockbuf(knet_handle_t knet_h, int sock, int target)
+{
+	int savederrno = 0;
+
+	if (_grow_sockbuf(knet_h, sock, SO_RCVBUF, SO_RCVBUFFORCE, target)) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to grow receive buffer: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (_grow_sockbuf(knet_h, sock, SO_SNDBUF, SO_SNDBUFFORCE, target)) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to grow send buffer: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	log_debug(knet_h, KNET_SUB_TRANSPORT, "Socket buffers set to %d bytes on socket: %i", target, sock);
+
+	return 0;
+}
+
+int _configure_link_busypoll(knet_handle_t knet_h, int sock, const char *type)
+{
+#if defined(SO_BUSY_POLL) || defined(SO_PREFER_BUSY_POLL)
+	int savederrno;
+	int value;
+#endif
+
+#ifdef SO_BUSY_POLL
+	/*
+	 * raising SO_BUSY_POLL above net.core.busy_read requires CAP_NET_ADMIN
+	 */
+	value = KNET_SOCK_BUSY_POLL_USECS;
+	if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0) {
+		savederrno = errno;
+		if (!(knet_h->flags & KNET_HANDLE_FLAG_PRIVILEGED)) {
+			log_warn(knet_h, KNET_SUB_TRANSPORT, "Unable to set %s busy poll: %s (handle is not privileged, continuing)",
+				 type, strerror(savederrno));
+		} else {
+			log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to set %s busy poll: %s",
+				type, strerror(savederrno));
+			errno = savederrno;
+			return -1;
+		}
+	} else {
+		log_debug(knet_h, KNET_SUB_TRANSPORT, "SO_BUSY_POLL enabled on socket: %i", sock);
+	}
+#else
+	log_debug(knet_h, KNET_SUB_TRANSPORT, "SO_BUSY_POLL not available in this build/platform");
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+	value = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value)) < 0) {
+		savederrno = errno;
+		/*
+		 * headers might be newer than the running kernel
+		 */
+		if (savederrno == ENOPROTOOPT) {
+			log_debug(knet_h, KNET_SUB_TRANSPORT, "SO_PREFER_BUSY_POLL not supported by the running kernel");
+		} else {
+			log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to set %s prefer busy poll: %s",
+				type, strerror(savederrno));
+			errno = savederrno;
+			return -1;
+		}
+	} else {
+		log_debug(knet_h, KNET_SUB_TRANSPORT, "SO_PREFER_BUSY_POLL enabled on socket: %i", sock);
+	}
+#else
+	log_debug(knet_h, KNET_SUB_TRANSPORT, "SO_PREFER_BUSY_POLL not available in this build/platform");
+#endif
+
+	return 0;
+}
+
 int _configure_common_socket(knet_handle_t knet_h, int sock, uint64_t flags, const char *type)
 {
 	int err = 0, savederrno = 0;
 	int value;
+	int sockbuf = KNET_RING_RCVBUFF;
+
+	if (flags & KNET_LINK_FLAG_SOCKBUF_AUTO) {
+		sockbuf = KNET_RING_RCVBUFF_MIN;
+	}
 
 	if (_fdset_cloexec(sock)) {
 		savederrno = errno;
@@ -183,7 +294,7 @@ int _configure_common_socket(knet_handle_t knet_h, int sock, uint64_t flags, con
 		goto exit_error;
 	}
 
-	if (_configure_sockbuf(knet_h, sock, SO_RCVBUF, SO_RCVBUFFORCE, KNET_RING_RCVBUFF)) {
+	if (_configure_sockbuf(knet_h, sock, SO_RCVBUF, SO_RCVBUFFORCE, sockbuf)) {
 		savederrno = errno;
 		err = -1;
 		log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to set %s receive buffer: %s",
@@ -191,7 +302,7 @@ int _configure_common_socket(knet_handle_t knet_h, int sock, uint64_t flags, con
 		goto exit_error;
 	}
 
-	if (_configure_sockbuf(knet_h, sock, SO_SNDBUF, SO_SNDBUFFORCE, KNET_RING_RCVBUFF)) {
+	if (_configure_sockbuf(knet_h, sock, SO_SNDBUF, SO_SNDBUFFORCE, sockbuf)) {
 		savederrno = errno;
 		err = -1;
 		log_err(knet_h, KNET_SUB_TRANSPORT, "Unable to set %s send buffer: %s",
@@ -230,6 +341,14 @@ int _configure_common_socket(knet_handle_t knet_h, int sock, uint64_t flags, con
 #endif
 	}
 
+	if (flags & KNET_LINK_FLAG_BUSYPOLL) {
+		if (_configure_link_busypoll(knet_h, sock, type) < 0) {
+			savederrno = errno;
+			err = -1;
+			goto exit_error;
+		}
+	}
+
 exit_error:
 	errno = savederrno;
 	return err;
@@ -401,6 +520,7 @@ void _close_socketpair(knet_handle_t knet_h, int *sock)
  */
 int _is_valid_fd(knet_handle_t knet_h, int sockfd)
 {
+	struct knet_fd_trackers *tracker;
 	int ret = 0;
 
 	if (sockfd < 0) {
@@ -413,7 +533,8 @@ int _is_valid_fd(knet_handle_t knet_h, int sockfd)
 		return -1;
 	}
 
-	if (knet_h->knet_transport_fd_tracker[sockfd].transport >= KNET_MAX_TRANSPORTS) {
+	tracker = _get_fd_tracker(knet_h, sockfd);
+	if ((!tracker) || (tracker->transport >= KNET_MAX_TRANSPORTS)) {
 		ret = 0;
 	} else {
 		ret = 1;
@@ -422,12 +543,52 @@ int _is_valid_fd(knet_handle_t knet_h, int sockfd)
 	return ret;
 }
 
+/*
+ * chunks are published with an atomic store and never released
+ * before knet_handle_free, so readers (RX thread) can look up
+ * fds without locking while a new chunk is added
+ */
+static struct knet_fd_trackers *_alloc_fd_tracker(knet_handle_t knet_h, int sockfd)
+{
+	struct knet_fd_trackers *chunk, *expected = NULL;
+	int i;
+
+	chunk = malloc(sizeof(struct knet_fd_trackers) * KNET_FD_TRACKER_CHUNK_SIZE);
+	if (!chunk) {
+		return NULL;
+	}
+
+	memset(chunk, 0, sizeof(struct knet_fd_trackers) * KNET_FD_TRACKER_CHUNK_SIZE);
+	for (i = 0; i < KNET_FD_TRACKER_CHUNK_SIZE; i++) {
+		chunk[i].transport = KNET_MAX_TRANSPORTS;
+	}
+
+	if (!__atomic_compare_exchange_n(&knet_h->knet_transport_fd_tracker[sockfd >> KNET_FD_TRACKER_CHUNK_BITS],
+					 &expected, chunk, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		free(chunk);
+	}
+
+	return _get_fd_tracker(knet_h, sockfd);
+}
+
+void _free_fd_trackers(knet_handle_t knet_h)
+{
+	int i;
+
+	for (i = 0; i < KNET_FD_TRACKER_CHUNKS; i++) {
+		free(knet_h->knet_transport_fd_tracker[i]);
+		knet_h->knet_transport_fd_tracker[i] = NULL;
+	}
+}
+
 /*
  * must be called with global write lock
  */
 
 int _set_fd_tracker(knet_handle_t knet_h, int sockfd, uint8_t transport, uint8_t data_type, void *data)
 {
+	struct knet_fd_trackers *tracker;
+
 	if (sockfd < 0) {
 		errno = EINVAL;
 		return -1;
@@ -438,9 +599,26 @@ int _set_fd_tracker(knet_handle_t knet_h, int sockfd, uint8_t transport, uint8_t
 		return -1;
 	}
 
-	knet_h->knet_transport_fd_tracker[sockfd].transport = transport;
-	knet_h->knet_transport_fd_tracker[sockfd].data_type = data_type;
-	knet_h->knet_transport_fd_tracker[sockfd].data = data;
+	tracker = _get_fd_tracker(knet_h, sockfd);
+	if (!tracker) {
+		/*
+		 * nothing to clear
+		 */
+		if (transport == KNET_MAX_TRANSPORTS) {
+			return 0;
+		}
+		tracker = _alloc_fd_tracker(knet_h, sockfd);
+		if (!tracker) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	tracker->transport = transport;
+	tracker->data_type = data_type;
+	tracker->data = data;
+	tracker->rx_kernel_drops_last = 0;
+	tracker->rx_kernel_drops_pending = 0;
 
 	return 0;
 }
@@ -11,11 +11,14 @@
 
 int _configure_common_socket(knet_handle_t knet_h, int sock, uint64_t flags, const char *type);
 int _configure_transport_socket(knet_handle_t knet_h, int sock, struct sockaddr_storage *address, uint64_t flags, const char *type);
+int _configure_link_sockbuf(knet_handle_t knet_h, int sock, int target);
+int _configure_link_busypoll(knet_handle_t knet_h, int sock, const char *type);
 
 int _init_socketpair(knet_handle_t knet_h, int *sock);
 void _close_socketpair(knet_handle_t knet_h, int *sock);
 
 int _set_fd_tracker(knet_handle_t knet_h, int sockfd, uint8_t transport, uint8_t data_type, void *data);
+void _free_fd_trackers(knet_handle_t knet_h);
 int _is_valid_fd(knet_handle_t knet_h, int sockfd);
 
 int _sendmmsg(int sockfd, int connection_oriented, struct knet_mmsghdr *msgvec, unsigned int vlen, unsigned int flags);
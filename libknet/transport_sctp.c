@@ -25,6 +25,7 @@
 #include "logging.h"
 #include "netutils.h"
 #include "common.h"
+#include "epoch.h"
 #include "transport_common.h"
 #include "transports.h"
 #include "threads_common.h"
@@ -299,6 +300,24 @@ static void _lock_sleep_relock(knet_handle_t knet_h)
 {
 	int i = 0;
 
+	/*
+	 * data path threads are in an epoch read section,
+	 * everybody else holds the global read lock
+	 */
+	switch (epoch_read_sleep(knet_h, knet_h->threads_timer_res / 16)) {
+		case 1:
+			return;
+		case -1:
+			/*
+			 * same as below, we cannot re-enter
+			 * the read section
+			 */
+			assert(0);
+			break;
+		default:
+			break;
+	}
+
 	/* Don't hold onto the lock while sleeping */
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
@@ -321,14 +340,42 @@ static void _lock_sleep_relock(knet_handle_t knet_h)
 	assert(0);
 }
 
+/*
+ * sockets can be closed and their tracker cleared by the connect
+ * and listen threads between an event and the time it is processed.
+ * Returns NULL and sets errno to EINVAL if sockfd is not (anymore)
+ * a SCTP socket with link info attached.
+ */
+static struct knet_fd_trackers *_sctp_get_fd_tracker(knet_handle_t knet_h, int sockfd)
+{
+	struct knet_fd_trackers *tracker = _get_fd_tracker(knet_h, sockfd);
+
+	if ((!tracker) ||
+	    (tracker->transport != KNET_TRANSPORT_SCTP) ||
+	    (!tracker->data)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return tracker;
+}
+
 int sctp_transport_tx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err, int recv_errno)
 {
-	sctp_connect_link_info_t *connect_info = knet_h->knet_transport_fd_tracker[sockfd].data;
-	sctp_accepted_link_info_t *accepted_info = knet_h->knet_transport_fd_tracker[sockfd].data;
+	struct knet_fd_trackers *tracker = _sctp_get_fd_tracker(knet_h, sockfd);
+	sctp_connect_link_info_t *connect_info;
+	sctp_accepted_link_info_t *accepted_info;
 	sctp_listen_link_info_t *listen_info;
 
+	if (!tracker) {
+		return -1;
+	}
+
+	connect_info = tracker->data;
+	accepted_info = tracker->data;
+
 	if (recv_err < 0) {
-		switch (knet_h->knet_transport_fd_tracker[sockfd].data_type) {
+		switch (tracker->data_type) {
 			case SCTP_CONNECT_LINK_INFO:
 				if (connect_info->link->transport_connected == 0) {
 					return -1;
@@ -380,11 +427,19 @@ int sctp_transport_tx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err,
 int sctp_transport_rx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err, int recv_errno)
 {
 	struct epoll_event ev;
-	sctp_accepted_link_info_t *accepted_info = knet_h->knet_transport_fd_tracker[sockfd].data;
+	struct knet_fd_trackers *tracker = _sctp_get_fd_tracker(knet_h, sockfd);
+	sctp_accepted_link_info_t *accepted_info;
 	sctp_listen_link_info_t *listen_info;
 	sctp_handle_info_t *handle_info = knet_h->transports[KNET_TRANSPORT_SCTP];
 
-	switch (knet_h->knet_transport_fd_tracker[sockfd].data_type) {
+	if (!tracker) {
+		log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "Received error for untracked socket %d", sockfd);
+		return -1;
+	}
+
+	accepted_info = tracker->data;
+
+	switch (tracker->data_type) {
 		case SCTP_CONNECT_LINK_INFO:
 			/*
 			 * all connect link have notifications enabled
@@ -453,8 +508,16 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 	size_t iovlen = msg->msg_hdr.msg_iovlen;
 	struct sctp_assoc_change *sac;
 	union sctp_notification  *snp;
-	sctp_accepted_link_info_t *listen_info = knet_h->knet_transport_fd_tracker[sockfd].data;
-	sctp_connect_link_info_t *connect_info = knet_h->knet_transport_fd_tracker[sockfd].data;
+	struct knet_fd_trackers *tracker = _sctp_get_fd_tracker(knet_h, sockfd);
+	sctp_accepted_link_info_t *listen_info;
+	sctp_connect_link_info_t *connect_info;
+
+	if (!tracker) {
+		return KNET_TRANSPORT_RX_NOT_DATA_STOP;
+	}
+
+	listen_info = tracker->data;
+	connect_info = tracker->data;
 
 	if (!(msg->msg_hdr.msg_flags & MSG_NOTIFICATION)) {
 		if (msg->msg_len == 0) {
@@ -466,7 +529,7 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 			 * the event handler should take care to avoid #2 by stopping
 			 * the rx thread from processing more packets than necessary.
 			 */
-			if (knet_h->knet_transport_fd_tracker[sockfd].data_type == SCTP_CONNECT_LINK_INFO) {
+			if (tracker->data_type == SCTP_CONNECT_LINK_INFO) {
 				if (connect_info->sock_shutdown) {
 					return KNET_TRANSPORT_RX_OOB_DATA_CONTINUE;
 				}
@@ -531,7 +594,7 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 				switch (sac->sac_state) {
 					case SCTP_COMM_LOST:
 						log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "[event] sctp assoc change socket %d: comm_lost", sockfd);
-						if (knet_h->knet_transport_fd_tracker[sockfd].data_type == SCTP_CONNECT_LINK_INFO) {
+						if (tracker->data_type == SCTP_CONNECT_LINK_INFO) {
 							connect_info->close_sock = 1;
 							connect_info->link->transport_connected = 0;
 						}
@@ -540,7 +603,7 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 						break;
 					case SCTP_COMM_UP:
 						log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "[event] sctp assoc change socket %d: comm_up", sockfd);
-						if (knet_h->knet_transport_fd_tracker[sockfd].data_type == SCTP_CONNECT_LINK_INFO) {
+						if (tracker->data_type == SCTP_CONNECT_LINK_INFO) {
 							connect_info->link->transport_connected = 1;
 						}
 						break;
@@ -549,7 +612,7 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 						break;
 					case SCTP_SHUTDOWN_COMP:
 						log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "[event] sctp assoc change socket %d: shutdown comp", sockfd);
-						if (knet_h->knet_transport_fd_tracker[sockfd].data_type == SCTP_CONNECT_LINK_INFO) {
+						if (tracker->data_type == SCTP_CONNECT_LINK_INFO) {
 							connect_info->close_sock = 1;
 						}
 						sctp_transport_rx_sock_error(knet_h, sockfd, 2, 0);
@@ -566,7 +629,7 @@ int sctp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsg
 				break;
 			case SCTP_SHUTDOWN_EVENT:
 				log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "[event] sctp shutdown event socket %d", sockfd);
-				if (knet_h->knet_transport_fd_tracker[sockfd].data_type == SCTP_CONNECT_LINK_INFO) {
+				if (tracker->data_type == SCTP_CONNECT_LINK_INFO) {
 					connect_info->link->transport_connected = 0;
 					connect_info->sock_shutdown = 1;
 				} else {
@@ -618,8 +681,17 @@ static void _handle_connected_sctp_socket(knet_handle_t knet_h, int connect_sock
 {
 	int err;
 	unsigned int status, len = sizeof(status);
-	sctp_connect_link_info_t *info = knet_h->knet_transport_fd_tracker[connect_sock].data;
-	struct knet_link *kn_link = info->link;
+	struct knet_fd_trackers *tracker = _sctp_get_fd_tracker(knet_h, connect_sock);
+	sctp_connect_link_info_t *info;
+	struct knet_link *kn_link;
+
+	if (!tracker) {
+		log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "Received stray notification for connect socket %d", connect_sock);
+		return;
+	}
+
+	info = tracker->data;
+	kn_link = info->link;
 
 	if (info->close_sock) {
 		if (_close_connect_socket(knet_h, kn_link) < 0) {
@@ -765,7 +837,8 @@ static void _handle_incoming_sctp(knet_handle_t knet_h, int listen_sock)
 	int err = 0, savederrno = 0;
 	int new_fd;
 	int i = -1;
-	sctp_listen_link_info_t *info = knet_h->knet_transport_fd_tracker[listen_sock].data;
+	struct knet_fd_trackers *tracker = _sctp_get_fd_tracker(knet_h, listen_sock);
+	sctp_listen_link_info_t *info;
 	struct epoll_event ev;
 	struct sockaddr_storage ss;
 	socklen_t sock_len = sizeof(ss);
@@ -773,6 +846,13 @@ static void _handle_incoming_sctp(knet_handle_t knet_h, int listen_sock)
 	char port_str[KNET_MAX_PORT_LEN];
 	sctp_accepted_link_info_t *accept_info = NULL;
 
+	if (!tracker) {
+		log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "Received stray notification for listen socket %d", listen_sock);
+		return;
+	}
+
+	info = tracker->data;
+
 	new_fd = accept(listen_sock, (struct sockaddr *)&ss, &sock_len);
 	if (new_fd < 0) {
 		savederrno = errno;
@@ -887,6 +967,7 @@ static void _handle_listen_sctp_errors(knet_handle_t knet_h)
 {
 	int sockfd = -1;
 	sctp_handle_info_t *handle_info = knet_h->transports[KNET_TRANSPORT_SCTP];
+	struct knet_fd_trackers *tracker;
 	sctp_accepted_link_info_t *accept_info;
 	sctp_listen_link_info_t *info;
 	struct knet_host *host;
@@ -912,7 +993,13 @@ static void _handle_listen_sctp_errors(knet_handle_t knet_h)
 
 	log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "Processing listen error on socket: %d", sockfd);
 
-	accept_info = knet_h->knet_transport_fd_tracker[sockfd].data;
+	tracker = _sctp_get_fd_tracker(knet_h, sockfd);
+	if (!tracker) {
+		log_debug(knet_h, KNET_SUB_TRANSP_SCTP, "Received stray notification for listen socket fd error");
+		return;
+	}
+
+	accept_info = tracker->data;
 	info = accept_info->link_info;
 
 	/*
@@ -1131,6 +1218,7 @@ static int sctp_link_listener_stop(knet_handle_t knet_h, struct knet_link *kn_li
 	sctp_connect_link_info_t *this_link_info = kn_link->transport_link;
 	sctp_listen_link_info_t *info = this_link_info->listener;
 	sctp_connect_link_info_t *link_info;
+	struct knet_fd_trackers *tracker;
 	struct epoll_event ev;
 
 	for (host = knet_h->host_head; host != NULL; host = host->next) {
@@ -1196,7 +1284,10 @@ static int sctp_link_listener_stop(knet_handle_t knet_h, struct knet_link *kn_li
 					strerror(errno));
 			}
 			info->on_rx_epoll = 0;
-			free(knet_h->knet_transport_fd_tracker[info->accepted_socks[i]].data);
+			tracker = _get_fd_tracker(knet_h, info->accepted_socks[i]);
+			if (tracker) {
+				free(tracker->data);
+			}
 			close(info->accepted_socks[i]);
 			if (_set_fd_tracker(knet_h, info->accepted_socks[i], KNET_MAX_TRANSPORTS, SCTP_NO_LINK_INFO, NULL) < 0) {
 				savederrno = errno;
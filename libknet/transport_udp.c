@@ -17,6 +17,7 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/udp.h>
 #if defined (IP_RECVERR) || defined (IPV6_RECVERR)
 #include <linux/errqueue.h>
 #endif
@@ -42,8 +43,18 @@ typedef struct udp_link_info {
 	struct sockaddr_storage local_address;
 	int socket_fd;
 	int on_epoll;
+	int gso;		/* UDP_SEGMENT can be used on this socket */
 } udp_link_info_t;
 
+/*
+ * UDP GSO limits: the kernel splits at most UDP_MAX_SEGMENTS
+ * segments per send and the whole train must fit in a
+ * single (max size) UDP datagram.
+ */
+#define KNET_UDP_GSO_MAX_SEGS 64
+#define KNET_UDP_GSO_MAX_LEN  65507
+#define KNET_UDP_GSO_MAX_IOV  (KNET_UDP_GSO_MAX_SEGS * 3)
+
 int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_link)
 {
 	int err = 0, savederrno = 0;
@@ -51,9 +62,12 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 	struct epoll_event ev;
 	udp_link_info_t *info;
 	udp_handle_info_t *handle_info = knet_h->transports[KNET_TRANSPORT_UDP];
-#if defined (IP_RECVERR) || defined (IPV6_RECVERR)
+#if defined (IP_RECVERR) || defined (IPV6_RECVERR) || defined (SO_RXQ_OVFL) || defined (UDP_SEGMENT) || defined (UDP_GRO)
 	int value;
 #endif
+#ifdef UDP_SEGMENT
+	socklen_t value_len;
+#endif
 
 	/*
 	 * Only allocate a new link if the local address is different
@@ -61,6 +75,18 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 	qb_list_for_each_entry(info, &handle_info->links_list, list) {
 		if (memcmp(&info->local_address, &kn_link->src_addr, sizeof(struct sockaddr_storage)) == 0) {
 			log_debug(knet_h, KNET_SUB_TRANSP_UDP, "Re-using existing UDP socket for new link");
+			/*
+			 * the socket was configured for the link that created it,
+			 * apply what this link needs on top (sockbufs only grow)
+			 */
+			if ((!(kn_link->flags & KNET_LINK_FLAG_SOCKBUF_AUTO)) &&
+			    (_configure_link_sockbuf(knet_h, info->socket_fd, KNET_RING_RCVBUFF) < 0)) {
+				return -1;
+			}
+			if ((kn_link->flags & KNET_LINK_FLAG_BUSYPOLL) &&
+			    (_configure_link_busypoll(knet_h, info->socket_fd, "UDP") < 0)) {
+				return -1;
+			}
 			kn_link->outsock = info->socket_fd;
 			kn_link->transport_link = info;
 			kn_link->transport_connected = 1;
@@ -120,6 +146,49 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 #else
 	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "IPV6_RECVERR not available in this build/platform");
 #endif
+#ifdef SO_RXQ_OVFL
+	/*
+	 * report drops due to full receive buffer, see rx_kernel_drops
+	 */
+	value = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &value, sizeof(value)) <0) {
+		savederrno = errno;
+		err = -1;
+		log_err(knet_h, KNET_SUB_TRANSP_UDP, "Unable to set RXQ_OVFL on socket: %s",
+			strerror(savederrno));
+		goto exit_error;
+	}
+	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "SO_RXQ_OVFL enabled on socket: %i", sock);
+#else
+	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "SO_RXQ_OVFL not available in this build/platform");
+#endif
+#ifdef UDP_SEGMENT
+	/*
+	 * GSO is optional, older kernels do not know about UDP_SEGMENT
+	 */
+	value_len = sizeof(value);
+	if (getsockopt(sock, SOL_UDP, UDP_SEGMENT, &value, &value_len) == 0) {
+		info->gso = 1;
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_SEGMENT available on socket: %i", sock);
+	} else {
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_SEGMENT not supported by the running kernel");
+	}
+#else
+	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_SEGMENT not available in this build/platform");
+#endif
+#ifdef UDP_GRO
+	/*
+	 * coalesced packets are split again by the RX thread
+	 */
+	value = 1;
+	if (setsockopt(sock, SOL_UDP, UDP_GRO, &value, sizeof(value)) < 0) {
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_GRO not supported by the running kernel");
+	} else {
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_GRO enabled on socket: %i", sock);
+	}
+#else
+	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_GRO not available in this build/platform");
+#endif
 
 	if (bind(sock, (struct sockaddr *)&kn_link->src_addr, sockaddr_len(&kn_link->src_addr))) {
 		savederrno = errno;
@@ -129,6 +198,18 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 		goto exit_error;
 	}
 
+	/*
+	 * RX is not stopped while links are configured, the fd tracker
+	 * has to be in place before the socket is added to epoll
+	 */
+	if (_set_fd_tracker(knet_h, sock, KNET_TRANSPORT_UDP, 0, info) < 0) {
+		savederrno = errno;
+		err = -1;
+		log_err(knet_h, KNET_SUB_TRANSP_UDP, "Unable to set fd tracker: %s",
+			strerror(savederrno));
+		goto exit_error;
+	}
+
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
 	ev.data.fd = sock;
@@ -138,19 +219,12 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 		err = -1;
 		log_err(knet_h, KNET_SUB_TRANSP_UDP, "Unable to add listener to epoll pool: %s",
 			strerror(savederrno));
+		_set_fd_tracker(knet_h, sock, KNET_MAX_TRANSPORTS, 0, NULL);
 		goto exit_error;
 	}
 
 	info->on_epoll = 1;
 
-	if (_set_fd_tracker(knet_h, sock, KNET_TRANSPORT_UDP, 0, info) < 0) {
-		savederrno = errno;
-		err = -1;
-		log_err(knet_h, KNET_SUB_TRANSP_UDP, "Unable to set fd tracker: %s",
-			strerror(savederrno));
-		goto exit_error;
-	}
-
 	memmove(&info->local_address, &kn_link->src_addr, sizeof(struct sockaddr_storage));
 	info->socket_fd = sock;
 	qb_list_add(&info->list, &handle_info->links_list);
@@ -285,6 +359,36 @@ int udp_transport_init(knet_handle_t knet_h)
 }
 
 #if defined (IP_RECVERR) || defined (IPV6_RECVERR)
+/*
+ * the socket is shared by all links with the same source address,
+ * flag only the link(s) the failed packet was sent to. The TX path
+ * demotes a flagged link on the next unreachable send error.
+ */
+static void udp_transport_link_unreachable(knet_handle_t knet_h, int sockfd, struct sockaddr_storage *remote, socklen_t remote_len)
+{
+	struct knet_host *host;
+	struct knet_link *link;
+	int link_idx;
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
+			link = &host->link[link_idx];
+			if ((!__atomic_load_n(&link->configured, __ATOMIC_ACQUIRE)) ||
+			    (link->transport != KNET_TRANSPORT_UDP) ||
+			    (link->outsock != sockfd)) {
+				continue;
+			}
+			if (!cmpaddr(remote, remote_len, &link->dst_addr, sockaddr_len(&link->dst_addr))) {
+				uint8_t expected = KNET_LINK_TX_REACHABLE;
+
+				__atomic_compare_exchange_n(&link->tx_unreachable, &expected,
+							    KNET_LINK_TX_UNREACHABLE_ERRQUEUE, 0,
+							    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			}
+		}
+	}
+}
+
 static int read_errs_from_sock(knet_handle_t knet_h, int sockfd)
 {
 	int err = 0, savederrno = 0;
@@ -351,6 +455,11 @@ static int read_errs_from_sock(knet_handle_t knet_h, int sockfd)
 							break;
 						case SO_EE_ORIGIN_ICMP:  /* ICMP */
 						case SO_EE_ORIGIN_ICMP6: /* ICMP6 */
+							if (((sock_err->ee_errno == EHOSTUNREACH) ||
+							     (sock_err->ee_errno == ENETUNREACH)) &&
+							    (msg.msg_namelen)) {
+								udp_transport_link_unreachable(knet_h, sockfd, &remote, msg.msg_namelen);
+							}
 							origin = (struct sockaddr_storage *)(void *)SO_EE_OFFENDER(sock_err);
 							if (knet_addrtostr(origin, sizeof(*origin),
 									   addr_str, KNET_MAX_HOST_LEN,
@@ -420,6 +529,160 @@ int udp_transport_tx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err,
 	return 0;
 }
 
+#ifdef UDP_SEGMENT
+static size_t _msg_len(const struct msghdr *msg)
+{
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i < (size_t)msg->msg_iovlen; i++) {
+		len += msg->msg_iov[i].iov_len;
+	}
+
+	return len;
+}
+
+/*
+ * find how many packets, starting from msgvec[0], can be sent
+ * as one GSO train: same destination, same size, except for the
+ * last one that can be shorter (ex: last fragment of a message)
+ */
+static unsigned int _gso_train_len(struct knet_mmsghdr *msgvec, unsigned int vlen, size_t *seg_size)
+{
+	size_t len, total, iovcnt;
+	unsigned int i;
+
+	*seg_size = _msg_len(&msgvec[0].msg_hdr);
+	total = *seg_size;
+	iovcnt = msgvec[0].msg_hdr.msg_iovlen;
+
+	for (i = 1; (i < vlen) && (i < KNET_UDP_GSO_MAX_SEGS); i++) {
+		if ((msgvec[i].msg_hdr.msg_namelen != msgvec[0].msg_hdr.msg_namelen) ||
+		    ((msgvec[i].msg_hdr.msg_name != msgvec[0].msg_hdr.msg_name) &&
+		     (memcmp(msgvec[i].msg_hdr.msg_name, msgvec[0].msg_hdr.msg_name, msgvec[0].msg_hdr.msg_namelen)))) {
+			break;
+		}
+
+		len = _msg_len(&msgvec[i].msg_hdr);
+		if ((len > *seg_size) ||
+		    (total + len > KNET_UDP_GSO_MAX_LEN) ||
+		    (iovcnt + msgvec[i].msg_hdr.msg_iovlen > KNET_UDP_GSO_MAX_IOV)) {
+			break;
+		}
+
+		total += len;
+		iovcnt += msgvec[i].msg_hdr.msg_iovlen;
+
+		if (len < *seg_size) {
+			i++;
+			break;
+		}
+	}
+
+	return i;
+}
+
+static int _gso_sendmsg(int sockfd, struct knet_mmsghdr *msgvec, unsigned int train, size_t seg_size, unsigned int flags)
+{
+	struct iovec iov[KNET_UDP_GSO_MAX_IOV];
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	uint16_t gso_size = seg_size;
+	size_t iovcnt = 0, j;
+	unsigned int i;
+
+	for (i = 0; i < train; i++) {
+		for (j = 0; j < (size_t)msgvec[i].msg_hdr.msg_iovlen; j++) {
+			iov[iovcnt++] = msgvec[i].msg_hdr.msg_iov[j];
+		}
+	}
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&control, 0, sizeof(control));
+	msg.msg_name = msgvec[0].msg_hdr.msg_name;
+	msg.msg_namelen = msgvec[0].msg_hdr.msg_namelen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	memmove(CMSG_DATA(cmsg), &gso_size, sizeof(uint16_t));
+
+	return sendmsg(sockfd, &msg, flags);
+}
+#endif
+
+/*
+ * send trains of same sized packets (fragments of the same message)
+ * with one sendmsg using UDP GSO. Falls back to one sendmsg per
+ * packet if GSO is not available.
+ */
+int udp_transport_tx_sendmmsg(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msgvec, unsigned int vlen, unsigned int flags)
+{
+#ifdef UDP_SEGMENT
+	int savederrno = 0, err = 0;
+	struct knet_fd_trackers *tracker;
+	udp_link_info_t *info = NULL;
+	unsigned int i = 0, train;
+	size_t seg_size;
+
+	tracker = _get_fd_tracker(knet_h, sockfd);
+	if ((tracker) && (tracker->transport == KNET_TRANSPORT_UDP)) {
+		info = tracker->data;
+	}
+
+	if ((!info) || (!__atomic_load_n(&info->gso, __ATOMIC_RELAXED)) || (vlen < 2)) {
+		return _sendmmsg(sockfd, TRANSPORT_PROTO_NOT_CONNECTION_ORIENTED, msgvec, vlen, flags);
+	}
+
+	while (i < vlen) {
+		train = _gso_train_len(&msgvec[i], vlen - i, &seg_size);
+		if (train < 2) {
+			err = _sendmmsg(sockfd, TRANSPORT_PROTO_NOT_CONNECTION_ORIENTED, &msgvec[i], 1, flags);
+		} else {
+			err = _gso_sendmsg(sockfd, &msgvec[i], train, seg_size, flags);
+			/*
+			 * EIO: the device cannot do checksum offloading
+			 * EINVAL: the train does not fit the path (ex: segment > MTU)
+			 */
+			if ((err < 0) && ((errno == EIO) || (errno == EINVAL))) {
+				log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP GSO send failed on socket %i: %s. Disabling GSO",
+					  sockfd, strerror(errno));
+				__atomic_store_n(&info->gso, 0, __ATOMIC_RELAXED);
+				err = _sendmmsg(sockfd, TRANSPORT_PROTO_NOT_CONNECTION_ORIENTED, &msgvec[i], vlen - i, flags);
+				savederrno = errno;
+				if (err > 0) {
+					i += err;
+				}
+				break;
+			}
+			if (err >= 0) {
+				__atomic_add_fetch(&knet_h->stats_extra.tx_udp_gso_trains, 1, __ATOMIC_RELAXED);
+				err = train;
+			}
+		}
+		savederrno = errno;
+		if (err < 0) {
+			break;
+		}
+		i += err;
+	}
+
+	errno = savederrno;
+	return ((i > 0) ? (int)i : err);
+#else
+	return _sendmmsg(sockfd, TRANSPORT_PROTO_NOT_CONNECTION_ORIENTED, msgvec, vlen, flags);
+#endif
+}
+
 int udp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msg)
 {
 	if (msg->msg_len == 0)
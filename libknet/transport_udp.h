@@ -21,6 +21,7 @@ int udp_transport_free(knet_handle_t knet_h);
 int udp_transport_init(knet_handle_t knet_h);
 int udp_transport_rx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err, int recv_errno);
 int udp_transport_tx_sock_error(knet_handle_t knet_h, int sockfd, int recv_err, int recv_errno);
+int udp_transport_tx_sendmmsg(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msgvec, unsigned int vlen, unsigned int flags);
 int udp_transport_rx_is_data(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msg);
 int udp_transport_link_dyn_connect(knet_handle_t knet_h, int sockfd, struct knet_link *kn_link);
 int udp_transport_link_get_acl_fd(knet_handle_t knet_h, struct knet_link *kn_link);
@@ -25,6 +25,7 @@ int transport_link_dyn_connect(knet_handle_t knet_h, int sockfd, struct knet_lin
 int transport_link_get_acl_fd(knet_handle_t knet_h, struct knet_link *kn_link);
 int transport_rx_sock_error(knet_handle_t knet_h, uint8_t transport, int sockfd, int recv_err, int recv_errno);
 int transport_tx_sock_error(knet_handle_t knet_h, uint8_t transport, int sockfd, int recv_err, int recv_errno);
+int transport_tx_sendmmsg(knet_handle_t knet_h, uint8_t transport, int sockfd, struct knet_mmsghdr *msgvec, unsigned int vlen, unsigned int flags);
 int transport_rx_is_data(knet_handle_t knet_h, uint8_t transport, int sockfd, struct knet_mmsghdr *msg);
 int transport_get_proto(knet_handle_t knet_h, uint8_t transport);
 int transport_get_acl_type(knet_handle_t knet_h, uint8_t transport);
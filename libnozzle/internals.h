@@ -35,7 +35,11 @@ struct nozzle_lib_config {
 
 struct nozzle_iface {
 	char name[IFNAMSIZ];		/* interface name */
-	int fd;				/* interface fd */
+	int fd;				/* interface fd (same as queue_fds[0]) */
+	int queue_fds[NOZZLE_MAX_QUEUES]; /* per queue fds for multi queue devices */
+	uint8_t queues;			/* number of queues opened */
+	int vnet_hdr;			/* packets are prefixed by struct nozzle_vnet_hdr */
+	uint32_t offloads;		/* NOZZLE_OFFLOAD_* currently enabled */
 	int up;				/* interface status 0 is down, 1 is up */
 	/*
 	 * extra data
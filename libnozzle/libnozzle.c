@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include <limits.h>
 #include <stdio.h>
+#include <sys/uio.h>
 #include <net/if.h>
 #include <ifaddrs.h>
 #include <stdint.h>
@@ -37,6 +38,8 @@
 #endif
 #include <netinet/ether.h>
 #include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
 #include <netlink/route/addr.h>
 #include <netlink/route/link.h>
 #endif
@@ -100,10 +103,19 @@ static void destroy_iface(nozzle_t nozzle)
 #ifdef KNET_BSD
 	struct ifreq ifr;
 #endif
+	uint8_t q;
 
 	if (!nozzle)
 		return;
 
+	/*
+	 * queue_fds[0] is the same fd as nozzle->fd
+	 */
+	for (q = 1; q < nozzle->queues; q++) {
+		if (nozzle->queue_fds[q] >= 0)
+			close(nozzle->queue_fds[q]);
+	}
+
 	if (nozzle->fd >= 0)
 		close(nozzle->fd);
 
@@ -378,15 +390,129 @@ out:
 #endif
 }
 
+#ifdef KNET_LINUX
+/*
+ * limit the size of the GSO packets the kernel hands over to the
+ * device, so that vnet header + ethernet frame never exceed
+ * NOZZLE_VNET_MAX_PACKET_SIZE. The value is read back, as kernels
+ * that cannot change it on a registered device might silently ignore it.
+ */
+static int _set_gso_max_size(nozzle_t nozzle)
+{
+	uint32_t gso_max_size = NOZZLE_VNET_MAX_PACKET_SIZE - sizeof(struct nozzle_vnet_hdr) - ETHER_HDR_LEN;
+	uint32_t cur_gso_max_size = 0;
+	struct ifinfomsg ifi;
+	struct nl_msg *msg = NULL;
+	struct rtnl_link *link = NULL;
+	int ifindex, err = -1;
+
+	ifindex = if_nametoindex(nozzle->name);
+	if (!ifindex) {
+		return -1;
+	}
+
+	msg = nlmsg_alloc_simple(RTM_NEWLINK, NLM_F_REQUEST);
+	if (!msg) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memset(&ifi, 0, sizeof(struct ifinfomsg));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = ifindex;
+
+	if ((nlmsg_append(msg, &ifi, sizeof(struct ifinfomsg), NLMSG_ALIGNTO) < 0) ||
+	    (nla_put_u32(msg, IFLA_GSO_MAX_SIZE, gso_max_size) < 0)) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	if ((nl_send_auto(lib_cfg.nlsock, msg) < 0) ||
+	    (nl_wait_for_ack(lib_cfg.nlsock) < 0)) {
+		errno = EOPNOTSUPP;
+		goto out;
+	}
+
+	if ((rtnl_link_get_kernel(lib_cfg.nlsock, ifindex, NULL, &link) < 0) ||
+	    (rtnl_link_get_gso_max_size(link, &cur_gso_max_size) < 0) ||
+	    (cur_gso_max_size > gso_max_size)) {
+		errno = EOPNOTSUPP;
+		goto out;
+	}
+
+	err = 0;
+
+out:
+	if (link) {
+		rtnl_link_put(link);
+	}
+	nlmsg_free(msg);
+	return err;
+}
+
+static int _set_offload(nozzle_t nozzle, uint32_t offloads)
+{
+	unsigned int tun_offloads = 0;
+
+	/*
+	 * do not enable segmentation offloads unless
+	 * the GSO packet size can be capped
+	 */
+	if ((offloads & ~NOZZLE_OFFLOAD_CSUM) && (_set_gso_max_size(nozzle) < 0)) {
+		return -1;
+	}
+
+	if (offloads & NOZZLE_OFFLOAD_CSUM)
+		tun_offloads |= TUN_F_CSUM;
+	if (offloads & NOZZLE_OFFLOAD_TSO4)
+		tun_offloads |= TUN_F_TSO4;
+	if (offloads & NOZZLE_OFFLOAD_TSO6)
+		tun_offloads |= TUN_F_TSO6;
+	if (offloads & NOZZLE_OFFLOAD_TSO_ECN)
+		tun_offloads |= TUN_F_TSO_ECN;
+	if (offloads & NOZZLE_OFFLOAD_UFO)
+		tun_offloads |= TUN_F_UFO;
+
+	/*
+	 * offloads are a property of the device, setting them
+	 * on the first queue is enough
+	 */
+	if (ioctl(nozzle->fd, TUNSETOFFLOAD, tun_offloads) < 0) {
+		return -1;
+	}
+
+	nozzle->offloads = offloads;
+
+	return 0;
+}
+#endif
+
+static int _check_offload(uint32_t offloads)
+{
+	if (offloads & ~NOZZLE_OFFLOAD_ALL) {
+		return -1;
+	}
+
+	/*
+	 * segmentation offloads require checksum offload
+	 */
+	if ((offloads & ~NOZZLE_OFFLOAD_CSUM) && (!(offloads & NOZZLE_OFFLOAD_CSUM))) {
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * Exported public API
  */
 
-nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
+static nozzle_t _nozzle_open(char *devname, size_t devname_size, const char *updownpath, uint8_t queues, int vnet_hdr, uint32_t offloads)
 {
 	int savederrno = 0;
 	nozzle_t nozzle = NULL;
 	char *temp_mac = NULL;
+	uint8_t q;
 #ifdef KNET_LINUX
 	struct ifreq ifr;
 #endif
@@ -412,6 +538,26 @@ nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
 		return NULL;
 	}
 
+	if ((queues < 1) || (queues > NOZZLE_MAX_QUEUES)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (_check_offload(offloads) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+#ifdef KNET_BSD
+	/*
+	 * BSD tap devices have no multi queue or vnet header support
+	 */
+	if ((queues > 1) || (vnet_hdr)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+#endif
+
 #ifdef KNET_BSD
 	/*
 	 * BSD does not support named devices like Linux
@@ -486,6 +632,10 @@ nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
 
 	memset(nozzle, 0, sizeof(struct nozzle_iface));
 
+	for (q = 0; q < NOZZLE_MAX_QUEUES; q++) {
+		nozzle->queue_fds[q] = -1;
+	}
+
 #ifdef KNET_BSD
 	if (!strlen(devname)) {
 		/*
@@ -523,6 +673,8 @@ nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
 		savederrno = EBUSY;
 		goto out_error;
 	}
+	nozzle->queue_fds[0] = nozzle->fd;
+	nozzle->queues = 1;
 	memmove(devname, curnozzle, IFNAMSIZ);
 	memmove(nozzle->name, curnozzle, IFNAMSIZ);
 #endif
@@ -533,12 +685,36 @@ nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
 		goto out_error;
 	}
 
+	nozzle->queue_fds[0] = nozzle->fd;
+	nozzle->queues = 1;
+
 	memset(&ifr, 0, sizeof(struct ifreq));
 	memmove(ifname, devname, IFNAMSIZ);
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (queues > 1) {
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	}
+	if (vnet_hdr) {
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	}
 
 	if (ioctl(nozzle->fd, TUNSETIFF, &ifr) < 0) {
 		savederrno = errno;
+		/*
+		 * kernels without multi queue or vnet header support
+		 * reject the unknown flags with EINVAL. Report it as
+		 * EOPNOTSUPP so that callers can fall back to nozzle_open.
+		 * EINVAL is also returned when the flags do not match
+		 * an existing device, that is a configuration error.
+		 */
+		if ((savederrno == EINVAL) && (ifr.ifr_flags & (IFF_MULTI_QUEUE | IFF_VNET_HDR))) {
+			unsigned int features = 0;
+
+			if ((ioctl(nozzle->fd, TUNGETFEATURES, &features) < 0) ||
+			    ((ifr.ifr_flags & (IFF_MULTI_QUEUE | IFF_VNET_HDR)) & ~features)) {
+				savederrno = EOPNOTSUPP;
+			}
+		}
 		goto out_error;
 	}
 
@@ -549,6 +725,31 @@ nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
 
 	memmove(devname, ifname, IFNAMSIZ);
 	memmove(nozzle->name, ifname, IFNAMSIZ);
+
+	/*
+	 * attach the extra queues to the device we just created.
+	 * ifr still contains the kernel assigned name and flags.
+	 */
+	for (q = 1; q < queues; q++) {
+		if ((nozzle->queue_fds[q] = open("/dev/net/tun", O_RDWR)) < 0) {
+			savederrno = errno;
+			goto out_error;
+		}
+		nozzle->queues++;
+
+		if (ioctl(nozzle->queue_fds[q], TUNSETIFF, &ifr) < 0) {
+			savederrno = errno;
+			goto out_error;
+		}
+	}
+
+	if (vnet_hdr) {
+		nozzle->vnet_hdr = 1;
+		if (_set_offload(nozzle, offloads) < 0) {
+			savederrno = errno;
+			goto out_error;
+		}
+	}
 #endif
 
 	nozzle->default_mtu = get_iface_mtu(nozzle);
@@ -589,6 +790,21 @@ out_error:
 	return NULL;
 }
 
+nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath)
+{
+	return _nozzle_open(devname, devname_size, updownpath, 1, 0, 0);
+}
+
+nozzle_t nozzle_open_mq(char *devname, size_t devname_size, const char *updownpath, uint8_t queues)
+{
+	return _nozzle_open(devname, devname_size, updownpath, queues, 0, 0);
+}
+
+nozzle_t nozzle_open_vnet(char *devname, size_t devname_size, const char *updownpath, uint8_t queues, uint32_t offloads)
+{
+	return _nozzle_open(devname, devname_size, updownpath, queues, 1, offloads);
+}
+
 int nozzle_close(nozzle_t nozzle)
 {
 	int err = 0, savederrno = 0;
@@ -995,6 +1211,143 @@ out_clean:
 	return fd;
 }
 
+int nozzle_get_queue_fds(const nozzle_t nozzle, int *fds, size_t *fds_entries)
+{
+	int err = 0, savederrno = 0;
+	uint8_t q;
+
+	if ((!fds) || (!fds_entries)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_lock(&config_mutex);
+	if (savederrno) {
+		errno = savederrno;
+		return -1;
+	}
+
+	if (!is_valid_nozzle(nozzle)) {
+		savederrno = ENOENT;
+		err = -1;
+		goto out_clean;
+	}
+
+	for (q = 0; q < nozzle->queues; q++) {
+		fds[q] = nozzle->queue_fds[q];
+	}
+	*fds_entries = nozzle->queues;
+
+out_clean:
+	pthread_mutex_unlock(&config_mutex);
+	errno = savederrno;
+	return err;
+}
+
+int nozzle_set_offload(nozzle_t nozzle, uint32_t offloads)
+{
+	int err = 0, savederrno = 0;
+
+	if (_check_offload(offloads) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_lock(&config_mutex);
+	if (savederrno) {
+		errno = savederrno;
+		return -1;
+	}
+
+	if (!is_valid_nozzle(nozzle)) {
+		savederrno = ENOENT;
+		err = -1;
+		goto out_clean;
+	}
+
+	if (!nozzle->vnet_hdr) {
+		savederrno = EINVAL;
+		err = -1;
+		goto out_clean;
+	}
+
+#ifdef KNET_LINUX
+	err = _set_offload(nozzle, offloads);
+	savederrno = errno;
+#endif
+#ifdef KNET_BSD
+	savederrno = EOPNOTSUPP;
+	err = -1;
+#endif
+
+out_clean:
+	pthread_mutex_unlock(&config_mutex);
+	errno = savederrno;
+	return err;
+}
+
+/*
+ * read/write vnet are data path functions and do not take config_mutex.
+ * it is the application responsibility to not call them while
+ * closing the nozzle device.
+ */
+
+ssize_t nozzle_read_vnet(const nozzle_t nozzle, uint8_t queue, struct nozzle_vnet_hdr *hdr, void *buf, size_t len)
+{
+	struct iovec iov[2];
+	ssize_t err;
+
+	if ((!nozzle) || (!hdr) || (!buf) || (queue >= nozzle->queues) || (!nozzle->vnet_hdr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(struct nozzle_vnet_hdr);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+
+	err = readv(nozzle->queue_fds[queue], iov, 2);
+	if (err < 0) {
+		return err;
+	}
+
+	if (err < (ssize_t)sizeof(struct nozzle_vnet_hdr)) {
+		errno = EIO;
+		return -1;
+	}
+
+	return err - sizeof(struct nozzle_vnet_hdr);
+}
+
+ssize_t nozzle_write_vnet(const nozzle_t nozzle, uint8_t queue, const struct nozzle_vnet_hdr *hdr, const void *buf, size_t len)
+{
+	struct iovec iov[2];
+	ssize_t err;
+
+	if ((!nozzle) || (!hdr) || (!buf) || (queue >= nozzle->queues) || (!nozzle->vnet_hdr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len = sizeof(struct nozzle_vnet_hdr);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+
+	err = writev(nozzle->queue_fds[queue], iov, 2);
+	if (err < 0) {
+		return err;
+	}
+
+	if (err < (ssize_t)sizeof(struct nozzle_vnet_hdr)) {
+		errno = EIO;
+		return -1;
+	}
+
+	return err - sizeof(struct nozzle_vnet_hdr);
+}
+
 int nozzle_set_mtu(nozzle_t nozzle, const int mtu)
 {
 	int err = 0, savederrno = 0;
@@ -10,6 +10,7 @@
 #define __LIBNOZZLE_H__
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <net/if.h>
 
 /**
@@ -54,6 +55,105 @@ typedef struct nozzle_iface *nozzle_t;
 
 nozzle_t nozzle_open(char *devname, size_t devname_size, const char *updownpath);
 
+#define NOZZLE_MAX_QUEUES 16
+
+/**
+ * nozzle_open_mq
+ *
+ * @brief create a new multi queue tap device on the system.
+ *
+ * devname, devname_size and updownpath - see nozzle_open
+ *
+ * queues - number of queues (1 to NOZZLE_MAX_QUEUES) to attach to the device.
+ *          When queues is higher than 1, the device is created with
+ *          IFF_MULTI_QUEUE and the kernel will spread flows across the
+ *          different queues. Each queue has its own fd that can be
+ *          retrieved via nozzle_get_queue_fds.
+ *          NOTE: multi queue devices are only supported on Linux.
+ *
+ * @return
+ * nozzle_open_mq returns
+ * a pointer to a nozzle struct on success
+ * NULL on error and errno is set. errno is set to EOPNOTSUPP when
+ * the kernel does not support multi queue tap devices.
+ */
+
+nozzle_t nozzle_open_mq(char *devname, size_t devname_size, const char *updownpath, uint8_t queues);
+
+#define NOZZLE_OFFLOAD_CSUM	(1 << 0) /* device accepts packets with partial checksum */
+#define NOZZLE_OFFLOAD_TSO4	(1 << 1) /* device accepts IPv4 TCP GSO packets */
+#define NOZZLE_OFFLOAD_TSO6	(1 << 2) /* device accepts IPv6 TCP GSO packets */
+#define NOZZLE_OFFLOAD_TSO_ECN	(1 << 3) /* device accepts TCP GSO packets with ECN */
+#define NOZZLE_OFFLOAD_UFO	(1 << 4) /* device accepts UDP fragmentation offload packets */
+#define NOZZLE_OFFLOAD_ALL	(NOZZLE_OFFLOAD_CSUM | NOZZLE_OFFLOAD_TSO4 | NOZZLE_OFFLOAD_TSO6 | \
+				 NOZZLE_OFFLOAD_TSO_ECN | NOZZLE_OFFLOAD_UFO)
+
+/*
+ * packet header used by devices opened with nozzle_open_vnet.
+ * Same layout as the kernel struct virtio_net_hdr.
+ */
+
+#define NOZZLE_VNET_HDR_F_NEEDS_CSUM	1
+#define NOZZLE_VNET_HDR_F_DATA_VALID	2
+
+#define NOZZLE_VNET_HDR_GSO_NONE	0
+#define NOZZLE_VNET_HDR_GSO_TCPV4	1
+#define NOZZLE_VNET_HDR_GSO_UDP		3
+#define NOZZLE_VNET_HDR_GSO_TCPV6	4
+#define NOZZLE_VNET_HDR_GSO_ECN		0x80
+
+struct nozzle_vnet_hdr {
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;	/* ethernet + ip + transport header length */
+	uint16_t gso_size;	/* bytes to append to hdr_len per frame */
+	uint16_t csum_start;	/* position to start checksumming from */
+	uint16_t csum_offset;	/* offset after that to place checksum */
+};
+
+/*
+ * max size of a packet read from a device opened with nozzle_open_vnet,
+ * including the struct nozzle_vnet_hdr. With segmentation offloads
+ * enabled the GSO packet size is capped to fit.
+ */
+#define NOZZLE_VNET_MAX_PACKET_SIZE 65536
+
+/**
+ * nozzle_open_vnet
+ *
+ * @brief create a new tap device on the system with vnet header and offload support.
+ *
+ * devname, devname_size and updownpath - see nozzle_open
+ *
+ * queues - see nozzle_open_mq
+ *
+ * offloads - bitmask of NOZZLE_OFFLOAD_* to enable on the device.
+ *            Any segmentation offload requires NOZZLE_OFFLOAD_CSUM.
+ *            With TSO enabled, the kernel will hand over GSO packets
+ *            that are no longer bound to the device MTU, up to
+ *            NOZZLE_VNET_MAX_PACKET_SIZE including the vnet header.
+ *            Segmentation offloads fail with EOPNOTSUPP on kernels
+ *            that cannot limit the GSO packet size.
+ *            NOTE: NOZZLE_OFFLOAD_UFO is not supported by recent
+ *            Linux kernels.
+ *
+ * Every packet read from, or written to, the device fds is prefixed
+ * by a struct nozzle_vnet_hdr. nozzle_read_vnet and nozzle_write_vnet
+ * can be used to split header and payload.
+ * Applications that pass the device fds to other libraries must be
+ * aware of the extra header.
+ *
+ * NOTE: vnet header support is only available on Linux.
+ *
+ * @return
+ * nozzle_open_vnet returns
+ * a pointer to a nozzle struct on success
+ * NULL on error and errno is set. errno is set to EOPNOTSUPP when
+ * the kernel does not support vnet header or multi queue tap devices.
+ */
+
+nozzle_t nozzle_open_vnet(char *devname, size_t devname_size, const char *updownpath, uint8_t queues, uint32_t offloads);
+
 /**
  * nozzle_close
  *
@@ -330,4 +430,91 @@ const char *nozzle_get_name_by_handle(const nozzle_t nozzle);
 
 int nozzle_get_fd(const nozzle_t nozzle);
 
+/**
+ * nozzle_get_queue_fds
+ *
+ * @brief retrieve the fds of all the queues of a nozzle device
+ *
+ * nozzle - pointer to the nozzle struct
+ *
+ * fds - array of at least NOZZLE_MAX_QUEUES entries that will be filled
+ *       with the queue fds. fds[0] is the same fd returned by nozzle_get_fd.
+ *
+ * fds_entries - number of valid entries in fds
+ *
+ * @return
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int nozzle_get_queue_fds(const nozzle_t nozzle, int *fds, size_t *fds_entries);
+
+/**
+ * nozzle_set_offload
+ *
+ * @brief change offloads on a nozzle device opened with nozzle_open_vnet
+ *
+ * nozzle - pointer to the nozzle struct
+ *
+ * offloads - bitmask of NOZZLE_OFFLOAD_* (see nozzle_open_vnet)
+ *
+ * @return
+ * 0 on success
+ * -1 on error and errno is set. errno is set to EOPNOTSUPP when
+ * segmentation offloads are requested and the GSO packet size
+ * cannot be capped to NOZZLE_VNET_MAX_PACKET_SIZE.
+ */
+
+int nozzle_set_offload(nozzle_t nozzle, uint32_t offloads);
+
+/**
+ * nozzle_read_vnet
+ *
+ * @brief read one packet and its vnet header from a nozzle device queue
+ *
+ * nozzle - pointer to the nozzle struct opened with nozzle_open_vnet
+ *
+ * queue - queue number to read from (0 for single queue devices)
+ *
+ * hdr - pointer to a struct nozzle_vnet_hdr that will be filled with the packet header
+ *
+ * buf - buffer to store the packet
+ *
+ * len - size of buf. GSO packets can be up to 64KB.
+ *
+ * This function does not take any internal lock and
+ * it must not be called while closing the device.
+ *
+ * @return
+ * number of bytes of packet data (excluding the header) on success
+ * -1 on error and errno is set.
+ */
+
+ssize_t nozzle_read_vnet(const nozzle_t nozzle, uint8_t queue, struct nozzle_vnet_hdr *hdr, void *buf, size_t len);
+
+/**
+ * nozzle_write_vnet
+ *
+ * @brief write one packet and its vnet header to a nozzle device queue
+ *
+ * nozzle - pointer to the nozzle struct opened with nozzle_open_vnet
+ *
+ * queue - queue number to write to (0 for single queue devices)
+ *
+ * hdr - pointer to the struct nozzle_vnet_hdr describing the packet
+ *
+ * buf - buffer containing the packet
+ *
+ * len - size of the packet in buf
+ *
+ * This function does not take any internal lock and
+ * it must not be called while closing the device.
+ *
+ * @return
+ * number of bytes of packet data (excluding the header) written on success
+ * -1 on error and errno is set.
+ */
+
+ssize_t nozzle_write_vnet(const nozzle_t nozzle, uint8_t queue, const struct nozzle_vnet_hdr *hdr, const void *buf, size_t len);
+
 #endif
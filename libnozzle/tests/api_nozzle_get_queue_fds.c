@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err=0;
+	nozzle_t nozzle;
+	int fds[NOZZLE_MAX_QUEUES];
+	size_t fds_entries = 0, i, j;
+#ifdef KNET_LINUX
+	uint8_t queues = 4;
+#else
+	uint8_t queues = 1;
+#endif
+
+	printf("Testing get queue fds\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_mq(device_name, size, NULL, queues);
+	if (!nozzle) {
+		printf("Unable to init %s\n", device_name);
+		return -1;
+	}
+
+	if (nozzle_get_queue_fds(nozzle, fds, &fds_entries) < 0) {
+		printf("Unable to get queue fds\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	if (fds_entries != queues) {
+		printf("nozzle_get_queue_fds returned %zu entries instead of %u\n", fds_entries, queues);
+		err = -1;
+		goto out_clean;
+	}
+
+	if (fds[0] != nozzle_get_fd(nozzle)) {
+		printf("First queue fd does not match nozzle_get_fd\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	for (i = 0; i < fds_entries; i++) {
+		if (fcntl(fds[i], F_GETFD) < 0) {
+			printf("Unable to get valid fd for queue %zu\n", i);
+			err = -1;
+			goto out_clean;
+		}
+		for (j = i + 1; j < fds_entries; j++) {
+			if (fds[i] == fds[j]) {
+				printf("Queue %zu and %zu share the same fd\n", i, j);
+				err = -1;
+				goto out_clean;
+			}
+		}
+	}
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Passing empty struct to get_queue_fds\n");
+	if (nozzle_get_queue_fds(NULL, fds, &fds_entries) == 0) {
+		printf("Something is wrong in nozzle_get_queue_fds sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing NULL fds to get_queue_fds\n");
+	if ((nozzle_get_queue_fds(nozzle, NULL, &fds_entries) == 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_get_queue_fds sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing NULL fds_entries to get_queue_fds\n");
+	if ((nozzle_get_queue_fds(nozzle, fds, NULL) == 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_get_queue_fds sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	need_root();
+
+	if (test() < 0)
+		return FAIL;
+
+	return PASS;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err = 0;
+	nozzle_t nozzle = NULL;
+#ifdef KNET_LINUX
+	int i;
+#endif
+
+	printf("Testing nozzle_open_mq with 1 queue\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_mq(device_name, size, NULL, 1);
+	if (!nozzle) {
+		printf("Unable to init %s\n", device_name);
+		return -1;
+	}
+
+	if (is_if_in_system(device_name) <= 0) {
+		printf("Unable to find interface %s on the system\n", device_name);
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+	nozzle = NULL;
+
+#ifdef KNET_LINUX
+	printf("Testing nozzle_open_mq with 4 queues\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_mq(device_name, size, NULL, 4);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	if (is_if_in_system(device_name) <= 0) {
+		printf("Unable to find interface %s on the system\n", device_name);
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+	nozzle = NULL;
+
+	/*
+	 * the kernel unregisters the device asynchronously
+	 * once the last queue fd is closed
+	 */
+	for (i = 0; i < 100; i++) {
+		if (is_if_in_system(device_name) == 0) {
+			break;
+		}
+		usleep(50000);
+	}
+
+	if (is_if_in_system(device_name) != 0) {
+		printf("Interface %s still present on the system after close\n", device_name);
+		err = -1;
+		goto out_clean;
+	}
+#endif
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Opening device with 0 queues\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_mq(device_name, size, NULL, 0);
+	if ((nozzle) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_open_mq sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Opening device with too many queues\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_mq(device_name, size, NULL, NOZZLE_MAX_QUEUES + 1);
+	if ((nozzle) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_open_mq sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	need_root();
+
+	if (test() < 0)
+		return FAIL;
+
+	return PASS;
+}
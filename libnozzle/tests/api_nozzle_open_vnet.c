@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err = 0;
+	nozzle_t nozzle = NULL;
+
+	printf("Testing nozzle_open_vnet without offloads\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, 0);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	if (is_if_in_system(device_name) <= 0) {
+		printf("Unable to find interface %s on the system\n", device_name);
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+	nozzle = NULL;
+
+	printf("Testing nozzle_open_vnet with TSO and 2 queues\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 2,
+				  NOZZLE_OFFLOAD_CSUM | NOZZLE_OFFLOAD_TSO4 | NOZZLE_OFFLOAD_TSO6 | NOZZLE_OFFLOAD_TSO_ECN);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	if (is_if_in_system(device_name) <= 0) {
+		printf("Unable to find interface %s on the system\n", device_name);
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+	nozzle = NULL;
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Opening device with TSO but without checksum offload\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, NOZZLE_OFFLOAD_TSO4);
+	if ((nozzle) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_open_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Opening device with unknown offloads\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, ~NOZZLE_OFFLOAD_ALL);
+	if ((nozzle) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_open_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	need_root();
+
+#ifndef KNET_LINUX
+	return SKIP;
+#endif
+
+	if (test() < 0)
+		return FAIL;
+
+	return PASS;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err = 0;
+	nozzle_t nozzle = NULL;
+	struct nozzle_vnet_hdr hdr;
+	char buf[65536];
+	struct pollfd pfd;
+	ssize_t len;
+
+	printf("Testing read vnet\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, NOZZLE_OFFLOAD_CSUM | NOZZLE_OFFLOAD_TSO4 | NOZZLE_OFFLOAD_TSO6);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * bringing the interface up will trigger the kernel
+	 * to send IPv6 DAD / router solicitations on the device
+	 */
+	if (nozzle_set_up(nozzle) < 0) {
+		printf("Unable to set interface up\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	pfd.fd = nozzle_get_fd(nozzle);
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, 10000) <= 0) {
+		printf("No packets received from the kernel, IPv6 disabled?\n");
+		err = SKIP;
+		goto out_clean;
+	}
+
+	memset(&hdr, 0xff, sizeof(hdr));
+	len = nozzle_read_vnet(nozzle, 0, &hdr, buf, sizeof(buf));
+	if (len <= 0) {
+		printf("Unable to read from device: %s\n", strerror(errno));
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Read %zd bytes, vnet hdr flags: %u gso_type: %u\n", len, hdr.flags, hdr.gso_type);
+
+	if (hdr.gso_type != NOZZLE_VNET_HDR_GSO_NONE) {
+		printf("Unexpected GSO packet from the kernel\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Passing empty struct to read_vnet\n");
+	if ((nozzle_read_vnet(NULL, 0, &hdr, buf, sizeof(buf)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_read_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing invalid queue to read_vnet\n");
+	if ((nozzle_read_vnet(nozzle, 1, &hdr, buf, sizeof(buf)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_read_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing NULL hdr to read_vnet\n");
+	if ((nozzle_read_vnet(nozzle, 0, NULL, buf, sizeof(buf)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_read_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+
+	printf("Reading vnet from a device without vnet header\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open(device_name, size, NULL);
+	if (!nozzle) {
+		printf("Unable to init %s\n", device_name);
+		return -1;
+	}
+
+	if ((nozzle_read_vnet(nozzle, 0, &hdr, buf, sizeof(buf)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_read_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	int err;
+
+	need_root();
+
+#ifndef KNET_LINUX
+	return SKIP;
+#endif
+
+	err = test();
+	if (err == SKIP)
+		return SKIP;
+	if (err < 0)
+		return FAIL;
+
+	return PASS;
+}
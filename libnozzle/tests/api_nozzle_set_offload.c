@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err = 0;
+	nozzle_t nozzle = NULL;
+
+	printf("Testing nozzle_set_offload\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, 0);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	if (nozzle_set_offload(nozzle, NOZZLE_OFFLOAD_CSUM | NOZZLE_OFFLOAD_TSO4 | NOZZLE_OFFLOAD_TSO6) < 0) {
+		printf("Unable to enable TSO offloads: %s\n", strerror(errno));
+		err = -1;
+		goto out_clean;
+	}
+
+	if (nozzle_set_offload(nozzle, 0) < 0) {
+		printf("Unable to disable offloads: %s\n", strerror(errno));
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Passing empty struct to set_offload\n");
+	if ((nozzle_set_offload(NULL, NOZZLE_OFFLOAD_CSUM) == 0) || (errno != ENOENT)) {
+		printf("Something is wrong in nozzle_set_offload sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing TSO without checksum offload\n");
+	if ((nozzle_set_offload(nozzle, NOZZLE_OFFLOAD_TSO6) == 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_set_offload sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	nozzle_close(nozzle);
+
+	printf("Setting offloads on a device without vnet header\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open(device_name, size, NULL);
+	if (!nozzle) {
+		printf("Unable to init %s\n", device_name);
+		return -1;
+	}
+
+	if ((nozzle_set_offload(nozzle, NOZZLE_OFFLOAD_CSUM) == 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_set_offload sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	need_root();
+
+#ifndef KNET_LINUX
+	return SKIP;
+#endif
+
+	if (test() < 0)
+		return FAIL;
+
+	return PASS;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 Red Hat, Inc.  All rights reserved.
+ *
+ * Author: Fabio M. Di Nitto <fabbione@kronosnet.org>
+ *
+ * This software licensed under GPL-2.0+
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <net/ethernet.h>
+
+#include "test-common.h"
+
+static int test(void)
+{
+	char device_name[IFNAMSIZ];
+	size_t size = IFNAMSIZ;
+	int err = 0;
+	nozzle_t nozzle = NULL;
+	struct nozzle_vnet_hdr hdr;
+	unsigned char frame[60];
+	struct ether_header *eth_h = (struct ether_header *)frame;
+	ssize_t len;
+
+	printf("Testing write vnet\n");
+
+	memset(device_name, 0, size);
+	nozzle = nozzle_open_vnet(device_name, size, NULL, 1, NOZZLE_OFFLOAD_CSUM);
+	if (!nozzle) {
+		printf("Unable to init %s: %s\n", device_name, strerror(errno));
+		return -1;
+	}
+
+	if (nozzle_set_up(nozzle) < 0) {
+		printf("Unable to set interface up\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	/*
+	 * minimal broadcast frame with an unused ethertype,
+	 * the kernel will simply drop it
+	 */
+	memset(frame, 0, sizeof(frame));
+	memset(eth_h->ether_dhost, 0xff, ETH_ALEN);
+	eth_h->ether_shost[0] = 0x02;
+	eth_h->ether_shost[5] = 0x01;
+	eth_h->ether_type = htons(0x88b5);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.gso_type = NOZZLE_VNET_HDR_GSO_NONE;
+
+	len = nozzle_write_vnet(nozzle, 0, &hdr, frame, sizeof(frame));
+	if (len != sizeof(frame)) {
+		printf("Unable to write to device: %zd %s\n", len, strerror(errno));
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Testing ERROR conditions\n");
+
+	printf("Passing empty struct to write_vnet\n");
+	if ((nozzle_write_vnet(NULL, 0, &hdr, frame, sizeof(frame)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_write_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing invalid queue to write_vnet\n");
+	if ((nozzle_write_vnet(nozzle, 1, &hdr, frame, sizeof(frame)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_write_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+	printf("Passing NULL buffer to write_vnet\n");
+	if ((nozzle_write_vnet(nozzle, 0, &hdr, NULL, sizeof(frame)) >= 0) || (errno != EINVAL)) {
+		printf("Something is wrong in nozzle_write_vnet sanity checks\n");
+		err = -1;
+		goto out_clean;
+	}
+
+out_clean:
+	if (nozzle) {
+		nozzle_close(nozzle);
+	}
+
+	return err;
+}
+
+int main(void)
+{
+	need_root();
+
+#ifndef KNET_LINUX
+	return SKIP;
+#endif
+
+	if (test() < 0)
+		return FAIL;
+
+	return PASS;
+}